@@ -31,6 +31,11 @@ ABoid::ABoid()
 		BoxVisual->SetRelativeLocation(FVector(0.0f));
 		BoxVisual->SetWorldScale3D(FVector(0.01f));
 	}
+
+	// The body every boid starts with, the controller reads it off the default object too.
+	SetIfConstantSpeed(false);
+	SetMaxAcceleration(100);
+	SetSpeed(300);
 }
 
 void ABoid::BeginDestroy()
@@ -38,10 +43,16 @@ void ABoid::BeginDestroy()
 	Super::BeginDestroy();
 
 	ListOfBoidsInVision.Reset();
-	Settings.ListOfBoids.Empty();
 	//this->Destroy();
 }
 
+void ABoid::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+
+	Settings.RemoveBoid(Handle);
+}
+
 //ABoid::~ABoid()
 //{
 //	//ListOfBoidsInVision.Empty();
@@ -61,100 +72,73 @@ void ABoid::BeginPlay()
 	//{
 	//	Settings.ListOfBoids.Empty();
 	//}
-	Settings.ListOfBoids.Add(this);
-
-	SetIfConstantSpeed(false);
-	SetMaxAcceleration(100);
-	SetSpeed(300);
+	// Replicas only show a flock simulated on the server, they stay out of this one.
+	if (IsReplica)
+	{
+		SetActorTickEnabled(false);
+	}
+	else
+	{
+		Handle = Settings.AddBoid(this);
+	}
+	Position = FVector2D(GetActorLocation());
 }
 
-void ABoid::ComputeNeighbourhood()
+FBoidNeighbourhood ABoid::ComputeNeighbourhood()
 {
-	for (int i = 0; i < Settings.ListOfBoids.Num(); i++)
+	// The controller found every boid's neighbours in one pass, this just looks up our row.
+	const FBoidNeighbourhood Neighbourhood = Settings.GetNeighbourhood(Settings.GetIndex(Handle));
+
+	if (Settings.TrackNeighbourActors)
 	{
-		// Check if the Boid being looked close enough.
-		if (Settings.ListOfBoids[i] != this)
+		ListOfBoidsInVision.Reset();
+		for (int32 i = 0; i < Neighbourhood.Num(); i++)
 		{
-			if (FVector2D::Distance(GetPosition(), Settings.ListOfBoids[i]->GetPosition()) <= VisualRange)
-			{
-				// Check if vision list is empty, if so then add the Boid.
-				if (ListOfBoidsInVision.Num() == 0)
-				{
-					ListOfBoidsInVision.Add(Settings.ListOfBoids[i]);
-					break;
-				}
-			
-				// Check if the Boid is in the vision already.
-				for (int j = 0; j < ListOfBoidsInVision.Num(); j++)
-				{
-					if (ListOfBoidsInVision[j] == Settings.ListOfBoids[i])
-					{
-						break;
-					}
-					if (j == ListOfBoidsInVision.Num() - 1 && ListOfBoidsInVision[j] != Settings.ListOfBoids[i])
-					{
-						ListOfBoidsInVision.Add(Settings.ListOfBoids[i]);
-					}
-				}
-			}
+			ListOfBoidsInVision.Add(Neighbourhood.GetBoid(i));
 		}
 	}
-
-	// Check vision list for boids not in range.
-	for (int i = 0; i < ListOfBoidsInVision.Num(); i++)
+	else if (ListOfBoidsInVision.Max() > 0)
 	{
-		if (ListOfBoidsInVision[i] != this)
-		{
-			// If not in range
-			if (GetDistanceTo(ListOfBoidsInVision[i]) > VisualRange)
-			{
-				// Remove by swap, shrink list by 1.
-				ListOfBoidsInVision.RemoveAtSwap(i, 1, true);
-			}
-		}
+		ListOfBoidsInVision.Empty();
 	}
+
+	return Neighbourhood;
 }
 
 // Called every frame
 void ABoid::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
-	ComputeNeighbourhood();
+	const FBoidNeighbourhood Neighbourhood = ComputeNeighbourhood();
 
-	Position = FVector2D(GetActorLocation());
-
-	
-	for (auto& Rule : Rules)
+	if (Pipeline)
 	{
-		FVector2D WeightedForce = Rule->ComputeWeightedForce(ListOfBoidsInVision, this);
-		ApplyForce(WeightedForce);
+		const FBoidKernelSelf Self = { Position, Velocity };
+		ApplyForce(Pipeline->Evaluate(Self, Neighbourhood));
 	}
-
-	if (GetAcceleration().Size() > GetMaxAcceleration())
+	
+	// The mouse rule comes last. The built-in rules used to have it between alignment and bounds, but it adds
+	// nothing while no button is held, so the default flock still sums its forces exactly as it did.
+	if (Rules)
 	{
-		FVector2D Temp = GetAcceleration();
-		Temp.Normalize();
-		SetAcceleration(Temp * GetMaxAcceleration());
+		for (auto& Rule : *Rules)
+		{
+			FVector2D WeightedForce = Rule->ComputeWeightedForce(Neighbourhood, this);
+			ApplyForce(WeightedForce);
+		}
 	}
-	
-	SetVelocity2D(Velocity + Acceleration);
 
+	// Steering is a change of velocity per frame, not per second. A boid that only ticks every few frames
+	// steers for all of them at once, or far boids would turn slower than near ones.
+	FBoidBody Body = GetBody();
+	Body.MaxAcceleration *= FramesPerTick;
+
+	// Same integration as the flock step, the actor just follows the position.
+	FVector2D NewPosition = Position;
+	IntegrateBoid(NewPosition, Velocity, Acceleration * FramesPerTick, Body, DeltaTime, Settings.Grid);
 	ResetAcceleration();
 
-	if (GetIfConstantSpeed())
-	{
-		FVector2D Temp = GetVelocity2D();
-		Temp.Normalize();
-		SetVelocity2D(Temp * GetSpeed());
-	}
-	else if (GetVelocity2D().Size() > GetSpeed())
-	{
-		FVector2D Temp = GetVelocity2D();
-		Temp.Normalize();
-		SetVelocity2D(Temp * GetSpeed());
-	}
-	
-	this->SetPosition(FVector2D(GetPosition().X + (Velocity.X * DeltaTime), GetPosition().Y + (Velocity.Y * DeltaTime)));
+	this->SetPosition(NewPosition);
 	BoidRotation();
 }
 
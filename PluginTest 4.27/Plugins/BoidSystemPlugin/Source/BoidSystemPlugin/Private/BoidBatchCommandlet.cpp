@@ -0,0 +1,75 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidBatchCommandlet.h"
+
+#include "BoidBatchSimulation.h"
+#include "BoidSystemPlugin.h"
+#include "Misc/Paths.h"
+
+UBoidBatchCommandlet::UBoidBatchCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+int32 UBoidBatchCommandlet::Main(const FString& Params)
+{
+	FBoidBatchScenario Scenario;
+	FString Output = FPaths::ProjectSavedDir() / TEXT("Boids/Batch.btrj");
+	FParse::Value(*Params, TEXT("Output="), Output);
+	if (!ParseScenario(Params, Scenario))
+	{
+		return 1;
+	}
+
+	FBoidBatchResult Result;
+	return FBoidBatchSimulation::Run(Scenario, Output, Result) ? 0 : 1;
+}
+
+bool UBoidBatchCommandlet::ParseScenario(const FString& Params, FBoidBatchScenario& OutScenario)
+{
+	// The controller's default flock and rule weights.
+	OutScenario = FBoidBatchScenario();
+	OutScenario.Body.Speed = 30.0f;
+	float AreaSize = 100.0f;
+	float CohesionWeight = 0.15f;
+	float SeparationWeight = 1.0f;
+	float AlignmentWeight = 2.0f;
+	float BoundsWeight = 3.5f;
+
+	FParse::Value(*Params, TEXT("Boids="), OutScenario.NumBoids);
+	FParse::Value(*Params, TEXT("Seed="), OutScenario.Seed);
+	FParse::Value(*Params, TEXT("Seconds="), OutScenario.SimulatedSeconds);
+	FParse::Value(*Params, TEXT("DeltaTime="), OutScenario.DeltaTime);
+	FParse::Value(*Params, TEXT("RecordInterval="), OutScenario.RecordInterval);
+	FParse::Value(*Params, TEXT("Area="), AreaSize);
+	FParse::Value(*Params, TEXT("VisualRange="), OutScenario.Params.VisualRange);
+	FParse::Value(*Params, TEXT("Speed="), OutScenario.Body.Speed);
+	FParse::Value(*Params, TEXT("Cohesion="), CohesionWeight);
+	FParse::Value(*Params, TEXT("Separation="), SeparationWeight);
+	FParse::Value(*Params, TEXT("Alignment="), AlignmentWeight);
+	FParse::Value(*Params, TEXT("Bounds="), BoundsWeight);
+
+	if (OutScenario.NumBoids <= 0 || OutScenario.DeltaTime <= 0 || AreaSize <= 0)
+	{
+		UE_LOG(LogBoids, Error, TEXT("Batch runs need -Boids, -DeltaTime and -Area above 0"));
+		return false;
+	}
+
+	const bool IsBounded = FParse::Param(*Params, TEXT("Bounded"));
+	OutScenario.Params.Area = FVector2D(AreaSize, AreaSize);
+	OutScenario.Params.IsWrapped = !IsBounded;
+	OutScenario.Params.UseFixedPoint = FParse::Param(*Params, TEXT("FixedPoint"));
+	OutScenario.Params.Pipeline.Get<FCohesionKernel>().Weight = CohesionWeight;
+	OutScenario.Params.Pipeline.Get<FSeparationKernel>().Weight = SeparationWeight;
+	OutScenario.Params.Pipeline.Get<FAlignmentKernel>().Weight = AlignmentWeight;
+	FBoundsKernel& Bounds = OutScenario.Params.Pipeline.Get<FBoundsKernel>();
+	Bounds.Weight = BoundsWeight;
+	Bounds.Width = AreaSize;
+	Bounds.Height = AreaSize;
+	Bounds.IsBounded = IsBounded;
+	return true;
+}
@@ -0,0 +1,84 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidBatchSimulation.h"
+
+#include "BoidPipelinedSimulation.h"
+#include "BoidSystemPlugin.h"
+#include "BoidTrajectoryFile.h"
+#include "Math/RandomStream.h"
+
+bool FBoidBatchSimulation::Run(const FBoidBatchScenario& Scenario, const FString& Path, FBoidBatchResult& OutResult)
+{
+	OutResult = FBoidBatchResult();
+	const int32 RecordInterval = FMath::Max(Scenario.RecordInterval, 1);
+	const int32 NumSteps = FMath::Max(FMath::CeilToInt(Scenario.SimulatedSeconds / Scenario.DeltaTime), 0);
+
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	SpawnFlock(Scenario, Positions, Velocities);
+	TArray<FBoidBody> Bodies;
+	Bodies.Init(Scenario.Body, Scenario.NumBoids);
+	TArray<FBoidHandle> Handles;
+	Handles.SetNum(Scenario.NumBoids);
+
+	FBoidTrajectoryHeader Header;
+	Header.NumBoids = Scenario.NumBoids;
+	Header.NumFrames = NumSteps / RecordInterval + 1;
+	Header.FrameInterval = Scenario.DeltaTime * RecordInterval;
+	Header.StepDeltaTime = Scenario.DeltaTime;
+	Header.AreaX = Scenario.Params.Area.X;
+	Header.AreaY = Scenario.Params.Area.Y;
+	Header.Flags = (Scenario.Params.IsWrapped ? FBoidTrajectoryHeader::Wrapped : 0) | (Scenario.Params.UseFixedPoint ? FBoidTrajectoryHeader::FixedPoint : 0);
+	Header.Seed = Scenario.Seed;
+
+	FBoidTrajectoryWriter Writer;
+	if (!Writer.Open(Path, Header))
+	{
+		return false;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	FBoidPipelinedSimulation Simulation(Handles, Positions, Velocities, Bodies);
+	int32 NumFrames = 0;
+
+	for (int32 Step = 0; Step <= NumSteps; Step++)
+	{
+		// The current state stays put while the next step runs, so writing it costs no time of its own.
+		if (Step < NumSteps)
+		{
+			Simulation.Launch(Scenario.Params, Scenario.DeltaTime, true);
+		}
+		if (Step % RecordInterval == 0)
+		{
+			Writer.WriteFrame(NumFrames++, Simulation.GetPositions(), Simulation.GetVelocities());
+		}
+		Simulation.Complete();
+	}
+
+	OutResult.NumSteps = NumSteps;
+	OutResult.NumFrames = NumFrames;
+	OutResult.SimulatedSeconds = double(NumSteps) * Scenario.DeltaTime;
+	OutResult.WallSeconds = FPlatformTime::Seconds() - StartTime;
+
+	const bool Saved = Writer.Close(NumFrames);
+	OutResult.FileBytes = Header.HeaderSize + int64(NumFrames) * Scenario.NumBoids * sizeof(FBoidTrajectorySample);
+
+	UE_LOG(LogBoids, Display, TEXT("Batch: %.1f simulated seconds of %d boids in %.2f wall seconds, %.1f simulated seconds per wall second, %d frames (%.1f MB) to %s"),
+		OutResult.SimulatedSeconds, Scenario.NumBoids, OutResult.WallSeconds, OutResult.GetSimulatedSecondsPerWallSecond(), NumFrames,
+		OutResult.FileBytes / (1024.0 * 1024.0), *Path);
+	return Saved;
+}
+
+void FBoidBatchSimulation::SpawnFlock(const FBoidBatchScenario& Scenario, TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities)
+{
+	// Same spread as the controller spawns its flock with.
+	FRandomStream Random(Scenario.Seed);
+	OutPositions.Reset(Scenario.NumBoids);
+	OutVelocities.Reset(Scenario.NumBoids);
+	for (int32 i = 0; i < Scenario.NumBoids; i++)
+	{
+		OutPositions.Add(FVector2D(Random.FRandRange(0, Scenario.Params.Area.X), Random.FRandRange(0, Scenario.Params.Area.Y)));
+		OutVelocities.Add(FVector2D(Random.RandRange(-100, 100), Random.RandRange(-100, 100)) * Scenario.Body.Speed);
+	}
+}
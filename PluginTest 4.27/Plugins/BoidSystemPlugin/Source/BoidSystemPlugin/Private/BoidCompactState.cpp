@@ -0,0 +1,24 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidCompactState.h"
+
+void FBoidQuantisation::Configure(FVector2D Area, bool _IsWrapped, float MaxSpeed)
+{
+	IsWrapped = _IsWrapped;
+	Area = FVector2D(FMath::Max(Area.X, 1.0f), FMath::Max(Area.Y, 1.0f));
+
+	const FVector2D Span = IsWrapped ? Area : Area * 3.0f;
+	PositionStep = Span / 65536.0f;
+	// Bounded, keep half a step off the walls, the bounds rule divides by the distance to them.
+	Origin = IsWrapped ? FVector2D::ZeroVector : -Area - PositionStep * 0.5f;
+	InvPositionStep = FVector2D(1.0f / PositionStep.X, 1.0f / PositionStep.Y);
+
+	VelocityStep = FMath::Max(MaxSpeed, 1.0f) * 2.0f / MAX_int16;
+	InvVelocityStep = 1.0f / VelocityStep;
+}
+
+bool FBoidQuantisation::operator==(const FBoidQuantisation& Other) const
+{
+	return Origin == Other.Origin && PositionStep == Other.PositionStep && VelocityStep == Other.VelocityStep && IsWrapped == Other.IsWrapped;
+}
@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidConsoleVariables.h"
+
+TAutoConsoleVariable<int32> CVarBoidsCount(
+	TEXT("boids.Count"),
+	-1,
+	TEXT("Boids in the flock. The controller spawns or destroys boids to match whenever it changes,\n")
+	TEXT("clicks and commands change the flock from there. -1 keeps whatever it has (default)."),
+	ECVF_Default);
+
+TAutoConsoleVariable<int32> CVarBoidsThreads(
+	TEXT("boids.Threads"),
+	0,
+	TEXT("Workers splitting the rules stage of the pipelined flock step, 0 uses every task graph worker (default)."),
+	ECVF_Default);
+
+TAutoConsoleVariable<int32> CVarBoidsChunkSize(
+	TEXT("boids.ChunkSize"),
+	0,
+	TEXT("Boids per work item handed to the rules workers, 0 makes a few items per worker (default)."),
+	ECVF_Default);
+
+TAutoConsoleVariable<int32> CVarBoidsLODTiers(
+	TEXT("boids.LODTiers"),
+	1,
+	TEXT("Distance tiers the flock is updated in. Boids in tier k, k * boids.LODDistance or more from the camera,\n")
+	TEXT("update every 2^k frames. 1 updates every boid every frame (default)."),
+	ECVF_Default);
+
+TAutoConsoleVariable<float> CVarBoidsLODDistance(
+	TEXT("boids.LODDistance"),
+	1000.0f,
+	TEXT("Width of each boids.LODTiers distance tier, in world units."),
+	ECVF_Default);
+
+TAutoConsoleVariable<int32> CVarBoidsNeighbourCap(
+	TEXT("boids.NeighbourCap"),
+	0,
+	TEXT("Most neighbours kept per boid, the nearest ones. 0 keeps all of them (default)."),
+	ECVF_Default);
+
+TAutoConsoleVariable<float> CVarBoidsUpdateBudgetMs(
+	TEXT("boids.UpdateBudgetMs"),
+	0.0f,
+	TEXT("Game thread milliseconds per frame for moving boid actors to the flock simulation's state. Boids left over\n")
+	TEXT("go first next frame. Only in the Pipelined and Async modes, 0 is unlimited (default)."),
+	ECVF_Default);
+
+TAutoConsoleVariable<int32> CVarBoidsDebugDraw(
+	TEXT("boids.DebugDraw"),
+	-1,
+	TEXT("Debug lines to neighbours. 0 off, 1 on, -1 uses the controller's DebugLines (default)."),
+	ECVF_Default);
+
+TAutoConsoleVariable<int32> CVarBoidsNeighbourBackend(
+	TEXT("boids.NeighbourBackend"),
+	0,
+	TEXT("Structure used to find each boid's neighbours.\n")
+	TEXT(" 0: pick from the flock's density each frame (default)\n")
+	TEXT(" 1: brute force\n")
+	TEXT(" 2: uniform grid\n")
+	TEXT(" 3: k-d tree"),
+	ECVF_Default);
+
+TAutoConsoleVariable<int32> CVarBoidsSimulationMode(
+	TEXT("boids.SimulationMode"),
+	-1,
+	TEXT("How the flock is stepped. 0 every boid actor steps itself, 1 pipelined on the task graph, 2 on its own thread,\n")
+	TEXT("3 lockstep between the players, only read when play begins. -1 uses the controller's SimulationMode (default)."),
+	ECVF_Default);
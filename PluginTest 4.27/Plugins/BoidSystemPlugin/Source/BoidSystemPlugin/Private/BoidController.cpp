@@ -3,22 +3,39 @@
 
 #include "BoidController.h"
 
+#include "BoidConsoleVariables.h"
+#include "BoidLockstepComponent.h"
+#include "BoidSettings.h"
+#include "BoidSystemPlugin.h"
 #include "DrawDebugHelpers.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
 #include "Camera/CameraComponent.h"
 
+DECLARE_CYCLE_STAT(TEXT("Apply Commands"), STAT_BoidApplyCommands, STATGROUP_Boids);
+
 ABoidController::ABoidController()
 {
 	// Set this pawn to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
 	PrimaryActorTick.bCanEverTick = true;
 
 	RootComponent = CreateDefaultSubobject<USceneComponent>(TEXT("RootComponent"));
+	FlockReplication = CreateDefaultSubobject<UBoidFlockReplicationComponent>(TEXT("FlockReplication"));
+	Lockstep = CreateDefaultSubobject<UBoidLockstepComponent>(TEXT("Lockstep"));
 	
 }
 
+bool ABoidController::OwnsFlock() const
+{
+	return GetNetMode() != NM_Client && IsLocalController();
+}
+
 void ABoidController::BeginDestroy()
 {
 	Super::BeginDestroy();
 
+	SimulationThread.Reset();
+	PipelinedSimulation.Reset();
+	DetachBoidRules();
 	Boids.Empty();
 	CachedBoids.Empty();
 	BoidRules.Empty();
@@ -45,35 +62,158 @@ void ABoidController::BeginPlay()
 	
 	SetShowMouseCursor(true);
 
+	FlockReplication->SetFlockArea(WallArea, !IsBounded);
+	InitializeRules();
+	UpdateRules();
+
+	// Zones follow the lockstep flock wherever it is shown.
+	Lockstep->OnFlockShown.AddUObject(this, &ABoidController::UpdateLockstepZones);
+
+	// The server puts every player in the session, clients join once its flock arrives.
+	if (GetNetMode() != NM_Client && GetSimulationMode() == EBoidSimulationMode::Lockstep)
+	{
+		FlockReplication->SetComponentTickEnabled(false);
+		Lockstep->JoinSession(MakeLockstepParams(), StartingBoids);
+		return;
+	}
+
+	if (!OwnsFlock())
+	{
+		return;
+	}
+
 	for (int i = 1; i <= StartingBoids; i++)
 	{
-		ABoid* Boid = GetWorld()->SpawnActor<ABoid>(ABoid::StaticClass(), FVector(FMath::RandRange(WallArea.X - WallArea.X, WallArea.X),
-			FMath::RandRange(WallArea.Y - WallArea.Y, WallArea.Y), 1), Rot);
-		RandomizeBoidVelocity(Boid);
-		Boid->SetVisualRange(VisualRange);
-		Boid->SetSpeed(Speed);
-		Boid->SetActorRotation(FRotator(0));
+		SpawnFlockBoid(FVector(FMath::RandRange(WallArea.X - WallArea.X, WallArea.X),
+			FMath::RandRange(WallArea.Y - WallArea.Y, WallArea.Y), 1));
+	}
+}
+
+void ABoidController::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+
+	// The boids stay in the world, a logged out player's controller goes.
+	DetachBoidRules();
 
-		CachedBoids.Emplace(Boid);
+	if (!OwnsFlock())
+	{
+		return;
 	}
+
+	// The flock outlives play in editor, don't let the next session see these boids.
+	SimulationThread.Reset();
+	PipelinedSimulation.Reset();
+	Settings.Reset();
+}
+
+ABoid* ABoidController::SpawnFlockBoid(FVector Location)
+{
+	ABoid* Boid = GetWorld()->SpawnActor<ABoid>(ABoid::StaticClass(), Location, Rot);
+	RandomizeBoidVelocity(Boid);
+	Boid->SetVisualRange(VisualRange);
+	Boid->SetSpeed(Speed);
+	Boid->SetActorRotation(FRotator(0));
+	ApplyOneBoidRules(Boid);
+	// The grid has to be rebuilt before any boid looks for neighbours.
+	Boid->AddTickPrerequisiteActor(this);
+
+	CachedBoids.Emplace(Boid);
+	return Boid;
 }
 
 void ABoidController::InitializeRules()
 {
 	BoidRules.Empty();
-	
-	BoidRules.Emplace(MakeUnique<CohesionRule>(CohesionWeight));
-	BoidRules.Emplace(MakeUnique<SeparationRule>(SeparationWeight));
-	BoidRules.Emplace(MakeUnique<AlignmentRule>(AlignmentWeight));
-	BoidRules.Emplace(MakeUnique<PointRepulsionRule>(PointWeight, true, false, this,
-		this, DebugLines, EnableMouse, LeftClick, RightClick));
-	BoidRules.Emplace(MakeUnique<BoundedAreaRule>(WallArea.Y, WallArea.X, 10, WallWeight, IsBounded));
-	
-	DefaultWeights = new float[BoidRules.Num()];
-	int i = 0;
+	WallRule = nullptr;
+
+	// The pipeline covers the built-in rules, BoidRules only keeps what it can't know at compile time.
+	if (!UseRulePipeline)
+	{
+		BoidRules.Emplace(MakeUnique<CohesionRule>());
+		BoidRules.Emplace(MakeUnique<SeparationRule>());
+		BoidRules.Emplace(MakeUnique<AlignmentRule>());
+	}
+	TUniquePtr<PointRepulsionRule> Mouse = MakeUnique<PointRepulsionRule>(PointWeight, true, false, this,
+		this, DebugLines, EnableMouse, LeftClick, RightClick);
+	MouseRule = Mouse.Get();
+	BoidRules.Emplace(MoveTemp(Mouse));
+	if (!UseRulePipeline)
+	{
+		TUniquePtr<BoundedAreaRule> Wall = MakeUnique<BoundedAreaRule>(WallArea.Y, WallArea.X, 10, WallWeight, IsBounded);
+		WallRule = Wall.Get();
+		BoidRules.Emplace(MoveTemp(Wall));
+	}
+
+	RulesUsePipeline = UseRulePipeline;
+}
+
+void ABoidController::GatherRuleDescs()
+{
+	// A rule set is read where it is, GetActiveRules doesn't copy it.
+	if (RuleSet)
+	{
+		return;
+	}
+
+	// No rule set, describe the weights set on the controller.
+	auto AddRule = [this](EBoidRuleType Type, float Weight, float Radius)
+	{
+		FBoidRuleDesc& Desc = ControllerRules.AddDefaulted_GetRef();
+		Desc.Type = Type;
+		Desc.Weight = Weight;
+		Desc.Radius = Radius;
+	};
+
+	ControllerRules.Reset();
+	AddRule(EBoidRuleType::Cohesion, CohesionWeight, 0.0f);
+	AddRule(EBoidRuleType::Separation, SeparationWeight, 10.0f);
+	AddRule(EBoidRuleType::Alignment, AlignmentWeight, 0.0f);
+	AddRule(EBoidRuleType::PointRepulsion, PointWeight, 15.0f);
+	AddRule(EBoidRuleType::Bounds, WallWeight, 10.0f);
+}
+
+void ABoidController::UpdateRules()
+{
+	// Everything here is written in place, boids point at these rules so nothing is rebuilt or copied per boid.
+	GatherRuleDescs();
+
+	auto SetKernel = [this](auto& Kernel, EBoidRuleType Type)
+	{
+		const FBoidRuleDesc* Desc = FindBoidRuleDesc(GetActiveRules(), Type);
+		Kernel.Weight = (Desc && Desc->IsEnabled) ? Desc->Weight : 0.0f;
+		return Desc;
+	};
+
+	SetKernel(RulePipeline.Get<FCohesionKernel>(), EBoidRuleType::Cohesion);
+	SetKernel(RulePipeline.Get<FAlignmentKernel>(), EBoidRuleType::Alignment);
+
+	FSeparationKernel& Separation = RulePipeline.Get<FSeparationKernel>();
+	if (const FBoidRuleDesc* Desc = SetKernel(Separation, EBoidRuleType::Separation))
+	{
+		Separation.DesiredDistance = Desc->Radius;
+		Separation.Falloff = Desc->Falloff;
+	}
+
+	FBoundsKernel& Bounds = RulePipeline.Get<FBoundsKernel>();
+	if (const FBoidRuleDesc* Desc = SetKernel(Bounds, EBoidRuleType::Bounds))
+	{
+		Bounds.DesiredDistance = FMath::RoundToInt(Desc->Radius);
+	}
+	Bounds.Width = WallArea.X;
+	Bounds.Height = WallArea.Y;
+	Bounds.IsBounded = IsBounded;
+
 	for (const auto& Rule : BoidRules)
 	{
-		DefaultWeights[i++] = Rule->Weight;
+		Rule->ApplyRuleSet(GetActiveRules());
+	}
+
+	const int32 DebugDraw = CVarBoidsDebugDraw.GetValueOnGameThread();
+	MouseRule->SetInput(DebugDraw >= 0 ? DebugDraw > 0 : DebugLines, EnableMouse, LeftClick, RightClick);
+	if (WallRule)
+	{
+		WallRule->SetArea(WallArea.X, WallArea.Y, IsBounded);
 	}
 }
 
@@ -81,13 +221,31 @@ void ABoidController::ApplyBoidRules()
 {
 	for (const auto& Boid : CachedBoids)
 	{
-		Boid->SetBoidRules(BoidRules);
+		if (!Boid)
+		{
+			continue;
+		}
+		Boid->SetBoidRules(&BoidRules);
+		Boid->SetRulePipeline(UseRulePipeline ? &RulePipeline : nullptr);
 	}
 }
 
 void ABoidController::ApplyOneBoidRules(ABoid* Boid)
 {
-	Boid->SetBoidRules(BoidRules);
+	Boid->SetBoidRules(&BoidRules);
+	Boid->SetRulePipeline(UseRulePipeline ? &RulePipeline : nullptr);
+}
+
+void ABoidController::DetachBoidRules()
+{
+	for (ABoid* Boid : CachedBoids)
+	{
+		if (IsValid(Boid))
+		{
+			Boid->SetBoidRules(nullptr);
+			Boid->SetRulePipeline(nullptr);
+		}
+	}
 }
 
 void ABoidController::RandomizeBoidVelocity(ABoid* Boid)
@@ -119,11 +277,523 @@ void ABoidController::Tick(float DeltaSeconds)
 {
 	Super::Tick(DeltaSeconds);
 	SetShowMouseCursor(true);
+	// Changes queued from any thread since the last tick, before anything reads the flock this frame.
+	ApplyCommands();
+
+	if (Lockstep->IsInSession())
+	{
+		if (IsLocalController())
+		{
+			// Held buttons only count over the floor, like the mouse rule.
+			FHitResult CursorHit;
+			const bool IsOverFloor = EnableMouse && (LeftClick || RightClick) && GetHitResultUnderCursor(ECollisionChannel::ECC_Visibility, false, CursorHit);
+			Lockstep->SetLocalInput(FVector2D(CursorHit.Location), IsOverFloor && LeftClick, IsOverFloor && RightClick);
+		}
+		// Zones update once the component has stepped and shown the flock, see UpdateLockstepZones.
+		return;
+	}
+
+	FlockReplication->SetFlockArea(WallArea, !IsBounded);
+	if (!OwnsFlock())
+	{
+		return;
+	}
 
 	MousePos = Hit.Location;
 
-	InitializeRules();
-	ApplyBoidRules();
+	const bool Reorder = ReorderInterval > 0 && ++FramesSinceReorder >= ReorderInterval;
+	if (Reorder)
+	{
+		FramesSinceReorder = 0;
+	}
+
+	ApplyFlockCount();
+
+	Settings.TrackNeighbourActors = TrackNeighbourActors;
+	Settings.AutoTuneGrid = AutoTuneGrid;
+	Settings.MaxNeighbours = FMath::Max(CVarBoidsNeighbourCap.GetValueOnGameThread(), 0);
+
+	// Only rebuild the rules when switching paths, otherwise just refresh their parameters.
+	if (UseRulePipeline != RulesUsePipeline)
+	{
+		InitializeRules();
+		ApplyBoidRules();
+	}
+	UpdateRules();
+
+	// Lockstep only starts with play, when every player can begin from the same flock. Switched to later, or
+	// without a session to join, the flock carries on as it was.
+	EBoidSimulationMode Mode = GetSimulationMode();
+	if (Mode == EBoidSimulationMode::Lockstep)
+	{
+		if (!HasWarnedNoLockstep)
+		{
+			UE_LOG(LogBoids, Warning, TEXT("Lockstep mode needs a session started with play, the flock keeps running as it was"));
+			HasWarnedNoLockstep = true;
+		}
+		Mode = ActiveMode;
+	}
+
+	if (Mode != EBoidSimulationMode::Actors)
+	{
+		TickFlockSimulation(DeltaSeconds, Mode);
+		UpdateZones();
+		return;
+	}
+	if (ActiveMode != EBoidSimulationMode::Actors)
+	{
+		StopFlockSimulation();
+	}
+	ApplyBoidLOD();
+
+	const uint64 GridStartCycles = FPlatformTime::Cycles64();
+	Settings.RebuildGrid(WallArea, VisualRange, !IsBounded, Reorder);
+	QueryGridFrame = GFrameCounter;
+	// The boids moved themselves in their last ticks, the grid has just caught up with them.
+	UpdateZones();
+	const uint64 NeighbourStartCycles = FPlatformTime::Cycles64();
+	Settings.BuildNeighbours(VisualRange);
+	const uint64 EndCycles = FPlatformTime::Cycles64();
+	LogFlockStats(DeltaSeconds, NeighbourStartCycles - GridStartCycles, EndCycles - NeighbourStartCycles);
+}
+
+EBoidSimulationMode ABoidController::GetSimulationMode() const
+{
+	const int32 Mode = CVarBoidsSimulationMode.GetValueOnGameThread();
+	if (Mode >= 0 && Mode <= static_cast<int32>(EBoidSimulationMode::Lockstep))
+	{
+		return static_cast<EBoidSimulationMode>(Mode);
+	}
+
+	return SimulationMode;
+}
+
+FBoidSimulationParams ABoidController::MakeSimulationParams() const
+{
+	FBoidSimulationParams Params;
+	Params.Pipeline = RulePipeline;
+	Params.Area = WallArea;
+	Params.VisualRange = VisualRange;
+	Params.IsWrapped = !IsBounded;
+	Params.AutoTuneGrid = AutoTuneGrid;
+	Params.UseFarField = UseFarField;
+	Params.FarFieldTolerance = FarFieldTolerance;
+	Params.UseCompactState = UseCompactState;
+	Params.UseFixedPoint = UseFixedPoint;
+	Params.MaxNeighbours = FMath::Max(CVarBoidsNeighbourCap.GetValueOnGameThread(), 0);
+	Params.NumThreads = FMath::Max(CVarBoidsThreads.GetValueOnGameThread(), 0);
+	Params.BoidsPerItem = FMath::Max(CVarBoidsChunkSize.GetValueOnGameThread(), 0);
+
+	// The actors get the mouse from PointRepulsionRule, the simulations through the pipeline's point kernel.
+	if (const FBoidRuleDesc* Desc = FindBoidRuleDesc(GetActiveRules(), EBoidRuleType::PointRepulsion))
+	{
+		// Held buttons only count over the floor, like the mouse rule.
+		FHitResult CursorHit;
+		const bool IsOverFloor = Desc->IsEnabled && EnableMouse && (LeftClick || RightClick)
+			&& GetHitResultUnderCursor(ECollisionChannel::ECC_Visibility, false, CursorHit);
+		FPointKernel& Point = Params.Pipeline.Get<FPointKernel>();
+		Point.Weight = MouseRule->GetBaseWeightMultiplier() * Desc->Weight;
+		Point.Distance = Desc->Radius;
+		Point.Point = FVector2D(CursorHit.Location);
+		Point.IsPushing = IsOverFloor && LeftClick;
+		Point.IsPulling = IsOverFloor && RightClick;
+	}
+	return Params;
+}
+
+FBoidLockstepParams ABoidController::MakeLockstepParams() const
+{
+	FBoidLockstepParams Params;
+	Params.Simulation = MakeSimulationParams();
+	// Every player's mouse is part of the turn input, AddMouseForces applies them all.
+	Params.Simulation.Pipeline.Get<FPointKernel>() = FPointKernel();
+	// Boids spawned by the controller end up with these.
+	Params.Body = GetDefault<ABoid>()->GetBody();
+	Params.Body.Speed = Speed;
+	Params.TurnDeltaTime = 1.0f / FMath::Max(LockstepTurnRate, 1.0f);
+	if (const FBoidRuleDesc* Desc = FindBoidRuleDesc(GetActiveRules(), EBoidRuleType::PointRepulsion))
+	{
+		Params.PointWeight = Desc->IsEnabled ? MouseRule->GetBaseWeightMultiplier() * Desc->Weight : 0.0f;
+		Params.PointDistance = Desc->Radius;
+	}
+	Params.Seed = FMath::Rand();
+	return Params;
+}
+
+void ABoidController::StartFlockSimulation(EBoidSimulationMode Mode)
+{
+	// Joins whatever ran before. The actors already show its last step, so the new one carries on from there.
+	SimulationThread.Reset();
+	PipelinedSimulation.Reset();
+
+	// Drops boids that left and snapshots the rest into Settings.Positions and Velocities.
+	Settings.RebuildGrid(WallArea, VisualRange, !IsBounded);
+	// Boids joining and leaving from here on go to the running simulation.
+	Settings.SetTrackChanges(true);
+	RemovedIds.Reset();
+
+	TArray<FBoidHandle> Handles;
+	TArray<FBoidBody> Bodies;
+	Handles.Reserve(Settings.ListOfBoids.Num());
+	Bodies.Reserve(Settings.ListOfBoids.Num());
+	for (int32 i = 0; i < Settings.ListOfBoids.Num(); i++)
+	{
+		ABoid* Boid = Settings.ListOfBoids[i];
+		Handles.Add(Settings.GetHandle(i));
+		Bodies.Add(Boid->GetBody());
+		Boid->SetActorTickEnabled(false);
+	}
+	SyncCursor = 0;
+
+	if (Mode == EBoidSimulationMode::Async)
+	{
+		SimulationThread = MakeUnique<FBoidSimulationThread>(Handles, Settings.Positions, Settings.Velocities, Bodies,
+			MakeSimulationParams(), AsyncStepRate);
+		SimulationThread->Start();
+	}
+	else
+	{
+		PipelinedSimulation = MakeUnique<FBoidPipelinedSimulation>(Handles, Settings.Positions, Settings.Velocities, Bodies);
+	}
+
+	ActiveMode = Mode;
+	SimulationRevision = Settings.GetRevision();
+}
+
+void ABoidController::StopFlockSimulation()
+{
+	SimulationThread.Reset();
+	PipelinedSimulation.Reset();
+	ActiveMode = EBoidSimulationMode::Actors;
+	Settings.SetTrackChanges(false);
+
+	for (ABoid* Boid : Settings.ListOfBoids)
+	{
+		if (Boid)
+		{
+			Boid->SetActorTickEnabled(true);
+		}
+	}
+}
+
+void ABoidController::TickFlockSimulation(float DeltaSeconds, EBoidSimulationMode Mode)
+{
+	if (ActiveMode != Mode)
+	{
+		StartFlockSimulation(Mode);
+	}
+
+	// Spawned and destroyed boids are handed to the running simulation rather than starting it over.
+	FlockChanges.Reset();
+	if (SimulationRevision != Settings.GetRevision())
+	{
+		GatherFlockChanges();
+		SimulationRevision = Settings.GetRevision();
+	}
+
+	if (SimulationThread)
+	{
+		SimulationThread->PushParams(MakeSimulationParams());
+		const uint32 NumChanges = SimulationThread->PushChanges(FlockChanges);
+		for (const FBoidHandle& Handle : FlockChanges.Removed)
+		{
+			RemovedIds.Add(Handle.Id, NumChanges);
+		}
+
+		if (const FBoidFlockState* State = SimulationThread->FetchState())
+		{
+			for (auto It = RemovedIds.CreateIterator(); It; ++It)
+			{
+				if (It.Value() <= State->NumChanges)
+				{
+					It.RemoveCurrent();
+				}
+			}
+			SyncBoidActors(State->Handles, State->Positions, State->Velocities);
+		}
+	}
+	else
+	{
+		// Collect last frame's step and start the next one before touching the actors, so the two overlap.
+		PipelinedSimulation->Complete();
+		PipelinedSimulation->ApplyChanges(FlockChanges);
+		LogWorkerStats(DeltaSeconds);
+		PipelinedSimulation->Launch(MakeSimulationParams(), DeltaSeconds, BalanceWorkByCost);
+		SyncBoidActors(PipelinedSimulation->GetHandles(), PipelinedSimulation->GetPositions(), PipelinedSimulation->GetVelocities());
+	}
+}
+
+void ABoidController::GatherFlockChanges()
+{
+	Settings.TakeChanges(AddedBoids, FlockChanges.Removed);
+
+	for (const FBoidHandle& Handle : AddedBoids)
+	{
+		if (ABoid* Boid = Settings.GetBoid(Handle))
+		{
+			FlockChanges.Add(Handle, Boid->GetPosition(), Boid->GetVelocity2D(), Boid->GetBody());
+			// Moved by the simulation from now on.
+			Boid->SetActorTickEnabled(false);
+		}
+	}
+}
+
+void ABoidController::LogWorkerStats(float DeltaSeconds)
+{
+	StatsTime += DeltaSeconds;
+	StatsFrames++;
+
+	if (StatsLogInterval <= 0.0f || StatsTime < StatsLogInterval)
+	{
+		return;
+	}
+
+	FBoidWorkPartition& Partition = PipelinedSimulation->GetPartition();
+
+	FString WorkerLoads;
+	for (int32 Worker = 0; Worker < Partition.GetNumWorkers(); Worker++)
+	{
+		const FBoidWorkerStats& Stats = Partition.GetWorkerStats(Worker);
+		WorkerLoads += FString::Printf(TEXT(" %.2f ms (%d items, %d stolen)"),
+			FPlatformTime::ToMilliseconds64(Stats.BusyCycles) / StatsFrames, Stats.Items, Stats.Steals);
+	}
+
+	UE_LOG(LogBoids, Log, TEXT("%d boids, rules split %s over %d workers into %d items, imbalance %.2f, per worker busy time per frame (items, steals since the last line):%s"),
+		PipelinedSimulation->GetHandles().Num(), BalanceWorkByCost ? TEXT("by cell cost") : TEXT("uniformly"),
+		Partition.GetNumWorkers(), Partition.GetNumItems(), Partition.GetImbalance(), *WorkerLoads);
+
+	Partition.ResetStats();
+	StatsTime = 0.0f;
+	StatsFrames = 0;
+}
+
+void ABoidController::SyncBoidActors(const TArray<FBoidHandle>& Handles, const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(BoidStage_SyncActors);
+
+	const int32 Num = Handles.Num();
+	if (Num == 0)
+	{
+		return;
+	}
+
+	const double BudgetSeconds = CVarBoidsUpdateBudgetMs.GetValueOnGameThread() / 1000.0;
+	const int32 NumTiers = FMath::Max(CVarBoidsLODTiers.GetValueOnGameThread(), 1);
+	const float TierDistance = CVarBoidsLODDistance.GetValueOnGameThread();
+	const FVector2D ViewPosition = GetViewPosition();
+	const double StartTime = FPlatformTime::Seconds();
+	SyncFrame++;
+
+	// Start where the last sync ran out of budget, so every boid gets its turn.
+	int32 Done = 0;
+	for (; Done < Num; Done++)
+	{
+		// Reading the clock is not free, only look every so often.
+		if (BudgetSeconds > 0 && (Done & 63) == 63 && FPlatformTime::Seconds() - StartTime > BudgetSeconds)
+		{
+			break;
+		}
+
+		const int32 i = (SyncCursor + Done) % Num;
+
+		// Tier k boids move every 2^k frames, staggered so each frame moves a share of them.
+		if (NumTiers > 1)
+		{
+			const uint32 TierMask = (1u << GetLODTier(Positions[i], ViewPosition, NumTiers, TierDistance)) - 1;
+			if (((SyncFrame + i) & TierMask) != 0)
+			{
+				continue;
+			}
+		}
+
+		// Not the boid this state has under the id.
+		if (RemovedIds.Num() > 0 && RemovedIds.Contains(Handles[i].Id))
+		{
+			continue;
+		}
+
+		if (ABoid* Boid = Settings.GetBoid(Handles[i]))
+		{
+			Boid->SetVelocity2D(Velocities[i]);
+			Boid->SetPosition(Positions[i]);
+			Boid->BoidRotation();
+		}
+	}
+
+	SyncCursor = (SyncCursor + Done) % Num;
+}
+
+void ABoidController::ApplyFlockCount()
+{
+	// A resize whenever it changes rather than a clamp, so spawns and despawns in between are left alone.
+	const int32 Count = CVarBoidsCount.GetValueOnGameThread();
+	if (Count == AppliedFlockCount)
+	{
+		return;
+	}
+	AppliedFlockCount = Count;
+	if (Count < 0)
+	{
+		return;
+	}
+
+	while (CachedBoids.Num() < Count)
+	{
+		SpawnFlockBoid(FVector(FMath::FRandRange(0, WallArea.X), FMath::FRandRange(0, WallArea.Y), 1));
+	}
+
+	// The flock drops the slots of destroyed boids on its next rebuild.
+	while (CachedBoids.Num() > Count)
+	{
+		if (ABoid* Boid = CachedBoids.Pop())
+		{
+			Boid->Destroy();
+		}
+	}
+}
+
+void ABoidController::ApplyCommands()
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidApplyCommands);
+
+	const bool IsLockstep = Lockstep->IsInSession();
+	const bool IsOwner = OwnsFlock();
+	int32 NumDropped = 0;
+
+	// Only what fits in the queue, so producers that never stop can't hold up the frame.
+	FBoidCommand Command;
+	for (int32 i = 0; i < Commands.GetCapacity() && Commands.Dequeue(Command); i++)
+	{
+		// In lockstep every peer spawns it on the same turn, and the flock is only changed through turns.
+		// Turns carry no despawns or rule weights.
+		if (IsLockstep)
+		{
+			if (Command.Type == EBoidCommandType::Spawn)
+			{
+				Lockstep->AddLocalSpawn(Command.Position);
+			}
+			else
+			{
+				NumDropped++;
+			}
+			continue;
+		}
+
+		// Remote players get the flock replicated, there is nothing to change here.
+		if (!IsOwner)
+		{
+			continue;
+		}
+
+		switch (Command.Type)
+		{
+		case EBoidCommandType::Spawn:
+			SpawnFlockBoid(FVector(Command.Position.X, Command.Position.Y, 1));
+			break;
+		case EBoidCommandType::Despawn:
+			// The flock drops its slot on the next rebuild, like ApplyFlockCount.
+			if (ABoid* Boid = Command.Boid.Get())
+			{
+				CachedBoids.RemoveSingleSwap(Boid, false);
+				Boid->Destroy();
+			}
+			break;
+		case EBoidCommandType::SetRuleWeight:
+			// The controller's own weights, a RuleSet replaces them. UpdateRules picks them up this tick.
+			switch (Command.Rule)
+			{
+			case EBoidRuleType::Cohesion:		CohesionWeight = Command.Value;		break;
+			case EBoidRuleType::Separation:		SeparationWeight = Command.Value;	break;
+			case EBoidRuleType::Alignment:		AlignmentWeight = Command.Value;	break;
+			case EBoidRuleType::Bounds:			WallWeight = Command.Value;			break;
+			case EBoidRuleType::PointRepulsion:	PointWeight = Command.Value;		break;
+			}
+			break;
+		}
+	}
+
+	if (NumDropped > 0)
+	{
+		UE_LOG(LogBoids, Warning, TEXT("%d despawn and rule weight commands dropped, a lockstep flock only takes spawns"), NumDropped);
+	}
+}
+
+void ABoidController::ApplyBoidLOD()
+{
+	const int32 NumTiers = FMath::Max(CVarBoidsLODTiers.GetValueOnGameThread(), 1);
+	if (NumTiers == 1 && AppliedLODTiers == 1)
+	{
+		return;
+	}
+	AppliedLODTiers = NumTiers;
+
+	// Boids tick themselves here, so far ones just tick less often, take the longer delta time and steer for every frame it covers.
+	const float TierDistance = CVarBoidsLODDistance.GetValueOnGameThread();
+	const FVector2D ViewPosition = GetViewPosition();
+	// Tiers are counted in 60 Hz frames.
+	const float FrameSeconds = 1.0f / 60.0f;
+
+	for (ABoid* Boid : CachedBoids)
+	{
+		if (!Boid)
+		{
+			continue;
+		}
+
+		const int32 Tier = GetLODTier(Boid->GetPosition(), ViewPosition, NumTiers, TierDistance);
+		const float Interval = ((1 << Tier) - 1) * FrameSeconds;
+		if (Boid->GetActorTickInterval() != Interval)
+		{
+			Boid->SetActorTickInterval(Interval);
+			Boid->SetFramesPerTick(1 << Tier);
+		}
+	}
+}
+
+int32 ABoidController::GetLODTier(FVector2D Position, FVector2D ViewPosition, int32 NumTiers, float TierDistance) const
+{
+	if (NumTiers <= 1 || TierDistance <= 0.0f)
+	{
+		return 0;
+	}
+
+	// Capped so the update interval stays within a second or so.
+	return FMath::Min(FMath::FloorToInt(FVector2D::Distance(Position, ViewPosition) / TierDistance), FMath::Min(NumTiers - 1, 6));
+}
+
+FVector2D ABoidController::GetViewPosition() const
+{
+	return PlayerCameraManager ? FVector2D(PlayerCameraManager->GetCameraLocation()) : FVector2D::ZeroVector;
+}
+
+void ABoidController::LogFlockStats(float DeltaSeconds, uint64 GridCycles, uint64 NeighbourCycles)
+{
+	StatsGridCycles += GridCycles;
+	StatsNeighbourCycles += NeighbourCycles;
+	StatsBoidUpdates += Settings.ListOfBoids.Num();
+	StatsTime += DeltaSeconds;
+	StatsFrames++;
+
+	if (StatsLogInterval <= 0.0f || StatsTime < StatsLogInterval)
+	{
+		return;
+	}
+
+	const double NeighbourSeconds = FPlatformTime::ToSeconds64(StatsNeighbourCycles);
+	UE_LOG(LogBoids, Log, TEXT("%d boids, reorder every %d frames: neighbour search %.1f ns/boid (%.2f M boids/s), grid rebuild %.1f us/frame, ")
+		TEXT("%d neighbours in %lld KB (%s indices, arena %lld KB)"),
+		Settings.ListOfBoids.Num(), ReorderInterval,
+		StatsBoidUpdates > 0 ? NeighbourSeconds * 1e9 / StatsBoidUpdates : 0.0,
+		NeighbourSeconds > 0 ? StatsBoidUpdates / NeighbourSeconds * 1e-6 : 0.0,
+		FPlatformTime::ToSeconds64(StatsGridCycles) * 1e6 / StatsFrames,
+		Settings.Neighbours.GetNumNeighbours(), Settings.Neighbours.GetAllocatedBytes() / 1024,
+		Settings.Neighbours.IsWide() ? TEXT("32 bit") : TEXT("16 bit"), Settings.FrameArena.GetCapacity() / 1024);
+
+	StatsTime = 0.0f;
+	StatsFrames = 0;
+	StatsGridCycles = 0;
+	StatsNeighbourCycles = 0;
+	StatsBoidUpdates = 0;
 }
 
 void ABoidController::SpawnBoid()
@@ -139,18 +809,323 @@ void ABoidController::SpawnBoid()
 		
 		DrawDebugBox(GetWorld(), SpawnSpot, FVector(1), FColor::Orange, false, 10.0f);
 
-		// Create the Boid.
-		ABoid* Boid = GetWorld()->SpawnActor<ABoid>(ABoid::StaticClass(), SpawnSpot, Rot);
-		RandomizeBoidVelocity(Boid);
-		Boid->SetVisualRange(VisualRange);
-		Boid->SetSpeed(Speed);
-		ApplyOneBoidRules(Boid);
-		Boid->SetActorRotation(FRotator(0));
+		// Created at the start of the next tick.
+		if (!Commands.Enqueue(FBoidCommand::MakeSpawn(FVector2D(SpawnSpot))))
+		{
+			UE_LOG(LogBoids, Warning, TEXT("The command queue is full, no boid spawned at %f, %f"), SpawnSpot.X, SpawnSpot.Y);
+		}
+	}
+}
+
+void ABoidController::BenchmarkBoidGC()
+{
+	// It spawns boid actors straight into the flock, any other mode would lose track of them.
+	if (Lockstep->IsInSession() || ActiveMode != EBoidSimulationMode::Actors || GetSimulationMode() != EBoidSimulationMode::Actors)
+	{
+		UE_LOG(LogBoids, Warning, TEXT("BenchmarkBoidGC only runs in Actors mode, set boids.SimulationMode 0 first"));
+		return;
+	}
+
+	const int32 FlockSizes[] = { 1000, 10000, 50000 };
+	// Boids can be destroyed by anything in the world, leave those out.
+	CachedBoids.RemoveAll([](ABoid* Boid) { return !IsValid(Boid); });
+	const int32 StartNum = CachedBoids.Num();
+
+	for (const int32 FlockSize : FlockSizes)
+	{
+		// Grow the area with the flock so every size sees the same density, and so the same neighbour count.
+		const FVector2D Area = WallArea * FMath::Sqrt(FlockSize / static_cast<float>(FMath::Max(StartNum, 1)));
+		while (CachedBoids.Num() < FlockSize)
+		{
+			SpawnFlockBoid(FVector(FMath::FRandRange(0, Area.X), FMath::FRandRange(0, Area.Y), 1));
+		}
+
+		Settings.RebuildGrid(Area, VisualRange, false);
+		Settings.BuildNeighbours(VisualRange);
+
+		for (const bool Track : { true, false })
+		{
+			Settings.TrackNeighbourActors = Track;
+
+			int64 NumReferences = 0;
+			for (ABoid* Boid : CachedBoids)
+			{
+				if (IsValid(Boid))
+				{
+					Boid->ComputeNeighbourhood();
+					NumReferences += Boid->ListOfBoidsInVision.Num();
+				}
+			}
+
+			const double StartTime = FPlatformTime::Seconds();
+			CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS, true);
+			const double GCMilliseconds = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+
+			UE_LOG(LogBoids, Log, TEXT("GC with %d boids, %s: %.2f ms, %lld neighbour references"),
+				CachedBoids.Num(), Track ? TEXT("tracking neighbour actors") : TEXT("indices only"), GCMilliseconds, NumReferences);
+		}
+	}
+
+	// Put the flock back the way it was, the next tick picks the settings up again.
+	for (int32 i = StartNum; i < CachedBoids.Num(); i++)
+	{
+		if (IsValid(CachedBoids[i]))
+		{
+			CachedBoids[i]->Destroy();
+		}
+	}
+	CachedBoids.SetNum(StartNum);
+	Settings.TrackNeighbourActors = TrackNeighbourActors;
+
+	// The grid and neighbours are shared, give them back the flock's own area before anything reads them this frame.
+	Settings.RebuildGrid(WallArea, VisualRange, !IsBounded);
+	Settings.BuildNeighbours(VisualRange);
+}
+
+void ABoidController::ReportFarFieldAccuracy()
+{
+	Settings.RebuildGrid(WallArea, VisualRange, !IsBounded);
+
+	const float Tolerances[] = { 0.0f, 0.25f, 0.5f, 1.0f };
+	FBoidSimulationParams Params = MakeSimulationParams();
+
+	for (const float Tolerance : Tolerances)
+	{
+		Params.FarFieldTolerance = Tolerance;
+		const FBoidFarFieldAccuracy Accuracy = FBoidSimulation::MeasureFarFieldAccuracy(Settings.Positions, Settings.Velocities, Params);
+
+		UE_LOG(LogBoids, Log, TEXT("Far field, %d boids, range %.1f, tolerance %.2f: mean error %.4f, max error %.4f (mean force %.4f), ")
+			TEXT("exact %.2f ms, far field %.2f ms"),
+			Settings.Positions.Num(), VisualRange, Tolerance, Accuracy.MeanError, Accuracy.MaxError, Accuracy.MeanForce,
+			Accuracy.ExactSeconds * 1000.0, Accuracy.FarFieldSeconds * 1000.0);
+	}
+}
+
+void ABoidController::BenchmarkNeighbourSearch()
+{
+	Settings.RebuildGrid(WallArea, VisualRange, !IsBounded);
+
+	// At least a thousand boids so the backends have something to tell apart.
+	const int32 Num = FMath::Max(Settings.Positions.Num(), 1000);
+	const int32 NumClumps = 8;
+
+	TArray<FVector2D> Uniform;
+	TArray<FVector2D> Clumped;
+	for (int32 i = 0; i < Num; i++)
+	{
+		Uniform.Add(FVector2D(FMath::FRandRange(0, WallArea.X), FMath::FRandRange(0, WallArea.Y)));
+	}
+	for (int32 Clump = 0; Clump < NumClumps; Clump++)
+	{
+		const FVector2D Centre(FMath::FRandRange(0, WallArea.X), FMath::FRandRange(0, WallArea.Y));
+		for (int32 i = Clump; i < Num; i += NumClumps)
+		{
+			const FVector2D Position = Centre + FMath::RandPointInCircle(VisualRange * 2.0f);
+			Clumped.Add(FVector2D(FMath::Clamp(Position.X, 0.0f, WallArea.X), FMath::Clamp(Position.Y, 0.0f, WallArea.Y)));
+		}
+	}
+
+	const TPair<const TCHAR*, const TArray<FVector2D>*> Layouts[] = {
+		{ TEXT("current flock"), &Settings.Positions },
+		{ TEXT("uniform"), &Uniform },
+		{ TEXT("clumped"), &Clumped }
+	};
+
+	for (const TPair<const TCHAR*, const TArray<FVector2D>*>& Layout : Layouts)
+	{
+		if (Layout.Value->Num() == 0)
+		{
+			continue;
+		}
+
+		FBoidNeighbourTiming Timings[(int32)EBoidNeighbourBackend::Count];
+		FBoidNeighbourBackends::Benchmark(*Layout.Value, WallArea, VisualRange, !IsBounded, 3, Timings);
+
+		FBoidSpatialGrid Grid;
+		Grid.Configure(WallArea, VisualRange, !IsBounded);
+		Grid.Build(*Layout.Value);
+		const EBoidNeighbourBackend Choice = FBoidNeighbourBackends::Choose(Grid, VisualRange, EBoidNeighbourBackend::Auto);
+
+		UE_LOG(LogBoids, Log, TEXT("Neighbour search, %d boids %s: brute force %.2f ms, grid %.2f ms, k-d tree %.2f ms, %d neighbours, auto picks %s"),
+			Layout.Value->Num(), Layout.Key,
+			Timings[(int32)EBoidNeighbourBackend::BruteForce].Seconds * 1000.0,
+			Timings[(int32)EBoidNeighbourBackend::Grid].Seconds * 1000.0,
+			Timings[(int32)EBoidNeighbourBackend::KdTree].Seconds * 1000.0,
+			Timings[(int32)EBoidNeighbourBackend::Grid].NumNeighbours, GetBoidNeighbourBackendName(Choice));
+
+		if (Timings[(int32)EBoidNeighbourBackend::BruteForce].NumNeighbours != Timings[(int32)EBoidNeighbourBackend::Grid].NumNeighbours
+			|| Timings[(int32)EBoidNeighbourBackend::KdTree].NumNeighbours != Timings[(int32)EBoidNeighbourBackend::Grid].NumNeighbours)
+		{
+			UE_LOG(LogBoids, Warning, TEXT("Neighbour backends disagree: brute force %d, grid %d, k-d tree %d"),
+				Timings[(int32)EBoidNeighbourBackend::BruteForce].NumNeighbours, Timings[(int32)EBoidNeighbourBackend::Grid].NumNeighbours,
+				Timings[(int32)EBoidNeighbourBackend::KdTree].NumNeighbours);
+		}
+	}
+}
+
+const FBoidSpatialGrid& ABoidController::GetQueryGrid()
+{
+	if (QueryGridFrame != GFrameCounter)
+	{
+		Settings.RebuildGrid(WallArea, VisualRange, !IsBounded);
+		QueryGridFrame = GFrameCounter;
+	}
+	return Settings.Grid;
+}
+
+void ABoidController::CopyQueryHits(int32 NumHits, TArray<ABoid*>& OutBoids, TArray<float>* OutDistances) const
+{
+	NumHits = FMath::Min(NumHits, QueryHits.Num());
+	OutBoids.Reset(NumHits);
+	if (OutDistances)
+	{
+		OutDistances->Reset(NumHits);
+	}
 
-		CachedBoids.Emplace(Boid);
+	for (int32 i = 0; i < NumHits; i++)
+	{
+		OutBoids.Add(Settings.ListOfBoids[QueryHits[i].Index]);
+		if (OutDistances)
+		{
+			OutDistances->Add(QueryHits[i].Distance);
+		}
 	}
 }
 
+int32 ABoidController::FindBoidsInRadius(FVector2D Centre, float Radius, TArray<ABoid*>& OutBoids, int32 MaxBoids)
+{
+	QueryHits.SetNumUninitialized(FMath::Max(MaxBoids, 0), false);
+	const int32 NumFound = FBoidSpatialQuery::Radius(GetQueryGrid(), Centre, Radius, QueryHits);
+	CopyQueryHits(NumFound, OutBoids, nullptr);
+	return NumFound;
+}
+
+int32 ABoidController::FindBoidsInBox(FVector2D Centre, FVector2D HalfExtent, TArray<ABoid*>& OutBoids, int32 MaxBoids)
+{
+	QueryHits.SetNumUninitialized(FMath::Max(MaxBoids, 0), false);
+	const int32 NumFound = FBoidSpatialQuery::Box(GetQueryGrid(), Centre, HalfExtent, QueryHits);
+	CopyQueryHits(NumFound, OutBoids, nullptr);
+	return NumFound;
+}
+
+int32 ABoidController::TraceBoids(FVector2D Start, FVector2D End, float Radius, TArray<ABoid*>& OutBoids, TArray<float>& OutDistances, int32 MaxBoids)
+{
+	QueryHits.SetNumUninitialized(FMath::Max(MaxBoids, 0), false);
+	const int32 NumFound = FBoidSpatialQuery::Ray(GetQueryGrid(), Start, End, Radius, QueryHits);
+	CopyQueryHits(NumFound, OutBoids, &OutDistances);
+	return NumFound;
+}
+
+int32 ABoidController::FindNearestBoids(FVector2D Centre, float MaxDistance, int32 Count, TArray<ABoid*>& OutBoids, TArray<float>& OutDistances)
+{
+	QueryHits.SetNumUninitialized(FMath::Max(Count, 0), false);
+	const int32 NumFound = FBoidSpatialQuery::Nearest(GetQueryGrid(), Centre, MaxDistance, QueryHits);
+	CopyQueryHits(NumFound, OutBoids, &OutDistances);
+	return NumFound;
+}
+
+void ABoidController::FindBoidsInRadiusBatch(const TArray<FVector2D>& Centres, float Radius, int32 MaxBoidsPerCentre, TArray<ABoid*>& OutBoids,
+	TArray<int32>& OutNumFound)
+{
+	const int32 PerCentre = FMath::Max(MaxBoidsPerCentre, 0);
+	BatchQueries.Reset(Centres.Num());
+	for (const FVector2D& Centre : Centres)
+	{
+		BatchQueries.Add(FBoidQuery::MakeRadius(Centre, Radius));
+	}
+	QueryHits.SetNumUninitialized(Centres.Num() * PerCentre, false);
+	OutNumFound.SetNumUninitialized(Centres.Num());
+
+	FBoidSpatialQuery::RunBatch(GetQueryGrid(), BatchQueries, QueryHits, OutNumFound);
+
+	OutBoids.Reset(QueryHits.Num());
+	for (int32 i = 0; i < Centres.Num(); i++)
+	{
+		for (int32 Hit = 0; Hit < PerCentre; Hit++)
+		{
+			OutBoids.Add(Hit < OutNumFound[i] ? Settings.ListOfBoids[QueryHits[i * PerCentre + Hit].Index] : nullptr);
+		}
+	}
+}
+
+int32 ABoidController::AddCircleZone(FVector2D Centre, float Radius)
+{
+	return Zones.AddZone(FBoidZoneShape::MakeCircle(Centre, Radius));
+}
+
+int32 ABoidController::AddBoxZone(FVector2D Centre, FVector2D HalfExtent)
+{
+	return Zones.AddZone(FBoidZoneShape::MakeBox(Centre, HalfExtent));
+}
+
+void ABoidController::RemoveZone(int32 Zone)
+{
+	Zones.RemoveZone(Zone);
+}
+
+void ABoidController::MoveZone(int32 Zone, FVector2D Centre)
+{
+	if (Zones.IsValidZone(Zone))
+	{
+		FBoidZoneShape Shape = Zones.GetShape(Zone);
+		Shape.Centre = Centre;
+		Zones.SetZoneShape(Zone, Shape);
+	}
+}
+
+bool ABoidController::HasZoneWork() const
+{
+	// One more update once the last zone is gone, to clear its events.
+	return Zones.HasZones() || Zones.GetEntered().Num() > 0 || Zones.GetExited().Num() > 0;
+}
+
+void ABoidController::UpdateZones()
+{
+	if (HasZoneWork())
+	{
+		UpdateZones(GetQueryGrid(), [](int32 Index) { return Settings.GetHandle(Index).Id; },
+			[](int32 BoidId) { return Settings.GetBoid(FBoidHandle{ BoidId }); });
+	}
+}
+
+void ABoidController::UpdateLockstepZones(const FBoidLockstepSimulation& Shown)
+{
+	if (!HasZoneWork())
+	{
+		return;
+	}
+
+	const FBoidSimulationParams& Params = Shown.GetParams().Simulation;
+	LockstepZoneGrid.Configure(Params.Area, Params.VisualRange, Params.IsWrapped);
+	LockstepZoneGrid.Build(Shown.GetState().Positions);
+	const TArray<ABoid*>& Replicas = Lockstep->GetReplicas();
+	UpdateZones(LockstepZoneGrid, [](int32 Index) { return Index; },
+		[&Replicas](int32 BoidId) { return Replicas.IsValidIndex(BoidId) ? Replicas[BoidId] : nullptr; });
+}
+
+void ABoidController::UpdateZones(const FBoidSpatialGrid& Grid, TFunctionRef<int32(int32)> GetBoidId, TFunctionRef<ABoid*(int32)> GetBoid)
+{
+	Zones.Update(Grid, GetBoidId);
+	if (!OnZoneEvents.IsBound() || (Zones.GetEntered().Num() == 0 && Zones.GetExited().Num() == 0))
+	{
+		return;
+	}
+
+	auto ToOverlaps = [&GetBoid](const TArray<FBoidZoneEvent>& Events, TArray<FBoidZoneOverlap>& OutOverlaps)
+	{
+		OutOverlaps.Reset(Events.Num());
+		for (const FBoidZoneEvent& Event : Events)
+		{
+			FBoidZoneOverlap& Overlap = OutOverlaps.AddDefaulted_GetRef();
+			Overlap.Zone = Event.Zone;
+			Overlap.Boid = GetBoid(Event.BoidId);
+		}
+	};
+	ToOverlaps(Zones.GetEntered(), ZoneEntered);
+	ToOverlaps(Zones.GetExited(), ZoneExited);
+	OnZoneEvents.Broadcast(ZoneEntered, ZoneExited);
+}
+
 void ABoidController::SetupInputComponent()
 {
 	Super::SetupInputComponent();
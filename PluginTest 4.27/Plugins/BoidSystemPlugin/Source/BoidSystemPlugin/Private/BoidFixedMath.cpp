@@ -0,0 +1,62 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidFixedMath.h"
+
+// Constants below have 30 fraction bits, worked out once rather than with float maths that could differ.
+static const int64 BoidFixedLog2E = 1549082005;
+// Taylor series of 2^x = e^(x ln 2), enough terms for x in [0, 1) to be well under a 16.16 step.
+static const int64 BoidFixedExp2Terms[] = { 1073741824, 744261118, 257941248, 59597083, 10327387, 1431680, 165394, 16377, 1419 };
+
+uint32 FBoidFixedMath::SqrtRaw(uint64 Value)
+{
+	// A double square root is close but however the compiler gets it, so correct it to the exact answer with integers.
+	uint64 Result = FMath::Min<uint64>(static_cast<uint64>(sqrt(static_cast<double>(Value))), MAX_uint32);
+	while (Result * Result > Value)
+	{
+		Result--;
+	}
+	while (Result < MAX_uint32 && (Result + 1) * (Result + 1) <= Value)
+	{
+		Result++;
+	}
+
+	return static_cast<uint32>(Result);
+}
+
+int32 FBoidFixedMath::Sqrt(int32 Value)
+{
+	return Value > 0 ? static_cast<int32>(SqrtRaw(static_cast<uint64>(Value) << FractionBits)) : 0;
+}
+
+int32 FBoidFixedMath::Exp(int32 Value)
+{
+	// e^x = 2^(x log2 e), split into a whole power of two and 2^f with f in [0, 1).
+	const int64 Power = (static_cast<int64>(Value) * BoidFixedLog2E) >> FractionBits;
+	const int64 Whole = Power >> 30;
+	const int64 Fraction = Power & ((int64(1) << 30) - 1);
+
+	// 2^16 and up does not fit, 2^-17 and below rounds to 0.
+	if (Whole >= 15)
+	{
+		return MAX_int32;
+	}
+	if (Whole < -17)
+	{
+		return 0;
+	}
+
+	int64 Result = BoidFixedExp2Terms[UE_ARRAY_COUNT(BoidFixedExp2Terms) - 1];
+	for (int32 Term = UE_ARRAY_COUNT(BoidFixedExp2Terms) - 2; Term >= 0; Term--)
+	{
+		Result = BoidFixedExp2Terms[Term] + ((Result * Fraction) >> 30);
+	}
+
+	// From 30 fraction bits to 16, times 2^Whole.
+	const int64 Shift = 30 - FractionBits - Whole;
+	if (Shift == 0)
+	{
+		return Saturate(Result);
+	}
+	return Saturate((Result + (int64(1) << (Shift - 1))) >> Shift);
+}
@@ -0,0 +1,213 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidFixedPipeline.h"
+
+void FBoidFixedPipeline::Configure(const FDefaultBoidPipeline& Pipeline, FVector2D _Area, float VisualRange, bool _IsWrapped)
+{
+	const FCohesionKernel& Cohesion = Pipeline.Get<FCohesionKernel>();
+	const FSeparationKernel& Separation = Pipeline.Get<FSeparationKernel>();
+	const FAlignmentKernel& Alignment = Pipeline.Get<FAlignmentKernel>();
+	const FBoundsKernel& Bounds = Pipeline.Get<FBoundsKernel>();
+	const FPointKernel& PointKernel = Pipeline.Get<FPointKernel>();
+
+	CohesionWeight = FBoidFixedMath::FromFloat(Cohesion.Weight);
+	SeparationWeight = FBoidFixedMath::FromFloat(Separation.Weight);
+	const int64 DesiredDistance = FBoidFixedMath::FromFloat(Separation.DesiredDistance);
+	DesiredDistanceSquared = static_cast<uint64>(DesiredDistance * DesiredDistance);
+	Falloff = FBoidFixedMath::FromFloat(Separation.Falloff);
+	AlignmentWeight = FBoidFixedMath::FromFloat(Alignment.Weight);
+	BoundsWeight = FBoidFixedMath::FromFloat(Bounds.Weight);
+	Width = FBoidFixedMath::FromFloat(Bounds.Width);
+	Height = FBoidFixedMath::FromFloat(Bounds.Height);
+	BoundsDistance = FBoidFixedMath::Saturate(static_cast<int64>(Bounds.DesiredDistance) * FBoidFixedMath::One);
+	IsBounded = Bounds.IsBounded;
+	PointScale = FBoidFixedMath::FromFloat(30 * PointKernel.Weight);
+	Point = FBoidFixedMath::FromVector(PointKernel.Point);
+	PointDistance = FBoidFixedMath::FromFloat(PointKernel.Distance);
+	IsPushing = PointKernel.IsPushing;
+	IsPulling = PointKernel.IsPulling;
+
+	// Same minimum as the grid's.
+	Area = FBoidFixedMath::FromVector(FVector2D(FMath::Max(_Area.X, 1.0f), FMath::Max(_Area.Y, 1.0f)));
+	IsWrapped = _IsWrapped;
+	const int64 Range = FBoidFixedMath::FromFloat(VisualRange);
+	RangeSquared = static_cast<uint64>(Range * Range);
+	// Float distances are off by a few float steps, far less than this.
+	SearchRange = VisualRange * 1.01f + 0.01f;
+}
+
+FBoidFixedVector FBoidFixedPipeline::Evaluate(const FBoidNeighbourLists& Lists, const TArray<FBoidFixedVector>& Positions,
+	const TArray<FBoidFixedVector>& Velocities, int32 Self) const
+{
+	const FBoidFixedVector Position = Positions[Self];
+	int64 OffsetSumX = 0;
+	int64 OffsetSumY = 0;
+	int64 VelocitySumX = 0;
+	int64 VelocitySumY = 0;
+	int64 SeparationSumX = 0;
+	int64 SeparationSumY = 0;
+	int32 NumNeighbours = 0;
+	int32 NumClose = 0;
+
+	for (int32 Entry = Lists.GetRowStart(Self); Entry < Lists.GetRowEnd(Self); Entry++)
+	{
+		const int32 Index = Lists.GetIndex(Entry);
+		const FBoidFixedVector Offset = GetOffset(Position, Positions[Index]);
+		const uint64 DistanceSquared = FBoidFixedMath::SizeSquared(Offset);
+		if (DistanceSquared > RangeSquared)
+		{
+			continue;
+		}
+
+		OffsetSumX += Offset.X;
+		OffsetSumY += Offset.Y;
+		VelocitySumX += Velocities[Index].X;
+		VelocitySumY += Velocities[Index].Y;
+		NumNeighbours++;
+
+		if (DistanceSquared < DesiredDistanceSquared && DistanceSquared > 0)
+		{
+			// Offset * e^(-Distance * Falloff) / Distance, the offset is at most the distance so this stays small.
+			const int64 Distance = FBoidFixedMath::SqrtRaw(DistanceSquared);
+			const int64 Scale = (static_cast<int64>(FBoidFixedMath::Exp(-FBoidFixedMath::Mul(static_cast<int32>(Distance), Falloff))) << FBoidFixedMath::FractionBits) / Distance;
+			SeparationSumX -= (Offset.X * Scale) >> FBoidFixedMath::FractionBits;
+			SeparationSumY -= (Offset.Y * Scale) >> FBoidFixedMath::FractionBits;
+			NumClose++;
+		}
+	}
+
+	FBoidFixedVector Cohesion;
+	FBoidFixedVector Alignment;
+	FBoidFixedVector Separation;
+	if (NumNeighbours > 0)
+	{
+		Cohesion = FBoidFixedMath::GetNormal(FBoidFixedVector(FBoidFixedMath::Saturate(OffsetSumX / NumNeighbours), FBoidFixedMath::Saturate(OffsetSumY / NumNeighbours)));
+		Alignment = FBoidFixedMath::GetNormal(FBoidFixedVector(FBoidFixedMath::Saturate(VelocitySumX / NumNeighbours), FBoidFixedMath::Saturate(VelocitySumY / NumNeighbours)));
+	}
+	if (NumClose > 0)
+	{
+		Separation = FBoidFixedMath::GetNormal(FBoidFixedVector(FBoidFixedMath::Saturate(SeparationSumX / NumClose), FBoidFixedMath::Saturate(SeparationSumY / NumClose)));
+	}
+	const FBoidFixedVector Bounds = FinishBounds(Position);
+	const FBoidFixedVector PointForce = FinishPoint(Position);
+
+	const int64 ForceX = static_cast<int64>(FBoidFixedMath::Mul(CohesionWeight, Cohesion.X)) + FBoidFixedMath::Mul(SeparationWeight, Separation.X)
+		+ FBoidFixedMath::Mul(AlignmentWeight, Alignment.X) + FBoidFixedMath::Mul(BoundsWeight, Bounds.X) + PointForce.X;
+	const int64 ForceY = static_cast<int64>(FBoidFixedMath::Mul(CohesionWeight, Cohesion.Y)) + FBoidFixedMath::Mul(SeparationWeight, Separation.Y)
+		+ FBoidFixedMath::Mul(AlignmentWeight, Alignment.Y) + FBoidFixedMath::Mul(BoundsWeight, Bounds.Y) + PointForce.Y;
+	return FBoidFixedVector(FBoidFixedMath::Saturate(ForceX), FBoidFixedMath::Saturate(ForceY));
+}
+
+FBoidFixedVector FBoidFixedPipeline::FinishBounds(FBoidFixedVector Position) const
+{
+	FBoidFixedVector BoundedForce;
+	if (!IsBounded)
+	{
+		return BoundedForce;
+	}
+
+	// Same as FBoundsKernel, with one fixed point step for its epsilon and for a divisor of 0.
+	if (Position.X < BoundsDistance)
+	{
+		BoundedForce.X = FBoidFixedMath::Div(BoundsDistance, Position.X != 0 ? Position.X : 1);
+	}
+	else if (Position.X > Width - BoundsDistance)
+	{
+		const int64 Distance = (static_cast<int64>(Position.X) - Width) / FBoidFixedMath::One * FBoidFixedMath::One;
+		BoundedForce.X = FBoidFixedMath::Div(BoundsDistance, FBoidFixedMath::Saturate(Distance + 1));
+	}
+
+	if (Position.Y < BoundsDistance)
+	{
+		BoundedForce.Y = FBoidFixedMath::Div(BoundsDistance, Position.Y != 0 ? Position.Y : 1);
+	}
+	else if (Position.Y > Height - BoundsDistance)
+	{
+		const int64 Distance = (static_cast<int64>(Position.Y) - Height) / FBoidFixedMath::One * FBoidFixedMath::One;
+		BoundedForce.Y = FBoidFixedMath::Div(BoundsDistance, FBoidFixedMath::Saturate(Distance + 1));
+	}
+
+	return BoundedForce;
+}
+
+FBoidFixedVector FBoidFixedPipeline::FinishPoint(FBoidFixedVector Position) const
+{
+	FBoidFixedVector PointForce;
+	if (!IsPushing && !IsPulling)
+	{
+		return PointForce;
+	}
+
+	// Same as FPointKernel, already weighted.
+	const FBoidFixedVector Direction = Point - Position;
+	const int32 Distance = FBoidFixedMath::Size(Direction);
+	if (Distance > PointDistance || IsPushing)
+	{
+		PointForce = FBoidFixedMath::GetNormal(Direction);
+	}
+	else if (Distance < PointDistance)
+	{
+		PointForce = FBoidFixedVector() - FBoidFixedMath::GetNormal(Direction);
+	}
+
+	if (IsPushing)
+	{
+		PointForce = FBoidFixedVector() - PointForce;
+	}
+	return FBoidFixedMath::Mul(PointForce, PointScale);
+}
+
+void FBoidFixedPipeline::Integrate(FBoidFixedVector& Position, FBoidFixedVector& Velocity, FBoidFixedVector Acceleration, int32 Speed, int32 MaxAcceleration,
+	bool HasConstantSpeed, int32 DeltaTime) const
+{
+	if (FBoidFixedMath::Size(Acceleration) > MaxAcceleration)
+	{
+		Acceleration = FBoidFixedMath::Mul(FBoidFixedMath::GetNormal(Acceleration), MaxAcceleration);
+	}
+
+	Velocity = FBoidFixedVector(FBoidFixedMath::Saturate(static_cast<int64>(Velocity.X) + Acceleration.X),
+		FBoidFixedMath::Saturate(static_cast<int64>(Velocity.Y) + Acceleration.Y));
+
+	if (HasConstantSpeed || FBoidFixedMath::Size(Velocity) > Speed)
+	{
+		Velocity = FBoidFixedMath::Mul(FBoidFixedMath::GetNormal(Velocity), Speed);
+	}
+
+	const FBoidFixedVector Step = FBoidFixedMath::Mul(Velocity, DeltaTime);
+	Position = WrapPosition(FBoidFixedVector(FBoidFixedMath::Saturate(static_cast<int64>(Position.X) + Step.X),
+		FBoidFixedMath::Saturate(static_cast<int64>(Position.Y) + Step.Y)));
+}
+
+FBoidFixedVector FBoidFixedPipeline::GetOffset(FBoidFixedVector From, FBoidFixedVector To) const
+{
+	int64 X = static_cast<int64>(To.X) - From.X;
+	int64 Y = static_cast<int64>(To.Y) - From.Y;
+
+	if (IsWrapped)
+	{
+		// Both positions are inside the area, so one correction per axis is enough.
+		if (X > Area.X / 2)				{ X -= Area.X; }
+		else if (X < -(Area.X / 2))		{ X += Area.X; }
+
+		if (Y > Area.Y / 2)				{ Y -= Area.Y; }
+		else if (Y < -(Area.Y / 2))		{ Y += Area.Y; }
+	}
+
+	return FBoidFixedVector(FBoidFixedMath::Saturate(X), FBoidFixedMath::Saturate(Y));
+}
+
+FBoidFixedVector FBoidFixedPipeline::WrapPosition(FBoidFixedVector Position) const
+{
+	if (!IsWrapped)
+	{
+		return Position;
+	}
+
+	// The remainder keeps the sign of the position, so pull negative values back up.
+	int32 X = Position.X % Area.X;
+	int32 Y = Position.Y % Area.Y;
+	if (X < 0)	{ X += Area.X; }
+	if (Y < 0)	{ Y += Area.Y; }
+	return FBoidFixedVector(X, Y);
+}
@@ -0,0 +1,224 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidFlockReplicationComponent.h"
+
+#include "Algo/BinarySearch.h"
+#include "Boid.h"
+#include "BoidSettings.h"
+#include "BoidSystemPlugin.h"
+#include "Camera/PlayerCameraManager.h"
+#include "GameFramework/PlayerController.h"
+
+DECLARE_CYCLE_STAT(TEXT("Replication Send"), STAT_BoidReplicationSend, STATGROUP_Boids);
+DECLARE_CYCLE_STAT(TEXT("Replication Show"), STAT_BoidReplicationShow, STATGROUP_Boids);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Replication Bytes Per Boid Per Second"), STAT_BoidReplicationBytesPerBoid, STATGROUP_Boids);
+
+UBoidFlockReplicationComponent::UBoidFlockReplicationComponent()
+{
+	PrimaryComponentTick.bCanEverTick = true;
+	SetIsReplicatedByDefault(true);
+}
+
+void UBoidFlockReplicationComponent::SetFlockArea(FVector2D Area, bool IsWrapped)
+{
+	FlockArea = Area;
+	FlockIsWrapped = IsWrapped;
+}
+
+FBoidReplicationSettings UBoidFlockReplicationComponent::MakeSettings() const
+{
+	FBoidReplicationSettings Settings;
+	Settings.Precision = FMath::Max(Precision, 0.001f);
+	Settings.RelevancyRadius = RelevancyRadius;
+	Settings.MaxBoids = MaxBoidsPerSnapshot;
+	Settings.MaxBytes = MaxSnapshotBytes;
+	Settings.Area = FlockArea;
+	Settings.IsWrapped = FlockIsWrapped;
+	return Settings;
+}
+
+bool UBoidFlockReplicationComponent::IsSending() const
+{
+	// The server's copy of a remote player's controller, the host's own needs nothing sent.
+	const APlayerController* Controller = Cast<APlayerController>(GetOwner());
+	return Controller && GetOwnerRole() == ROLE_Authority && !Controller->IsLocalController();
+}
+
+bool UBoidFlockReplicationComponent::IsReceiving() const
+{
+	const APlayerController* Controller = Cast<APlayerController>(GetOwner());
+	return Controller && GetNetMode() == NM_Client && Controller->IsLocalController();
+}
+
+void UBoidFlockReplicationComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	if (IsSending())
+	{
+		SendSnapshot(DeltaTime);
+	}
+	else if (IsReceiving())
+	{
+		ShowFlock(DeltaTime);
+	}
+}
+
+void UBoidFlockReplicationComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+
+	for (const TPair<int32, ABoid*>& Replica : Replicas)
+	{
+		if (Replica.Value)
+		{
+			Replica.Value->Destroy();
+		}
+	}
+	Replicas.Empty();
+}
+
+void UBoidFlockReplicationComponent::SendSnapshot(float DeltaTime)
+{
+	SendAccumulator += DeltaTime;
+	StatsTime += DeltaTime;
+
+	const float Interval = 1.0f / FMath::Max(SendRate, 1.0f);
+	if (SendAccumulator < Interval)
+	{
+		return;
+	}
+	// Never more than one snapshot a frame, a slow frame just sends one.
+	SendAccumulator = FMath::Min(SendAccumulator - Interval, Interval);
+
+	SCOPE_CYCLE_COUNTER(STAT_BoidReplicationSend);
+
+	// The actors carry the flock's state in every simulation mode.
+	Ids.Reset();
+	Positions.Reset();
+	Velocities.Reset();
+	for (const ABoid* Boid : Settings.ListOfBoids)
+	{
+		if (Boid)
+		{
+			Ids.Add(Boid->GetHandle().Id);
+			Positions.Add(Boid->GetPosition());
+			Velocities.Add(Boid->GetVelocity2D());
+		}
+	}
+
+	Sender.Settings = MakeSettings();
+	Sender.BuildSnapshot(Ids, Positions, Velocities, GetWorld()->GetTimeSeconds(), Bytes);
+	ClientReceiveSnapshot(Bytes);
+
+	LogBandwidth(Bytes.Num());
+}
+
+void UBoidFlockReplicationComponent::LogBandwidth(int32 SentBytes)
+{
+	StatsBytes += SentBytes;
+	StatsFlockBoids += Sender.GetNumSent();
+	StatsSnapshots++;
+
+	const float Interval = StatsLogInterval > 0.0f ? StatsLogInterval : 1.0f;
+	if (StatsTime < Interval)
+	{
+		return;
+	}
+
+	const double BytesPerSecond = StatsBytes / StatsTime;
+	const double MeanBoids = static_cast<double>(StatsFlockBoids) / StatsSnapshots;
+	BytesPerBoidPerSecond = MeanBoids > 0 ? BytesPerSecond / MeanBoids : 0.0f;
+	SET_FLOAT_STAT(STAT_BoidReplicationBytesPerBoid, BytesPerBoidPerSecond);
+
+	if (StatsLogInterval > 0.0f)
+	{
+		UE_LOG(LogBoids, Log, TEXT("Flock replication to %s: %.1f KB/s for %.0f boids, %.2f bytes per boid per second, %.2f bytes per boid per snapshot, baseline %u"),
+			*GetOwner()->GetName(), BytesPerSecond / 1024.0, MeanBoids, BytesPerBoidPerSecond, MeanBoids > 0 ? StatsBytes / (MeanBoids * StatsSnapshots) : 0.0,
+			Sender.GetAcknowledged());
+	}
+
+	StatsTime = 0.0f;
+	StatsBytes = 0;
+	StatsFlockBoids = 0;
+	StatsSnapshots = 0;
+}
+
+void UBoidFlockReplicationComponent::ClientReceiveSnapshot_Implementation(const TArray<uint8>& Data)
+{
+	Receiver.Settings = MakeSettings();
+
+	uint32 Sequence = 0;
+	if (!Receiver.Receive(Data, Sequence))
+	{
+		return;
+	}
+
+	const APlayerController* Controller = Cast<APlayerController>(GetOwner());
+	const FVector2D ViewPosition = Controller && Controller->PlayerCameraManager
+		? FVector2D(Controller->PlayerCameraManager->GetCameraLocation()) : FVector2D::ZeroVector;
+	ServerAcknowledgeSnapshot(Sequence, ViewPosition);
+}
+
+void UBoidFlockReplicationComponent::ServerAcknowledgeSnapshot_Implementation(uint32 Sequence, FVector2D ViewPosition)
+{
+	Sender.Acknowledge(Sequence);
+	Sender.SetViewPosition(ViewPosition);
+}
+
+void UBoidFlockReplicationComponent::ShowFlock(float DeltaTime)
+{
+	if (Receiver.GetLatestTime() <= 0.0f)
+	{
+		return;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_BoidReplicationShow);
+
+	// Run on our own clock, pulled gently towards the delay behind the newest snapshot so jitter doesn't show.
+	// Snap on the first snapshot and after long stalls.
+	const float TargetTime = Receiver.GetLatestTime() - InterpolationDelay;
+	RenderTime += DeltaTime;
+	if (!HasRenderTime || FMath::Abs(TargetTime - RenderTime) > FMath::Max(InterpolationDelay * 4.0f, 0.5f))
+	{
+		RenderTime = TargetTime;
+		HasRenderTime = true;
+	}
+	else
+	{
+		RenderTime += (TargetTime - RenderTime) * FMath::Min(DeltaTime * 2.0f, 1.0f);
+	}
+
+	Receiver.Settings = MakeSettings();
+	Receiver.Sample(RenderTime, States);
+
+	for (const FBoidReplicatedState& State : States)
+	{
+		ABoid*& Replica = Replicas.FindOrAdd(State.Id);
+		if (!Replica)
+		{
+			Replica = GetWorld()->SpawnActorDeferred<ABoid>(ABoid::StaticClass(), FTransform(FVector(State.Position.X, State.Position.Y, 1)));
+			Replica->IsReplica = true;
+			Replica->FinishSpawning(FTransform(FVector(State.Position.X, State.Position.Y, 1)));
+		}
+
+		Replica->SetVelocity2D(State.Heading);
+		Replica->SetPosition(State.Position);
+		Replica->BoidRotation();
+	}
+
+	// States are sorted by id, boids missing from them left the flock or the client's view.
+	for (auto It = Replicas.CreateIterator(); It; ++It)
+	{
+		const int32 Found = Algo::BinarySearchBy(States, It.Key(), [](const FBoidReplicatedState& State) { return State.Id; });
+		if (Found == INDEX_NONE)
+		{
+			if (It.Value())
+			{
+				It.Value()->Destroy();
+			}
+			It.RemoveCurrent();
+		}
+	}
+}
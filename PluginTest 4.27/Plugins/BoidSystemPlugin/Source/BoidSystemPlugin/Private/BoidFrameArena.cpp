@@ -0,0 +1,47 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidFrameArena.h"
+
+FBoidFrameArena::~FBoidFrameArena()
+{
+	Reset();
+	FMemory::Free(Block);
+}
+
+void FBoidFrameArena::Reset()
+{
+	for (void* Allocation : Overflow)
+	{
+		FMemory::Free(Allocation);
+	}
+	Overflow.Reset();
+
+	// Grow once so the whole of last frame fits next time, with some slack for a growing flock.
+	if (OverflowBytes > 0)
+	{
+		const int64 NewCapacity = (Used + OverflowBytes) * 3 / 2;
+		FMemory::Free(Block);
+		Block = static_cast<uint8*>(FMemory::Malloc(NewCapacity, 16));
+		Capacity = NewCapacity;
+	}
+
+	Used = 0;
+	OverflowBytes = 0;
+}
+
+void* FBoidFrameArena::AllocBytes(int64 Size, int64 Alignment)
+{
+	const int64 Start = Align(Used, Alignment);
+
+	if (Start + Size <= Capacity)
+	{
+		Used = Start + Size;
+		return Block + Start;
+	}
+
+	void* Allocation = FMemory::Malloc(FMath::Max<int64>(Size, 1), FMath::Max<int64>(Alignment, 16));
+	Overflow.Add(Allocation);
+	OverflowBytes += Align(Size, 16);
+	return Allocation;
+}
@@ -0,0 +1,93 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidGridTuner.h"
+
+#include "BoidSystemPlugin.h"
+
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Grid Cell Size"), STAT_BoidGridCellSize, STATGROUP_Boids);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Grid Effective Density"), STAT_BoidGridDensity, STATGROUP_Boids);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Grid Split Limit"), STAT_BoidGridSplitLimit, STATGROUP_Boids);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Grid Split Cells"), STAT_BoidGridSplitCells, STATGROUP_Boids);
+
+// Cost of visiting one cell against testing one boid, roughly what the loops spend on each.
+static const float BoidCellVisitCost = 4.0f;
+// Finest cells tried, as a fraction of the visual range.
+static const int32 BoidMaxRangeDivisor = 4;
+// A change has to be this much cheaper to be taken, so the layout doesn't flip every frame.
+static const float BoidTuneHysteresis = 0.9f;
+
+void FBoidGridTuner::Tune(const FBoidSpatialGrid& LastGrid, float Range)
+{
+	const int32 Num = LastGrid.GetNum();
+	const FVector2D Area = LastGrid.GetArea();
+	Range = FMath::Max(Range, 1.0f);
+
+	if (Num == 0)
+	{
+		Divisor = 1;
+		CellSize = Range;
+		MaxBoidsPerCell = 0;
+		return;
+	}
+
+	// Sum of squared occupancy over the cell area is the density seen from the average boid, clumps count in full.
+	double SquaredOccupancy = 0;
+	for (int32 Cell = 0; Cell < LastGrid.GetNumCells(); Cell++)
+	{
+		const double Count = LastGrid.GetCellStart(Cell + 1) - LastGrid.GetCellStart(Cell);
+		SquaredOccupancy += Count * Count;
+	}
+	const FVector2D LastCellSize = LastGrid.GetCellSize();
+	EffectiveDensity = static_cast<float>(SquaredOccupancy / (double(Num) * LastCellSize.X * LastCellSize.Y));
+
+	// Don't make more cells than a few per boid, beyond that memory and clearing cost more than they save.
+	const float MaxCells = FMath::Max(Num * 4.0f, 4096.0f);
+	int32 BestDivisor = 1;
+	float BestCost = PredictCost(Range, 1);
+	for (int32 Candidate = 2; Candidate <= BoidMaxRangeDivisor; Candidate++)
+	{
+		const float Size = Range / Candidate;
+		if (Area.X * Area.Y / (Size * Size) > MaxCells)
+		{
+			break;
+		}
+
+		const float Cost = PredictCost(Range, Candidate);
+		if (Cost < BestCost)
+		{
+			BestCost = Cost;
+			BestDivisor = Candidate;
+		}
+	}
+
+	const bool RangeChanged = Range != LastRange;
+	if (RangeChanged || BestCost < PredictCost(Range, Divisor) * BoidTuneHysteresis)
+	{
+		if (BestDivisor != Divisor || CellSize == 0)
+		{
+			UE_LOG(LogBoids, Log, TEXT("Grid cell size %.2f (visual range / %d) for %d boids at effective density %.3f, predicted %.0f per query"),
+				Range / BestDivisor, BestDivisor, Num, EffectiveDensity, BestCost);
+		}
+		Divisor = BestDivisor;
+	}
+	CellSize = Range / Divisor;
+	LastRange = Range;
+
+	// Split cells well above what an even spread would put in them.
+	const float MeanOccupancy = Num / (Area.X * Area.Y) * CellSize * CellSize;
+	MaxBoidsPerCell = FMath::Max(FMath::CeilToInt(MeanOccupancy * 4.0f), 16);
+
+	SET_FLOAT_STAT(STAT_BoidGridCellSize, CellSize);
+	SET_FLOAT_STAT(STAT_BoidGridDensity, EffectiveDensity);
+	SET_DWORD_STAT(STAT_BoidGridSplitLimit, MaxBoidsPerCell);
+	SET_DWORD_STAT(STAT_BoidGridSplitCells, LastGrid.GetNumSubdivided());
+}
+
+float FBoidGridTuner::PredictCost(float Range, int32 RangeDivisor) const
+{
+	// A query covers the centre cell plus Divisor cells either side, on both axes.
+	const float Size = Range / RangeDivisor;
+	const float Side = 2.0f * RangeDivisor + 1.0f;
+	return BoidCellVisitCost * Side * Side + EffectiveDensity * FMath::Square(Side * Size);
+}
@@ -0,0 +1,368 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidLockstep.h"
+
+#include "Math/RandomStream.h"
+#include "Misc/Crc.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+static const uint32 BoidLockstepMagic = 0x4B434F4C;
+static const int32 BoidLockstepVersion = 3;
+// Checksums the host remembers, peers further behind than this go unchecked.
+static const int32 BoidLockstepChecksumHistory = 256;
+// Most players or spawns in one turn, anything claiming more is broken.
+static const int32 BoidLockstepMaxEntries = 4096;
+
+void FBoidLockstepInput::Serialize(FArchive& Ar)
+{
+	uint8 Buttons = (LeftClick ? 1 : 0) | (RightClick ? 2 : 0);
+	Ar << Buttons;
+	LeftClick = (Buttons & 1) != 0;
+	RightClick = (Buttons & 2) != 0;
+
+	if (Buttons != 0)
+	{
+		Ar << MousePosition;
+	}
+
+	uint32 NumSpawns = Spawns.Num();
+	Ar.SerializeIntPacked(NumSpawns);
+	if (Ar.IsLoading())
+	{
+		if (NumSpawns > static_cast<uint32>(BoidLockstepMaxEntries))
+		{
+			Ar.SetError();
+			return;
+		}
+		Spawns.SetNumUninitialized(NumSpawns);
+	}
+	for (FVector2D& Spawn : Spawns)
+	{
+		Ar << Spawn;
+	}
+}
+
+bool FBoidLockstepTurn::Serialize(FArchive& Ar)
+{
+	Ar.SerializeIntPacked(Turn);
+
+	uint32 NumInputs = Inputs.Num();
+	Ar.SerializeIntPacked(NumInputs);
+	if (Ar.IsLoading())
+	{
+		if (Ar.IsError() || NumInputs > static_cast<uint32>(BoidLockstepMaxEntries))
+		{
+			return false;
+		}
+		Inputs.SetNum(NumInputs);
+	}
+
+	for (TPair<int32, FBoidLockstepInput>& Input : Inputs)
+	{
+		uint32 Slot = Input.Key;
+		Ar.SerializeIntPacked(Slot);
+		Input.Key = Slot;
+		Input.Value.Serialize(Ar);
+	}
+
+	return !Ar.IsError();
+}
+
+static void SerializeBoidLockstepParams(FArchive& Ar, FBoidLockstepParams& Params)
+{
+	FBoidSimulationParams& Simulation = Params.Simulation;
+	FCohesionKernel& Cohesion = Simulation.Pipeline.Get<FCohesionKernel>();
+	FSeparationKernel& Separation = Simulation.Pipeline.Get<FSeparationKernel>();
+	FAlignmentKernel& Alignment = Simulation.Pipeline.Get<FAlignmentKernel>();
+	FBoundsKernel& Bounds = Simulation.Pipeline.Get<FBoundsKernel>();
+
+	Ar << Simulation.Area << Simulation.VisualRange << Simulation.IsWrapped << Simulation.MaxNeighbours << Simulation.UseFixedPoint;
+	Ar << Cohesion.Weight << Separation.Weight << Separation.DesiredDistance << Separation.Falloff << Alignment.Weight;
+	Ar << Bounds.Weight << Bounds.Width << Bounds.Height << Bounds.DesiredDistance << Bounds.IsBounded;
+	Ar << Params.Body.Speed << Params.Body.MaxAcceleration << Params.Body.HasConstantSpeed;
+	Ar << Params.TurnDeltaTime << Params.PointWeight << Params.PointDistance << Params.Seed;
+}
+
+void FBoidLockstepSimulation::Init(const FBoidLockstepParams& _Params, int32 NumBoids)
+{
+	Params = _Params;
+	NextTurn = 1;
+
+	// Same spread as the controller spawns its flock with.
+	FRandomStream Random(Params.Seed);
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	for (int32 i = 0; i < NumBoids; i++)
+	{
+		// One draw per statement, the order of arguments is up to the compiler and peers may be built by different ones.
+		const float X = Random.FRandRange(0, Params.Simulation.Area.X);
+		const float Y = Random.FRandRange(0, Params.Simulation.Area.Y);
+		const int32 VelocityX = Random.RandRange(-100, 100);
+		const int32 VelocityY = Random.RandRange(-100, 100);
+		Positions.Add(FVector2D(X, Y));
+		Velocities.Add(FVector2D(VelocityX, VelocityY) * Params.Body.Speed);
+	}
+
+	Restart(Positions, Velocities);
+}
+
+void FBoidLockstepSimulation::Restart(const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities)
+{
+	// Everything that could differ between peers or from step to step is off.
+	Params.Simulation.AutoTuneGrid = false;
+	Params.Simulation.UseFarField = false;
+	Params.Simulation.UseCompactState = false;
+	Params.Simulation.NeighbourBackend = EBoidNeighbourBackend::Grid;
+
+	Bodies.Init(Params.Body, Positions.Num());
+	Handles.SetNum(Positions.Num());
+	for (int32 i = 0; i < Handles.Num(); i++)
+	{
+		Handles[i] = FBoidHandle{ i };
+	}
+	Simulation.Init(Positions, Velocities, Bodies);
+	Simulation.SetParams(Params.Simulation);
+	Simulation.CopyState(State);
+}
+
+void FBoidLockstepSimulation::Save(TArray<uint8>& OutBytes) const
+{
+	OutBytes.Reset();
+	FMemoryWriter Writer(OutBytes);
+
+	uint32 Magic = BoidLockstepMagic;
+	int32 Version = BoidLockstepVersion;
+	uint32 Turn = NextTurn;
+	FBoidLockstepParams SavedParams = Params;
+	TArray<FVector2D> Positions = State.Positions;
+	TArray<FVector2D> Velocities = State.Velocities;
+
+	Writer << Magic << Version << Turn;
+	SerializeBoidLockstepParams(Writer, SavedParams);
+	Writer << Positions << Velocities;
+}
+
+bool FBoidLockstepSimulation::Load(const TArray<uint8>& Bytes)
+{
+	FMemoryReader Reader(Bytes);
+
+	uint32 Magic = 0;
+	int32 Version = 0;
+	uint32 Turn = 0;
+	FBoidLockstepParams LoadedParams;
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+
+	Reader << Magic << Version;
+	if (Magic != BoidLockstepMagic || Version != BoidLockstepVersion)
+	{
+		return false;
+	}
+	Reader << Turn;
+	SerializeBoidLockstepParams(Reader, LoadedParams);
+	Reader << Positions << Velocities;
+	if (Reader.IsError() || Positions.Num() != Velocities.Num())
+	{
+		return false;
+	}
+
+	Params = LoadedParams;
+	NextTurn = Turn;
+	Restart(Positions, Velocities);
+	return true;
+}
+
+void FBoidLockstepSimulation::Step(const FBoidLockstepTurn& Turn)
+{
+	check(Turn.Turn == NextTurn);
+
+	Simulation.BuildNeighbours();
+	Simulation.EvaluateRules(0, Simulation.GetNum());
+	for (const TPair<int32, FBoidLockstepInput>& Input : Turn.Inputs)
+	{
+		AddMouseForces(Input.Value);
+	}
+	Simulation.Integrate(Params.TurnDeltaTime, 0, Simulation.GetNum());
+	Simulation.FinishStep();
+	Simulation.CopyState(State);
+
+	// New boids join after the step, so every peer adds them to the same state. They are appended to the running
+	// simulation, a turn with spawns costs no more than one without.
+	Changes.Reset();
+	for (const TPair<int32, FBoidLockstepInput>& Input : Turn.Inputs)
+	{
+		FRandomStream Random(Params.Seed + Turn.Turn * 31 + Input.Key);
+		for (const FVector2D Spawn : Input.Value.Spawns)
+		{
+			const int32 VelocityX = Random.RandRange(-100, 100);
+			const int32 VelocityY = Random.RandRange(-100, 100);
+			Changes.Add(FBoidHandle{ Handles.Num() + Changes.Added.Num() }, Spawn, FVector2D(VelocityX, VelocityY) * Params.Body.Speed, Params.Body);
+		}
+	}
+	if (!Changes.IsEmpty())
+	{
+		Simulation.ApplyChanges(Changes, Handles);
+		Simulation.CopyState(State);
+	}
+
+	NextTurn++;
+}
+
+void FBoidLockstepSimulation::AddMouseForces(const FBoidLockstepInput& Input)
+{
+	if (!Input.LeftClick && !Input.RightClick)
+	{
+		return;
+	}
+
+	if (Params.Simulation.UseFixedPoint)
+	{
+		AddFixedMouseForces(Input);
+		return;
+	}
+
+	// Same as PointRepulsionRule: left pushes away, right pulls to PointDistance from the mouse.
+	for (int32 i = 0; i < State.Positions.Num(); i++)
+	{
+		FVector2D Direction = Input.MousePosition - State.Positions[i];
+		const float Distance = Direction.Size();
+		FVector2D Force = FVector2D::ZeroVector;
+
+		if (Distance > Params.PointDistance || Input.LeftClick)
+		{
+			Direction.Normalize();
+			Force = Direction * 30;
+		}
+		else if (Distance < Params.PointDistance)
+		{
+			Direction.Normalize();
+			Force = -Direction * 30;
+		}
+
+		if (Input.LeftClick)
+		{
+			Force = -Force;
+		}
+
+		Simulation.AddForce(i, Force * Params.PointWeight);
+	}
+}
+
+void FBoidLockstepSimulation::AddFixedMouseForces(const FBoidLockstepInput& Input)
+{
+	// The same forces in integer maths, so turns stay bit for bit the same across builds too.
+	const FBoidFixedVector MousePosition = FBoidFixedMath::FromVector(Input.MousePosition);
+	const int32 PointDistance = FBoidFixedMath::FromFloat(Params.PointDistance);
+	const int32 Scale = FBoidFixedMath::FromFloat(30 * Params.PointWeight);
+
+	for (int32 i = 0; i < State.Positions.Num(); i++)
+	{
+		const FBoidFixedVector Direction = MousePosition - FBoidFixedMath::FromVector(State.Positions[i]);
+		const int32 Distance = FBoidFixedMath::Size(Direction);
+		FBoidFixedVector Force;
+
+		if (Distance > PointDistance || Input.LeftClick)
+		{
+			Force = FBoidFixedMath::GetNormal(Direction);
+		}
+		else if (Distance < PointDistance)
+		{
+			Force = FBoidFixedVector() - FBoidFixedMath::GetNormal(Direction);
+		}
+
+		if (Input.LeftClick)
+		{
+			Force = FBoidFixedVector() - Force;
+		}
+
+		Simulation.AddForce(i, FBoidFixedMath::ToVector(FBoidFixedMath::Mul(Force, Scale)));
+	}
+}
+
+uint32 FBoidLockstepSimulation::GetChecksum() const
+{
+	uint32 Checksum = FCrc::MemCrc32(&NextTurn, sizeof(NextTurn));
+	Checksum = FCrc::MemCrc32(State.Positions.GetData(), State.Positions.Num() * sizeof(FVector2D), Checksum);
+	return FCrc::MemCrc32(State.Velocities.GetData(), State.Velocities.Num() * sizeof(FVector2D), Checksum);
+}
+
+void FBoidLockstepHost::Start(const FBoidLockstepParams& Params, int32 NumBoids)
+{
+	Simulation.Init(Params, NumBoids);
+	Inputs.Reset();
+	IsSlotUsed.Reset();
+	Checksums.Init(TPair<uint32, uint32>(0, 0), BoidLockstepChecksumHistory);
+}
+
+int32 FBoidLockstepHost::AddPlayer()
+{
+	int32 Slot = IsSlotUsed.Find(false);
+	if (Slot == INDEX_NONE)
+	{
+		Slot = IsSlotUsed.Add(false);
+		Inputs.AddDefaulted();
+	}
+
+	IsSlotUsed[Slot] = true;
+	Inputs[Slot] = FBoidLockstepInput();
+	return Slot;
+}
+
+void FBoidLockstepHost::RemovePlayer(int32 Slot)
+{
+	if (IsSlotUsed.IsValidIndex(Slot))
+	{
+		IsSlotUsed[Slot] = false;
+		Inputs[Slot] = FBoidLockstepInput();
+	}
+}
+
+void FBoidLockstepHost::SetInput(int32 Slot, const FBoidLockstepInput& Input)
+{
+	if (!IsSlotUsed.IsValidIndex(Slot) || !IsSlotUsed[Slot])
+	{
+		return;
+	}
+
+	FBoidLockstepInput& Held = Inputs[Slot];
+	Held.MousePosition = Input.MousePosition;
+	Held.LeftClick = Input.LeftClick;
+	Held.RightClick = Input.RightClick;
+	Held.Spawns.Append(Input.Spawns);
+}
+
+void FBoidLockstepHost::CloseTurn(TArray<uint8>& OutBytes)
+{
+	Turn.Turn = Simulation.GetNextTurn();
+	Turn.Inputs.Reset();
+	for (int32 Slot = 0; Slot < Inputs.Num(); Slot++)
+	{
+		if (IsSlotUsed[Slot] && !Inputs[Slot].IsIdle())
+		{
+			// Peers refuse a turn with more spawns than the wire takes, the rest wait for the next turns.
+			FBoidLockstepInput& Held = Inputs[Slot];
+			const int32 NumSpawns = FMath::Min(Held.Spawns.Num(), BoidLockstepMaxEntries);
+			FBoidLockstepInput& Sent = Turn.Inputs.Add_GetRef(TPair<int32, FBoidLockstepInput>(Slot, FBoidLockstepInput())).Value;
+			Sent.MousePosition = Held.MousePosition;
+			Sent.LeftClick = Held.LeftClick;
+			Sent.RightClick = Held.RightClick;
+			Sent.Spawns.Append(Held.Spawns.GetData(), NumSpawns);
+			Held.Spawns.RemoveAt(0, NumSpawns, false);
+		}
+	}
+
+	Simulation.Step(Turn);
+	Checksums[Turn.Turn % BoidLockstepChecksumHistory] = TPair<uint32, uint32>(Turn.Turn, Simulation.GetChecksum());
+
+	OutBytes.Reset();
+	FMemoryWriter Writer(OutBytes);
+	Turn.Serialize(Writer);
+}
+
+bool FBoidLockstepHost::CheckChecksum(uint32 Turn, uint32 Checksum) const
+{
+	const TPair<uint32, uint32>& Own = Checksums[Turn % BoidLockstepChecksumHistory];
+	return Own.Key != Turn || Own.Value == Checksum;
+}
@@ -0,0 +1,275 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidLockstepComponent.h"
+
+#include "Boid.h"
+#include "BoidLockstepSubsystem.h"
+#include "BoidSystemPlugin.h"
+#include "GameFramework/PlayerController.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+UBoidLockstepComponent::UBoidLockstepComponent()
+{
+	PrimaryComponentTick.bCanEverTick = true;
+	SetIsReplicatedByDefault(true);
+}
+
+UBoidLockstepSubsystem* UBoidLockstepComponent::GetSession() const
+{
+	return GetWorld() ? GetWorld()->GetSubsystem<UBoidLockstepSubsystem>() : nullptr;
+}
+
+bool UBoidLockstepComponent::IsRemotePeer() const
+{
+	const APlayerController* Controller = Cast<APlayerController>(GetOwner());
+	return Slot != INDEX_NONE && Controller && !Controller->IsLocalController();
+}
+
+void UBoidLockstepComponent::JoinSession(const FBoidLockstepParams& Params, int32 NumBoids)
+{
+	UBoidLockstepSubsystem* Session = GetSession();
+	if (!Session)
+	{
+		UE_LOG(LogBoids, Error, TEXT("%s has no lockstep session to join"), *GetOwner()->GetName());
+		return;
+	}
+	if (Slot != INDEX_NONE)
+	{
+		return;
+	}
+
+	Session->StartSession(Params, NumBoids);
+	Slot = Session->AddPeer(this);
+	HasSentState = false;
+	SpawnAllowance = MaxSpawnsPerSecond;
+}
+
+void UBoidLockstepComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+
+	if (UBoidLockstepSubsystem* Session = GetSession())
+	{
+		if (Slot != INDEX_NONE)
+		{
+			Session->RemovePeer(Slot);
+		}
+	}
+	Slot = INDEX_NONE;
+	HasSimulation = false;
+
+	for (ABoid* Replica : Replicas)
+	{
+		if (Replica)
+		{
+			Replica->Destroy();
+		}
+	}
+	Replicas.Empty();
+}
+
+void UBoidLockstepComponent::SetLocalInput(FVector2D MousePosition, bool LeftClick, bool RightClick)
+{
+	// The mouse only counts while a button is held.
+	const bool IsHeld = LeftClick || RightClick;
+	if (LeftClick != LocalInput.LeftClick || RightClick != LocalInput.RightClick || (IsHeld && MousePosition != LocalInput.MousePosition))
+	{
+		IsInputDirty = true;
+	}
+
+	LocalInput.MousePosition = IsHeld ? MousePosition : FVector2D::ZeroVector;
+	LocalInput.LeftClick = LeftClick;
+	LocalInput.RightClick = RightClick;
+}
+
+void UBoidLockstepComponent::AddLocalSpawn(FVector2D Position)
+{
+	LocalInput.Spawns.Add(Position);
+	IsInputDirty = true;
+}
+
+void UBoidLockstepComponent::SendTurn(const TArray<uint8>& Turn)
+{
+	// A client only gets turns after the state they follow on from.
+	if (IsRemotePeer() && HasSentState)
+	{
+		ClientReceiveTurn(Turn);
+	}
+}
+
+void UBoidLockstepComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	UBoidLockstepSubsystem* Session = GetSession();
+	if (Slot != INDEX_NONE && Session)
+	{
+		Session->Update(DeltaTime);
+		SpawnAllowance = FMath::Min(SpawnAllowance + MaxSpawnsPerSecond * DeltaTime, MaxSpawnsPerSecond);
+
+		// The connection only takes RPCs once the controller has been handed to it, some time after BeginPlay.
+		if (IsRemotePeer() && !HasSentState && GetOwner()->GetNetConnection())
+		{
+			Session->GetSimulation().Save(Bytes);
+			ClientStartLockstep(Bytes);
+			HasSentState = true;
+		}
+
+		if (!IsRemotePeer())
+		{
+			SendLocalInput(DeltaTime);
+			ShowFlock(Session->GetSimulation());
+		}
+		return;
+	}
+
+	if (HasSimulation)
+	{
+		StepTurns();
+		SendLocalInput(DeltaTime);
+		ShowFlock(Simulation);
+	}
+}
+
+void UBoidLockstepComponent::StepTurns()
+{
+	// Far behind, after a hitch or a long load, catch up in one go rather than stay behind.
+	const int32 CatchUpTurns = FMath::CeilToInt(1.0f / Simulation.GetParams().TurnDeltaTime);
+	const int32 NumTurns = PendingTurns.Num() > CatchUpTurns ? PendingTurns.Num() : FMath::Min(PendingTurns.Num(), MaxTurnsPerFrame);
+
+	for (int32 i = 0; i < NumTurns; i++)
+	{
+		Simulation.Step(PendingTurns[i]);
+		ServerReportChecksum(PendingTurns[i].Turn, Simulation.GetChecksum());
+	}
+	PendingTurns.RemoveAt(0, NumTurns, false);
+}
+
+void UBoidLockstepComponent::SendLocalInput(float DeltaTime)
+{
+	if (Slot != INDEX_NONE)
+	{
+		// The host's own input goes straight into the session.
+		if (IsInputDirty)
+		{
+			GetSession()->SetInput(Slot, LocalInput);
+			LocalInput.Spawns.Reset();
+			IsInputDirty = false;
+		}
+		return;
+	}
+
+	// At most once a turn, any more would be held over anyway.
+	InputAccumulator += DeltaTime;
+	if (!IsInputDirty || InputAccumulator < Simulation.GetParams().TurnDeltaTime)
+	{
+		return;
+	}
+	InputAccumulator = 0.0f;
+
+	Bytes.Reset();
+	FMemoryWriter Writer(Bytes);
+	LocalInput.Serialize(Writer);
+	ServerSendInput(Bytes);
+	LocalInput.Spawns.Reset();
+	IsInputDirty = false;
+}
+
+void UBoidLockstepComponent::ClientStartLockstep_Implementation(const TArray<uint8>& State)
+{
+	HasSimulation = Simulation.Load(State);
+	PendingTurns.Reset();
+	if (!HasSimulation)
+	{
+		UE_LOG(LogBoids, Error, TEXT("Could not load the lockstep flock sent by the server"));
+		return;
+	}
+
+	UE_LOG(LogBoids, Log, TEXT("Joined the lockstep session at turn %u with %d boids"), Simulation.GetNextTurn(), Simulation.GetNum());
+}
+
+void UBoidLockstepComponent::ClientReceiveTurn_Implementation(const TArray<uint8>& Turn)
+{
+	if (!HasSimulation)
+	{
+		return;
+	}
+
+	FBoidLockstepTurn& Received = PendingTurns.AddDefaulted_GetRef();
+	FMemoryReader Reader(Turn);
+	const uint32 Expected = PendingTurns.Num() > 1 ? PendingTurns[PendingTurns.Num() - 2].Turn + 1 : Simulation.GetNextTurn();
+	if (!Received.Serialize(Reader) || Received.Turn != Expected)
+	{
+		// Turns are reliable and in order, missing one means this flock can't follow any more.
+		UE_LOG(LogBoids, Error, TEXT("Lockstep turn %u is broken or out of order, expected %u"), Received.Turn, Expected);
+		PendingTurns.Pop(false);
+		HasSimulation = false;
+	}
+}
+
+void UBoidLockstepComponent::ServerSendInput_Implementation(const TArray<uint8>& Input)
+{
+	FBoidLockstepInput Received;
+	FMemoryReader Reader(Input);
+	Received.Serialize(Reader);
+	if (Reader.IsError() || !GetSession())
+	{
+		return;
+	}
+
+	// Spawns over the allowance are dropped, the buttons and mouse still count.
+	const int32 NumAllowed = FMath::FloorToInt(SpawnAllowance);
+	if (Received.Spawns.Num() > NumAllowed)
+	{
+		UE_LOG(LogBoids, Warning, TEXT("Dropped %d lockstep spawns from %s, over its %.0f a second"),
+			Received.Spawns.Num() - NumAllowed, *GetOwner()->GetName(), MaxSpawnsPerSecond);
+		Received.Spawns.SetNum(NumAllowed, false);
+	}
+	SpawnAllowance -= Received.Spawns.Num();
+	GetSession()->SetInput(Slot, Received);
+}
+
+void UBoidLockstepComponent::ServerReportChecksum_Implementation(uint32 Turn, uint32 Checksum)
+{
+	if (GetSession())
+	{
+		GetSession()->ReportChecksum(Slot, Turn, Checksum);
+	}
+}
+
+void UBoidLockstepComponent::ShowFlock(const FBoidLockstepSimulation& Shown)
+{
+	const FBoidFlockState& State = Shown.GetState();
+
+	while (Replicas.Num() > State.Positions.Num())
+	{
+		if (ABoid* Replica = Replicas.Pop(false))
+		{
+			Replica->Destroy();
+		}
+	}
+
+	while (Replicas.Num() < State.Positions.Num())
+	{
+		const FVector2D Position = State.Positions[Replicas.Num()];
+		const FTransform Transform(FVector(Position.X, Position.Y, 1));
+		ABoid* Replica = GetWorld()->SpawnActorDeferred<ABoid>(ABoid::StaticClass(), Transform);
+		Replica->IsReplica = true;
+		Replica->FinishSpawning(Transform);
+		Replicas.Add(Replica);
+	}
+
+	for (int32 i = 0; i < Replicas.Num(); i++)
+	{
+		if (Replicas[i])
+		{
+			Replicas[i]->SetVelocity2D(State.Velocities[i]);
+			Replicas[i]->SetPosition(State.Positions[i]);
+			Replicas[i]->BoidRotation();
+		}
+	}
+
+	OnFlockShown.Broadcast(Shown);
+}
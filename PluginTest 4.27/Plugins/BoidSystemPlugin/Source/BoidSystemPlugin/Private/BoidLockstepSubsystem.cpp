@@ -0,0 +1,118 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidLockstepSubsystem.h"
+
+#include "BoidLockstepComponent.h"
+#include "BoidSystemPlugin.h"
+
+DECLARE_CYCLE_STAT(TEXT("Lockstep Turn"), STAT_BoidLockstepTurn, STATGROUP_Boids);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Lockstep Desyncs"), STAT_BoidLockstepDesyncs, STATGROUP_Boids);
+
+// Turns closed in one frame at most, after a hitch the session slows down rather than stalls.
+static const int32 BoidLockstepMaxTurnsPerFrame = 4;
+static const float BoidLockstepStatsInterval = 5.0f;
+
+void UBoidLockstepSubsystem::StartSession(const FBoidLockstepParams& Params, int32 NumBoids)
+{
+	if (Running)
+	{
+		return;
+	}
+
+	Host.Start(Params, NumBoids);
+	Running = true;
+	TurnAccumulator = 0.0f;
+	UE_LOG(LogBoids, Log, TEXT("Lockstep session started with %d boids at %.0f turns a second"), NumBoids, 1.0f / Params.TurnDeltaTime);
+}
+
+int32 UBoidLockstepSubsystem::AddPeer(UBoidLockstepComponent* Peer)
+{
+	const int32 Slot = Host.AddPlayer();
+	if (Slot >= Peers.Num())
+	{
+		Peers.SetNum(Slot + 1);
+		HasDesynced.SetNum(Slot + 1);
+	}
+
+	Peers[Slot] = Peer;
+	HasDesynced[Slot] = false;
+	return Slot;
+}
+
+void UBoidLockstepSubsystem::RemovePeer(int32 Slot)
+{
+	if (Peers.IsValidIndex(Slot))
+	{
+		Host.RemovePlayer(Slot);
+		Peers[Slot] = nullptr;
+	}
+}
+
+void UBoidLockstepSubsystem::SetInput(int32 Slot, const FBoidLockstepInput& Input)
+{
+	Host.SetInput(Slot, Input);
+}
+
+void UBoidLockstepSubsystem::ReportChecksum(int32 Slot, uint32 Turn, uint32 Checksum)
+{
+	if (!HasDesynced.IsValidIndex(Slot) || HasDesynced[Slot] || Host.CheckChecksum(Turn, Checksum))
+	{
+		return;
+	}
+
+	// Nothing brings a peer back in sync short of sending it the whole state again, so just say it once.
+	HasDesynced[Slot] = true;
+	NumDesyncs++;
+	INC_DWORD_STAT(STAT_BoidLockstepDesyncs);
+	UE_LOG(LogBoids, Error, TEXT("Lockstep desync: player %d's flock differs from the server's after turn %u"), Slot, Turn);
+}
+
+void UBoidLockstepSubsystem::Update(float DeltaTime)
+{
+	if (!Running || LastUpdateFrame == GFrameCounter)
+	{
+		return;
+	}
+	LastUpdateFrame = GFrameCounter;
+
+	const float TurnDeltaTime = Host.GetSimulation().GetParams().TurnDeltaTime;
+	TurnAccumulator = FMath::Min(TurnAccumulator + DeltaTime, TurnDeltaTime * BoidLockstepMaxTurnsPerFrame);
+
+	while (TurnAccumulator >= TurnDeltaTime)
+	{
+		SCOPE_CYCLE_COUNTER(STAT_BoidLockstepTurn);
+
+		TurnAccumulator -= TurnDeltaTime;
+		Host.CloseTurn(TurnBytes);
+
+		for (const TWeakObjectPtr<UBoidLockstepComponent>& Peer : Peers)
+		{
+			if (Peer.IsValid())
+			{
+				Peer->SendTurn(TurnBytes);
+			}
+		}
+
+		StatsBytes += TurnBytes.Num();
+		StatsTurns++;
+	}
+
+	LogTraffic(DeltaTime, Host.GetSimulation().GetNum());
+}
+
+void UBoidLockstepSubsystem::LogTraffic(float DeltaTime, int32 NumBoids)
+{
+	StatsTime += DeltaTime;
+	if (StatsTime < BoidLockstepStatsInterval || StatsTurns == 0)
+	{
+		return;
+	}
+
+	UE_LOG(LogBoids, Log, TEXT("Lockstep turn %u: %.1f bytes per turn, %.1f bytes a second to each peer for %d boids, %d desyncs"),
+		Host.GetSimulation().GetNextTurn() - 1, static_cast<double>(StatsBytes) / StatsTurns, StatsBytes / StatsTime, NumBoids, NumDesyncs);
+
+	StatsTime = 0.0f;
+	StatsBytes = 0;
+	StatsTurns = 0;
+}
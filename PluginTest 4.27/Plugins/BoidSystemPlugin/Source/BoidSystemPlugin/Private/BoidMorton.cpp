@@ -0,0 +1,48 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidMorton.h"
+
+const TArray<int32>& FBoidRadixSorter::Sort(const TArray<uint32>& Keys)
+{
+	const int32 Num = Keys.Num();
+	uint32 MaxKey = 0;
+
+	SortedKeys = Keys;
+	ScratchKeys.SetNumUninitialized(Num);
+	Order.SetNumUninitialized(Num);
+	ScratchOrder.SetNumUninitialized(Num);
+
+	for (int32 i = 0; i < Num; i++)
+	{
+		Order[i] = i;
+		MaxKey = FMath::Max(MaxKey, Keys[i]);
+	}
+
+	for (uint32 Shift = 0; Shift < 32 && (MaxKey >> Shift) != 0; Shift += 8)
+	{
+		int32 Offsets[257] = {};
+
+		for (int32 i = 0; i < Num; i++)
+		{
+			Offsets[((SortedKeys[i] >> Shift) & 0xFF) + 1]++;
+		}
+
+		for (int32 Digit = 1; Digit <= 256; Digit++)
+		{
+			Offsets[Digit] += Offsets[Digit - 1];
+		}
+
+		for (int32 i = 0; i < Num; i++)
+		{
+			const int32 Target = Offsets[(SortedKeys[i] >> Shift) & 0xFF]++;
+			ScratchKeys[Target] = SortedKeys[i];
+			ScratchOrder[Target] = Order[i];
+		}
+
+		Swap(SortedKeys, ScratchKeys);
+		Swap(Order, ScratchOrder);
+	}
+
+	return Order;
+}
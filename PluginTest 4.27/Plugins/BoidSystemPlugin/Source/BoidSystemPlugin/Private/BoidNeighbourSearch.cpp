@@ -0,0 +1,317 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidNeighbourSearch.h"
+
+#include "BoidConsoleVariables.h"
+#include "BoidNeighbours.h"
+#include "BoidSystemPlugin.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Neighbour Backend"), STAT_BoidNeighbourBackend, STATGROUP_Boids);
+
+// Points left in a k-d tree range before it stops splitting.
+static const int32 BoidKdLeafSize = 8;
+// Cost of visiting one grid cell or tree node against testing one boid, as for the grid tuner.
+static const float BoidNodeVisitCost = 4.0f;
+// Another backend has to be this much cheaper to be taken, so the choice doesn't flip every frame.
+static const float BoidBackendHysteresis = 0.8f;
+
+const TCHAR* GetBoidNeighbourBackendName(EBoidNeighbourBackend Backend)
+{
+	switch (Backend)
+	{
+	case EBoidNeighbourBackend::Auto:		return TEXT("Auto");
+	case EBoidNeighbourBackend::BruteForce:	return TEXT("Brute force");
+	case EBoidNeighbourBackend::Grid:		return TEXT("Grid");
+	case EBoidNeighbourBackend::KdTree:		return TEXT("K-d tree");
+	default:								return TEXT("Unknown");
+	}
+}
+
+void FBoidBruteForceSearch::GatherNeighbours(FVector2D Position, int32 Self, float Range, TArray<int32>& OutIndices) const
+{
+	const float RangeSquared = Range * Range;
+
+	for (int32 Index = 0; Index < Grid->GetNum(); Index++)
+	{
+		if (Index != Self && Grid->GetOffset(Position, Grid->GetPosition(Index)).SizeSquared() <= RangeSquared)
+		{
+			OutIndices.Add(Index);
+		}
+	}
+}
+
+void FBoidGridSearch::GatherNeighbours(FVector2D Position, int32 Self, float Range, TArray<int32>& OutIndices) const
+{
+	Grid->ForEachInRange(Position, Range, [Self, &OutIndices](int32 Index, FVector2D Offset)
+	{
+		if (Index != Self)
+		{
+			OutIndices.Add(Index);
+		}
+	});
+}
+
+void FBoidKdTree::Build(const FBoidSpatialGrid& Grid)
+{
+	const int32 Num = Grid.GetNum();
+	Area = Grid.GetArea();
+	IsWrapped = Grid.GetIsWrapped();
+
+	Points.SetNumUninitialized(Num);
+	Order.SetNumUninitialized(Num);
+	SplitAxis.SetNumUninitialized(Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		Points[i] = Grid.GetPosition(i);
+		Order[i] = i;
+	}
+
+	BuildRange(0, Num);
+}
+
+void FBoidKdTree::BuildRange(int32 Start, int32 End)
+{
+	if (End - Start <= BoidKdLeafSize)
+	{
+		return;
+	}
+
+	// Split across the wider side so clumps and lines still end up in compact boxes.
+	FVector2D Min = Points[Start];
+	FVector2D Max = Points[Start];
+	for (int32 i = Start + 1; i < End; i++)
+	{
+		Min.X = FMath::Min(Min.X, Points[i].X);
+		Min.Y = FMath::Min(Min.Y, Points[i].Y);
+		Max.X = FMath::Max(Max.X, Points[i].X);
+		Max.Y = FMath::Max(Max.Y, Points[i].Y);
+	}
+	const int32 Axis = (Max.X - Min.X) >= (Max.Y - Min.Y) ? 0 : 1;
+
+	const int32 Middle = Start + (End - Start) / 2;
+	Select(Start, End, Middle, Axis);
+	SplitAxis[Middle] = static_cast<uint8>(Axis);
+
+	BuildRange(Start, Middle);
+	BuildRange(Middle + 1, End);
+}
+
+void FBoidKdTree::Select(int32 Start, int32 End, int32 Nth, int32 Axis)
+{
+	// Quickselect, leaving everything before Nth no greater and everything after no smaller.
+	int32 Low = Start;
+	int32 High = End - 1;
+
+	while (Low < High)
+	{
+		const float Pivot = Points[(Low + High) / 2][Axis];
+		int32 Left = Low;
+		int32 Right = High;
+
+		while (Left <= Right)
+		{
+			while (Points[Left][Axis] < Pivot)	{ Left++; }
+			while (Points[Right][Axis] > Pivot)	{ Right--; }
+
+			if (Left <= Right)
+			{
+				Swap(Points[Left], Points[Right]);
+				Swap(Order[Left], Order[Right]);
+				Left++;
+				Right--;
+			}
+		}
+
+		if (Nth <= Right)
+		{
+			High = Right;
+		}
+		else if (Nth >= Left)
+		{
+			Low = Left;
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+void FBoidKdTree::GatherNeighbours(FVector2D Position, int32 Self, float Range, TArray<int32>& OutIndices) const
+{
+	const float RangeSquared = Range * Range;
+
+	if (!IsWrapped)
+	{
+		Query(0, Points.Num(), Position, Range, RangeSquared, Self, OutIndices);
+		return;
+	}
+
+	// Near an edge of a wrapped area, also look from the position's images across it. While the
+	// range is under half the area no boid is in range of two of them, so none comes back twice.
+	float ShiftsX[2] = { 0, 0 };
+	float ShiftsY[2] = { 0, 0 };
+	int32 NumX = 1;
+	int32 NumY = 1;
+	if (Position.X - Range < 0)				{ ShiftsX[NumX++] = Area.X; }
+	else if (Position.X + Range >= Area.X)	{ ShiftsX[NumX++] = -Area.X; }
+	if (Position.Y - Range < 0)				{ ShiftsY[NumY++] = Area.Y; }
+	else if (Position.Y + Range >= Area.Y)	{ ShiftsY[NumY++] = -Area.Y; }
+
+	for (int32 Y = 0; Y < NumY; Y++)
+	{
+		for (int32 X = 0; X < NumX; X++)
+		{
+			Query(0, Points.Num(), Position + FVector2D(ShiftsX[X], ShiftsY[Y]), Range, RangeSquared, Self, OutIndices);
+		}
+	}
+}
+
+void FBoidKdTree::Query(int32 Start, int32 End, FVector2D Position, float Range, float RangeSquared, int32 Self, TArray<int32>& OutIndices) const
+{
+	if (End - Start <= BoidKdLeafSize)
+	{
+		for (int32 i = Start; i < End; i++)
+		{
+			if (Order[i] != Self && (Points[i] - Position).SizeSquared() <= RangeSquared)
+			{
+				OutIndices.Add(Order[i]);
+			}
+		}
+		return;
+	}
+
+	const int32 Middle = Start + (End - Start) / 2;
+	const int32 Axis = SplitAxis[Middle];
+
+	if (Order[Middle] != Self && (Points[Middle] - Position).SizeSquared() <= RangeSquared)
+	{
+		OutIndices.Add(Order[Middle]);
+	}
+
+	const float Distance = Position[Axis] - Points[Middle][Axis];
+	if (Distance <= Range)
+	{
+		Query(Start, Middle, Position, Range, RangeSquared, Self, OutIndices);
+	}
+	if (Distance >= -Range)
+	{
+		Query(Middle + 1, End, Position, Range, RangeSquared, Self, OutIndices);
+	}
+}
+
+FBoidNeighbourSearch& FBoidNeighbourBackends::Select(const FBoidSpatialGrid& Grid, float Range, EBoidNeighbourBackend Required)
+{
+	EBoidNeighbourBackend Backend = Required != EBoidNeighbourBackend::Auto ? Required : static_cast<EBoidNeighbourBackend>(
+		FMath::Clamp(CVarBoidsNeighbourBackend.GetValueOnAnyThread(), 0, static_cast<int32>(EBoidNeighbourBackend::Count) - 1));
+
+	if (Backend == EBoidNeighbourBackend::Auto)
+	{
+		Backend = Choose(Grid, Range, Current);
+		if (Backend != Current)
+		{
+			UE_LOG(LogBoids, Log, TEXT("Neighbour search switched from %s to %s for %d boids"),
+				GetBoidNeighbourBackendName(Current), GetBoidNeighbourBackendName(Backend), Grid.GetNum());
+		}
+	}
+
+	Current = Backend;
+	SET_DWORD_STAT(STAT_BoidNeighbourBackend, static_cast<uint32>(Current));
+
+	FBoidNeighbourSearch& Search = Get(Current);
+	Search.Build(Grid);
+	return Search;
+}
+
+FBoidNeighbourSearch& FBoidNeighbourBackends::Get(EBoidNeighbourBackend Backend)
+{
+	switch (Backend)
+	{
+	case EBoidNeighbourBackend::BruteForce:	return BruteForce;
+	case EBoidNeighbourBackend::KdTree:		return KdTree;
+	default:								return GridSearch;
+	}
+}
+
+EBoidNeighbourBackend FBoidNeighbourBackends::Choose(const FBoidSpatialGrid& Grid, float Range, EBoidNeighbourBackend Current)
+{
+	const int32 Num = Grid.GetNum();
+	if (Num == 0)
+	{
+		return EBoidNeighbourBackend::Grid;
+	}
+
+	// Density around the average boid, from the grid's occupancy: clumps count in full.
+	double SquaredOccupancy = 0;
+	for (int32 Cell = 0; Cell < Grid.GetNumCells(); Cell++)
+	{
+		const double Count = Grid.GetCellStart(Cell + 1) - Grid.GetCellStart(Cell);
+		SquaredOccupancy += Count * Count;
+	}
+	const FVector2D CellSize = Grid.GetCellSize();
+	const float Density = static_cast<float>(SquaredOccupancy / (double(Num) * CellSize.X * CellSize.Y));
+
+	// Predicted work per boid, in boids tested. The grid gets built every frame for the other
+	// stages anyway, so only its queries count; the tree also pays for its own build.
+	float Costs[static_cast<int32>(EBoidNeighbourBackend::Count)] = {};
+	Costs[static_cast<int32>(EBoidNeighbourBackend::BruteForce)] = static_cast<float>(Num);
+
+	const FVector2D Side(2.0f * FMath::CeilToFloat(Range / CellSize.X) + 1.0f, 2.0f * FMath::CeilToFloat(Range / CellSize.Y) + 1.0f);
+	const float GridTested = FMath::Min(Density * Side.X * CellSize.X * Side.Y * CellSize.Y, static_cast<float>(Num));
+	Costs[static_cast<int32>(EBoidNeighbourBackend::Grid)] = BoidNodeVisitCost * Side.X * Side.Y + GridTested;
+
+	// Leaves reach about their own width past the range.
+	const float Depth = FMath::Log2(static_cast<float>(Num) / BoidKdLeafSize + 1.0f);
+	const float LeafWidth = FMath::Sqrt(BoidKdLeafSize / FMath::Max(Density, SMALL_NUMBER));
+	const float TreeTested = FMath::Min(Density * FMath::Square(2.0f * Range + LeafWidth), static_cast<float>(Num));
+	Costs[static_cast<int32>(EBoidNeighbourBackend::KdTree)] = BoidNodeVisitCost * Depth * 2.0f + TreeTested + Depth;
+
+	EBoidNeighbourBackend Best = EBoidNeighbourBackend::BruteForce;
+	for (const EBoidNeighbourBackend Backend : { EBoidNeighbourBackend::Grid, EBoidNeighbourBackend::KdTree })
+	{
+		if (Costs[static_cast<int32>(Backend)] < Costs[static_cast<int32>(Best)])
+		{
+			Best = Backend;
+		}
+	}
+
+	if (Current != EBoidNeighbourBackend::Auto && Current != Best
+		&& Costs[static_cast<int32>(Best)] >= Costs[static_cast<int32>(Current)] * BoidBackendHysteresis)
+	{
+		return Current;
+	}
+
+	return Best;
+}
+
+void FBoidNeighbourBackends::Benchmark(const TArray<FVector2D>& Positions, FVector2D Area, float Range, bool IsWrapped, int32 Repeats,
+	FBoidNeighbourTiming OutTimings[(int32)EBoidNeighbourBackend::Count])
+{
+	FBoidNeighbourBackends Backends;
+	FBoidSpatialGrid Grid;
+	FBoidNeighbourLists Lists;
+	FBoidFrameArena Arena;
+
+	OutTimings[static_cast<int32>(EBoidNeighbourBackend::Auto)] = FBoidNeighbourTiming();
+
+	for (int32 Backend = static_cast<int32>(EBoidNeighbourBackend::BruteForce); Backend < static_cast<int32>(EBoidNeighbourBackend::Count); Backend++)
+	{
+		FBoidNeighbourTiming& Timing = OutTimings[Backend];
+		Timing.Seconds = MAX_dbl;
+
+		for (int32 Repeat = 0; Repeat < FMath::Max(Repeats, 1); Repeat++)
+		{
+			// Every backend starts from the grid, as it does in the flock.
+			const double StartTime = FPlatformTime::Seconds();
+			Grid.Configure(Area, Range, IsWrapped);
+			Grid.Build(Positions);
+			FBoidNeighbourSearch& Search = Backends.Get(static_cast<EBoidNeighbourBackend>(Backend));
+			Search.Build(Grid);
+			Arena.Reset();
+			Lists.Build(Search, Grid, Positions, Range, Arena);
+			Timing.Seconds = FMath::Min(Timing.Seconds, FPlatformTime::Seconds() - StartTime);
+			Timing.NumNeighbours = Lists.GetNumNeighbours();
+		}
+	}
+}
@@ -0,0 +1,156 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidNeighbours.h"
+
+#include "BoidNeighbourSearch.h"
+
+void FBoidNeighbourLists::Build(const FBoidSpatialGrid& Grid, const TArray<FVector2D>& Positions, float Range, FBoidFrameArena& Arena)
+{
+	BuildWith(Positions.Num(), Arena, [&Grid, &Positions, Range](int32 Boid, auto&& Emit)
+	{
+		Grid.ForEachInRange(Positions[Boid], Range, [Boid, &Emit](int32 Index, FVector2D Offset)
+		{
+			if (Index != Boid)
+			{
+				Emit(Index, Offset.SizeSquared());
+			}
+		});
+	});
+}
+
+void FBoidNeighbourLists::Build(const FBoidNeighbourSearch& Search, const FBoidSpatialGrid& Grid, const TArray<FVector2D>& Positions,
+	float Range, FBoidFrameArena& Arena)
+{
+	// The grid's own query inlines, no need to go through the interface for it.
+	if (const FBoidSpatialGrid* SearchGrid = Search.GetGrid())
+	{
+		Build(*SearchGrid, Positions, Range, Arena);
+		return;
+	}
+
+	BuildWith(Positions.Num(), Arena, [this, &Search, &Grid, &Positions, Range](int32 Boid, auto&& Emit)
+	{
+		GatherScratch.Reset();
+		Search.GatherNeighbours(Positions[Boid], Boid, Range, GatherScratch);
+		for (const int32 Index : GatherScratch)
+		{
+			Emit(Index, MaxNeighbours > 0 ? Grid.GetOffset(Positions[Boid], Positions[Index]).SizeSquared() : 0.0f);
+		}
+	});
+}
+
+template <typename QueryType>
+void FBoidNeighbourLists::BuildWith(int32 _NumBoids, FBoidFrameArena& Arena, const QueryType& Query)
+{
+	NumBoids = _NumBoids;
+	RowStart = Arena.Alloc<int32>(NumBoids + 1);
+	Indices16 = nullptr;
+	Indices32 = nullptr;
+
+	// Size the index array from last frame and fill in one pass. Only if the flock got a lot denser
+	// does the pass run again into an array of the exact size.
+	Capacity = FMath::Max(ExpectedNeighbours + ExpectedNeighbours / 4, NumBoids * 8);
+	int32 Total;
+
+	if (NumBoids <= MAX_uint16 + 1)
+	{
+		Indices16 = Arena.Alloc<uint16>(Capacity);
+		Total = Fill(Query, Indices16, Capacity);
+		if (Total > Capacity)
+		{
+			Capacity = Total;
+			Indices16 = Arena.Alloc<uint16>(Capacity);
+			Fill(Query, Indices16, Capacity);
+		}
+	}
+	else
+	{
+		Indices32 = Arena.Alloc<int32>(Capacity);
+		Total = Fill(Query, Indices32, Capacity);
+		if (Total > Capacity)
+		{
+			Capacity = Total;
+			Indices32 = Arena.Alloc<int32>(Capacity);
+			Fill(Query, Indices32, Capacity);
+		}
+	}
+
+	ExpectedNeighbours = Total;
+}
+
+template <typename IndexType, typename QueryType>
+int32 FBoidNeighbourLists::Fill(const QueryType& Query, IndexType* Indices, int32 IndexCapacity)
+{
+	int32 Count = 0;
+
+	if (MaxNeighbours <= 0)
+	{
+		for (int32 Boid = 0; Boid < NumBoids; Boid++)
+		{
+			RowStart[Boid] = Count;
+
+			Query(Boid, [&](int32 Index, float DistanceSquared)
+			{
+				// Keep counting past the end so the caller knows how much room to make.
+				if (Count < IndexCapacity)
+				{
+					Indices[Count] = static_cast<IndexType>(Index);
+				}
+				Count++;
+			});
+		}
+
+		RowStart[NumBoids] = Count;
+		return Count;
+	}
+
+	// Keeping the first found instead would favour whichever side of the boid the search visits first.
+	NearestIndices.SetNumUninitialized(MaxNeighbours, false);
+	NearestDistances.SetNumUninitialized(MaxNeighbours, false);
+
+	for (int32 Boid = 0; Boid < NumBoids; Boid++)
+	{
+		RowStart[Boid] = Count;
+
+		int32 NumNearest = 0;
+		Query(Boid, [&](int32 Index, float DistanceSquared)
+		{
+			if (NumNearest == MaxNeighbours)
+			{
+				if (DistanceSquared >= NearestDistances[NumNearest - 1])
+				{
+					return;
+				}
+				NumNearest--;
+			}
+
+			int32 Slot = NumNearest;
+			for (; Slot > 0 && NearestDistances[Slot - 1] > DistanceSquared; Slot--)
+			{
+				NearestIndices[Slot] = NearestIndices[Slot - 1];
+				NearestDistances[Slot] = NearestDistances[Slot - 1];
+			}
+			NearestIndices[Slot] = Index;
+			NearestDistances[Slot] = DistanceSquared;
+			NumNearest++;
+		});
+
+		for (int32 i = 0; i < NumNearest; i++)
+		{
+			if (Count < IndexCapacity)
+			{
+				Indices[Count] = static_cast<IndexType>(NearestIndices[i]);
+			}
+			Count++;
+		}
+	}
+
+	RowStart[NumBoids] = Count;
+	return Count;
+}
+
+int64 FBoidNeighbourLists::GetAllocatedBytes() const
+{
+	return sizeof(int32) * (NumBoids + 1) + (IsWide() ? sizeof(int32) : sizeof(uint16)) * int64(Capacity);
+}
@@ -0,0 +1,109 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidPipelinedSimulation.h"
+
+#include "BoidSystemPlugin.h"
+
+DECLARE_CYCLE_STAT(TEXT("Pipeline Neighbours"), STAT_BoidPipelineNeighbours, STATGROUP_Boids);
+DECLARE_CYCLE_STAT(TEXT("Pipeline Rules"), STAT_BoidPipelineRules, STATGROUP_Boids);
+DECLARE_CYCLE_STAT(TEXT("Pipeline Integrate"), STAT_BoidPipelineIntegrate, STATGROUP_Boids);
+DECLARE_CYCLE_STAT(TEXT("Pipeline Wait"), STAT_BoidPipelineWait, STATGROUP_Boids);
+
+FBoidPipelinedSimulation::FBoidPipelinedSimulation(const TArray<FBoidHandle>& _Handles, const TArray<FVector2D>& Positions,
+	const TArray<FVector2D>& Velocities, const TArray<FBoidBody>& Bodies) :
+	Handles(_Handles)
+{
+	Simulation.Init(Positions, Velocities, Bodies);
+}
+
+FBoidPipelinedSimulation::~FBoidPipelinedSimulation()
+{
+	// The tasks point at this object.
+	Complete();
+}
+
+void FBoidPipelinedSimulation::Launch(const FBoidSimulationParams& Params, float DeltaTime, bool BalanceByCost)
+{
+	check(!StepDone.IsValid());
+
+	Simulation.SetParams(Params);
+	UpdateUnpacked();
+
+	FGraphEventRef NeighboursDone = FFunctionGraphTask::CreateAndDispatchWhenReady([this]()
+	{
+		Simulation.BuildNeighbours();
+	}, GET_STATID(STAT_BoidPipelineNeighbours));
+
+	const FGraphEventArray AfterNeighbours = { NeighboursDone };
+	FGraphEventRef RulesDone = FFunctionGraphTask::CreateAndDispatchWhenReady([this, BalanceByCost, NumThreads = Params.NumThreads, BoidsPerItem = Params.BoidsPerItem]()
+	{
+		// The task running this takes part too.
+		const int32 MaxWorkers = FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+		const int32 NumWorkers = NumThreads > 0 ? FMath::Min(NumThreads, MaxWorkers) : MaxWorkers;
+		if (BalanceByCost)
+		{
+			Partition.Build(Simulation.GetGrid(), Simulation.GetNeighbours(), NumWorkers, BoidsPerItem);
+		}
+		else
+		{
+			Partition.BuildUniform(Simulation.GetNum(), NumWorkers, BoidsPerItem);
+		}
+
+		Partition.Execute([this](const int32* Boids, int32 Count)
+		{
+			Simulation.EvaluateRules(Boids, Count);
+		});
+	}, GET_STATID(STAT_BoidPipelineRules), &AfterNeighbours);
+
+	// Integration is cheap next to the rules, one task is enough.
+	const FGraphEventArray AfterRules = { RulesDone };
+	StepDone = FFunctionGraphTask::CreateAndDispatchWhenReady([this, DeltaTime]()
+	{
+		Simulation.Integrate(DeltaTime, 0, Simulation.GetNum());
+	}, GET_STATID(STAT_BoidPipelineIntegrate), &AfterRules);
+}
+
+void FBoidPipelinedSimulation::Complete()
+{
+	if (!StepDone.IsValid())
+	{
+		return;
+	}
+
+	{
+		SCOPE_CYCLE_COUNTER(STAT_BoidPipelineWait);
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(StepDone);
+	}
+
+	// Swapping here, on the caller's thread, keeps the current state stable while readers use it.
+	Simulation.FinishStep();
+	StepDone = nullptr;
+	UpdateUnpacked();
+}
+
+void FBoidPipelinedSimulation::ApplyChanges(const FBoidFlockChanges& Changes)
+{
+	check(!StepDone.IsValid());
+
+	if (Changes.IsEmpty())
+	{
+		return;
+	}
+
+	Simulation.ApplyChanges(Changes, Handles);
+	// Same step, and maybe the same size, so UpdateUnpacked would not notice.
+	if (!HasFloatState())
+	{
+		Simulation.CopyState(Unpacked);
+	}
+}
+
+void FBoidPipelinedSimulation::UpdateUnpacked()
+{
+	// The state only changes by stepping or in ApplyChanges, so a copy of the same step and size is still current.
+	if (!HasFloatState() && (Unpacked.StepIndex != Simulation.GetStepIndex() || Unpacked.Positions.Num() != Simulation.GetNum()))
+	{
+		Simulation.CopyState(Unpacked);
+	}
+}
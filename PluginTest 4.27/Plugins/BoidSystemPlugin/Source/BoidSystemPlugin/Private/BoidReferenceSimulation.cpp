@@ -0,0 +1,218 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidReferenceSimulation.h"
+
+// "BGLD", then bumped whenever the layout below changes.
+static const uint32 BoidGoldenMagic = 0x444C4742;
+static const int32 BoidGoldenVersion = 1;
+
+void FBoidReferenceSimulation::Init(const FBoidSimulationParams& _Params, const FBoidBody& _Body, const TArray<FVector2D>& _Positions,
+	const TArray<FVector2D>& _Velocities)
+{
+	Params = _Params;
+	Body = _Body;
+	Positions = _Positions;
+	Velocities = _Velocities;
+}
+
+void FBoidReferenceSimulation::Step(float DeltaTime)
+{
+	const int32 Num = Positions.Num();
+	Accelerations.SetNum(Num);
+
+	for (int32 i = 0; i < Num; i++)
+	{
+		Accelerations[i] = ComputeAcceleration(i);
+	}
+
+	for (int32 i = 0; i < Num; i++)
+	{
+		FVector2D Acceleration = Accelerations[i];
+		if (Acceleration.Size() > Body.MaxAcceleration)
+		{
+			Acceleration.Normalize();
+			Acceleration *= Body.MaxAcceleration;
+		}
+
+		Velocities[i] += Acceleration;
+		if (Body.HasConstantSpeed || Velocities[i].Size() > Body.Speed)
+		{
+			Velocities[i].Normalize();
+			Velocities[i] *= Body.Speed;
+		}
+
+		FVector2D Position = Positions[i] + Velocities[i] * DeltaTime;
+		if (Params.IsWrapped)
+		{
+			Position.X = FMath::Fmod(Position.X, Params.Area.X);
+			Position.Y = FMath::Fmod(Position.Y, Params.Area.Y);
+			if (Position.X < 0)	{ Position.X += Params.Area.X; }
+			if (Position.Y < 0)	{ Position.Y += Params.Area.Y; }
+			if (Position.X >= Params.Area.X)	{ Position.X = 0; }
+			if (Position.Y >= Params.Area.Y)	{ Position.Y = 0; }
+		}
+		Positions[i] = Position;
+	}
+}
+
+FVector2D FBoidReferenceSimulation::GetOffset(FVector2D From, FVector2D To) const
+{
+	FVector2D Offset = To - From;
+
+	if (Params.IsWrapped)
+	{
+		const FVector2D HalfArea = Params.Area * 0.5f;
+		if (Offset.X > HalfArea.X)			{ Offset.X -= Params.Area.X; }
+		else if (Offset.X < -HalfArea.X)	{ Offset.X += Params.Area.X; }
+		if (Offset.Y > HalfArea.Y)			{ Offset.Y -= Params.Area.Y; }
+		else if (Offset.Y < -HalfArea.Y)	{ Offset.Y += Params.Area.Y; }
+	}
+
+	return Offset;
+}
+
+FVector2D FBoidReferenceSimulation::ComputeAcceleration(int32 Index) const
+{
+	const FVector2D Position = Positions[Index];
+
+	NeighbourScratch.Reset();
+	for (int32 Other = 0; Other < Positions.Num(); Other++)
+	{
+		if (Other != Index && GetOffset(Position, Positions[Other]).SizeSquared() <= Params.VisualRange * Params.VisualRange)
+		{
+			NeighbourScratch.Add(Other);
+		}
+	}
+	const int32 NumNeighbours = NeighbourScratch.Num();
+
+	// Cohesion, towards the average offset.
+	FVector2D Cohesion = FVector2D::ZeroVector;
+	if (NumNeighbours > 0)
+	{
+		for (const int32 Other : NeighbourScratch)
+		{
+			Cohesion += GetOffset(Position, Positions[Other]);
+		}
+		Cohesion /= static_cast<float>(NumNeighbours);
+		Cohesion.Normalize();
+	}
+
+	// Separation, away from boids closer than the desired distance.
+	const FSeparationKernel& SeparationParams = Params.Pipeline.Get<FSeparationKernel>();
+	FVector2D Separation = FVector2D::ZeroVector;
+	int32 CountCloseNeighbours = 0;
+	for (const int32 Other : NeighbourScratch)
+	{
+		FVector2D OpposedDirection = -GetOffset(Position, Positions[Other]);
+		const float Distance = OpposedDirection.Size();
+
+		if (Distance < SeparationParams.DesiredDistance && Distance > 0)
+		{
+			OpposedDirection /= Distance;
+			Separation += OpposedDirection * FMath::Exp(-Distance * SeparationParams.Falloff);
+			CountCloseNeighbours++;
+		}
+	}
+	if (CountCloseNeighbours > 0)
+	{
+		Separation /= static_cast<float>(CountCloseNeighbours);
+	}
+	Separation.Normalize();
+
+	// Alignment, along the average velocity.
+	FVector2D Alignment = FVector2D::ZeroVector;
+	if (NumNeighbours > 0)
+	{
+		for (const int32 Other : NeighbourScratch)
+		{
+			Alignment += Velocities[Other];
+		}
+		Alignment /= static_cast<float>(NumNeighbours);
+	}
+	Alignment.Normalize();
+
+	// Bounds, pushing off the walls of a bounded area.
+	const FBoundsKernel& BoundsParams = Params.Pipeline.Get<FBoundsKernel>();
+	FVector2D Bounds = FVector2D::ZeroVector;
+	if (BoundsParams.IsBounded)
+	{
+		const float Epsilon = 0.00001f;
+		const int32 DesiredDistance = BoundsParams.DesiredDistance;
+
+		if (Position.X < DesiredDistance)
+		{
+			Bounds.X += DesiredDistance / Position.X;
+		}
+		else if (Position.X > BoundsParams.Width - DesiredDistance)
+		{
+			const int32 Distance = Position.X - BoundsParams.Width;
+			Bounds.X += DesiredDistance / (Distance + Epsilon);
+		}
+
+		if (Position.Y < DesiredDistance)
+		{
+			Bounds.Y += DesiredDistance / Position.Y;
+		}
+		else if (Position.Y > BoundsParams.Height - DesiredDistance)
+		{
+			const int32 Distance = Position.Y - BoundsParams.Height;
+			Bounds.Y += DesiredDistance / (Distance + Epsilon);
+		}
+	}
+
+	// Summed in the order the controller lists the rules.
+	FVector2D Acceleration = FVector2D::ZeroVector;
+	Acceleration += Params.Pipeline.Get<FCohesionKernel>().Weight * Cohesion;
+	Acceleration += SeparationParams.Weight * Separation;
+	Acceleration += Params.Pipeline.Get<FAlignmentKernel>().Weight * Alignment;
+	Acceleration += BoundsParams.Weight * Bounds;
+	return Acceleration;
+}
+
+void FBoidGoldenTrajectory::Record(const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities)
+{
+	FBoidReferenceSimulation Reference;
+	Reference.Init(Params, Body, Positions, Velocities);
+
+	SampleInterval = FMath::Max(SampleInterval, 1);
+	SamplePositions.Reset();
+	SampleVelocities.Reset();
+	SamplePositions.Add(Positions);
+	SampleVelocities.Add(Velocities);
+
+	for (int32 Frame = 1; Frame <= NumFrames; Frame++)
+	{
+		Reference.Step(DeltaTime);
+		if (Frame % SampleInterval == 0)
+		{
+			SamplePositions.Add(Reference.GetPositions());
+			SampleVelocities.Add(Reference.GetVelocities());
+		}
+	}
+}
+
+bool FBoidGoldenTrajectory::Serialize(FArchive& Ar)
+{
+	uint32 Magic = BoidGoldenMagic;
+	int32 Version = BoidGoldenVersion;
+	Ar << Magic << Version;
+	if (Magic != BoidGoldenMagic || Version != BoidGoldenVersion)
+	{
+		return false;
+	}
+
+	FCohesionKernel& Cohesion = Params.Pipeline.Get<FCohesionKernel>();
+	FSeparationKernel& Separation = Params.Pipeline.Get<FSeparationKernel>();
+	FAlignmentKernel& Alignment = Params.Pipeline.Get<FAlignmentKernel>();
+	FBoundsKernel& Bounds = Params.Pipeline.Get<FBoundsKernel>();
+
+	Ar << Params.Area << Params.VisualRange << Params.IsWrapped;
+	Ar << Cohesion.Weight << Separation.Weight << Separation.DesiredDistance << Separation.Falloff << Alignment.Weight;
+	Ar << Bounds.Weight << Bounds.Width << Bounds.Height << Bounds.DesiredDistance << Bounds.IsBounded;
+	Ar << Body.Speed << Body.MaxAcceleration << Body.HasConstantSpeed;
+	Ar << DeltaTime << NumFrames << SampleInterval;
+	Ar << SamplePositions << SampleVelocities;
+
+	return !Ar.IsError();
+}
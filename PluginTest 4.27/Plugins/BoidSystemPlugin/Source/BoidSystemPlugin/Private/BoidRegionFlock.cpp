@@ -0,0 +1,127 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "BoidRegionFlock.h"
+
+#include "BoidSystemPlugin.h"
+#include "Camera/PlayerCameraManager.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "Math/RandomStream.h"
+#include "Misc/Paths.h"
+#include "UObject/ConstructorHelpers.h"
+
+DECLARE_CYCLE_STAT(TEXT("Region Flock Tick"), STAT_BoidRegionFlockTick, STATGROUP_Boids);
+
+ABoidRegionFlock::ABoidRegionFlock()
+{
+	PrimaryActorTick.bCanEverTick = true;
+
+	BoidInstances = CreateDefaultSubobject<UInstancedStaticMeshComponent>(TEXT("BoidInstances"));
+	RootComponent = BoidInstances;
+	BoidInstances->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	static ConstructorHelpers::FObjectFinder<UStaticMesh> BoidMesh(TEXT("/BoidSystemPlugin/Shapes/Shape_Cube"));
+	if (BoidMesh.Succeeded())
+	{
+		BoidInstances->SetStaticMesh(BoidMesh.Object);
+	}
+}
+
+void ABoidRegionFlock::BeginPlay()
+{
+	Super::BeginPlay();
+
+	IsRunning = GetNetMode() != NM_Client;
+	if (!IsRunning)
+	{
+		return;
+	}
+
+	FBoidRegionWorldParams Params;
+	Params.Simulation.VisualRange = VisualRange;
+	Params.Simulation.Pipeline.Get<FSeparationKernel>().Weight = SeparationWeight;
+	Params.Simulation.Pipeline.Get<FCohesionKernel>().Weight = CohesionWeight;
+	Params.Simulation.Pipeline.Get<FAlignmentKernel>().Weight = AlignmentWeight;
+	Params.Body.Speed = Speed;
+	Params.NumRegions = FIntPoint(FMath::Max(NumRegions.X, 1), FMath::Max(NumRegions.Y, 1));
+	Params.RegionSize = RegionSize;
+	Params.ActiveRadius = ActiveRadius;
+	Params.SlowRadius = SlowRadius;
+	Params.SlowInterval = SlowInterval;
+	Params.SleepMargin = SleepMargin;
+	Params.CacheDirectory = FPaths::ProjectSavedDir() / TEXT("BoidRegions") / GetName();
+	RegionWorld.Init(Params);
+
+	// One draw per statement, so every build spawns the same flock for a seed.
+	FRandomStream Random(Seed);
+	const FVector2D WorldSize = FVector2D(Params.NumRegions.X, Params.NumRegions.Y) * RegionSize;
+	for (int32 i = 0; i < NumBoids; i++)
+	{
+		const float X = Random.FRandRange(0, WorldSize.X);
+		const float Y = Random.FRandRange(0, WorldSize.Y);
+		const float VelocityX = Random.FRandRange(-1, 1);
+		const float VelocityY = Random.FRandRange(-1, 1);
+		RegionWorld.AddBoid(FVector2D(X, Y), FVector2D(VelocityX, VelocityY) * Speed);
+	}
+	UE_LOG(LogBoids, Log, TEXT("%s spawned %d boids over %dx%d regions"), *GetName(), NumBoids, Params.NumRegions.X, Params.NumRegions.Y);
+}
+
+void ABoidRegionFlock::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	Super::EndPlay(EndPlayReason);
+
+	// Deletes the cache files.
+	RegionWorld.Reset();
+	IsRunning = false;
+}
+
+void ABoidRegionFlock::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+	if (!IsRunning)
+	{
+		return;
+	}
+	SCOPE_CYCLE_COUNTER(STAT_BoidRegionFlockTick);
+
+	GatherFocusPoints();
+	RegionWorld.UpdateRegions(FocusPoints);
+	RegionWorld.Step(DeltaTime);
+	DrawAwakeBoids();
+}
+
+void ABoidRegionFlock::GatherFocusPoints()
+{
+	FocusPoints.Reset();
+	for (FConstPlayerControllerIterator Iterator = GetWorld()->GetPlayerControllerIterator(); Iterator; ++Iterator)
+	{
+		const APlayerController* Controller = Iterator->Get();
+		if (Controller && Controller->PlayerCameraManager)
+		{
+			FocusPoints.Add(FVector2D(Controller->PlayerCameraManager->GetCameraLocation()));
+		}
+	}
+}
+
+void ABoidRegionFlock::DrawAwakeBoids()
+{
+	RegionWorld.GetAwakeBoids(AwakePositions, AwakeVelocities);
+
+	InstanceTransforms.Reset(AwakePositions.Num());
+	for (int32 i = 0; i < AwakePositions.Num(); i++)
+	{
+		const FRotator Rotation(0.0f, FMath::RadiansToDegrees(FMath::Atan2(AwakeVelocities[i].Y, AwakeVelocities[i].X)), 0.0f);
+		InstanceTransforms.Add(FTransform(Rotation, FVector(AwakePositions[i].X, AwakePositions[i].Y, 1.0f), FVector(BoidScale)));
+	}
+
+	// The count only changes when regions wake or sleep, every other frame the instances are just moved.
+	if (BoidInstances->GetInstanceCount() != InstanceTransforms.Num())
+	{
+		BoidInstances->ClearInstances();
+		BoidInstances->AddInstances(InstanceTransforms, false, true);
+	}
+	else if (InstanceTransforms.Num() > 0)
+	{
+		BoidInstances->BatchUpdateInstancesTransforms(0, InstanceTransforms, true, true, true);
+	}
+}
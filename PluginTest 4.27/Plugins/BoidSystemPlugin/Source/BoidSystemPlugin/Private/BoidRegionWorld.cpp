@@ -0,0 +1,536 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidRegionWorld.h"
+
+#include "Async/ParallelFor.h"
+#include "BoidSystemPlugin.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+DECLARE_CYCLE_STAT(TEXT("Region Step"), STAT_BoidRegionStep, STATGROUP_Boids);
+DECLARE_CYCLE_STAT(TEXT("Region Streaming"), STAT_BoidRegionStreaming, STATGROUP_Boids);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Awake Regions"), STAT_BoidAwakeRegions, STATGROUP_Boids);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Stepped Region Boids"), STAT_BoidSteppedRegionBoids, STATGROUP_Boids);
+
+static const uint32 BoidRegionCacheMagic = 0x43474552;
+static const int32 BoidRegionCacheVersion = 1;
+
+FBoidRegionWorld::~FBoidRegionWorld()
+{
+	Reset();
+}
+
+void FBoidRegionWorld::Init(const FBoidRegionWorldParams& _Params)
+{
+	Reset();
+
+	Params = _Params;
+	Params.RegionSize = FMath::Max(Params.RegionSize, 1.0f);
+	Params.NumRegions = FIntPoint(FMath::Max(Params.NumRegions.X, 1), FMath::Max(Params.NumRegions.Y, 1));
+	Params.SlowInterval = FMath::Max(Params.SlowInterval, 1);
+	if (Params.CacheDirectory.IsEmpty())
+	{
+		Params.CacheDirectory = FPaths::ProjectSavedDir() / TEXT("Boids/RegionCache");
+	}
+
+	// Each region steps its own square plus the ghost band, the borders are open.
+	Halo = Params.Simulation.VisualRange;
+	RegionParams = Params.Simulation;
+	RegionParams.Area = FVector2D(Params.RegionSize + Halo * 2, Params.RegionSize + Halo * 2);
+	RegionParams.IsWrapped = false;
+	RegionParams.Pipeline.Get<FBoundsKernel>().IsBounded = false;
+
+	CacheQuantisation.Configure(FVector2D(Params.RegionSize, Params.RegionSize), true, Params.Body.Speed);
+}
+
+void FBoidRegionWorld::Reset()
+{
+	for (const TPair<FIntPoint, FRegion>& Entry : Regions)
+	{
+		if (Entry.Value.NumCached > 0)
+		{
+			IFileManager::Get().Delete(*GetCachePath(Entry.Key));
+		}
+	}
+
+	Regions.Empty();
+	AwakeKeys.Empty();
+	ArrivalKeys.Empty();
+	FrameIndex = 0;
+	NumSteppedBoids = 0;
+	NumHandOffs = 0;
+	CacheBytes = 0;
+}
+
+void FBoidRegionWorld::AddBoid(FVector2D Position, FVector2D Velocity)
+{
+	const FIntPoint Unwrapped(FMath::FloorToInt(Position.X / Params.RegionSize), FMath::FloorToInt(Position.Y / Params.RegionSize));
+	const FIntPoint Key = WrapKey(Unwrapped);
+	FRegion& Region = Regions.FindOrAdd(Key);
+	Region.Positions.Add(Position - FVector2D(Unwrapped.X, Unwrapped.Y) * Params.RegionSize);
+	Region.Velocities.Add(Velocity);
+	if (Region.Tier == EBoidRegionTier::Dormant)
+	{
+		ArrivalKeys.Add(Key);
+	}
+}
+
+FIntPoint FBoidRegionWorld::WrapKey(FIntPoint Key) const
+{
+	return FIntPoint(((Key.X % Params.NumRegions.X) + Params.NumRegions.X) % Params.NumRegions.X,
+		((Key.Y % Params.NumRegions.Y) + Params.NumRegions.Y) % Params.NumRegions.Y);
+}
+
+FIntPoint FBoidRegionWorld::GetRegionKey(FVector2D Position) const
+{
+	return WrapKey(FIntPoint(FMath::FloorToInt(Position.X / Params.RegionSize), FMath::FloorToInt(Position.Y / Params.RegionSize)));
+}
+
+float FBoidRegionWorld::GetDistanceToRegion(FVector2D Position, FIntPoint Key) const
+{
+	const FVector2D WorldSize = FVector2D(Params.NumRegions.X, Params.NumRegions.Y) * Params.RegionSize;
+	FVector2D Offset = Position - (FVector2D(Key.X, Key.Y) + FVector2D(0.5f, 0.5f)) * Params.RegionSize;
+	Offset.X -= WorldSize.X * FMath::RoundToFloat(Offset.X / WorldSize.X);
+	Offset.Y -= WorldSize.Y * FMath::RoundToFloat(Offset.Y / WorldSize.Y);
+
+	const float HalfSize = Params.RegionSize * 0.5f;
+	return FVector2D(FMath::Max(FMath::Abs(Offset.X) - HalfSize, 0.0f), FMath::Max(FMath::Abs(Offset.Y) - HalfSize, 0.0f)).Size();
+}
+
+FString FBoidRegionWorld::GetCachePath(FIntPoint Key) const
+{
+	return Params.CacheDirectory / FString::Printf(TEXT("Region_%d_%d.bin"), Key.X, Key.Y);
+}
+
+void FBoidRegionWorld::UpdateRegions(const TArray<FVector2D>& FocusPoints)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidRegionStreaming);
+
+	// Every region in reach of a focus point, at the faster tier of any that reaches it.
+	WantedTiers.Reset();
+	const int32 Reach = FMath::CeilToInt(Params.SlowRadius / Params.RegionSize);
+	for (const FVector2D& Focus : FocusPoints)
+	{
+		const FIntPoint Centre(FMath::FloorToInt(Focus.X / Params.RegionSize), FMath::FloorToInt(Focus.Y / Params.RegionSize));
+		for (int32 Y = -Reach; Y <= Reach; Y++)
+		{
+			for (int32 X = -Reach; X <= Reach; X++)
+			{
+				const FIntPoint Key = WrapKey(Centre + FIntPoint(X, Y));
+				const float Distance = GetDistanceToRegion(Focus, Key);
+				if (Distance > Params.SlowRadius)
+				{
+					continue;
+				}
+
+				const EBoidRegionTier Tier = Distance <= Params.ActiveRadius ? EBoidRegionTier::Active : EBoidRegionTier::Slow;
+				EBoidRegionTier& Wanted = WantedTiers.FindOrAdd(Key, Tier);
+				Wanted = FMath::Max(Wanted, Tier);
+			}
+		}
+	}
+
+	// Awake regions nobody wants any more sleep once they are past the margin too.
+	for (int32 i = AwakeKeys.Num() - 1; i >= 0; i--)
+	{
+		const FIntPoint Key = AwakeKeys[i];
+		if (WantedTiers.Contains(Key))
+		{
+			continue;
+		}
+
+		float Distance = MAX_flt;
+		for (const FVector2D& Focus : FocusPoints)
+		{
+			Distance = FMath::Min(Distance, GetDistanceToRegion(Focus, Key));
+		}
+
+		FRegion& Region = Regions.FindChecked(Key);
+		if (Distance <= Params.SlowRadius + Params.SleepMargin || !Sleep(Key, Region))
+		{
+			Region.Tier = EBoidRegionTier::Slow;
+			continue;
+		}
+
+		if (Region.NumCached == 0 && Region.Positions.Num() == 0)
+		{
+			Regions.Remove(Key);
+		}
+		AwakeKeys.RemoveAtSwap(i);
+	}
+
+	for (const TPair<FIntPoint, EBoidRegionTier>& Wanted : WantedTiers)
+	{
+		FRegion& Region = Regions.FindOrAdd(Wanted.Key);
+		if (Region.Tier == EBoidRegionTier::Dormant)
+		{
+			Wake(Wanted.Key, Region, Wanted.Value);
+			AwakeKeys.Add(Wanted.Key);
+		}
+		Region.Tier = Wanted.Value;
+	}
+
+	CacheArrivals();
+
+	SET_DWORD_STAT(STAT_BoidAwakeRegions, AwakeKeys.Num());
+}
+
+void FBoidRegionWorld::Wake(FIntPoint Key, FRegion& Region, EBoidRegionTier Tier)
+{
+	// Boids that arrived while it slept go after the cached ones.
+	if (Region.NumCached > 0)
+	{
+		TArray<FVector2D> ArrivedPositions = MoveTemp(Region.Positions);
+		TArray<FVector2D> ArrivedVelocities = MoveTemp(Region.Velocities);
+		LoadCache(Key, Region);
+		Region.Positions.Append(ArrivedPositions);
+		Region.Velocities.Append(ArrivedVelocities);
+	}
+
+	Region.Tier = Tier;
+	Region.PendingTime = 0;
+	Region.Simulation = MakeUnique<FBoidSimulation>();
+	Region.Simulation->SetParams(RegionParams);
+	ArrivalKeys.Remove(Key);
+}
+
+bool FBoidRegionWorld::Sleep(FIntPoint Key, FRegion& Region)
+{
+	if (Region.Positions.Num() > 0 && !SaveCache(Key, Region))
+	{
+		return false;
+	}
+
+	Region.Tier = EBoidRegionTier::Dormant;
+	Region.StepPositions.Empty();
+	Region.StepVelocities.Empty();
+	Region.StepBodies.Empty();
+	Region.StepState = FBoidFlockState();
+	Region.Simulation.Reset();
+	return true;
+}
+
+bool FBoidRegionWorld::SaveCache(FIntPoint Key, FRegion& Region)
+{
+	const FString Path = GetCachePath(Key);
+	const int32 NumAdded = Region.Positions.Num();
+
+	// Boids already cached stay as they were packed, the header is written over and the new ones go after them.
+	CacheScratch.Reset();
+	if (Region.NumCached > 0 && !FFileHelper::LoadFileToArray(CacheScratch, *Path))
+	{
+		UE_LOG(LogBoids, Warning, TEXT("Could not read %s to add to it, keeping %d boids in memory"), *Path, NumAdded);
+		return false;
+	}
+	FMemoryWriter Writer(CacheScratch);
+
+	uint32 Magic = BoidRegionCacheMagic;
+	int32 Version = BoidRegionCacheVersion;
+	int32 Num = Region.NumCached + NumAdded;
+	float RegionSize = Params.RegionSize;
+	float Speed = Params.Body.Speed;
+	Writer << Magic << Version << Num << RegionSize << Speed;
+	Writer.Seek(CacheScratch.Num());
+
+	// Packing wraps, so keep boids on the far edge from rounding over to the near one.
+	const FVector2D MaxPosition = FVector2D(Params.RegionSize, Params.RegionSize) - CacheQuantisation.GetPositionStep();
+	for (int32 i = 0; i < NumAdded; i++)
+	{
+		FBoidPackedVector Position = CacheQuantisation.PackPosition(FVector2D(FMath::Min(Region.Positions[i].X, MaxPosition.X), FMath::Min(Region.Positions[i].Y, MaxPosition.Y)));
+		FBoidPackedVector Velocity = CacheQuantisation.PackVelocity(Region.Velocities[i]);
+		Writer << Position.X << Position.Y << Velocity.X << Velocity.Y;
+	}
+
+	if (!FFileHelper::SaveArrayToFile(CacheScratch, *Path))
+	{
+		UE_LOG(LogBoids, Warning, TEXT("Could not write %s, keeping %d boids in memory"), *Path, NumAdded);
+		return false;
+	}
+
+	Region.NumCached = Num;
+	CacheBytes += CacheScratch.Num() - Region.CachedBytes;
+	Region.CachedBytes = CacheScratch.Num();
+	Region.Positions.Empty();
+	Region.Velocities.Empty();
+	return true;
+}
+
+void FBoidRegionWorld::CacheArrivals()
+{
+	for (const FIntPoint& Key : ArrivalKeys)
+	{
+		FRegion* Region = Regions.Find(Key);
+		if (Region && Region->Tier == EBoidRegionTier::Dormant && Region->Positions.Num() > 0)
+		{
+			// On failure they wait in memory until the region wakes.
+			SaveCache(Key, *Region);
+		}
+	}
+	ArrivalKeys.Reset();
+}
+
+bool FBoidRegionWorld::LoadCache(FIntPoint Key, FRegion& Region)
+{
+	const FString Path = GetCachePath(Key);
+	const int32 Expected = Region.NumCached;
+	CacheBytes -= Region.CachedBytes;
+	Region.NumCached = 0;
+	Region.CachedBytes = 0;
+	Region.Positions.Reset();
+	Region.Velocities.Reset();
+
+	CacheScratch.Reset();
+	bool Loaded = FFileHelper::LoadFileToArray(CacheScratch, *Path);
+	IFileManager::Get().Delete(*Path);
+
+	FMemoryReader Reader(CacheScratch);
+	uint32 Magic = 0;
+	int32 Version = 0;
+	int32 Num = 0;
+	float RegionSize = 0;
+	float Speed = 0;
+	Reader << Magic << Version << Num << RegionSize << Speed;
+	Loaded = Loaded && !Reader.IsError() && Magic == BoidRegionCacheMagic && Version == BoidRegionCacheVersion && Num == Expected
+		&& RegionSize == Params.RegionSize && Speed == Params.Body.Speed;
+
+	if (Loaded)
+	{
+		Region.Positions.Reserve(Num);
+		Region.Velocities.Reserve(Num);
+		for (int32 i = 0; i < Num; i++)
+		{
+			FBoidPackedVector Position;
+			FBoidPackedVector Velocity;
+			Reader << Position.X << Position.Y << Velocity.X << Velocity.Y;
+			Region.Positions.Add(CacheQuantisation.UnpackPosition(Position));
+			Region.Velocities.Add(CacheQuantisation.UnpackVelocity(Velocity));
+		}
+		Loaded = !Reader.IsError();
+	}
+
+	if (!Loaded)
+	{
+		UE_LOG(LogBoids, Warning, TEXT("Could not read %s back, %d boids dropped"), *Path, Expected);
+		Region.Positions.Reset();
+		Region.Velocities.Reset();
+	}
+	return Loaded;
+}
+
+void FBoidRegionWorld::Step(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidRegionStep);
+
+	// Slow regions take turns, spread over the interval so the frames cost about the same.
+	FrameIndex++;
+	SteppingKeys.Reset();
+	for (const FIntPoint& Key : AwakeKeys)
+	{
+		FRegion& Region = Regions.FindChecked(Key);
+		Region.PendingTime += DeltaTime;
+		const uint32 Phase = uint32(Key.X * 7 + Key.Y * 13);
+		if (Region.Tier == EBoidRegionTier::Active || (FrameIndex + Phase) % Params.SlowInterval == 0)
+		{
+			SteppingKeys.Add(Key);
+		}
+	}
+
+	// The map doesn't change until the hand-offs, so the regions can be worked on in place.
+	SteppingRegions.Reset();
+	for (const FIntPoint& Key : SteppingKeys)
+	{
+		SteppingRegions.Add(&Regions.FindChecked(Key));
+	}
+
+	// Every region gathers its ghosts before any takes its boids back, so all see the same frame.
+	ParallelFor(SteppingKeys.Num(), [this](int32 i)
+	{
+		GatherStepInputs(SteppingKeys[i], *SteppingRegions[i]);
+		StepRegion(*SteppingRegions[i], SteppingRegions[i]->PendingTime);
+	});
+
+	NumSteppedBoids = 0;
+	HandOffs.Reset();
+	for (int32 i = 0; i < SteppingKeys.Num(); i++)
+	{
+		NumSteppedBoids += SteppingRegions[i]->Positions.Num();
+		FinishRegionStep(SteppingKeys[i], *SteppingRegions[i], HandOffs);
+		SteppingRegions[i]->PendingTime = 0;
+	}
+
+	// Into the region whether it is awake or not, a dormant one adds them to its cache.
+	for (const FBoidHandOff& HandOff : HandOffs)
+	{
+		FRegion& Region = Regions.FindOrAdd(HandOff.Key);
+		Region.Positions.Add(HandOff.Position);
+		Region.Velocities.Add(HandOff.Velocity);
+		if (Region.Tier == EBoidRegionTier::Dormant)
+		{
+			ArrivalKeys.Add(HandOff.Key);
+		}
+	}
+	NumHandOffs = HandOffs.Num();
+	CacheArrivals();
+
+	SET_DWORD_STAT(STAT_BoidSteppedRegionBoids, NumSteppedBoids);
+}
+
+void FBoidRegionWorld::GatherStepInputs(FIntPoint Key, FRegion& Region) const
+{
+	const FVector2D HaloOffset(Halo, Halo);
+	Region.StepPositions.Reset();
+	Region.StepVelocities.Reset();
+
+	for (int32 i = 0; i < Region.Positions.Num(); i++)
+	{
+		Region.StepPositions.Add(Region.Positions[i] + HaloOffset);
+		Region.StepVelocities.Add(Region.Velocities[i]);
+	}
+
+	for (int32 Y = -1; Y <= 1; Y++)
+	{
+		for (int32 X = -1; X <= 1; X++)
+		{
+			const FIntPoint NeighbourKey = WrapKey(Key + FIntPoint(X, Y));
+			const FRegion* Neighbour = Regions.Find(NeighbourKey);
+			if ((X == 0 && Y == 0) || !Neighbour || Neighbour->Tier == EBoidRegionTier::Dormant)
+			{
+				continue;
+			}
+
+			// The neighbour's boids relative to this region, kept if they are within the band.
+			const FVector2D Offset = FVector2D(X, Y) * Params.RegionSize + HaloOffset;
+			const float Max = Params.RegionSize + Halo * 2;
+			for (int32 i = 0; i < Neighbour->Positions.Num(); i++)
+			{
+				const FVector2D Position = Neighbour->Positions[i] + Offset;
+				if (Position.X >= 0 && Position.Y >= 0 && Position.X < Max && Position.Y < Max)
+				{
+					Region.StepPositions.Add(Position);
+					Region.StepVelocities.Add(Neighbour->Velocities[i]);
+				}
+			}
+		}
+	}
+
+	Region.StepBodies.Init(Params.Body, Region.StepPositions.Num());
+}
+
+void FBoidRegionWorld::StepRegion(FRegion& Region, float DeltaTime) const
+{
+	// Ghosts are stepped too and thrown away, their own region steps them for real. They are different every
+	// step, so the flock is handed over whole, the params and buffers carry on from the last one.
+	Region.Simulation->Init(Region.StepPositions, Region.StepVelocities, Region.StepBodies);
+	Region.Simulation->Step(DeltaTime);
+	Region.Simulation->CopyState(Region.StepState);
+}
+
+void FBoidRegionWorld::FinishRegionStep(FIntPoint Key, FRegion& Region, TArray<FBoidHandOff>& OutHandOffs) const
+{
+	const FVector2D HaloOffset(Halo, Halo);
+	int32 NumKept = 0;
+
+	for (int32 i = 0; i < Region.Positions.Num(); i++)
+	{
+		const FVector2D Position = Region.StepState.Positions[i] - HaloOffset;
+		const FVector2D Velocity = Region.StepState.Velocities[i];
+		const FIntPoint Step(FMath::FloorToInt(Position.X / Params.RegionSize), FMath::FloorToInt(Position.Y / Params.RegionSize));
+
+		if (Step == FIntPoint::ZeroValue)
+		{
+			Region.Positions[NumKept] = Position;
+			Region.Velocities[NumKept] = Velocity;
+			NumKept++;
+		}
+		else
+		{
+			OutHandOffs.Add({ WrapKey(Key + Step), Position - FVector2D(Step.X, Step.Y) * Params.RegionSize, Velocity });
+		}
+	}
+
+	Region.Positions.SetNum(NumKept, false);
+	Region.Velocities.SetNum(NumKept, false);
+}
+
+void FBoidRegionWorld::GetAwakeBoids(TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities) const
+{
+	OutPositions.Reset();
+	OutVelocities.Reset();
+	for (const FIntPoint& Key : AwakeKeys)
+	{
+		const FRegion& Region = Regions.FindChecked(Key);
+		const FVector2D Corner = FVector2D(Key.X, Key.Y) * Params.RegionSize;
+		for (int32 i = 0; i < Region.Positions.Num(); i++)
+		{
+			OutPositions.Add(Corner + Region.Positions[i]);
+			OutVelocities.Add(Region.Velocities[i]);
+		}
+	}
+}
+
+bool FBoidRegionWorld::GetRegionBoids(FIntPoint Key, TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities) const
+{
+	OutPositions.Reset();
+	OutVelocities.Reset();
+	const FRegion* Region = Regions.Find(WrapKey(Key));
+	if (!Region || Region->Tier == EBoidRegionTier::Dormant)
+	{
+		return false;
+	}
+
+	const FVector2D Corner = FVector2D(Key.X, Key.Y) * Params.RegionSize;
+	for (int32 i = 0; i < Region->Positions.Num(); i++)
+	{
+		OutPositions.Add(Corner + Region->Positions[i]);
+		OutVelocities.Add(Region->Velocities[i]);
+	}
+	return OutPositions.Num() > 0;
+}
+
+EBoidRegionTier FBoidRegionWorld::GetRegionTier(FIntPoint Key) const
+{
+	const FRegion* Region = Regions.Find(WrapKey(Key));
+	return Region ? Region->Tier : EBoidRegionTier::Dormant;
+}
+
+int32 FBoidRegionWorld::GetNumAwakeBoids() const
+{
+	int32 Num = 0;
+	for (const FIntPoint& Key : AwakeKeys)
+	{
+		Num += Regions.FindChecked(Key).Positions.Num();
+	}
+	return Num;
+}
+
+int32 FBoidRegionWorld::GetNumDormantBoids() const
+{
+	int32 Num = 0;
+	for (const TPair<FIntPoint, FRegion>& Entry : Regions)
+	{
+		if (Entry.Value.Tier == EBoidRegionTier::Dormant)
+		{
+			Num += Entry.Value.NumCached + Entry.Value.Positions.Num();
+		}
+	}
+	return Num;
+}
+
+int64 FBoidRegionWorld::GetAwakeBytes() const
+{
+	int64 Bytes = 0;
+	for (const FIntPoint& Key : AwakeKeys)
+	{
+		const FRegion& Region = Regions.FindChecked(Key);
+		Bytes += sizeof(FRegion) + sizeof(FBoidSimulation);
+		Bytes += Region.Positions.GetAllocatedSize() + Region.Velocities.GetAllocatedSize();
+		Bytes += Region.StepPositions.GetAllocatedSize() + Region.StepVelocities.GetAllocatedSize() + Region.StepBodies.GetAllocatedSize();
+		Bytes += Region.StepState.Positions.GetAllocatedSize() + Region.StepState.Velocities.GetAllocatedSize();
+		Bytes += int64(Region.Simulation->GetStateBytesPerBoid() * Region.Simulation->GetNum());
+	}
+	return Bytes;
+}
@@ -0,0 +1,381 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidReplication.h"
+
+#include "Algo/BinarySearch.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+// Snapshots kept on each side to encode against and interpolate between, about 1.5 seconds at 20 Hz.
+static const int32 BoidSnapshotHistory = 32;
+
+// Small values of either sign to small unsigned ones, so they pack into few bytes.
+static uint32 ZigZag(int32 Value)
+{
+	return (static_cast<uint32>(Value) << 1) ^ static_cast<uint32>(Value >> 31);
+}
+
+static int32 UnZigZag(uint32 Value)
+{
+	return static_cast<int32>(Value >> 1) ^ -static_cast<int32>(Value & 1);
+}
+
+static void WriteSigned(FArchive& Ar, int32 Value)
+{
+	uint32 Packed = ZigZag(Value);
+	Ar.SerializeIntPacked(Packed);
+}
+
+static int32 ReadSigned(FArchive& Ar)
+{
+	uint32 Packed = 0;
+	Ar.SerializeIntPacked(Packed);
+	return UnZigZag(Packed);
+}
+
+// Shortest vector between two positions, across the seam when wrapped.
+static FVector2D GetWrappedOffset(FVector2D From, FVector2D To, const FBoidReplicationSettings& Settings)
+{
+	FVector2D Offset = To - From;
+	if (Settings.IsWrapped)
+	{
+		Offset.X -= Settings.Area.X * FMath::RoundToFloat(Offset.X / Settings.Area.X);
+		Offset.Y -= Settings.Area.Y * FMath::RoundToFloat(Offset.Y / Settings.Area.Y);
+	}
+	return Offset;
+}
+
+FIntPoint QuantiseBoidPosition(FVector2D Position, float Precision)
+{
+	return FIntPoint(FMath::RoundToInt(Position.X / Precision), FMath::RoundToInt(Position.Y / Precision));
+}
+
+uint8 QuantiseBoidHeading(FVector2D Velocity)
+{
+	const float Angle = FMath::Atan2(Velocity.Y, Velocity.X);
+	return static_cast<uint8>(FMath::RoundToInt(Angle * (256.0f / (2.0f * PI))) & 0xFF);
+}
+
+const FBoidReplicatedBoid* FBoidReplicationSnapshot::Find(int32 Id) const
+{
+	const int32 Index = Algo::LowerBoundBy(Boids, Id, [](const FBoidReplicatedBoid& Boid) { return Boid.Id; });
+	return Boids.IsValidIndex(Index) && Boids[Index].Id == Id ? &Boids[Index] : nullptr;
+}
+
+void EncodeBoidSnapshot(const FBoidReplicationSnapshot& Snapshot, const FBoidReplicationSnapshot* Baseline, TArray<uint8>& OutBytes)
+{
+	OutBytes.Reset();
+	FMemoryWriter Writer(OutBytes);
+
+	uint32 Sequence = Snapshot.Sequence;
+	uint32 BaselineSequence = Baseline ? Baseline->Sequence : 0;
+	float Time = Snapshot.Time;
+	uint32 Count = Snapshot.Boids.Num();
+	Writer.SerializeIntPacked(Sequence);
+	Writer.SerializeIntPacked(BaselineSequence);
+	Writer << Time;
+	Writer.SerializeIntPacked(Count);
+
+	// Usually the same boids as the baseline, then their ids don't need sending at all.
+	uint8 SameIds = Baseline && Baseline->Boids.Num() == Snapshot.Boids.Num();
+	for (int32 i = 0; SameIds && i < Snapshot.Boids.Num(); i++)
+	{
+		SameIds = Snapshot.Boids[i].Id == Baseline->Boids[i].Id;
+	}
+	Writer << SameIds;
+
+	// Both lists are sorted by id, so one pass over each finds the boids they share.
+	int32 BaselineIndex = 0;
+	int32 PreviousId = -1;
+
+	for (const FBoidReplicatedBoid& Boid : Snapshot.Boids)
+	{
+		if (!SameIds)
+		{
+			uint32 IdGap = Boid.Id - PreviousId - 1;
+			Writer.SerializeIntPacked(IdGap);
+		}
+		PreviousId = Boid.Id;
+
+		while (Baseline && Baseline->Boids.IsValidIndex(BaselineIndex) && Baseline->Boids[BaselineIndex].Id < Boid.Id)
+		{
+			BaselineIndex++;
+		}
+
+		uint8 Heading = Boid.Heading;
+		if (Baseline && Baseline->Boids.IsValidIndex(BaselineIndex) && Baseline->Boids[BaselineIndex].Id == Boid.Id)
+		{
+			const FBoidReplicatedBoid& Previous = Baseline->Boids[BaselineIndex];
+			WriteSigned(Writer, Boid.Position.X - Previous.Position.X);
+			WriteSigned(Writer, Boid.Position.Y - Previous.Position.Y);
+			// Wraps around the turn by itself.
+			Heading = Boid.Heading - Previous.Heading;
+		}
+		else
+		{
+			WriteSigned(Writer, Boid.Position.X);
+			WriteSigned(Writer, Boid.Position.Y);
+		}
+		Writer << Heading;
+	}
+}
+
+bool DecodeBoidSnapshot(const TArray<uint8>& Bytes, TFunctionRef<const FBoidReplicationSnapshot*(uint32)> FindBaseline,
+	FBoidReplicationSnapshot& OutSnapshot)
+{
+	FMemoryReader Reader(Bytes);
+
+	uint32 BaselineSequence = 0;
+	uint32 Count = 0;
+	uint8 SameIds = 0;
+	Reader.SerializeIntPacked(OutSnapshot.Sequence);
+	Reader.SerializeIntPacked(BaselineSequence);
+	Reader << OutSnapshot.Time;
+	Reader.SerializeIntPacked(Count);
+	Reader << SameIds;
+
+	// Every boid takes three bytes or more, anything claiming more boids than bytes is broken.
+	if (Reader.IsError() || Count > static_cast<uint32>(Bytes.Num()))
+	{
+		return false;
+	}
+
+	const FBoidReplicationSnapshot* Baseline = nullptr;
+	if (BaselineSequence != 0)
+	{
+		Baseline = FindBaseline(BaselineSequence);
+		if (!Baseline)
+		{
+			return false;
+		}
+	}
+	if (SameIds && (!Baseline || Baseline->Boids.Num() != static_cast<int32>(Count)))
+	{
+		return false;
+	}
+
+	OutSnapshot.Boids.SetNumUninitialized(Count);
+	int32 BaselineIndex = 0;
+	int32 PreviousId = -1;
+
+	for (int32 i = 0; i < OutSnapshot.Boids.Num(); i++)
+	{
+		FBoidReplicatedBoid& Boid = OutSnapshot.Boids[i];
+		if (SameIds)
+		{
+			Boid.Id = Baseline->Boids[i].Id;
+		}
+		else
+		{
+			uint32 IdGap = 0;
+			Reader.SerializeIntPacked(IdGap);
+			Boid.Id = PreviousId + 1 + static_cast<int32>(IdGap);
+		}
+		PreviousId = Boid.Id;
+
+		Boid.Position.X = ReadSigned(Reader);
+		Boid.Position.Y = ReadSigned(Reader);
+		Reader << Boid.Heading;
+
+		while (Baseline && Baseline->Boids.IsValidIndex(BaselineIndex) && Baseline->Boids[BaselineIndex].Id < Boid.Id)
+		{
+			BaselineIndex++;
+		}
+
+		if (Baseline && Baseline->Boids.IsValidIndex(BaselineIndex) && Baseline->Boids[BaselineIndex].Id == Boid.Id)
+		{
+			const FBoidReplicatedBoid& Previous = Baseline->Boids[BaselineIndex];
+			Boid.Position += Previous.Position;
+			Boid.Heading += Previous.Heading;
+		}
+	}
+
+	return !Reader.IsError();
+}
+
+void FBoidSnapshotSender::BuildSnapshot(const TArray<int32>& Ids, const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities, float Time,
+	TArray<uint8>& OutBytes)
+{
+	const int32 Num = Ids.Num();
+	const float RadiusSquared = FMath::Square(Settings.RelevancyRadius);
+	Relevant.Reset();
+	DistancesSquared.SetNumUninitialized(Num);
+
+	for (int32 i = 0; i < Num; i++)
+	{
+		DistancesSquared[i] = GetWrappedOffset(ViewPosition, Positions[i], Settings).SizeSquared();
+		if (Settings.RelevancyRadius <= 0 || DistancesSquared[i] <= RadiusSquared)
+		{
+			Relevant.Add(i);
+		}
+	}
+
+	const auto ByDistance = [this](int32 A, int32 B) { return DistancesSquared[A] < DistancesSquared[B]; };
+	bool IsByDistance = false;
+	if (Settings.MaxBoids > 0 && Relevant.Num() > Settings.MaxBoids)
+	{
+		Relevant.Sort(ByDistance);
+		Relevant.SetNum(Settings.MaxBoids, false);
+		IsByDistance = true;
+	}
+
+	FBoidReplicationSnapshot Snapshot;
+	Snapshot.Sequence = NextSequence++;
+	Snapshot.Time = Time;
+	const FBoidReplicationSnapshot* Baseline = FindSent(Acknowledged);
+	for (;;)
+	{
+		Snapshot.Boids.Reset(Relevant.Num());
+		for (const int32 i : Relevant)
+		{
+			Snapshot.Boids.Add(FBoidReplicatedBoid{ Ids[i], QuantiseBoidPosition(Positions[i], Settings.Precision), QuantiseBoidHeading(Velocities[i]) });
+		}
+		Snapshot.Boids.Sort([](const FBoidReplicatedBoid& A, const FBoidReplicatedBoid& B) { return A.Id < B.Id; });
+
+		EncodeBoidSnapshot(Snapshot, Baseline, OutBytes);
+		if (Settings.MaxBytes <= 0 || OutBytes.Num() <= Settings.MaxBytes || Relevant.Num() == 0)
+		{
+			break;
+		}
+
+		// Too big, keep the nearest boids in proportion to the overshoot with a tenth to spare. Boids new
+		// to the baseline cost the most, so the nearest go out first and the rest follow as they are acknowledged.
+		if (!IsByDistance)
+		{
+			Relevant.Sort(ByDistance);
+			IsByDistance = true;
+		}
+		const int32 NumKept = static_cast<int32>(static_cast<int64>(Relevant.Num()) * Settings.MaxBytes * 9 / (10 * static_cast<int64>(OutBytes.Num())));
+		Relevant.SetNum(FMath::Min(NumKept, Relevant.Num() - 1), false);
+	}
+
+	LastNumBoids = Snapshot.Boids.Num();
+
+	Sent.Add(MoveTemp(Snapshot));
+	if (Sent.Num() > BoidSnapshotHistory)
+	{
+		Sent.RemoveAt(0, Sent.Num() - BoidSnapshotHistory, false);
+	}
+}
+
+void FBoidSnapshotSender::Acknowledge(uint32 Sequence)
+{
+	// Acknowledgements can arrive out of order, only ever move forward.
+	if (Sequence > Acknowledged && FindSent(Sequence))
+	{
+		Acknowledged = Sequence;
+	}
+}
+
+const FBoidReplicationSnapshot* FBoidSnapshotSender::FindSent(uint32 Sequence) const
+{
+	for (const FBoidReplicationSnapshot& Snapshot : Sent)
+	{
+		if (Snapshot.Sequence == Sequence)
+		{
+			return &Snapshot;
+		}
+	}
+	return nullptr;
+}
+
+bool FBoidSnapshotReceiver::Receive(const TArray<uint8>& Bytes, uint32& OutSequence)
+{
+	FBoidReplicationSnapshot Snapshot;
+	const bool Decoded = DecodeBoidSnapshot(Bytes, [this](uint32 Sequence) -> const FBoidReplicationSnapshot*
+	{
+		for (const FBoidReplicationSnapshot& Previous : Received)
+		{
+			if (Previous.Sequence == Sequence)
+			{
+				return &Previous;
+			}
+		}
+		return nullptr;
+	}, Snapshot);
+
+	if (!Decoded || (Received.Num() > 0 && Snapshot.Sequence <= Received.Last().Sequence))
+	{
+		return false;
+	}
+
+	OutSequence = Snapshot.Sequence;
+	Received.Add(MoveTemp(Snapshot));
+	if (Received.Num() > BoidSnapshotHistory)
+	{
+		Received.RemoveAt(0, Received.Num() - BoidSnapshotHistory, false);
+	}
+	return true;
+}
+
+void FBoidSnapshotReceiver::Sample(float Time, TArray<FBoidReplicatedState>& OutStates) const
+{
+	OutStates.Reset();
+	if (Received.Num() == 0)
+	{
+		return;
+	}
+
+	// The first snapshot after Time, or the newest if Time is past all of them.
+	int32 Next = 0;
+	while (Next < Received.Num() - 1 && Received[Next].Time <= Time)
+	{
+		Next++;
+	}
+
+	const FBoidReplicationSnapshot& To = Received[Next];
+	const FBoidReplicationSnapshot* From = Next > 0 && To.Time > Time ? &Received[Next - 1] : nullptr;
+	const float Alpha = From && To.Time > From->Time ? FMath::Clamp((Time - From->Time) / (To.Time - From->Time), 0.0f, 1.0f) : 1.0f;
+
+	OutStates.Reserve(To.Boids.Num());
+	int32 FromIndex = 0;
+
+	for (const FBoidReplicatedBoid& Boid : To.Boids)
+	{
+		FBoidReplicatedState& State = OutStates.AddDefaulted_GetRef();
+		State.Id = Boid.Id;
+		State.Position = Unpack(Boid.Position);
+		State.Heading = UnpackHeading(Boid.Heading);
+
+		while (From && From->Boids.IsValidIndex(FromIndex) && From->Boids[FromIndex].Id < Boid.Id)
+		{
+			FromIndex++;
+		}
+
+		// Boids that just became relevant have nothing to come from.
+		if (From && From->Boids.IsValidIndex(FromIndex) && From->Boids[FromIndex].Id == Boid.Id)
+		{
+			const FVector2D Start = Unpack(From->Boids[FromIndex].Position);
+			State.Position = Start + GetWrappedOffset(Start, State.Position, Settings) * Alpha;
+			if (Settings.IsWrapped)
+			{
+				State.Position.X -= Settings.Area.X * FMath::FloorToFloat(State.Position.X / Settings.Area.X);
+				State.Position.Y -= Settings.Area.Y * FMath::FloorToFloat(State.Position.Y / Settings.Area.Y);
+			}
+
+			const FVector2D Heading = FMath::Lerp(UnpackHeading(From->Boids[FromIndex].Heading), State.Heading, Alpha);
+			State.Heading = Heading.GetSafeNormal(SMALL_NUMBER);
+			if (State.Heading.IsZero())
+			{
+				State.Heading = UnpackHeading(Boid.Heading);
+			}
+		}
+	}
+}
+
+float FBoidSnapshotReceiver::GetLatestTime() const
+{
+	return Received.Num() > 0 ? Received.Last().Time : 0.0f;
+}
+
+FVector2D FBoidSnapshotReceiver::Unpack(FIntPoint Position) const
+{
+	return FVector2D(Position.X * Settings.Precision, Position.Y * Settings.Precision);
+}
+
+FVector2D FBoidSnapshotReceiver::UnpackHeading(uint8 Heading)
+{
+	const float Angle = Heading * (2.0f * PI / 256.0f);
+	return FVector2D(FMath::Cos(Angle), FMath::Sin(Angle));
+}
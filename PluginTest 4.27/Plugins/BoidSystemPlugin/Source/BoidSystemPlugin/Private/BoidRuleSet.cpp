@@ -0,0 +1,33 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidRuleSet.h"
+
+const FBoidRuleDesc* FindBoidRuleDesc(const TArray<FBoidRuleDesc>& RuleDescs, EBoidRuleType Type)
+{
+	for (const FBoidRuleDesc& Desc : RuleDescs)
+	{
+		if (Desc.Type == Type)
+		{
+			return &Desc;
+		}
+	}
+
+	return nullptr;
+}
+
+const FBoidRuleDesc* UBoidRuleSet::FindRule(EBoidRuleType Type) const
+{
+	return FindBoidRuleDesc(Rules, Type);
+}
+
+void UBoidRuleSet::SetRuleWeight(EBoidRuleType Type, float Weight)
+{
+	for (FBoidRuleDesc& Desc : Rules)
+	{
+		if (Desc.Type == Type)
+		{
+			Desc.Weight = Weight;
+		}
+	}
+}
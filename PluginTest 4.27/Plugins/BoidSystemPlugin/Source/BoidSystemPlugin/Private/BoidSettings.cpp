@@ -1,5 +1,12 @@
 ﻿#include "BoidSettings.h"
 
+#include "Boid.h"
+#include "BoidSystemPlugin.h"
+
+DECLARE_CYCLE_STAT(TEXT("Rebuild Grid"), STAT_BoidRebuildGrid, STATGROUP_Boids);
+DECLARE_CYCLE_STAT(TEXT("Morton Reorder"), STAT_BoidMortonReorder, STATGROUP_Boids);
+DECLARE_CYCLE_STAT(TEXT("Neighbour Search"), STAT_BoidNeighbourSearch, STATGROUP_Boids);
+
 BoidSettings::BoidSettings()
 {
 }
@@ -10,3 +17,229 @@ BoidSettings::~BoidSettings()
 	
 	ListOfBoids.Empty();
 }
+
+FBoidHandle BoidSettings::AddBoid(ABoid* Boid)
+{
+	const int32 Index = ListOfBoids.Add(Boid);
+
+	int32 Id;
+	if (FreeHandles.Num() > 0)
+	{
+		Id = FreeHandles.Pop(false);
+		HandleToIndex[Id] = Index;
+	}
+	else
+	{
+		Id = HandleToIndex.Add(Index);
+	}
+	IndexToHandle.Add(Id);
+	Revision++;
+
+	if (TrackChanges)
+	{
+		while (AddedSlots.Num() <= Id)
+		{
+			AddedSlots.Add(INDEX_NONE);
+		}
+		AddedSlots[Id] = AddedSinceTaken.Add(FBoidHandle{ Id });
+	}
+
+	return FBoidHandle{ Id };
+}
+
+void BoidSettings::RemoveBoid(FBoidHandle Handle)
+{
+	const int32 Index = GetIndex(Handle);
+
+	if (ListOfBoids.IsValidIndex(Index) && ListOfBoids[Index])
+	{
+		ListOfBoids[Index] = nullptr;
+		HandleToIndex[Handle.Id] = INDEX_NONE;
+		NumRemoved++;
+		Revision++;
+
+		if (TrackChanges)
+		{
+			// Gone before anyone saw it join, drop the join instead.
+			const int32 AddedSlot = AddedSlots.IsValidIndex(Handle.Id) ? AddedSlots[Handle.Id] : INDEX_NONE;
+			if (AddedSlot != INDEX_NONE)
+			{
+				AddedSinceTaken.RemoveAtSwap(AddedSlot, 1, false);
+				if (AddedSinceTaken.IsValidIndex(AddedSlot))
+				{
+					AddedSlots[AddedSinceTaken[AddedSlot].Id] = AddedSlot;
+				}
+				AddedSlots[Handle.Id] = INDEX_NONE;
+			}
+			else
+			{
+				RemovedSinceTaken.Add(Handle);
+			}
+		}
+	}
+}
+
+void BoidSettings::SetTrackChanges(bool Track)
+{
+	TrackChanges = Track;
+	AddedSinceTaken.Reset();
+	RemovedSinceTaken.Reset();
+	AddedSlots.Reset();
+}
+
+void BoidSettings::TakeChanges(TArray<FBoidHandle>& OutAdded, TArray<FBoidHandle>& OutRemoved)
+{
+	for (const FBoidHandle& Handle : AddedSinceTaken)
+	{
+		AddedSlots[Handle.Id] = INDEX_NONE;
+	}
+	OutAdded = MoveTemp(AddedSinceTaken);
+	OutRemoved = MoveTemp(RemovedSinceTaken);
+	AddedSinceTaken.Reset();
+	RemovedSinceTaken.Reset();
+}
+
+void BoidSettings::CompactRemovedBoids()
+{
+	if (NumRemoved == 0)
+	{
+		return;
+	}
+
+	// Keeps the remaining boids in order, so the Morton layout survives.
+	int32 Write = 0;
+	for (int32 Read = 0; Read < ListOfBoids.Num(); Read++)
+	{
+		if (ListOfBoids[Read])
+		{
+			ListOfBoids[Write] = ListOfBoids[Read];
+			IndexToHandle[Write] = IndexToHandle[Read];
+			HandleToIndex[IndexToHandle[Write]] = Write;
+			Write++;
+		}
+		else
+		{
+			FreeHandles.Add(IndexToHandle[Read]);
+		}
+	}
+
+	ListOfBoids.SetNum(Write, false);
+	IndexToHandle.SetNum(Write, false);
+	NumRemoved = 0;
+}
+
+void BoidSettings::Reset()
+{
+	ListOfBoids.Empty();
+	Positions.Empty();
+	Velocities.Empty();
+	IndexToHandle.Empty();
+	HandleToIndex.Empty();
+	FreeHandles.Empty();
+	NumRemoved = 0;
+	Revision++;
+	SetTrackChanges(false);
+	Neighbours = FBoidNeighbourLists();
+}
+
+int32 BoidSettings::GetIndex(FBoidHandle Handle) const
+{
+	return HandleToIndex.IsValidIndex(Handle.Id) ? HandleToIndex[Handle.Id] : INDEX_NONE;
+}
+
+ABoid* BoidSettings::GetBoid(FBoidHandle Handle) const
+{
+	const int32 Index = GetIndex(Handle);
+	return ListOfBoids.IsValidIndex(Index) ? ListOfBoids[Index] : nullptr;
+}
+
+void BoidSettings::RebuildGrid(FVector2D Area, float VisualRange, bool IsWrapped, bool Reorder)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidRebuildGrid);
+
+	CompactRemovedBoids();
+
+	Positions.Reset(ListOfBoids.Num());
+	Velocities.Reset(ListOfBoids.Num());
+
+	for (const ABoid* Boid : ListOfBoids)
+	{
+		Positions.Add(Boid->GetPosition());
+		Velocities.Add(Boid->GetVelocity2D());
+	}
+
+	if (AutoTuneGrid)
+	{
+		// Reads the grid as built last frame, so it has to run before it gets reconfigured.
+		GridTuner.Tune(Grid, VisualRange);
+		Grid.Configure(Area, GridTuner.GetCellSize(), IsWrapped);
+		Grid.SetMaxBoidsPerCell(GridTuner.GetMaxBoidsPerCell());
+	}
+	else
+	{
+		Grid.Configure(Area, VisualRange, IsWrapped);
+		Grid.SetMaxBoidsPerCell(0);
+	}
+
+	if (Reorder)
+	{
+		ReorderByMorton();
+	}
+
+	Grid.Build(Positions);
+}
+
+void BoidSettings::BuildNeighbours(float VisualRange)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidNeighbourSearch);
+
+	FrameArena.Reset();
+	Neighbours.SetMaxNeighbours(MaxNeighbours);
+	Neighbours.Build(NeighbourBackends.Select(Grid, VisualRange), Grid, Positions, VisualRange, FrameArena);
+}
+
+FBoidNeighbourhood BoidSettings::GetNeighbourhood(int32 Index) const
+{
+	if (Index < 0 || Index >= Neighbours.GetNumBoids())
+	{
+		return FBoidNeighbourhood();
+	}
+
+	return FBoidNeighbourhood(Neighbours, Grid, Positions, Velocities, ListOfBoids, Index);
+}
+
+void BoidSettings::ReorderByMorton()
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidMortonReorder);
+
+	const int32 Num = ListOfBoids.Num();
+
+	MortonKeys.SetNumUninitialized(Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		const FIntPoint Cell = Grid.GetCell(Positions[i]);
+		MortonKeys[i] = EncodeMorton2D(Cell.X, Cell.Y);
+	}
+
+	const TArray<int32>& Order = Sorter.Sort(MortonKeys);
+
+	// Gather the boids and their handles through the new order.
+	ScratchBoids.SetNumUninitialized(Num);
+	ScratchHandles.SetNumUninitialized(Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		ScratchBoids[i] = ListOfBoids[Order[i]];
+		ScratchHandles[i] = IndexToHandle[Order[i]];
+	}
+	Swap(ListOfBoids, ScratchBoids);
+	Swap(IndexToHandle, ScratchHandles);
+
+	// The position and velocity arrays are rebuilt from the actors every frame, so reorder them in place
+	// through the boid array instead of keeping more scratch copies around.
+	for (int32 i = 0; i < Num; i++)
+	{
+		Positions[i] = ListOfBoids[i]->GetPosition();
+		Velocities[i] = ListOfBoids[i]->GetVelocity2D();
+		HandleToIndex[IndexToHandle[i]] = i;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,307 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidShard.h"
+
+#include "BoidSystemPlugin.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+DECLARE_CYCLE_STAT(TEXT("Shard Step"), STAT_BoidShardStep, STATGROUP_Boids);
+DECLARE_CYCLE_STAT(TEXT("Shard Exchange"), STAT_BoidShardExchange, STATGROUP_Boids);
+
+static const uint32 BoidShardExchangeMagic = 0x58454853;
+static const uint32 BoidShardBoidsMagic = 0x44494F42;
+static const int32 BoidShardVersion = 1;
+
+// Into [0, Size), as FBoidSpatialGrid wraps positions.
+static float WrapCoordinate(float Value, float Size)
+{
+	Value = FMath::Fmod(Value, Size);
+	if (Value < 0)		{ Value += Size; }
+	if (Value >= Size)	{ Value = 0; }
+	return Value;
+}
+
+void FBoidShard::Init(const FBoidSimulationParams& _Params, const FBoidBody& _Body, int32 _Index, int32 _NumShards)
+{
+	Params = _Params;
+	Body = _Body;
+	NumShards = FMath::Max(_NumShards, 1);
+	Index = FMath::Clamp(_Index, 0, NumShards - 1);
+	Halo = Params.VisualRange;
+
+	const float StripWidth = Params.Area.X / NumShards;
+	MinX = StripWidth * Index;
+	MaxX = Index == NumShards - 1 ? Params.Area.X : StripWidth * (Index + 1);
+
+	LocalParams = Params;
+	LocalParams.Area = FVector2D(MaxX - MinX + Halo * 2, Params.Area.Y + Halo * 2);
+	LocalParams.IsWrapped = false;
+	LocalParams.Pipeline.Get<FBoundsKernel>().IsBounded = false;
+
+	StepIndex = 0;
+	NumGhosts = 0;
+	Ids.Reset();
+	Positions.Reset();
+	Velocities.Reset();
+	for (int32 Side = 0; Side < 2; Side++)
+	{
+		LeavingIds[Side].Reset();
+		LeavingPositions[Side].Reset();
+		LeavingVelocities[Side].Reset();
+		GhostPositions[Side].Reset();
+		GhostVelocities[Side].Reset();
+	}
+}
+
+void FBoidShard::AddBoids(const TArray<FVector2D>& _Positions, const TArray<FVector2D>& _Velocities, uint32 FirstId)
+{
+	for (int32 i = 0; i < _Positions.Num(); i++)
+	{
+		const FVector2D Position(WrapCoordinate(_Positions[i].X, Params.Area.X), WrapCoordinate(_Positions[i].Y, Params.Area.Y));
+		if (Position.X >= MinX && Position.X < MaxX)
+		{
+			Ids.Add(FirstId + i);
+			Positions.Add(Position);
+			Velocities.Add(_Velocities[i]);
+		}
+	}
+}
+
+int32 FBoidShard::GetMaxShards(const FBoidSimulationParams& Params)
+{
+	return FMath::Max(FMath::FloorToInt(Params.Area.X / FMath::Max(Params.VisualRange, 1.0f)), 1);
+}
+
+float FBoidShard::GetEdgeOffset(float X, float Edge) const
+{
+	const float Offset = X - Edge;
+	return Offset - Params.Area.X * FMath::RoundToFloat(Offset / Params.Area.X);
+}
+
+void FBoidShard::WriteExchange(TArray<uint8>& OutToLeft, TArray<uint8>& OutToRight)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidShardExchange);
+
+	// Keep the boids still in the strip, the rest go to the side they left by.
+	int32 NumKept = 0;
+	for (int32 i = 0; i < Ids.Num(); i++)
+	{
+		if (Positions[i].X >= MinX && Positions[i].X < MaxX)
+		{
+			Ids[NumKept] = Ids[i];
+			Positions[NumKept] = Positions[i];
+			Velocities[NumKept] = Velocities[i];
+			NumKept++;
+		}
+		else
+		{
+			const int32 Side = GetEdgeOffset(Positions[i].X, (MinX + MaxX) * 0.5f) < 0 ? 0 : 1;
+			LeavingIds[Side].Add(Ids[i]);
+			LeavingPositions[Side].Add(Positions[i]);
+			LeavingVelocities[Side].Add(Velocities[i]);
+		}
+	}
+	Ids.SetNum(NumKept, false);
+	Positions.SetNum(NumKept, false);
+	Velocities.SetNum(NumKept, false);
+
+	WriteSide(OutToLeft, 0);
+	WriteSide(OutToRight, 1);
+}
+
+void FBoidShard::WriteSide(TArray<uint8>& OutMessage, int32 Side)
+{
+	// Own boids within visual range of the edge on that side.
+	SendPositions.Reset();
+	SendVelocities.Reset();
+	for (int32 i = 0; i < Positions.Num(); i++)
+	{
+		const float Distance = Side == 0 ? Positions[i].X - MinX : MaxX - Positions[i].X;
+		if (Distance <= Halo)
+		{
+			SendPositions.Add(Positions[i]);
+			SendVelocities.Add(Velocities[i]);
+		}
+	}
+
+	OutMessage.Reset();
+	FMemoryWriter Writer(OutMessage);
+
+	uint32 Magic = BoidShardExchangeMagic;
+	int32 Version = BoidShardVersion;
+	uint64 Step = StepIndex;
+	int32 From = Index;
+	int32 To = Side;
+	Writer << Magic << Version << Step << From << To;
+	Writer << LeavingIds[Side] << LeavingPositions[Side] << LeavingVelocities[Side];
+	Writer << SendPositions << SendVelocities;
+}
+
+bool FBoidShard::ReadExchange(const TArray<uint8>& FromLeft, const TArray<uint8>& FromRight)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidShardExchange);
+
+	// The left neighbour sent this to its right and the other way round.
+	if (!ReadSide(FromLeft, 1) || !ReadSide(FromRight, 0))
+	{
+		return false;
+	}
+
+	// Own boids first so the step's first entries are theirs, then everything around them.
+	StepPositions.Reset();
+	StepVelocities.Reset();
+	for (int32 i = 0; i < Positions.Num(); i++)
+	{
+		AddStepBoid(Positions[i], Velocities[i], 2);
+	}
+	for (int32 Side = 0; Side < 2; Side++)
+	{
+		for (int32 i = 0; i < GhostPositions[Side].Num(); i++)
+		{
+			AddStepBoid(GhostPositions[Side][i], GhostVelocities[Side][i], Side);
+		}
+
+		// Those that just left are still close enough to matter here.
+		for (int32 i = 0; i < LeavingPositions[Side].Num(); i++)
+		{
+			AddStepBoid(LeavingPositions[Side][i], LeavingVelocities[Side][i], Side);
+		}
+		LeavingIds[Side].Reset();
+		LeavingPositions[Side].Reset();
+		LeavingVelocities[Side].Reset();
+	}
+	AddWrapGhosts();
+
+	NumGhosts = StepPositions.Num() - Positions.Num();
+	StepBodies.Init(Body, StepPositions.Num());
+	return true;
+}
+
+bool FBoidShard::ReadSide(const TArray<uint8>& Message, int32 Side)
+{
+	FMemoryReader Reader(Message);
+
+	uint32 Magic = 0;
+	int32 Version = 0;
+	uint64 Step = 0;
+	int32 From = 0;
+	int32 To = 0;
+	Reader << Magic << Version;
+	if (Magic != BoidShardExchangeMagic || Version != BoidShardVersion)
+	{
+		return false;
+	}
+	Reader << Step << From << To;
+
+	// Boids crossing into this strip, appended as they are.
+	TArray<uint32> ArrivingIds;
+	TArray<FVector2D> ArrivingPositions;
+	TArray<FVector2D> ArrivingVelocities;
+	Reader << ArrivingIds << ArrivingPositions << ArrivingVelocities;
+	Reader << GhostPositions[1 - Side] << GhostVelocities[1 - Side];
+	if (Reader.IsError() || Step != StepIndex || To != Side || ArrivingIds.Num() != ArrivingPositions.Num() || ArrivingIds.Num() != ArrivingVelocities.Num()
+		|| GhostPositions[1 - Side].Num() != GhostVelocities[1 - Side].Num())
+	{
+		UE_LOG(LogBoids, Warning, TEXT("Shard %d got a bad exchange message from shard %d for step %llu"), Index, From, Step);
+		return false;
+	}
+
+	for (int32 i = 0; i < ArrivingIds.Num(); i++)
+	{
+		Ids.Add(ArrivingIds[i]);
+		Positions.Add(FVector2D(WrapCoordinate(ArrivingPositions[i].X, Params.Area.X), ArrivingPositions[i].Y));
+		Velocities.Add(ArrivingVelocities[i]);
+	}
+	return true;
+}
+
+void FBoidShard::AddStepBoid(FVector2D Position, FVector2D Velocity, int32 Side)
+{
+	// Left of the strip comes out negative, right of it past the strip's width.
+	float X = Position.X - MinX;
+	if (Side == 0)
+	{
+		X = GetEdgeOffset(Position.X, MinX);
+	}
+	else if (Side == 1)
+	{
+		X = MaxX - MinX + GetEdgeOffset(Position.X, MaxX);
+	}
+
+	StepPositions.Add(FVector2D(X + Halo, Position.Y + Halo));
+	StepVelocities.Add(Velocity);
+}
+
+void FBoidShard::AddWrapGhosts()
+{
+	const int32 Num = StepPositions.Num();
+	for (int32 i = 0; i < Num; i++)
+	{
+		// Copies, the arrays may grow under a reference to their own element.
+		const FVector2D Position = StepPositions[i];
+		const FVector2D Velocity = StepVelocities[i];
+		if (Position.Y < Halo * 2)
+		{
+			StepPositions.Add(FVector2D(Position.X, Position.Y + Params.Area.Y));
+			StepVelocities.Add(Velocity);
+		}
+		else if (Position.Y >= Params.Area.Y)
+		{
+			StepPositions.Add(FVector2D(Position.X, Position.Y - Params.Area.Y));
+			StepVelocities.Add(Velocity);
+		}
+	}
+}
+
+void FBoidShard::Step(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidShardStep);
+
+	// The strip's FBoidSimulation is set up again every step, its ghosts change completely.
+	Simulation.Init(StepPositions, StepVelocities, StepBodies);
+	Simulation.SetParams(LocalParams);
+	Simulation.Step(DeltaTime);
+	Simulation.CopyState(StepState);
+	StepIndex++;
+
+	// Boids that left the strip stay here until the next exchange hands them on.
+	const FVector2D Origin(MinX - Halo, -Halo);
+	for (int32 i = 0; i < Ids.Num(); i++)
+	{
+		const FVector2D Local = StepState.Positions[i] + Origin;
+		Positions[i] = FVector2D(WrapCoordinate(Local.X, Params.Area.X), WrapCoordinate(Local.Y, Params.Area.Y));
+		Velocities[i] = StepState.Velocities[i];
+	}
+}
+
+void FBoidShard::WriteBoids(TArray<uint8>& OutMessage) const
+{
+	OutMessage.Reset();
+	FMemoryWriter Writer(OutMessage);
+
+	uint32 Magic = BoidShardBoidsMagic;
+	int32 Version = BoidShardVersion;
+	uint64 Step = StepIndex;
+	TArray<uint32> SavedIds = Ids;
+	TArray<FVector2D> SavedPositions = Positions;
+	TArray<FVector2D> SavedVelocities = Velocities;
+	Writer << Magic << Version << Step << SavedIds << SavedPositions << SavedVelocities;
+}
+
+bool FBoidShard::ReadBoids(const TArray<uint8>& Message, uint64& OutStepIndex, TArray<uint32>& OutIds,
+	TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities)
+{
+	FMemoryReader Reader(Message);
+
+	uint32 Magic = 0;
+	int32 Version = 0;
+	Reader << Magic << Version;
+	if (Magic != BoidShardBoidsMagic || Version != BoidShardVersion)
+	{
+		return false;
+	}
+	Reader << OutStepIndex << OutIds << OutPositions << OutVelocities;
+	return !Reader.IsError() && OutIds.Num() == OutPositions.Num() && OutIds.Num() == OutVelocities.Num();
+}
@@ -0,0 +1,109 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidShardCommandlet.h"
+
+#include "BoidBatchCommandlet.h"
+#include "BoidShard.h"
+#include "BoidShardProcess.h"
+#include "BoidSystemPlugin.h"
+#include "Misc/Paths.h"
+
+UBoidShardCommandlet::UBoidShardCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+int32 UBoidShardCommandlet::Main(const FString& Params)
+{
+	FBoidBatchScenario Scenario;
+	if (!UBoidBatchCommandlet::ParseScenario(Params, Scenario))
+	{
+		return 1;
+	}
+	if (!Scenario.Params.IsWrapped)
+	{
+		UE_LOG(LogBoids, Error, TEXT("BoidShard splits a wrapped flock, leave out -Bounded"));
+		return 1;
+	}
+
+	int32 NumShards = 2;
+	int32 Port = 7820;
+	FString Output = FPaths::ProjectSavedDir() / TEXT("Boids/Shards.btrj");
+	FParse::Value(*Params, TEXT("Shards="), NumShards);
+	FParse::Value(*Params, TEXT("Port="), Port);
+	FParse::Value(*Params, TEXT("Output="), Output);
+
+	if (FParse::Param(*Params, TEXT("Worker")))
+	{
+		int32 Index = 0;
+		FParse::Value(*Params, TEXT("Index="), Index);
+		return FBoidShardWorker::Run(Scenario, Index, NumShards, Port) ? 0 : 1;
+	}
+
+	// Workers get the scenario back as switches, floats written out in full so they spawn the same flock.
+	FString WorkerSwitches = FString::Printf(TEXT("-Boids=%d -Seed=%d -Seconds=%.9g -DeltaTime=%.9g -RecordInterval=%d -Area=%.9g -VisualRange=%.9g -Speed=%.9g")
+		TEXT(" -Cohesion=%.9g -Separation=%.9g -Alignment=%.9g -Bounds=%.9g"),
+		Scenario.NumBoids, Scenario.Seed, Scenario.SimulatedSeconds, Scenario.DeltaTime, Scenario.RecordInterval, Scenario.Params.Area.X,
+		Scenario.Params.VisualRange, Scenario.Body.Speed, Scenario.Params.Pipeline.Get<FCohesionKernel>().Weight,
+		Scenario.Params.Pipeline.Get<FSeparationKernel>().Weight, Scenario.Params.Pipeline.Get<FAlignmentKernel>().Weight,
+		Scenario.Params.Pipeline.Get<FBoundsKernel>().Weight);
+	if (Scenario.Params.UseFixedPoint)
+	{
+		WorkerSwitches += TEXT(" -FixedPoint");
+	}
+
+	const int32 MaxShards = FBoidShard::GetMaxShards(Scenario.Params);
+	if (NumShards > MaxShards)
+	{
+		UE_LOG(LogBoids, Warning, TEXT("%d shards would be narrower than the visual range, using %d"), NumShards, MaxShards);
+		NumShards = MaxShards;
+	}
+
+	TArray<int32> ShardCounts;
+	if (FParse::Param(*Params, TEXT("Sweep")))
+	{
+		for (int32 Count = 1; Count < NumShards; Count *= 2)
+		{
+			ShardCounts.Add(Count);
+		}
+	}
+	ShardCounts.Add(NumShards);
+
+	TArray<FBoidShardResult> Results;
+	for (int32 Count : ShardCounts)
+	{
+		FBoidShardResult Result;
+		if (!FBoidShardCoordinator::Run(Scenario, Count, Port, WorkerSwitches, Output, Result))
+		{
+			return 1;
+		}
+		Results.Add(Result);
+	}
+
+	// Efficiency is the speedup over one process divided by the processes it took.
+	if (Results.Num() > 1)
+	{
+		const double BaseSeconds = Results[0].WallSeconds;
+		UE_LOG(LogBoids, Display, TEXT("Scaling of %d boids over %.1f simulated seconds:"), Scenario.NumBoids, Results[0].SimulatedSeconds);
+		for (const FBoidShardResult& Result : Results)
+		{
+			const double Speedup = Result.WallSeconds > 0 ? BaseSeconds / Result.WallSeconds : 0;
+			double MaxStepSeconds = 0;
+			double SumStepSeconds = 0;
+			for (const FBoidShardWorkerReport& Report : Result.Workers)
+			{
+				MaxStepSeconds = FMath::Max(MaxStepSeconds, Report.StepSeconds);
+				SumStepSeconds += Report.StepSeconds;
+			}
+			const double Balance = MaxStepSeconds > 0 ? SumStepSeconds / (MaxStepSeconds * Result.Workers.Num()) : 1;
+
+			UE_LOG(LogBoids, Display, TEXT("  %2d processes: %8.2f s, %5.2fx speedup, %3.0f%% efficiency, %3.0f%% load balance"),
+				Result.NumShards, Result.WallSeconds, Speedup, Speedup / Result.NumShards * 100.0, Balance * 100.0);
+		}
+	}
+	return 0;
+}
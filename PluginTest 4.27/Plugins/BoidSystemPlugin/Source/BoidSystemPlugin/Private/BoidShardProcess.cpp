@@ -0,0 +1,563 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidShardProcess.h"
+
+#include "BoidShard.h"
+#include "BoidSystemPlugin.h"
+#include "BoidTrajectoryFile.h"
+#include "HAL/PlatformProcess.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "SocketSubsystem.h"
+#include "Sockets.h"
+
+static const uint32 BoidShardHelloMagic = 0x4C484253;
+static const uint32 BoidShardStartMagic = 0x54534253;
+static const uint32 BoidShardReportMagic = 0x50524253;
+static const int32 BoidShardProcessVersion = 1;
+
+// Workers are whole engine processes, starting one can take a while.
+static const double BoidShardConnectSeconds = 120.0;
+// Longest a step may wait on a neighbour or a frame on a worker.
+static const double BoidShardMessageSeconds = 60.0;
+// Longest PumpLinks blocks on its sockets before it looks at all of them again.
+static const double BoidShardWaitSeconds = 0.001;
+// Longest message a link takes, far over any frame the workers send. A longer length can only be a broken stream.
+static const uint32 BoidShardMaxMessageBytes = 256 * 1024 * 1024;
+
+static ISocketSubsystem* GetBoidSocketSubsystem()
+{
+	return ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+}
+
+static TSharedRef<FInternetAddr> MakeLoopbackAddress(int32 Port)
+{
+	TSharedRef<FInternetAddr> Address = GetBoidSocketSubsystem()->CreateInternetAddr();
+	Address->SetLoopbackAddress();
+	Address->SetPort(Port);
+	return Address;
+}
+
+// Pump every link until IsDone, false if one is lost or the time runs out.
+static bool PumpLinks(const TArray<FBoidShardLink*>& Links, TFunctionRef<bool()> IsDone, double TimeoutSeconds)
+{
+	const double EndTime = FPlatformTime::Seconds() + TimeoutSeconds;
+	for (;;)
+	{
+		for (FBoidShardLink* Link : Links)
+		{
+			if (!Link->Pump())
+			{
+				return false;
+			}
+		}
+		if (IsDone())
+		{
+			return true;
+		}
+		if (FPlatformTime::Seconds() > EndTime)
+		{
+			return false;
+		}
+
+		// Neighbours are other processes on this machine, block rather than spin on the core they need. Each
+		// link gets a slice, a wait ends as soon as its socket has something.
+		for (FBoidShardLink* Link : Links)
+		{
+			Link->Wait(BoidShardWaitSeconds / Links.Num());
+		}
+	}
+}
+
+static void WriteControlMessage(TArray<uint8>& OutMessage, uint32 Magic, int32 Value)
+{
+	OutMessage.Reset();
+	FMemoryWriter Writer(OutMessage);
+	int32 Version = BoidShardProcessVersion;
+	Writer << Magic << Version << Value;
+}
+
+static bool ReadControlMessage(const TArray<uint8>& Message, uint32 Magic, int32& OutValue)
+{
+	FMemoryReader Reader(Message);
+	uint32 ReadMagic = 0;
+	int32 Version = 0;
+	Reader << ReadMagic << Version << OutValue;
+	return !Reader.IsError() && ReadMagic == Magic && Version == BoidShardProcessVersion;
+}
+
+FBoidShardLink::~FBoidShardLink()
+{
+	Close();
+}
+
+FSocket* FBoidShardLink::Listen(int32 Port, int32 MaxPending)
+{
+	FSocket* Listener = GetBoidSocketSubsystem()->CreateSocket(NAME_Stream, TEXT("Boid shard listener"), false);
+	if (!Listener)
+	{
+		return nullptr;
+	}
+
+	Listener->SetReuseAddr(true);
+	if (!Listener->Bind(*MakeLoopbackAddress(Port)) || !Listener->Listen(MaxPending))
+	{
+		UE_LOG(LogBoids, Error, TEXT("Could not listen on port %d"), Port);
+		CloseSocket(Listener);
+		return nullptr;
+	}
+	return Listener;
+}
+
+void FBoidShardLink::CloseSocket(FSocket* Socket)
+{
+	if (Socket)
+	{
+		Socket->Close();
+		GetBoidSocketSubsystem()->DestroySocket(Socket);
+	}
+}
+
+bool FBoidShardLink::Connect(int32 Port, double TimeoutSeconds)
+{
+	Close();
+
+	const TSharedRef<FInternetAddr> Address = MakeLoopbackAddress(Port);
+	const double EndTime = FPlatformTime::Seconds() + TimeoutSeconds;
+	while (FPlatformTime::Seconds() < EndTime)
+	{
+		Socket = GetBoidSocketSubsystem()->CreateSocket(NAME_Stream, TEXT("Boid shard link"), false);
+		if (Socket && Socket->Connect(*Address))
+		{
+			SetupSocket();
+			return true;
+		}
+
+		// Not listening yet.
+		CloseSocket(Socket);
+		Socket = nullptr;
+		FPlatformProcess::Sleep(0.05f);
+	}
+
+	UE_LOG(LogBoids, Error, TEXT("Could not connect to port %d"), Port);
+	return false;
+}
+
+bool FBoidShardLink::Accept(FSocket* Listener, double TimeoutSeconds)
+{
+	Close();
+
+	const double EndTime = FPlatformTime::Seconds() + TimeoutSeconds;
+	while (FPlatformTime::Seconds() < EndTime)
+	{
+		bool HasPendingConnection = false;
+		if (Listener->WaitForPendingConnection(HasPendingConnection, FTimespan::FromMilliseconds(100)) && HasPendingConnection)
+		{
+			Socket = Listener->Accept(TEXT("Boid shard link"));
+			if (Socket)
+			{
+				SetupSocket();
+				return true;
+			}
+		}
+	}
+
+	UE_LOG(LogBoids, Error, TEXT("No connection came in time"));
+	return false;
+}
+
+void FBoidShardLink::SetupSocket()
+{
+	// Halo messages are small and every step waits on them, so send them at once.
+	int32 NewSize = 0;
+	Socket->SetNonBlocking(true);
+	Socket->SetNoDelay(true);
+	Socket->SetSendBufferSize(4 * 1024 * 1024, NewSize);
+	Socket->SetReceiveBufferSize(4 * 1024 * 1024, NewSize);
+}
+
+void FBoidShardLink::Close()
+{
+	CloseSocket(Socket);
+	Socket = nullptr;
+	Outgoing.Reset();
+	SendOffset = 0;
+	Incoming.Reset();
+}
+
+void FBoidShardLink::Send(const TArray<uint8>& Message)
+{
+	check(uint32(Message.Num()) <= BoidShardMaxMessageBytes);
+	uint32 Length = Message.Num();
+	const int32 Offset = Outgoing.AddUninitialized(sizeof(Length) + Message.Num());
+	FMemory::Memcpy(Outgoing.GetData() + Offset, &Length, sizeof(Length));
+	FMemory::Memcpy(Outgoing.GetData() + Offset + sizeof(Length), Message.GetData(), Message.Num());
+}
+
+bool FBoidShardLink::Pump()
+{
+	if (!Socket)
+	{
+		return false;
+	}
+
+	while (SendOffset < Outgoing.Num())
+	{
+		int32 BytesSent = 0;
+		if (!Socket->Send(Outgoing.GetData() + SendOffset, Outgoing.Num() - SendOffset, BytesSent))
+		{
+			if (GetBoidSocketSubsystem()->GetLastErrorCode() != SE_EWOULDBLOCK)
+			{
+				return false;
+			}
+			break;
+		}
+		if (BytesSent <= 0)
+		{
+			break;
+		}
+		SendOffset += BytesSent;
+	}
+	if (SendOffset == Outgoing.Num())
+	{
+		Outgoing.Reset();
+		SendOffset = 0;
+	}
+
+	uint32 PendingBytes = 0;
+	while (Socket->HasPendingData(PendingBytes) && PendingBytes > 0)
+	{
+		const int32 Offset = Incoming.AddUninitialized(PendingBytes);
+		int32 BytesRead = 0;
+		if (!Socket->Recv(Incoming.GetData() + Offset, PendingBytes, BytesRead))
+		{
+			return false;
+		}
+		Incoming.SetNum(Offset + BytesRead, false);
+	}
+
+	return Socket->GetConnectionState() != SCS_ConnectionError;
+}
+
+bool FBoidShardLink::Receive(TArray<uint8>& OutMessage)
+{
+	uint32 Length = 0;
+	if (Incoming.Num() < int32(sizeof(Length)))
+	{
+		return false;
+	}
+	FMemory::Memcpy(&Length, Incoming.GetData(), sizeof(Length));
+	if (Length > BoidShardMaxMessageBytes)
+	{
+		// Nothing after it can be framed either, the next Pump reports the link lost.
+		UE_LOG(LogBoids, Error, TEXT("Shard link received a %u byte message, longer than the %u allowed, closing it"), Length, BoidShardMaxMessageBytes);
+		Close();
+		return false;
+	}
+	if (Incoming.Num() < int32(sizeof(Length) + Length))
+	{
+		return false;
+	}
+
+	OutMessage.Reset();
+	OutMessage.Append(Incoming.GetData() + sizeof(Length), Length);
+	Incoming.RemoveAt(0, sizeof(Length) + Length, false);
+	return true;
+}
+
+void FBoidShardLink::Wait(double TimeoutSeconds)
+{
+	if (Socket)
+	{
+		// A socket can nearly always be written to, so only wait on that while the send buffer is full.
+		Socket->Wait(IsSent() ? ESocketWaitConditions::WaitForRead : ESocketWaitConditions::WaitForReadOrWrite,
+			FTimespan::FromSeconds(TimeoutSeconds));
+	}
+}
+
+bool FBoidShardCoordinator::Run(const FBoidBatchScenario& Scenario, int32 NumShards, int32 Port, const FString& WorkerSwitches,
+	const FString& Path, FBoidShardResult& OutResult)
+{
+	OutResult = FBoidShardResult();
+	OutResult.NumShards = FMath::Clamp(NumShards, 1, FBoidShard::GetMaxShards(Scenario.Params));
+	const int32 RecordInterval = FMath::Max(Scenario.RecordInterval, 1);
+	const int32 NumSteps = FMath::Max(FMath::CeilToInt(Scenario.SimulatedSeconds / Scenario.DeltaTime), 0);
+	const int32 NumFrames = NumSteps / RecordInterval + 1;
+
+	FBoidTrajectoryHeader Header;
+	Header.NumBoids = Scenario.NumBoids;
+	Header.NumFrames = NumFrames;
+	Header.FrameInterval = Scenario.DeltaTime * RecordInterval;
+	Header.StepDeltaTime = Scenario.DeltaTime;
+	Header.AreaX = Scenario.Params.Area.X;
+	Header.AreaY = Scenario.Params.Area.Y;
+	Header.Flags = FBoidTrajectoryHeader::Wrapped | (Scenario.Params.UseFixedPoint ? FBoidTrajectoryHeader::FixedPoint : 0);
+	Header.Seed = Scenario.Seed;
+
+	FBoidTrajectoryWriter Writer;
+	FSocket* Listener = FBoidShardLink::Listen(Port, OutResult.NumShards);
+	if (!Listener || !Writer.Open(Path, Header))
+	{
+		FBoidShardLink::CloseSocket(Listener);
+		return false;
+	}
+
+	// Copies of this executable, with the project when there is one.
+	const FString Executable = FPlatformProcess::ExecutablePath();
+	const FString Project = FPaths::IsProjectFilePathSet() ? FString::Printf(TEXT("\"%s\" "), *FPaths::ConvertRelativePathToFull(FPaths::GetProjectFilePath())) : FString();
+	TArray<FProcHandle> Processes;
+	TArray<TUniquePtr<FBoidShardLink>> Links;
+	TArray<FBoidShardLink*> LinkPointers;
+
+	auto Fail = [&](const TCHAR* Reason)
+	{
+		UE_LOG(LogBoids, Error, TEXT("Sharded run over %d workers failed: %s"), OutResult.NumShards, Reason);
+		for (FProcHandle& Process : Processes)
+		{
+			FPlatformProcess::TerminateProc(Process, true);
+			FPlatformProcess::CloseProc(Process);
+		}
+		Links.Empty();
+		FBoidShardLink::CloseSocket(Listener);
+		Writer.Close(0);
+		return false;
+	};
+
+	for (int32 i = 0; i < OutResult.NumShards; i++)
+	{
+		const FString Arguments = FString::Printf(TEXT("%s-run=BoidShard %s -Worker -Index=%d -Shards=%d -Port=%d -unattended -nosplash"),
+			*Project, *WorkerSwitches, i, OutResult.NumShards, Port);
+		FProcHandle Process = FPlatformProcess::CreateProc(*Executable, *Arguments, false, true, true, nullptr, 0, nullptr, nullptr);
+		if (!Process.IsValid())
+		{
+			return Fail(TEXT("could not start a worker"));
+		}
+		Processes.Add(Process);
+	}
+
+	// Workers say which strip they are once connected.
+	TArray<uint8> Message;
+	Links.SetNum(OutResult.NumShards);
+	for (int32 NumConnected = 0; NumConnected < OutResult.NumShards; NumConnected++)
+	{
+		TUniquePtr<FBoidShardLink> Link = MakeUnique<FBoidShardLink>();
+		int32 Index = INDEX_NONE;
+		if (!Link->Accept(Listener, BoidShardConnectSeconds)
+			|| !PumpLinks({ Link.Get() }, [&]() { return Link->Receive(Message); }, BoidShardMessageSeconds)
+			|| !ReadControlMessage(Message, BoidShardHelloMagic, Index) || !Links.IsValidIndex(Index) || Links[Index].IsValid())
+		{
+			return Fail(TEXT("a worker did not connect"));
+		}
+		Links[Index] = MoveTemp(Link);
+	}
+	for (const TUniquePtr<FBoidShardLink>& Link : Links)
+	{
+		LinkPointers.Add(Link.Get());
+	}
+
+	// Every worker is listening for its neighbour by now.
+	const double StartTime = FPlatformTime::Seconds();
+	WriteControlMessage(Message, BoidShardStartMagic, OutResult.NumShards);
+	for (FBoidShardLink* Link : LinkPointers)
+	{
+		Link->Send(Message);
+	}
+
+	TArray<uint32> Ids;
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	for (int32 Frame = 0; Frame < NumFrames; Frame++)
+	{
+		FBoidTrajectorySample* Samples = Writer.GetFrame(Frame);
+		int32 NumMerged = 0;
+		for (FBoidShardLink* Link : LinkPointers)
+		{
+			uint64 StepIndex = 0;
+			if (!PumpLinks(LinkPointers, [&]() { return Link->Receive(Message); }, BoidShardMessageSeconds)
+				|| !FBoidShard::ReadBoids(Message, StepIndex, Ids, Positions, Velocities) || StepIndex != uint64(Frame) * RecordInterval)
+			{
+				return Fail(TEXT("a worker's frame did not come"));
+			}
+
+			// Boids keep their slot by id wherever they are.
+			for (int32 i = 0; i < Ids.Num(); i++)
+			{
+				if (Ids[i] < uint32(Scenario.NumBoids))
+				{
+					Samples[Ids[i]].Position = Positions[i];
+					Samples[Ids[i]].Velocity = Velocities[i];
+					NumMerged++;
+				}
+			}
+		}
+		if (NumMerged != Scenario.NumBoids)
+		{
+			return Fail(TEXT("boids went missing between the workers"));
+		}
+	}
+
+	for (FBoidShardLink* Link : LinkPointers)
+	{
+		FBoidShardWorkerReport Report;
+		if (!PumpLinks(LinkPointers, [&]() { return Link->Receive(Message); }, BoidShardMessageSeconds))
+		{
+			return Fail(TEXT("a worker's report did not come"));
+		}
+		FMemoryReader Reader(Message);
+		uint32 Magic = 0;
+		int32 Version = 0;
+		Reader << Magic << Version << Report.Index << Report.NumBoids << Report.MaxGhosts << Report.StepSeconds << Report.ExchangeSeconds;
+		if (Reader.IsError() || Magic != BoidShardReportMagic || Version != BoidShardProcessVersion)
+		{
+			return Fail(TEXT("a worker's report did not read back"));
+		}
+		OutResult.Workers.Add(Report);
+	}
+
+	OutResult.NumSteps = NumSteps;
+	OutResult.NumFrames = NumFrames;
+	OutResult.SimulatedSeconds = double(NumSteps) * Scenario.DeltaTime;
+	OutResult.WallSeconds = FPlatformTime::Seconds() - StartTime;
+
+	Links.Empty();
+	FBoidShardLink::CloseSocket(Listener);
+	for (FProcHandle& Process : Processes)
+	{
+		FPlatformProcess::WaitForProc(Process);
+		FPlatformProcess::CloseProc(Process);
+	}
+
+	const bool Saved = Writer.Close(NumFrames);
+	OutResult.FileBytes = Header.HeaderSize + int64(NumFrames) * Scenario.NumBoids * sizeof(FBoidTrajectorySample);
+
+	UE_LOG(LogBoids, Display, TEXT("Shards: %.1f simulated seconds of %d boids over %d workers in %.2f wall seconds, %.1f simulated seconds per wall second, %d frames to %s"),
+		OutResult.SimulatedSeconds, Scenario.NumBoids, OutResult.NumShards, OutResult.WallSeconds, OutResult.GetSimulatedSecondsPerWallSecond(), NumFrames, *Path);
+	for (const FBoidShardWorkerReport& Report : OutResult.Workers)
+	{
+		UE_LOG(LogBoids, Display, TEXT("  Worker %d: %d boids, up to %d ghosts, %.2f s stepping, %.2f s exchanging"),
+			Report.Index, Report.NumBoids, Report.MaxGhosts, Report.StepSeconds, Report.ExchangeSeconds);
+	}
+	return Saved;
+}
+
+bool FBoidShardWorker::Run(const FBoidBatchScenario& Scenario, int32 Index, int32 NumShards, int32 Port)
+{
+	const int32 RecordInterval = FMath::Max(Scenario.RecordInterval, 1);
+	const int32 NumSteps = FMath::Max(FMath::CeilToInt(Scenario.SimulatedSeconds / Scenario.DeltaTime), 0);
+
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	FBoidBatchSimulation::SpawnFlock(Scenario, Positions, Velocities);
+	FBoidShard Shard;
+	Shard.Init(Scenario.Params, Scenario.Body, Index, NumShards);
+	Shard.AddBoids(Positions, Velocities, 0);
+
+	// Listen for the left neighbour before telling the coordinator, which starts everyone once all have.
+	FSocket* Listener = nullptr;
+	if (NumShards > 1)
+	{
+		Listener = FBoidShardLink::Listen(Port + 1 + Index, 1);
+		if (!Listener)
+		{
+			return false;
+		}
+	}
+
+	TArray<uint8> Message;
+	FBoidShardLink Coordinator;
+	FBoidShardLink Left;
+	FBoidShardLink Right;
+	int32 StartedShards = 0;
+	WriteControlMessage(Message, BoidShardHelloMagic, Index);
+	bool Connected = Coordinator.Connect(Port, BoidShardConnectSeconds);
+	if (Connected)
+	{
+		Coordinator.Send(Message);
+		Connected = PumpLinks({ &Coordinator }, [&]() { return Coordinator.Receive(Message); }, BoidShardConnectSeconds)
+			&& ReadControlMessage(Message, BoidShardStartMagic, StartedShards) && StartedShards == NumShards;
+	}
+	if (Connected && NumShards > 1)
+	{
+		Connected = Right.Connect(Port + 1 + (Index + 1) % NumShards, BoidShardConnectSeconds) && Left.Accept(Listener, BoidShardConnectSeconds);
+	}
+	FBoidShardLink::CloseSocket(Listener);
+	if (!Connected)
+	{
+		UE_LOG(LogBoids, Error, TEXT("Shard worker %d could not reach the coordinator or its neighbours"), Index);
+		return false;
+	}
+
+	TArray<FBoidShardLink*> Links = { &Coordinator };
+	if (NumShards > 1)
+	{
+		Links.Add(&Left);
+		Links.Add(&Right);
+	}
+
+	FBoidShardWorkerReport Report;
+	Report.Index = Index;
+	TArray<uint8> ToLeft;
+	TArray<uint8> ToRight;
+	TArray<uint8> FromLeft;
+	TArray<uint8> FromRight;
+	for (int32 Step = 0; Step <= NumSteps; Step++)
+	{
+		if (Step % RecordInterval == 0)
+		{
+			Shard.WriteBoids(Message);
+			Coordinator.Send(Message);
+		}
+		if (Step == NumSteps)
+		{
+			break;
+		}
+
+		const double ExchangeStartTime = FPlatformTime::Seconds();
+		Shard.WriteExchange(ToLeft, ToRight);
+		bool Exchanged = true;
+		if (NumShards == 1)
+		{
+			// Its own neighbour on both sides.
+			Exchanged = Coordinator.Pump();
+			Swap(FromLeft, ToRight);
+			Swap(FromRight, ToLeft);
+		}
+		else
+		{
+			bool HasLeft = false;
+			bool HasRight = false;
+			Left.Send(ToLeft);
+			Right.Send(ToRight);
+			Exchanged = PumpLinks(Links, [&]()
+			{
+				HasLeft = HasLeft || Left.Receive(FromLeft);
+				HasRight = HasRight || Right.Receive(FromRight);
+				return HasLeft && HasRight;
+			}, BoidShardMessageSeconds);
+		}
+
+		const double StepStartTime = FPlatformTime::Seconds();
+		if (!Exchanged || !Shard.ReadExchange(FromLeft, FromRight))
+		{
+			UE_LOG(LogBoids, Error, TEXT("Shard worker %d lost its neighbours at step %d"), Index, Step);
+			return false;
+		}
+		Shard.Step(Scenario.DeltaTime);
+
+		Report.ExchangeSeconds += StepStartTime - ExchangeStartTime;
+		Report.StepSeconds += FPlatformTime::Seconds() - StepStartTime;
+		Report.MaxGhosts = FMath::Max(Report.MaxGhosts, Shard.GetNumGhosts());
+	}
+
+	Report.NumBoids = Shard.GetNum();
+	Message.Reset();
+	FMemoryWriter Writer(Message);
+	uint32 Magic = BoidShardReportMagic;
+	int32 Version = BoidShardProcessVersion;
+	Writer << Magic << Version << Report.Index << Report.NumBoids << Report.MaxGhosts << Report.StepSeconds << Report.ExchangeSeconds;
+	Coordinator.Send(Message);
+
+	return PumpLinks(Links, [&]() { return Coordinator.IsSent() && Left.IsSent() && Right.IsSent(); }, BoidShardMessageSeconds);
+}
@@ -0,0 +1,614 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidSimulation.h"
+
+#include "BoidSystemPlugin.h"
+#include "Misc/Crc.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+DECLARE_CYCLE_STAT(TEXT("Flock Step"), STAT_BoidFlockStep, STATGROUP_Boids);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Flock State Bytes Per Boid"), STAT_BoidStateBytesPerBoid, STATGROUP_Boids);
+
+void FBoidSimulation::Init(const TArray<FVector2D>& _Positions, const TArray<FVector2D>& _Velocities, const TArray<FBoidBody>& _Bodies)
+{
+	check(_Positions.Num() == _Velocities.Num() && _Positions.Num() == _Bodies.Num());
+
+	Positions = _Positions;
+	Velocities = _Velocities;
+	Bodies = _Bodies;
+	StepIndex = 0;
+
+	MaxSpeed = 0;
+	for (const FBoidBody& Body : Bodies)
+	{
+		MaxSpeed = FMath::Max(MaxSpeed, Body.Speed);
+	}
+
+	IsCompact = false;
+	PackedPositions.Reset();
+	PackedVelocities.Reset();
+	NextPackedPositions.Reset();
+	NextPackedVelocities.Reset();
+	IsFixed = false;
+	FixedPositions.Reset();
+	FixedVelocities.Reset();
+	NextFixedPositions.Reset();
+	NextFixedVelocities.Reset();
+	UpdateStorage();
+}
+
+void FBoidSimulation::SetParams(const FBoidSimulationParams& _Params)
+{
+	Params = _Params;
+	if (Params.UseFixedPoint)
+	{
+		FixedPipeline.Configure(Params.Pipeline, Params.Area, Params.VisualRange, Params.IsWrapped);
+	}
+	UpdateStorage();
+}
+
+void FBoidSimulation::UpdateStorage()
+{
+	// Fixed point takes over from both float layouts.
+	if (Params.UseFixedPoint)
+	{
+		if (IsCompact)
+		{
+			UnpackState();
+		}
+		if (!IsFixed)
+		{
+			FixState();
+		}
+		return;
+	}
+	if (IsFixed)
+	{
+		UnfixState();
+	}
+
+	// Far field sums velocities per cell straight from the float array.
+	if (!Params.UseCompactState || Params.UseFarField)
+	{
+		if (IsCompact)
+		{
+			UnpackState();
+		}
+		return;
+	}
+
+	FBoidQuantisation Wanted;
+	Wanted.Configure(Params.Area, Params.IsWrapped, MaxSpeed);
+	if (IsCompact && Wanted == Quantisation)
+	{
+		return;
+	}
+
+	if (IsCompact)
+	{
+		UnpackState();
+	}
+	Quantisation = Wanted;
+	PackState();
+}
+
+void FBoidSimulation::PackState()
+{
+	const int32 Num = Positions.Num();
+	PackedPositions.SetNumUninitialized(Num);
+	PackedVelocities.SetNumUninitialized(Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		PackedPositions[i] = Quantisation.PackPosition(Positions[i]);
+		PackedVelocities[i] = Quantisation.PackVelocity(Velocities[i]);
+	}
+
+	Positions.Empty();
+	Velocities.Empty();
+	NextPositions.Empty();
+	NextVelocities.Empty();
+	IsCompact = true;
+}
+
+void FBoidSimulation::UnpackState()
+{
+	const int32 Num = PackedPositions.Num();
+	Positions.SetNumUninitialized(Num);
+	Velocities.SetNumUninitialized(Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		Positions[i] = Quantisation.UnpackPosition(PackedPositions[i]);
+		Velocities[i] = Quantisation.UnpackVelocity(PackedVelocities[i]);
+	}
+
+	PackedPositions.Empty();
+	PackedVelocities.Empty();
+	NextPackedPositions.Empty();
+	NextPackedVelocities.Empty();
+	IsCompact = false;
+}
+
+void FBoidSimulation::FixState()
+{
+	const int32 Num = Positions.Num();
+	FixedPositions.SetNumUninitialized(Num);
+	FixedVelocities.SetNumUninitialized(Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		FixedPositions[i] = FixedPipeline.WrapPosition(FBoidFixedMath::FromVector(Positions[i]));
+		FixedVelocities[i] = FBoidFixedMath::FromVector(Velocities[i]);
+	}
+
+	Positions.Empty();
+	Velocities.Empty();
+	NextPositions.Empty();
+	NextVelocities.Empty();
+	Accelerations.Empty();
+	IsFixed = true;
+}
+
+void FBoidSimulation::UnfixState()
+{
+	const int32 Num = FixedPositions.Num();
+	Positions.SetNumUninitialized(Num);
+	Velocities.SetNumUninitialized(Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		Positions[i] = FBoidFixedMath::ToVector(FixedPositions[i]);
+		Velocities[i] = FBoidFixedMath::ToVector(FixedVelocities[i]);
+	}
+
+	FixedPositions.Empty();
+	FixedVelocities.Empty();
+	FixedAccelerations.Empty();
+	NextFixedPositions.Empty();
+	NextFixedVelocities.Empty();
+	IsFixed = false;
+}
+
+void FBoidSimulation::Step(float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidFlockStep);
+
+	BuildNeighbours();
+	EvaluateRules(0, GetNum());
+	Integrate(DeltaTime, 0, GetNum());
+	FinishStep();
+}
+
+void FBoidSimulation::BuildNeighbours()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(BoidStage_BuildNeighbours);
+
+	FrameArena.Reset();
+
+	if (IsFixed)
+	{
+		// Only candidates, the fixed point kernels test the range again exactly.
+		if (Params.AutoTuneGrid)
+		{
+			GridTuner.Tune(Grid, FixedPipeline.GetSearchRange());
+			Grid.Configure(Params.Area, GridTuner.GetCellSize(), Params.IsWrapped);
+			Grid.SetMaxBoidsPerCell(GridTuner.GetMaxBoidsPerCell());
+		}
+		else
+		{
+			Grid.Configure(Params.Area, FixedPipeline.GetSearchRange(), Params.IsWrapped);
+			Grid.SetMaxBoidsPerCell(0);
+		}
+		Grid.Build(FixedPositions.Num(), [this](int32 Index) { return FBoidFixedMath::ToVector(FixedPositions[Index]); });
+		Neighbours.SetMaxNeighbours(0);
+		Neighbours.Build(NeighbourBackends.Select(Grid, FixedPipeline.GetSearchRange(), Params.NeighbourBackend), Grid, Grid.GetPositions(),
+			FixedPipeline.GetSearchRange(), FrameArena);
+
+		const int32 Num = FixedPositions.Num();
+		FixedAccelerations.SetNumUninitialized(Num);
+		NextFixedPositions.SetNumUninitialized(Num);
+		NextFixedVelocities.SetNumUninitialized(Num);
+		return;
+	}
+
+	if (Params.UseFarField)
+	{
+		Grid.Configure(Params.Area, Params.VisualRange / FMath::Max(Params.FarFieldCellsPerRange, 1), Params.IsWrapped);
+		Grid.SetMaxBoidsPerCell(0);
+		Grid.Build(Positions);
+		Grid.BuildAggregates(Velocities);
+		// Nothing may read last step's lists, their memory went with the arena.
+		Neighbours = FBoidNeighbourLists();
+	}
+	else
+	{
+		if (Params.AutoTuneGrid)
+		{
+			GridTuner.Tune(Grid, Params.VisualRange);
+			Grid.Configure(Params.Area, GridTuner.GetCellSize(), Params.IsWrapped);
+			Grid.SetMaxBoidsPerCell(GridTuner.GetMaxBoidsPerCell());
+		}
+		else
+		{
+			Grid.Configure(Params.Area, Params.VisualRange, Params.IsWrapped);
+			Grid.SetMaxBoidsPerCell(0);
+		}
+		if (IsCompact)
+		{
+			Grid.Build(PackedPositions.Num(), [this](int32 Index) { return Quantisation.UnpackPosition(PackedPositions[Index]); });
+		}
+		else
+		{
+			Grid.Build(Positions);
+		}
+		Neighbours.SetMaxNeighbours(Params.MaxNeighbours);
+		Neighbours.Build(NeighbourBackends.Select(Grid, Params.VisualRange, Params.NeighbourBackend), Grid, Grid.GetPositions(),
+			Params.VisualRange, FrameArena);
+	}
+
+	// Sized here so the later stages can write from several threads.
+	const int32 Num = GetNum();
+	Accelerations.SetNumUninitialized(Num);
+	if (IsCompact)
+	{
+		NextPackedPositions.SetNumUninitialized(Num);
+		NextPackedVelocities.SetNumUninitialized(Num);
+	}
+	else
+	{
+		NextPositions.SetNumUninitialized(Num);
+		NextVelocities.SetNumUninitialized(Num);
+	}
+}
+
+FORCEINLINE void FBoidSimulation::EvaluateRule(int32 Index)
+{
+	if (IsFixed)
+	{
+		FixedAccelerations[Index] = FixedPipeline.Evaluate(Neighbours, FixedPositions, FixedVelocities, Index);
+		return;
+	}
+
+	if (IsCompact)
+	{
+		const FBoidKernelSelf Self = { Quantisation.UnpackPosition(PackedPositions[Index]), Quantisation.UnpackVelocity(PackedVelocities[Index]) };
+		const FBoidCompactNeighbourhood Neighbourhood(Neighbours, Quantisation, PackedPositions, PackedVelocities, Index);
+		Accelerations[Index] = Params.Pipeline.Evaluate(Self, Neighbourhood);
+		return;
+	}
+
+	const FBoidKernelSelf Self = { Positions[Index], Velocities[Index] };
+
+	if (Params.UseFarField)
+	{
+		Accelerations[Index] = Params.Pipeline.EvaluateFarField(Self, Index, Grid, Velocities, Params.VisualRange, Params.FarFieldTolerance);
+	}
+	else
+	{
+		const FBoidNeighbourhood Neighbourhood(Neighbours, Grid, Positions, Velocities, NoBoids, Index);
+		Accelerations[Index] = Params.Pipeline.Evaluate(Self, Neighbourhood);
+	}
+}
+
+void FBoidSimulation::EvaluateRules(int32 Start, int32 End)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(BoidStage_EvaluateRules);
+
+	for (int32 i = Start; i < End; i++)
+	{
+		EvaluateRule(i);
+	}
+}
+
+void FBoidSimulation::EvaluateRules(const int32* Boids, int32 Count)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(BoidStage_EvaluateRules);
+
+	for (int32 i = 0; i < Count; i++)
+	{
+		EvaluateRule(Boids[i]);
+	}
+}
+
+void FBoidSimulation::AddForce(int32 Index, FVector2D Force)
+{
+	if (IsFixed)
+	{
+		FixedAccelerations[Index] = FixedAccelerations[Index] + FBoidFixedMath::FromVector(Force);
+		return;
+	}
+
+	Accelerations[Index] += Force;
+}
+
+void FBoidSimulation::Integrate(float DeltaTime, int32 Start, int32 End)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(BoidStage_Integrate);
+
+	if (IsFixed)
+	{
+		const int32 FixedDeltaTime = FBoidFixedMath::FromFloat(DeltaTime);
+		for (int32 i = Start; i < End; i++)
+		{
+			NextFixedPositions[i] = FixedPositions[i];
+			NextFixedVelocities[i] = FixedVelocities[i];
+			FixedPipeline.Integrate(NextFixedPositions[i], NextFixedVelocities[i], FixedAccelerations[i], FBoidFixedMath::FromFloat(Bodies[i].Speed),
+				FBoidFixedMath::FromFloat(Bodies[i].MaxAcceleration), Bodies[i].HasConstantSpeed, FixedDeltaTime);
+		}
+		return;
+	}
+
+	if (IsCompact)
+	{
+		for (int32 i = Start; i < End; i++)
+		{
+			FVector2D Position = Quantisation.UnpackPosition(PackedPositions[i]);
+			FVector2D Velocity = Quantisation.UnpackVelocity(PackedVelocities[i]);
+			IntegrateBoid(Position, Velocity, Accelerations[i], Bodies[i], DeltaTime, Grid);
+			NextPackedPositions[i] = Quantisation.PackPosition(Position);
+			NextPackedVelocities[i] = Quantisation.PackVelocity(Velocity);
+		}
+		return;
+	}
+
+	for (int32 i = Start; i < End; i++)
+	{
+		NextPositions[i] = Positions[i];
+		NextVelocities[i] = Velocities[i];
+		IntegrateBoid(NextPositions[i], NextVelocities[i], Accelerations[i], Bodies[i], DeltaTime, Grid);
+	}
+}
+
+void FBoidSimulation::FinishStep()
+{
+	if (IsFixed)
+	{
+		Swap(FixedPositions, NextFixedPositions);
+		Swap(FixedVelocities, NextFixedVelocities);
+	}
+	else if (IsCompact)
+	{
+		Swap(PackedPositions, NextPackedPositions);
+		Swap(PackedVelocities, NextPackedVelocities);
+	}
+	else
+	{
+		Swap(Positions, NextPositions);
+		Swap(Velocities, NextVelocities);
+	}
+	StepIndex++;
+
+	SET_FLOAT_STAT(STAT_BoidStateBytesPerBoid, GetStateBytesPerBoid());
+}
+
+void FBoidSimulation::ApplyChanges(const FBoidFlockChanges& Changes, TArray<FBoidHandle>& Handles)
+{
+	check(Handles.Num() == GetNum());
+
+	if (Changes.Removed.Num() > 0)
+	{
+		const TSet<FBoidHandle> Removed(Changes.Removed);
+		// Back to front, the boid swapped into a freed slot has already been looked at.
+		for (int32 i = Handles.Num() - 1; i >= 0; i--)
+		{
+			if (Removed.Contains(Handles[i]))
+			{
+				RemoveBoidAtSwap(i);
+				Handles.RemoveAtSwap(i, 1, false);
+			}
+		}
+	}
+
+	for (int32 i = 0; i < Changes.Added.Num(); i++)
+	{
+		AddBoid(Changes.AddedPositions[i], Changes.AddedVelocities[i], Changes.AddedBodies[i]);
+		Handles.Add(Changes.Added[i]);
+	}
+}
+
+void FBoidSimulation::AddBoid(FVector2D Position, FVector2D Velocity, const FBoidBody& Body)
+{
+	// A faster boid widens the packed velocity range, so the compact state gets packed again.
+	const bool IsFaster = Body.Speed > MaxSpeed;
+	MaxSpeed = FMath::Max(MaxSpeed, Body.Speed);
+	if (IsFaster && IsCompact)
+	{
+		UnpackState();
+	}
+
+	Bodies.Add(Body);
+	if (IsFixed)
+	{
+		FixedPositions.Add(FixedPipeline.WrapPosition(FBoidFixedMath::FromVector(Position)));
+		FixedVelocities.Add(FBoidFixedMath::FromVector(Velocity));
+	}
+	else if (IsCompact)
+	{
+		PackedPositions.Add(Quantisation.PackPosition(Position));
+		PackedVelocities.Add(Quantisation.PackVelocity(Velocity));
+	}
+	else
+	{
+		Positions.Add(Position);
+		Velocities.Add(Velocity);
+	}
+
+	if (IsFaster)
+	{
+		UpdateStorage();
+	}
+}
+
+void FBoidSimulation::RemoveBoidAtSwap(int32 Index)
+{
+	Bodies.RemoveAtSwap(Index, 1, false);
+	if (IsFixed)
+	{
+		FixedPositions.RemoveAtSwap(Index, 1, false);
+		FixedVelocities.RemoveAtSwap(Index, 1, false);
+	}
+	else if (IsCompact)
+	{
+		PackedPositions.RemoveAtSwap(Index, 1, false);
+		PackedVelocities.RemoveAtSwap(Index, 1, false);
+	}
+	else
+	{
+		Positions.RemoveAtSwap(Index, 1, false);
+		Velocities.RemoveAtSwap(Index, 1, false);
+	}
+}
+
+void FBoidSimulation::CopyState(FBoidFlockState& State) const
+{
+	if (IsFixed)
+	{
+		const int32 Num = FixedPositions.Num();
+		State.Positions.SetNumUninitialized(Num, false);
+		State.Velocities.SetNumUninitialized(Num, false);
+		for (int32 i = 0; i < Num; i++)
+		{
+			State.Positions[i] = FBoidFixedMath::ToVector(FixedPositions[i]);
+			State.Velocities[i] = FBoidFixedMath::ToVector(FixedVelocities[i]);
+		}
+		State.StepIndex = StepIndex;
+		return;
+	}
+
+	if (IsCompact)
+	{
+		const int32 Num = PackedPositions.Num();
+		State.Positions.SetNumUninitialized(Num, false);
+		State.Velocities.SetNumUninitialized(Num, false);
+		for (int32 i = 0; i < Num; i++)
+		{
+			State.Positions[i] = Quantisation.UnpackPosition(PackedPositions[i]);
+			State.Velocities[i] = Quantisation.UnpackVelocity(PackedVelocities[i]);
+		}
+		State.StepIndex = StepIndex;
+		return;
+	}
+
+	State.Positions.SetNumUninitialized(Positions.Num(), false);
+	State.Velocities.SetNumUninitialized(Velocities.Num(), false);
+	FMemory::Memcpy(State.Positions.GetData(), Positions.GetData(), Positions.Num() * sizeof(FVector2D));
+	FMemory::Memcpy(State.Velocities.GetData(), Velocities.GetData(), Velocities.Num() * sizeof(FVector2D));
+	State.StepIndex = StepIndex;
+}
+
+float FBoidSimulation::GetStateBytesPerBoid() const
+{
+	const int32 Num = GetNum();
+	if (Num == 0)
+	{
+		return 0;
+	}
+
+	const SIZE_T Bytes = Positions.GetAllocatedSize() + Velocities.GetAllocatedSize() + NextPositions.GetAllocatedSize() + NextVelocities.GetAllocatedSize()
+		+ PackedPositions.GetAllocatedSize() + PackedVelocities.GetAllocatedSize() + NextPackedPositions.GetAllocatedSize() + NextPackedVelocities.GetAllocatedSize()
+		+ FixedPositions.GetAllocatedSize() + FixedVelocities.GetAllocatedSize() + NextFixedPositions.GetAllocatedSize() + NextFixedVelocities.GetAllocatedSize()
+		+ Accelerations.GetAllocatedSize() + FixedAccelerations.GetAllocatedSize() + Bodies.GetAllocatedSize();
+	return static_cast<float>(Bytes) / Num;
+}
+
+uint32 FBoidSimulation::GetStateChecksum() const
+{
+	if (IsFixed)
+	{
+		const uint32 Checksum = FCrc::MemCrc32(FixedPositions.GetData(), FixedPositions.Num() * sizeof(FBoidFixedVector));
+		return FCrc::MemCrc32(FixedVelocities.GetData(), FixedVelocities.Num() * sizeof(FBoidFixedVector), Checksum);
+	}
+	if (IsCompact)
+	{
+		const uint32 Checksum = FCrc::MemCrc32(PackedPositions.GetData(), PackedPositions.Num() * sizeof(FBoidPackedVector));
+		return FCrc::MemCrc32(PackedVelocities.GetData(), PackedVelocities.Num() * sizeof(FBoidPackedVector), Checksum);
+	}
+	const uint32 Checksum = FCrc::MemCrc32(Positions.GetData(), Positions.Num() * sizeof(FVector2D));
+	return FCrc::MemCrc32(Velocities.GetData(), Velocities.Num() * sizeof(FVector2D), Checksum);
+}
+
+FBoidFarFieldAccuracy FBoidSimulation::MeasureFarFieldAccuracy(const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities,
+	const FBoidSimulationParams& Params)
+{
+	FBoidFarFieldAccuracy Accuracy;
+	const int32 Num = Positions.Num();
+	if (Num == 0)
+	{
+		return Accuracy;
+	}
+
+	FBoidSimulation Exact;
+	FBoidSimulation FarField;
+	TArray<FBoidBody> Bodies;
+	Bodies.SetNum(Num);
+	Exact.Init(Positions, Velocities, Bodies);
+	FarField.Init(Positions, Velocities, Bodies);
+
+	Exact.SetParams(Params);
+	Exact.Params.UseFarField = false;
+	FarField.SetParams(Params);
+	FarField.Params.UseFarField = true;
+
+	// Timings include building the grid, as that is where the exact path spends much of its time.
+	double StartTime = FPlatformTime::Seconds();
+	Exact.BuildNeighbours();
+	Exact.EvaluateRules(0, Num);
+	Accuracy.ExactSeconds = FPlatformTime::Seconds() - StartTime;
+
+	StartTime = FPlatformTime::Seconds();
+	FarField.BuildNeighbours();
+	FarField.EvaluateRules(0, Num);
+	Accuracy.FarFieldSeconds = FPlatformTime::Seconds() - StartTime;
+
+	for (int32 i = 0; i < Num; i++)
+	{
+		const double Error = (FarField.Accelerations[i] - Exact.Accelerations[i]).Size();
+		Accuracy.MeanError += Error;
+		Accuracy.MaxError = FMath::Max(Accuracy.MaxError, Error);
+		Accuracy.MeanForce += Exact.Accelerations[i].Size();
+	}
+	Accuracy.MeanError /= Num;
+	Accuracy.MeanForce /= Num;
+
+	return Accuracy;
+}
+
+void FBoidFlockChanges::Add(FBoidHandle Handle, FVector2D Position, FVector2D Velocity, const FBoidBody& Body)
+{
+	Added.Add(Handle);
+	AddedPositions.Add(Position);
+	AddedVelocities.Add(Velocity);
+	AddedBodies.Add(Body);
+}
+
+void FBoidFlockChanges::Append(const FBoidFlockChanges& Other)
+{
+	for (const FBoidHandle& Handle : Other.Removed)
+	{
+		const int32 Index = Added.Find(Handle);
+		if (Index != INDEX_NONE)
+		{
+			// Never simulated, so it only has to leave Added. Keeps the rest in spawn order.
+			Added.RemoveAt(Index, 1, false);
+			AddedPositions.RemoveAt(Index, 1, false);
+			AddedVelocities.RemoveAt(Index, 1, false);
+			AddedBodies.RemoveAt(Index, 1, false);
+		}
+		else
+		{
+			Removed.Add(Handle);
+		}
+	}
+
+	Added.Append(Other.Added);
+	AddedPositions.Append(Other.AddedPositions);
+	AddedVelocities.Append(Other.AddedVelocities);
+	AddedBodies.Append(Other.AddedBodies);
+}
+
+void FBoidFlockChanges::Reset()
+{
+	Removed.Reset();
+	Added.Reset();
+	AddedPositions.Reset();
+	AddedVelocities.Reset();
+	AddedBodies.Reset();
+}
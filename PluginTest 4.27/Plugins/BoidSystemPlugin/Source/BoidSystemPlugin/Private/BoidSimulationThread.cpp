@@ -0,0 +1,104 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidSimulationThread.h"
+
+#include "HAL/RunnableThread.h"
+
+FBoidSimulationThread::FBoidSimulationThread(const TArray<FBoidHandle>& _Handles, const TArray<FVector2D>& Positions,
+	const TArray<FVector2D>& Velocities, const TArray<FBoidBody>& Bodies, const FBoidSimulationParams& Params, float StepRate) :
+	Handles(_Handles),
+	StepInterval(1.0f / FMath::Max(StepRate, 1.0f))
+{
+	Simulation.Init(Positions, Velocities, Bodies);
+	Simulation.SetParams(Params);
+}
+
+FBoidSimulationThread::~FBoidSimulationThread()
+{
+	if (Thread)
+	{
+		// Kill stops the runnable and waits for Run to return.
+		Thread->Kill(true);
+		delete Thread;
+		Thread = nullptr;
+	}
+}
+
+void FBoidSimulationThread::Start()
+{
+	check(!Thread);
+	Thread = FRunnableThread::Create(this, TEXT("BoidSimulation"), 0, TPri_Normal);
+}
+
+void FBoidSimulationThread::PushParams(const FBoidSimulationParams& Params)
+{
+	PendingParams.GetWriteBuffer() = Params;
+	PendingParams.Publish();
+}
+
+uint32 FBoidSimulationThread::PushChanges(const FBoidFlockChanges& Changes)
+{
+	if (Changes.IsEmpty())
+	{
+		return NumChangesPushed;
+	}
+
+	FScopeLock Lock(&ChangesLock);
+	PendingChanges.Append(Changes);
+	NumChangesPending = ++NumChangesPushed;
+	return NumChangesPushed;
+}
+
+const FBoidFlockState* FBoidSimulationThread::FetchState()
+{
+	return States.Fetch() ? &States.GetReadBuffer() : nullptr;
+}
+
+uint32 FBoidSimulationThread::Run()
+{
+	double NextStepTime = FPlatformTime::Seconds();
+
+	while (!StopRequested)
+	{
+		if (PendingParams.Fetch())
+		{
+			Simulation.SetParams(PendingParams.GetReadBuffer());
+		}
+
+		{
+			FScopeLock Lock(&ChangesLock);
+			Swap(PendingChanges, ApplyingChanges);
+			NumChangesApplied = NumChangesPending;
+		}
+		if (!ApplyingChanges.IsEmpty())
+		{
+			Simulation.ApplyChanges(ApplyingChanges, Handles);
+			ApplyingChanges.Reset();
+		}
+
+		const double StartTime = FPlatformTime::Seconds();
+		Simulation.Step(StepInterval);
+
+		FBoidFlockState& State = States.GetWriteBuffer();
+		Simulation.CopyState(State);
+		State.Handles = Handles;
+		State.NumChanges = NumChangesApplied;
+		State.StepSeconds = FPlatformTime::Seconds() - StartTime;
+		States.Publish();
+
+		// Hold the fixed rate. If steps take longer than that, drop the backlog rather than trying to catch up.
+		NextStepTime += StepInterval;
+		const double Now = FPlatformTime::Seconds();
+		if (NextStepTime > Now)
+		{
+			FPlatformProcess::Sleep(NextStepTime - Now);
+		}
+		else if (Now - NextStepTime > StepInterval * 4)
+		{
+			NextStepTime = Now;
+		}
+	}
+
+	return 0;
+}
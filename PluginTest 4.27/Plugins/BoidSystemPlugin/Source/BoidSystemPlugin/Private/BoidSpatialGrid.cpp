@@ -0,0 +1,174 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidSpatialGrid.h"
+
+FBoidSpatialGrid::FBoidSpatialGrid()
+{
+	Configure(FVector2D(100, 100), 10, false);
+}
+
+void FBoidSpatialGrid::Configure(FVector2D _Area, float _MinCellSize, bool _IsWrapped)
+{
+	Area = FVector2D(FMath::Max(_Area.X, 1.0f), FMath::Max(_Area.Y, 1.0f));
+	HalfArea = Area * 0.5f;
+	IsWrapped = _IsWrapped;
+
+	// Cells must tile the area exactly so the wrapped grid has no partial column or row,
+	// and must be at least as large as the query range so a 3x3 block covers it.
+	const float MinCellSize = FMath::Max(_MinCellSize, 1.0f);
+	NumCells.X = FMath::Max(FMath::FloorToInt(Area.X / MinCellSize), 1);
+	NumCells.Y = FMath::Max(FMath::FloorToInt(Area.Y / MinCellSize), 1);
+	CellSize = FVector2D(Area.X / NumCells.X, Area.Y / NumCells.Y);
+	InvCellSize = FVector2D(1.0f / CellSize.X, 1.0f / CellSize.Y);
+}
+
+void FBoidSpatialGrid::Build(const TArray<FVector2D>& _Positions)
+{
+	Positions = _Positions;
+	SortIntoCells();
+}
+
+void FBoidSpatialGrid::SortIntoCells()
+{
+	const int32 CellCount = NumCells.X * NumCells.Y;
+	CellStart.Reset();
+	CellStart.AddZeroed(CellCount + 1);
+	BoidCell.SetNumUninitialized(Positions.Num());
+	CellEntries.SetNumUninitialized(Positions.Num());
+
+	// Counting sort: count per cell, running total gives each cell's end, then scatter
+	// backwards so every cell start ends up in place and indices stay in ascending order.
+	for (int32 i = 0; i < Positions.Num(); i++)
+	{
+		const int32 Cell = CellCoord(Positions[i].Y, 1) * NumCells.X + CellCoord(Positions[i].X, 0);
+		BoidCell[i] = Cell;
+		CellStart[Cell]++;
+	}
+
+	for (int32 Cell = 1; Cell <= CellCount; Cell++)
+	{
+		CellStart[Cell] += CellStart[Cell - 1];
+	}
+
+	for (int32 i = Positions.Num() - 1; i >= 0; i--)
+	{
+		CellEntries[--CellStart[BoidCell[i]]] = i;
+	}
+
+	Subdivide();
+}
+
+void FBoidSpatialGrid::Subdivide()
+{
+	CellSplit.Reset();
+	Splits.Reset();
+	SubCellStart.Reset();
+
+	if (MaxBoidsPerCell <= 0)
+	{
+		return;
+	}
+
+	const int32 CellCount = NumCells.X * NumCells.Y;
+
+	for (int32 Cell = 0; Cell < CellCount; Cell++)
+	{
+		const int32 Start = CellStart[Cell];
+		const int32 Count = CellStart[Cell + 1] - Start;
+		if (Count <= MaxBoidsPerCell)
+		{
+			continue;
+		}
+
+		// Bounded border cells also hold boids outside the area, their box does not hold them.
+		const int32 X = Cell % NumCells.X;
+		const int32 Y = Cell / NumCells.X;
+		if (!IsWrapped && (X == 0 || Y == 0 || X == NumCells.X - 1 || Y == NumCells.Y - 1))
+		{
+			continue;
+		}
+
+		if (CellSplit.Num() == 0)
+		{
+			CellSplit.Init(INDEX_NONE, CellCount);
+		}
+
+		// Enough divisions to bring the average sub-cell back under the limit.
+		const int32 Divisions = FMath::Clamp(FMath::CeilToInt(FMath::Sqrt(static_cast<float>(Count) / MaxBoidsPerCell)), 2, 8);
+		const int32 NumSubCells = Divisions * Divisions;
+		const FVector2D CellMin(X * CellSize.X, Y * CellSize.Y);
+		const FVector2D InvSubSize = InvCellSize * static_cast<float>(Divisions);
+
+		CellSplit[Cell] = Splits.Add(FCellSplit{ SubCellStart.Num(), Divisions });
+		const int32 SubStart = SubCellStart.AddZeroed(NumSubCells + 1);
+
+		// Same counting sort as the cells, just within this cell's run of entries.
+		ScratchSubCell.SetNumUninitialized(Count);
+		ScratchEntries.SetNumUninitialized(Count);
+		for (int32 i = 0; i < Count; i++)
+		{
+			const FVector2D Local = (Positions[CellEntries[Start + i]] - CellMin) * InvSubSize;
+			const int32 SubX = FMath::Clamp(FMath::FloorToInt(Local.X), 0, Divisions - 1);
+			const int32 SubY = FMath::Clamp(FMath::FloorToInt(Local.Y), 0, Divisions - 1);
+			ScratchSubCell[i] = SubY * Divisions + SubX;
+			SubCellStart[SubStart + ScratchSubCell[i]]++;
+		}
+
+		int32 Running = Start;
+		for (int32 SubCell = 0; SubCell <= NumSubCells; SubCell++)
+		{
+			Running += SubCellStart[SubStart + SubCell];
+			SubCellStart[SubStart + SubCell] = Running;
+		}
+
+		for (int32 i = Count - 1; i >= 0; i--)
+		{
+			ScratchEntries[--SubCellStart[SubStart + ScratchSubCell[i]] - Start] = CellEntries[Start + i];
+		}
+		FMemory::Memcpy(&CellEntries[Start], ScratchEntries.GetData(), Count * sizeof(int32));
+	}
+}
+
+void FBoidSpatialGrid::BuildAggregates(const TArray<FVector2D>& Velocities)
+{
+	check(Velocities.Num() == Positions.Num());
+
+	const int32 CellCount = NumCells.X * NumCells.Y;
+	CellPositionSums.Reset();
+	CellPositionSums.AddZeroed(CellCount);
+	CellVelocitySums.Reset();
+	CellVelocitySums.AddZeroed(CellCount);
+
+	// Relative to the cell centre so the sums stay small and precise in large areas.
+	for (int32 Cell = 0; Cell < CellCount; Cell++)
+	{
+		const FVector2D CellCentre = GetCellCentre(Cell);
+
+		for (int32 Entry = CellStart[Cell]; Entry < CellStart[Cell + 1]; Entry++)
+		{
+			const int32 Index = CellEntries[Entry];
+			CellPositionSums[Cell] += Positions[Index] - CellCentre;
+			CellVelocitySums[Cell] += Velocities[Index];
+		}
+	}
+}
+
+FVector2D FBoidSpatialGrid::WrapPosition(FVector2D Position) const
+{
+	if (IsWrapped)
+	{
+		// Fmod keeps the sign of the input, so pull negative values back up.
+		Position.X = FMath::Fmod(Position.X, Area.X);
+		Position.Y = FMath::Fmod(Position.Y, Area.Y);
+
+		if (Position.X < 0)	{ Position.X += Area.X; }
+		if (Position.Y < 0)	{ Position.Y += Area.Y; }
+
+		// Adding the area to a tiny negative value can round up to the area itself.
+		if (Position.X >= Area.X)	{ Position.X = 0; }
+		if (Position.Y >= Area.Y)	{ Position.Y = 0; }
+	}
+
+	return Position;
+}
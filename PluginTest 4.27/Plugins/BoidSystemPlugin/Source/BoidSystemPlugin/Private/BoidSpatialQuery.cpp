@@ -0,0 +1,335 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidSpatialQuery.h"
+
+#include "Async/ParallelFor.h"
+#include "BoidSystemPlugin.h"
+
+DECLARE_CYCLE_STAT(TEXT("Spatial Query Batch"), STAT_BoidSpatialQueryBatch, STATGROUP_Boids);
+
+// Queries per task graph task in a batch, single queries are too small to hand out one by one.
+static const int32 BoidQueriesPerTask = 32;
+
+// Keep Hits sorted nearest first, dropping the furthest once full.
+static void InsertNearest(TArrayView<FBoidQueryHit> Hits, int32& NumHits, int32 Index, float Distance)
+{
+	if (NumHits == Hits.Num())
+	{
+		if (Distance >= Hits[NumHits - 1].Distance)
+		{
+			return;
+		}
+		NumHits--;
+	}
+
+	int32 Slot = NumHits;
+	for (; Slot > 0 && Hits[Slot - 1].Distance > Distance; Slot--)
+	{
+		Hits[Slot] = Hits[Slot - 1];
+	}
+	Hits[Slot] = FBoidQueryHit{ Index, Distance };
+	NumHits++;
+}
+
+// Cell at a column and row that may be outside the grid when it wraps.
+static int32 GetWrappedCell(FIntPoint Counts, int32 X, int32 Y)
+{
+	return ((Y % Counts.Y) + Counts.Y) % Counts.Y * Counts.X + ((X % Counts.X) + Counts.X) % Counts.X;
+}
+
+// Calls Func(Index) for every boid in a cell.
+template <typename FuncType>
+static void ForEachInCell(const FBoidSpatialGrid& Grid, int32 Cell, FuncType&& Func)
+{
+	const TArray<int32>& Entries = Grid.GetCellEntries();
+	for (int32 Entry = Grid.GetCellStart(Cell); Entry < Grid.GetCellStart(Cell + 1); Entry++)
+	{
+		Func(Entries[Entry]);
+	}
+}
+
+int32 FBoidSpatialQuery::Radius(const FBoidSpatialGrid& Grid, FVector2D Centre, float Radius, TArrayView<FBoidQueryHit> OutHits)
+{
+	int32 NumMatched = 0;
+	Grid.ForEachInRange(Grid.WrapPosition(Centre), FMath::Max(Radius, 0.0f), [&](int32 Index, FVector2D Offset)
+	{
+		if (NumMatched < OutHits.Num())
+		{
+			OutHits[NumMatched] = FBoidQueryHit{ Index, Offset.Size() };
+		}
+		NumMatched++;
+	});
+	return NumMatched;
+}
+
+int32 FBoidSpatialQuery::Box(const FBoidSpatialGrid& Grid, FVector2D Centre, FVector2D HalfExtent, TArrayView<FBoidQueryHit> OutHits)
+{
+	int32 NumMatched = 0;
+	const FVector2D Extent(FMath::Max(HalfExtent.X, 0.0f), FMath::Max(HalfExtent.Y, 0.0f));
+	Grid.ForEachInBox(Grid.WrapPosition(Centre), Extent, [&](int32 Index, FVector2D Offset)
+	{
+		if (NumMatched < OutHits.Num())
+		{
+			OutHits[NumMatched] = FBoidQueryHit{ Index, Offset.Size() };
+		}
+		NumMatched++;
+	});
+	return NumMatched;
+}
+
+int32 FBoidSpatialQuery::Ray(const FBoidSpatialGrid& Grid, FVector2D Start, FVector2D End, float Radius, TArrayView<FBoidQueryHit> OutHits)
+{
+	if (OutHits.Num() == 0 || Grid.GetNum() == 0)
+	{
+		return 0;
+	}
+
+	const FVector2D Origin = Grid.WrapPosition(Start);
+	const bool IsWrapped = Grid.GetIsWrapped();
+	const FVector2D CellSize = Grid.GetCellSize();
+	const FIntPoint Counts = Grid.GetCellCounts();
+	Radius = FMath::Max(Radius, 0.0f);
+
+	// A ray of no length finds what touches its start.
+	FVector2D Direction = End - Start;
+	float Length = Direction.Size();
+	Direction = Length > SMALL_NUMBER ? Direction / Length : FVector2D(1, 0);
+
+	// Offsets across the seam are only the ray's own while everything it touches is within half the area.
+	if (IsWrapped)
+	{
+		const FVector2D Area = Grid.GetArea();
+		Length = FMath::Min(Length, FMath::Max(FMath::Min(Area.X, Area.Y) * 0.5f - Radius, 0.0f));
+	}
+	const FVector2D Finish = Origin + Direction * Length;
+	const float RadiusSquared = Radius * Radius;
+
+	// Rows the thick ray crosses, then in each row only the columns it crosses there.
+	int32 MinRow = FMath::FloorToInt((FMath::Min(Origin.Y, Finish.Y) - Radius) / CellSize.Y);
+	int32 MaxRow = FMath::FloorToInt((FMath::Max(Origin.Y, Finish.Y) + Radius) / CellSize.Y);
+	bool IsAllRows = false;
+	if (IsWrapped && MaxRow - MinRow + 1 >= Counts.Y)
+	{
+		MinRow = 0;
+		MaxRow = Counts.Y - 1;
+		IsAllRows = true;
+	}
+	else if (!IsWrapped)
+	{
+		MinRow = FMath::Clamp(MinRow, 0, Counts.Y - 1);
+		MaxRow = FMath::Clamp(MaxRow, 0, Counts.Y - 1);
+	}
+
+	int32 NumHits = 0;
+	for (int32 Row = MinRow; Row <= MaxRow; Row++)
+	{
+		// Bounded border rows also hold the boids past the edge, so they take the whole ray.
+		float T0 = 0;
+		float T1 = Length;
+		if (!IsAllRows && (IsWrapped || (Row > 0 && Row < Counts.Y - 1)))
+		{
+			const float RowMin = Row * CellSize.Y - Radius;
+			const float RowMax = (Row + 1) * CellSize.Y + Radius;
+			if (FMath::Abs(Direction.Y) > SMALL_NUMBER)
+			{
+				float A = (RowMin - Origin.Y) / Direction.Y;
+				float B = (RowMax - Origin.Y) / Direction.Y;
+				if (A > B)
+				{
+					Swap(A, B);
+				}
+				T0 = FMath::Max(A, 0.0f);
+				T1 = FMath::Min(B, Length);
+			}
+			else if (Origin.Y < RowMin || Origin.Y > RowMax)
+			{
+				continue;
+			}
+			if (T0 > T1)
+			{
+				continue;
+			}
+		}
+
+		const float XA = Origin.X + Direction.X * T0;
+		const float XB = Origin.X + Direction.X * T1;
+		int32 MinColumn = FMath::FloorToInt((FMath::Min(XA, XB) - Radius) / CellSize.X);
+		int32 MaxColumn = FMath::FloorToInt((FMath::Max(XA, XB) + Radius) / CellSize.X);
+		if (IsWrapped && MaxColumn - MinColumn + 1 >= Counts.X)
+		{
+			MinColumn = 0;
+			MaxColumn = Counts.X - 1;
+		}
+		else if (!IsWrapped)
+		{
+			MinColumn = FMath::Clamp(MinColumn, 0, Counts.X - 1);
+			MaxColumn = FMath::Clamp(MaxColumn, 0, Counts.X - 1);
+		}
+
+		for (int32 Column = MinColumn; Column <= MaxColumn; Column++)
+		{
+			ForEachInCell(Grid, GetWrappedCell(Counts, Column, Row), [&](int32 Index)
+			{
+				const FVector2D Offset = Grid.GetOffset(Origin, Grid.GetPosition(Index));
+				const float Along = FVector2D::DotProduct(Offset, Direction);
+				if ((Offset - Direction * FMath::Clamp(Along, 0.0f, Length)).SizeSquared() > RadiusSquared)
+				{
+					return;
+				}
+
+				// Where the ray enters the circle of Radius around the boid, 0 when it starts inside.
+				const float AcrossSquared = Offset.SizeSquared() - Along * Along;
+				const float Entry = Along - FMath::Sqrt(FMath::Max(RadiusSquared - AcrossSquared, 0.0f));
+				InsertNearest(OutHits, NumHits, Index, FMath::Max(Entry, 0.0f));
+			});
+		}
+	}
+
+	return NumHits;
+}
+
+int32 FBoidSpatialQuery::Nearest(const FBoidSpatialGrid& Grid, FVector2D Centre, float MaxDistance, TArrayView<FBoidQueryHit> OutHits)
+{
+	if (OutHits.Num() == 0 || Grid.GetNum() == 0 || MaxDistance < 0)
+	{
+		return 0;
+	}
+
+	Centre = Grid.WrapPosition(Centre);
+	const FVector2D CellSize = Grid.GetCellSize();
+	const FIntPoint Counts = Grid.GetCellCounts();
+	const FIntPoint Home = Grid.GetCell(Centre);
+	const float MaxDistanceSquared = MaxDistance * MaxDistance;
+
+	// Box of cells searched so far, grown a ring at a time. Wrapped it may never cover a cell twice,
+	// bounded it stops at the grid's edges.
+	int32 Min[2] = { Home.X, Home.Y };
+	int32 Max[2] = { Home.X, Home.Y };
+	int32 Lowest[2] = { 0, 0 };
+	int32 Highest[2] = { Counts.X - 1, Counts.Y - 1 };
+	if (Grid.GetIsWrapped())
+	{
+		for (int32 Axis = 0; Axis < 2; Axis++)
+		{
+			const int32 Count = Axis == 0 ? Counts.X : Counts.Y;
+			Lowest[Axis] = Min[Axis] - (Count - 1) / 2;
+			Highest[Axis] = Lowest[Axis] + Count - 1;
+		}
+	}
+
+	// Distances stay squared until the end.
+	int32 NumHits = 0;
+	auto VisitCell = [&](int32 X, int32 Y)
+	{
+		ForEachInCell(Grid, GetWrappedCell(Counts, X, Y), [&](int32 Index)
+		{
+			const float DistanceSquared = Grid.GetOffset(Centre, Grid.GetPosition(Index)).SizeSquared();
+			if (DistanceSquared <= MaxDistanceSquared)
+			{
+				InsertNearest(OutHits, NumHits, Index, DistanceSquared);
+			}
+		});
+	};
+
+	VisitCell(Home.X, Home.Y);
+	for (;;)
+	{
+		// Nothing outside the box is nearer than the nearest side it can still grow past.
+		float Bound = MAX_flt;
+		for (int32 Axis = 0; Axis < 2; Axis++)
+		{
+			if (Min[Axis] > Lowest[Axis])
+			{
+				Bound = FMath::Min(Bound, Centre[Axis] - Min[Axis] * CellSize[Axis]);
+			}
+			if (Max[Axis] < Highest[Axis])
+			{
+				Bound = FMath::Min(Bound, (Max[Axis] + 1) * CellSize[Axis] - Centre[Axis]);
+			}
+		}
+		Bound = FMath::Max(Bound, 0.0f);
+
+		if (Bound == MAX_flt || Bound > MaxDistance || (NumHits == OutHits.Num() && Bound * Bound >= OutHits[NumHits - 1].Distance))
+		{
+			break;
+		}
+
+		// Visit the ring around the old box.
+		const int32 NewMin[2] = { FMath::Max(Min[0] - 1, Lowest[0]), FMath::Max(Min[1] - 1, Lowest[1]) };
+		const int32 NewMax[2] = { FMath::Min(Max[0] + 1, Highest[0]), FMath::Min(Max[1] + 1, Highest[1]) };
+		for (int32 Y = NewMin[1]; Y <= NewMax[1]; Y++)
+		{
+			if (Y < Min[1] || Y > Max[1])
+			{
+				for (int32 X = NewMin[0]; X <= NewMax[0]; X++)
+				{
+					VisitCell(X, Y);
+				}
+				continue;
+			}
+
+			for (int32 X = NewMin[0]; X < Min[0]; X++)
+			{
+				VisitCell(X, Y);
+			}
+			for (int32 X = Max[0] + 1; X <= NewMax[0]; X++)
+			{
+				VisitCell(X, Y);
+			}
+		}
+
+		for (int32 Axis = 0; Axis < 2; Axis++)
+		{
+			Min[Axis] = NewMin[Axis];
+			Max[Axis] = NewMax[Axis];
+		}
+	}
+
+	for (int32 i = 0; i < NumHits; i++)
+	{
+		OutHits[i].Distance = FMath::Sqrt(OutHits[i].Distance);
+	}
+	return NumHits;
+}
+
+int32 FBoidSpatialQuery::Run(const FBoidSpatialGrid& Grid, const FBoidQuery& Query, TArrayView<FBoidQueryHit> OutHits)
+{
+	switch (Query.Type)
+	{
+	case EBoidQueryType::Radius:
+		return Radius(Grid, Query.Position, Query.Radius, OutHits);
+	case EBoidQueryType::Box:
+		return Box(Grid, Query.Position, Query.Extent, OutHits);
+	case EBoidQueryType::Ray:
+		return Ray(Grid, Query.Position, Query.Position + Query.Extent, Query.Radius, OutHits);
+	case EBoidQueryType::Nearest:
+		return Nearest(Grid, Query.Position, Query.Radius, OutHits);
+	}
+	return 0;
+}
+
+void FBoidSpatialQuery::RunBatch(const FBoidSpatialGrid& Grid, TArrayView<const FBoidQuery> Queries, TArrayView<FBoidQueryHit> OutHits,
+	TArrayView<int32> OutNumHits)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidSpatialQueryBatch);
+	check(OutNumHits.Num() >= Queries.Num());
+
+	const int32 NumQueries = Queries.Num();
+	if (NumQueries == 0)
+	{
+		return;
+	}
+
+	// The grid is only read, so the queries can run anywhere as long as each writes its own slice.
+	const int32 HitsPerQuery = OutHits.Num() / NumQueries;
+	const int32 NumTasks = FMath::DivideAndRoundUp(NumQueries, BoidQueriesPerTask);
+	ParallelFor(NumTasks, [&](int32 Task)
+	{
+		const int32 End = FMath::Min((Task + 1) * BoidQueriesPerTask, NumQueries);
+		for (int32 i = Task * BoidQueriesPerTask; i < End; i++)
+		{
+			OutNumHits[i] = Run(Grid, Queries[i], OutHits.Slice(i * HitsPerQuery, HitsPerQuery));
+		}
+	}, NumTasks == 1);
+}
@@ -0,0 +1,188 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidTrajectoryFile.h"
+
+#include "Async/MappedFileHandle.h"
+#include "BoidSystemPlugin.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+#if PLATFORM_WINDOWS
+#include "Windows/AllowWindowsPlatformTypes.h"
+#include "Windows/WindowsHWrapper.h"
+#include "Windows/HideWindowsPlatformTypes.h"
+#elif PLATFORM_UNIX || PLATFORM_MAC
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+FBoidTrajectoryWriter::~FBoidTrajectoryWriter()
+{
+	if (IsOpen())
+	{
+		Close(Header.NumFrames);
+	}
+}
+
+bool FBoidTrajectoryWriter::Open(const FString& Path, const FBoidTrajectoryHeader& _Header)
+{
+	check(!IsOpen());
+
+	FilePath = FPaths::ConvertRelativePathToFull(Path);
+	Header = _Header;
+	Header.FrameStride = Header.NumBoids * sizeof(FBoidTrajectorySample);
+	FileSize = Header.HeaderSize + int64(Header.NumFrames) * Header.FrameStride;
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(FilePath), true);
+
+#if PLATFORM_WINDOWS
+	FileHandle = CreateFileW(*FilePath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (FileHandle == INVALID_HANDLE_VALUE)
+	{
+		FileHandle = nullptr;
+	}
+	else
+	{
+		// Mapping more than the file has grows it.
+		MappingHandle = CreateFileMappingW(FileHandle, nullptr, PAGE_READWRITE, DWORD(FileSize >> 32), DWORD(FileSize & 0xffffffff), nullptr);
+		Data = MappingHandle ? static_cast<uint8*>(MapViewOfFile(MappingHandle, FILE_MAP_WRITE, 0, 0, SIZE_T(FileSize))) : nullptr;
+	}
+#elif PLATFORM_UNIX || PLATFORM_MAC
+	FileDescriptor = open(TCHAR_TO_UTF8(*FilePath), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (FileDescriptor >= 0 && ftruncate(FileDescriptor, FileSize) == 0)
+	{
+		void* Mapping = mmap(nullptr, FileSize, PROT_READ | PROT_WRITE, MAP_SHARED, FileDescriptor, 0);
+		Data = Mapping != MAP_FAILED ? static_cast<uint8*>(Mapping) : nullptr;
+	}
+#else
+	Buffer.SetNumZeroed(FileSize);
+	Data = Buffer.GetData();
+#endif
+
+	if (!IsOpen())
+	{
+		UE_LOG(LogBoids, Error, TEXT("Could not map %lld bytes of %s for the trajectory"), FileSize, *FilePath);
+		Close(0);
+		return false;
+	}
+
+	FMemory::Memcpy(Data, &Header, sizeof(Header));
+	return true;
+}
+
+FBoidTrajectorySample* FBoidTrajectoryWriter::GetFrame(int32 Frame)
+{
+	check(IsOpen() && Frame >= 0 && uint32(Frame) < Header.NumFrames);
+	return reinterpret_cast<FBoidTrajectorySample*>(Data + Header.HeaderSize + int64(Frame) * Header.FrameStride);
+}
+
+void FBoidTrajectoryWriter::WriteFrame(int32 Frame, const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities)
+{
+	check(Positions.Num() == Header.NumBoids && Velocities.Num() == Header.NumBoids);
+
+	FBoidTrajectorySample* Samples = GetFrame(Frame);
+	for (uint32 i = 0; i < Header.NumBoids; i++)
+	{
+		Samples[i].Position = Positions[i];
+		Samples[i].Velocity = Velocities[i];
+	}
+}
+
+bool FBoidTrajectoryWriter::Close(int32 NumFramesWritten)
+{
+	bool Saved = true;
+	const int64 WrittenSize = Header.HeaderSize + int64(NumFramesWritten) * Header.FrameStride;
+	if (IsOpen())
+	{
+		Header.NumFrames = NumFramesWritten;
+		FMemory::Memcpy(Data, &Header, sizeof(Header));
+	}
+
+#if PLATFORM_WINDOWS
+	if (Data)
+	{
+		UnmapViewOfFile(Data);
+	}
+	if (MappingHandle)
+	{
+		CloseHandle(MappingHandle);
+	}
+	if (FileHandle)
+	{
+		LARGE_INTEGER Size;
+		Size.QuadPart = WrittenSize;
+		Saved = Data && SetFilePointerEx(FileHandle, Size, nullptr, FILE_BEGIN) && SetEndOfFile(FileHandle);
+		CloseHandle(FileHandle);
+	}
+	FileHandle = nullptr;
+	MappingHandle = nullptr;
+#elif PLATFORM_UNIX || PLATFORM_MAC
+	if (Data)
+	{
+		munmap(Data, FileSize);
+	}
+	if (FileDescriptor >= 0)
+	{
+		Saved = Data && ftruncate(FileDescriptor, WrittenSize) == 0;
+		close(FileDescriptor);
+	}
+	FileDescriptor = -1;
+#else
+	if (Data)
+	{
+		Buffer.SetNum(WrittenSize);
+		Saved = FFileHelper::SaveArrayToFile(Buffer, *FilePath);
+	}
+	Buffer.Empty();
+#endif
+
+	Data = nullptr;
+	return Saved;
+}
+
+FBoidTrajectoryReader::~FBoidTrajectoryReader()
+{
+	Close();
+}
+
+bool FBoidTrajectoryReader::Open(const FString& Path)
+{
+	Close();
+
+	Handle = FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Path);
+	Region = Handle ? Handle->MapRegion() : nullptr;
+	if (!Region || Region->GetMappedSize() < int64(sizeof(FBoidTrajectoryHeader)))
+	{
+		Close();
+		return false;
+	}
+
+	Data = Region->GetMappedPtr();
+	const FBoidTrajectoryHeader& Header = GetHeader();
+	const bool IsValid = Header.Magic == FBoidTrajectoryHeader::MagicValue && Header.Version == FBoidTrajectoryHeader::CurrentVersion
+		&& Header.FrameStride == Header.NumBoids * sizeof(FBoidTrajectorySample)
+		&& Region->GetMappedSize() >= Header.HeaderSize + int64(Header.NumFrames) * Header.FrameStride;
+	if (!IsValid)
+	{
+		Close();
+	}
+	return IsValid;
+}
+
+void FBoidTrajectoryReader::Close()
+{
+	delete Region;
+	delete Handle;
+	Region = nullptr;
+	Handle = nullptr;
+	Data = nullptr;
+}
+
+const FBoidTrajectorySample* FBoidTrajectoryReader::GetFrame(int32 Frame) const
+{
+	check(Data && Frame >= 0 && uint32(Frame) < GetHeader().NumFrames);
+	return reinterpret_cast<const FBoidTrajectorySample*>(Data + GetHeader().HeaderSize + int64(Frame) * GetHeader().FrameStride);
+}
@@ -0,0 +1,254 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidWorkPartition.h"
+
+#include "Async/ParallelFor.h"
+
+// Items made per worker. More gives stealing finer pieces to even out with, fewer costs less to hand out.
+static const int32 BoidItemsPerWorker = 8;
+
+void FBoidWorkPartition::Build(const FBoidSpatialGrid& Grid, const FBoidNeighbourLists& Neighbours, int32 NumWorkers, int32 BoidsPerItem)
+{
+	SetNumWorkers(NumWorkers);
+	AllowStealing = true;
+	Entries = Grid.GetCellEntries().GetData();
+	Items.Reset();
+
+	TArray<int64> ItemCosts;
+	const int64 TotalCost = int64(Neighbours.GetNumBoids()) + Neighbours.GetNumNeighbours();
+	const int64 NumBoids = FMath::Max(Neighbours.GetNumBoids(), 1);
+	const int64 TargetCost = FMath::Max<int64>(BoidsPerItem > 0
+		? TotalCost * BoidsPerItem / NumBoids
+		: TotalCost / (Queues.Num() * BoidItemsPerWorker), 1);
+
+	auto BoidCost = [&Neighbours](int32 Boid)
+	{
+		return int64(1) + Neighbours.GetRowEnd(Boid) - Neighbours.GetRowStart(Boid);
+	};
+
+	auto AddItem = [this, &ItemCosts](int32 Start, int32 End, int64 Cost)
+	{
+		Items.Add(FItem{ Start, End });
+		ItemCosts.Add(Cost);
+	};
+
+	// Cells are consecutive in the entries, so an item is just a run of entries.
+	int32 ItemStart = 0;
+	int64 ItemCost = 0;
+
+	for (int32 Cell = 0; Cell < Grid.GetNumCells(); Cell++)
+	{
+		const int32 CellStart = Grid.GetCellStart(Cell);
+		const int32 CellEnd = Grid.GetCellStart(Cell + 1);
+
+		int64 CellCost = 0;
+		for (int32 Entry = CellStart; Entry < CellEnd; Entry++)
+		{
+			CellCost += BoidCost(Entries[Entry]);
+		}
+
+		if (ItemCost > 0 && ItemCost + CellCost > TargetCost)
+		{
+			AddItem(ItemStart, CellStart, ItemCost);
+			ItemStart = CellStart;
+			ItemCost = 0;
+		}
+
+		if (CellCost <= TargetCost)
+		{
+			ItemCost += CellCost;
+			continue;
+		}
+
+		// A clump, cut the cell itself into items of about the target cost.
+		for (int32 Entry = CellStart; Entry < CellEnd; Entry++)
+		{
+			ItemCost += BoidCost(Entries[Entry]);
+			if (ItemCost >= TargetCost)
+			{
+				AddItem(ItemStart, Entry + 1, ItemCost);
+				ItemStart = Entry + 1;
+				ItemCost = 0;
+			}
+		}
+	}
+
+	if (ItemStart < Grid.GetCellEntries().Num())
+	{
+		AddItem(ItemStart, Grid.GetCellEntries().Num(), ItemCost);
+	}
+
+	DealItems(ItemCosts);
+}
+
+void FBoidWorkPartition::BuildUniform(int32 NumBoids, int32 NumWorkers, int32 BoidsPerItem)
+{
+	SetNumWorkers(NumWorkers);
+	AllowStealing = false;
+
+	if (IdentityEntries.Num() != NumBoids)
+	{
+		IdentityEntries.SetNumUninitialized(NumBoids);
+		for (int32 i = 0; i < NumBoids; i++)
+		{
+			IdentityEntries[i] = i;
+		}
+	}
+	Entries = IdentityEntries.GetData();
+
+	// One item per worker unless asked for smaller ones, every boid counted the same.
+	const int32 NumItems = BoidsPerItem > 0 ? FMath::Max(FMath::DivideAndRoundUp(NumBoids, BoidsPerItem), 1) : Queues.Num();
+	Items.Reset();
+	TArray<int64> ItemCosts;
+	for (int32 Item = 0; Item < NumItems; Item++)
+	{
+		const int32 Start = int64(NumBoids) * Item / NumItems;
+		const int32 End = int64(NumBoids) * (Item + 1) / NumItems;
+		Items.Add(FItem{ Start, End });
+		ItemCosts.Add(End - Start);
+	}
+
+	DealItems(ItemCosts);
+}
+
+void FBoidWorkPartition::SetNumWorkers(int32 NumWorkers)
+{
+	NumWorkers = FMath::Max(NumWorkers, 1);
+	if (Queues.Num() != NumWorkers)
+	{
+		Queues.Empty(NumWorkers);
+		Queues.AddDefaulted(NumWorkers);
+	}
+}
+
+void FBoidWorkPartition::DealItems(const TArray<int64>& ItemCosts)
+{
+	int64 TotalCost = 0;
+	for (const int64 Cost : ItemCosts)
+	{
+		TotalCost += Cost;
+	}
+
+	// Worker W takes the items whose running cost falls in its share, so neighbouring items stay together.
+	const int32 NumWorkers = Queues.Num();
+	int32 Item = 0;
+	int64 RunningCost = 0;
+
+	for (int32 Worker = 0; Worker < NumWorkers; Worker++)
+	{
+		const int32 Head = Item;
+		const int64 ShareEnd = TotalCost * (Worker + 1) / NumWorkers;
+
+		while (Item < Items.Num() && (Worker == NumWorkers - 1 || RunningCost + ItemCosts[Item] / 2 < ShareEnd))
+		{
+			RunningCost += ItemCosts[Item];
+			Item++;
+		}
+
+		Queues[Worker].Range = PackRange(Head, Item);
+	}
+}
+
+bool FBoidWorkPartition::PopFront(FQueue& Queue, int32& Item)
+{
+	uint64 Range = Queue.Range.Load();
+	for (;;)
+	{
+		const uint32 Head = uint32(Range >> 32);
+		const uint32 Tail = uint32(Range);
+		if (Head >= Tail)
+		{
+			return false;
+		}
+		if (Queue.Range.CompareExchange(Range, PackRange(Head + 1, Tail)))
+		{
+			Item = Head;
+			return true;
+		}
+	}
+}
+
+bool FBoidWorkPartition::PopBack(FQueue& Queue, int32& Item)
+{
+	uint64 Range = Queue.Range.Load();
+	for (;;)
+	{
+		const uint32 Head = uint32(Range >> 32);
+		const uint32 Tail = uint32(Range);
+		if (Head >= Tail)
+		{
+			return false;
+		}
+		if (Queue.Range.CompareExchange(Range, PackRange(Head, Tail - 1)))
+		{
+			Item = Tail - 1;
+			return true;
+		}
+	}
+}
+
+void FBoidWorkPartition::Execute(TFunctionRef<void(const int32* Boids, int32 Count)> Func)
+{
+	const int32 NumWorkers = Queues.Num();
+
+	ParallelFor(NumWorkers, [this, &Func, NumWorkers](int32 Worker)
+	{
+		FQueue& Own = Queues[Worker];
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		int32 Item;
+
+		auto Run = [this, &Func](int32 ItemIndex)
+		{
+			const FItem& Work = Items[ItemIndex];
+			Func(Entries + Work.EntryStart, Work.EntryEnd - Work.EntryStart);
+		};
+
+		while (PopFront(Own, Item))
+		{
+			Run(Item);
+			Own.Stats.Items++;
+		}
+
+		// Out of work, take from the far end of the others' runs, away from where they are working.
+		bool Stole = AllowStealing;
+		while (Stole)
+		{
+			Stole = false;
+			for (int32 Offset = 1; Offset < NumWorkers; Offset++)
+			{
+				if (PopBack(Queues[(Worker + Offset) % NumWorkers], Item))
+				{
+					Run(Item);
+					Own.Stats.Items++;
+					Own.Stats.Steals++;
+					Stole = true;
+					break;
+				}
+			}
+		}
+
+		Own.Stats.BusyCycles += FPlatformTime::Cycles64() - StartCycles;
+	});
+}
+
+float FBoidWorkPartition::GetImbalance() const
+{
+	uint64 MaxCycles = 0;
+	uint64 TotalCycles = 0;
+	for (const FQueue& Queue : Queues)
+	{
+		MaxCycles = FMath::Max(MaxCycles, Queue.Stats.BusyCycles);
+		TotalCycles += Queue.Stats.BusyCycles;
+	}
+
+	return TotalCycles > 0 ? float(double(MaxCycles) * Queues.Num() / TotalCycles) : 1.0f;
+}
+
+void FBoidWorkPartition::ResetStats()
+{
+	for (FQueue& Queue : Queues)
+	{
+		Queue.Stats = FBoidWorkerStats();
+	}
+}
@@ -0,0 +1,149 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BoidZones.h"
+
+#include "Async/ParallelFor.h"
+#include "BoidSystemPlugin.h"
+
+DECLARE_CYCLE_STAT(TEXT("Update Zones"), STAT_BoidUpdateZones, STATGROUP_Boids);
+
+// Fewer zones than this are updated on the calling thread.
+static const int32 BoidZonesParallelMin = 8;
+
+int32 FBoidZoneTracker::AddZone(const FBoidZoneShape& Shape)
+{
+	const int32 Zone = FreeZones.Num() > 0 ? FreeZones.Pop(false) : Zones.AddDefaulted();
+	Zones[Zone].Shape = Shape;
+	Zones[Zone].IsUsed = true;
+	Zones[Zone].IsRemoved = false;
+	Zones[Zone].Members.Reset();
+	NumZones++;
+	return Zone;
+}
+
+void FBoidZoneTracker::RemoveZone(int32 Zone)
+{
+	if (IsValidZone(Zone))
+	{
+		Zones[Zone].IsRemoved = true;
+		NumZones--;
+		NumRemoved++;
+	}
+}
+
+void FBoidZoneTracker::SetZoneShape(int32 Zone, const FBoidZoneShape& Shape)
+{
+	if (IsValidZone(Zone))
+	{
+		Zones[Zone].Shape = Shape;
+	}
+}
+
+void FBoidZoneTracker::Reset()
+{
+	Zones.Reset();
+	FreeZones.Reset();
+	NumZones = 0;
+	NumRemoved = 0;
+	Entered.Reset();
+	Exited.Reset();
+}
+
+bool FBoidZoneTracker::IsValidZone(int32 Zone) const
+{
+	return Zones.IsValidIndex(Zone) && Zones[Zone].IsUsed && !Zones[Zone].IsRemoved;
+}
+
+TArrayView<const int32> FBoidZoneTracker::GetMembers(int32 Zone) const
+{
+	return IsValidZone(Zone) ? TArrayView<const int32>(Zones[Zone].Members) : TArrayView<const int32>();
+}
+
+void FBoidZoneTracker::Update(const FBoidSpatialGrid& Grid, TFunctionRef<int32(int32)> GetBoidId)
+{
+	SCOPE_CYCLE_COUNTER(STAT_BoidUpdateZones);
+
+	// Each zone only writes its own arrays, the grid is only read.
+	ParallelFor(Zones.Num(), [this, &Grid, GetBoidId](int32 Zone)
+	{
+		UpdateZone(Zones[Zone], Grid, GetBoidId);
+	}, Zones.Num() < BoidZonesParallelMin);
+
+	// Gathered in zone order, so the events come out the same however the zones were split.
+	Entered.Reset();
+	Exited.Reset();
+	for (int32 ZoneIndex = 0; ZoneIndex < Zones.Num(); ZoneIndex++)
+	{
+		FZone& Zone = Zones[ZoneIndex];
+		for (int32 Id : Zone.ZoneEntered)
+		{
+			Entered.Add(FBoidZoneEvent{ ZoneIndex, Id });
+		}
+		for (int32 Id : Zone.ZoneExited)
+		{
+			Exited.Add(FBoidZoneEvent{ ZoneIndex, Id });
+		}
+
+		// Its exits are out, the slot can go to the next new zone.
+		if (Zone.IsUsed && Zone.IsRemoved)
+		{
+			Zone.IsUsed = false;
+			Zone.IsRemoved = false;
+			FreeZones.Add(ZoneIndex);
+			NumRemoved--;
+		}
+	}
+}
+
+void FBoidZoneTracker::UpdateZone(FZone& Zone, const FBoidSpatialGrid& Grid, TFunctionRef<int32(int32)> GetBoidId)
+{
+	Zone.Found.Reset();
+	Zone.ZoneEntered.Reset();
+	Zone.ZoneExited.Reset();
+	if (!Zone.IsUsed)
+	{
+		return;
+	}
+
+	if (!Zone.IsRemoved)
+	{
+		const FVector2D Centre = Grid.WrapPosition(Zone.Shape.Centre);
+		auto AddMember = [&Zone, GetBoidId](int32 Index, FVector2D Offset)
+		{
+			Zone.Found.Add(GetBoidId(Index));
+		};
+
+		if (Zone.Shape.Type == EBoidZoneShape::Circle)
+		{
+			Grid.ForEachInRange(Centre, FMath::Max(Zone.Shape.Extent.X, 0.0f), AddMember);
+		}
+		else
+		{
+			Grid.ForEachInBox(Centre, FVector2D(FMath::Max(Zone.Shape.Extent.X, 0.0f), FMath::Max(Zone.Shape.Extent.Y, 0.0f)), AddMember);
+		}
+		Zone.Found.Sort();
+	}
+
+	// Both sorted, one merge finds who came and who went.
+	int32 Old = 0;
+	int32 New = 0;
+	while (Old < Zone.Members.Num() || New < Zone.Found.Num())
+	{
+		if (New == Zone.Found.Num() || (Old < Zone.Members.Num() && Zone.Members[Old] < Zone.Found[New]))
+		{
+			Zone.ZoneExited.Add(Zone.Members[Old++]);
+		}
+		else if (Old == Zone.Members.Num() || Zone.Found[New] < Zone.Members[Old])
+		{
+			Zone.ZoneEntered.Add(Zone.Found[New++]);
+		}
+		else
+		{
+			Old++;
+			New++;
+		}
+	}
+
+	Swap(Zone.Members, Zone.Found);
+}
@@ -18,7 +18,17 @@ FBoidRules::FBoidRules(const FBoidRules& SRules)
 	DebugColor = SRules.DebugColor;
 }
 
-FVector2D FBoidRules::ComputeWeightedForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid)
+const FBoidRuleDesc* FBoidRules::ApplyRuleDesc(const TArray<FBoidRuleDesc>& RuleDescs, EBoidRuleType Type)
+{
+	const FBoidRuleDesc* Desc = FindBoidRuleDesc(RuleDescs, Type);
+	
+	Weight = Desc ? Desc->Weight : 0.0f;
+	IsEnabled = Desc && Desc->IsEnabled;
+
+	return Desc;
+}
+
+FVector2D FBoidRules::ComputeWeightedForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid)
 {
 	if (IsEnabled)
 	{
@@ -32,22 +42,21 @@ FVector2D FBoidRules::ComputeWeightedForce(const TArray<ABoid*>& Neighbourhood,
 	return Force2D;
 }
 
-FVector2D CohesionRule::ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid)
+FVector2D CohesionRule::ComputeForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid)
 {
 	FVector2D CohesionForce = FVector2D().ZeroVector;
 
 	if (Neighbourhood.Num() > 0)
 	{
-		FVector2D Centre = FVector2D().ZeroVector;
+		// Averaging the offsets instead of the positions keeps the centre right across a wrapped seam.
+		FVector2D CentreDirection = FVector2D().ZeroVector;
 
-		for (auto const& Neighbour : Neighbourhood)
+		for (int i = 0; i < Neighbourhood.Num(); i++)
 		{
-			Centre += FVector2D(Neighbour->GetActorLocation().X, Neighbour->GetActorLocation().Y);
+			CentreDirection += Neighbourhood.GetOffset(i);
 		}
 		
-		Centre /= static_cast<float>(Neighbourhood.Num());
-
-		FVector2D CentreDirection = Centre - Boid->GetPosition();
+		CentreDirection /= static_cast<float>(Neighbourhood.Num());
 
 		CohesionForce = CentreDirection;
 		CohesionForce.Normalize();
@@ -56,7 +65,7 @@ FVector2D CohesionRule::ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid*
 	return CohesionForce;
 }
 
-FVector2D SeparationRule::ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid)
+FVector2D SeparationRule::ComputeForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid)
 {
 	FVector2D SeparationForce = FVector2D().ZeroVector;
 
@@ -64,19 +73,18 @@ FVector2D SeparationRule::ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoi
 	
 	if (Neighbourhood.Num() > 0)
 	{
-		FVector2D Position = Boid->GetPosition();
 		int CountCloseNeighbours = 0;
 
-		for (auto const& Neighbour : Neighbourhood)
+		for (int i = 0; i < Neighbourhood.Num(); i++)
 		{
-			float Distance = FVector2D::Distance(Position, Neighbour->GetPosition());
+			FVector2D OpposedDirection = -Neighbourhood.GetOffset(i);
+			float Distance = OpposedDirection.Size();
 
 			if (Distance < DesiredDistance && Distance > 0)
 			{
-				FVector2D OpposedDirection = Position - Neighbour->GetPosition();
-				OpposedDirection.Normalize();
+				OpposedDirection /= Distance;
 
-				float ScalingFactor = FMath::Exp(-Distance);
+				float ScalingFactor = FMath::Exp(-Distance * Falloff);
 				SeparationForce += OpposedDirection * ScalingFactor;
 				CountCloseNeighbours++;
 			}
@@ -93,15 +101,24 @@ FVector2D SeparationRule::ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoi
 	return SeparationForce;
 }
 
-FVector2D AlignmentRule::ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid)
+void SeparationRule::ApplyRuleSet(const TArray<FBoidRuleDesc>& RuleDescs)
+{
+	if (const FBoidRuleDesc* Desc = ApplyRuleDesc(RuleDescs, EBoidRuleType::Separation))
+	{
+		DesiredMinimalDistance = Desc->Radius;
+		Falloff = Desc->Falloff;
+	}
+}
+
+FVector2D AlignmentRule::ComputeForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid)
 {
 	FVector2D AverageVelocity = FVector2D().ZeroVector;
 
 	if (Neighbourhood.Num() > 0)
 	{
-		for (auto const& Neighbour : Neighbourhood)
+		for (int i = 0; i < Neighbourhood.Num(); i++)
 		{
-			AverageVelocity += (Neighbour)->GetVelocity2D();
+			AverageVelocity += Neighbourhood.GetVelocity(i);
 		}
 
 		AverageVelocity /= static_cast<float>(Neighbourhood.Num());
@@ -111,7 +128,7 @@ FVector2D AlignmentRule::ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid
 	return AverageVelocity;
 }
 
-FVector2D BoundedAreaRule::ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid)
+FVector2D BoundedAreaRule::ComputeForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid)
 {
 	FVector2D BoundedForce = FVector2D().ZeroVector;
 	FVector2D Position = Boid->GetPosition();
@@ -146,34 +163,19 @@ FVector2D BoundedAreaRule::ComputeForce(const TArray<ABoid*>& Neighbourhood, ABo
 
 		return BoundedForce;
 	}
-	// Else teleport Boids to the other side of the bounded area.
-	// Top Side.
-	if (Position.Y > Height)
-	{
-		Boid->SetPosition(FVector2D(Position.X, Height - Height));
-	}
-	// Bottom Side.
-	else if (Position.Y < Height - Height)
-	{
-		Boid->SetPosition(FVector2D(Position.X, Height));
-	}
-
-	// Left Side.
-	else if (Position.X < Width - Width)
-	{
-		Boid->SetPosition(FVector2D(Width, Position.Y));
-	}
+	// Else the area wraps, which is handled on the boid position itself, so there is nothing to push against.
+	return BoundedForce;
+}
 
-	// Right Side.
-	else if (Position.X > Width)
+void BoundedAreaRule::ApplyRuleSet(const TArray<FBoidRuleDesc>& RuleDescs)
+{
+	if (const FBoidRuleDesc* Desc = ApplyRuleDesc(RuleDescs, EBoidRuleType::Bounds))
 	{
-		Boid->SetPosition(FVector2D(Width - Width, Position.Y));
+		DesiredDistance = FMath::RoundToInt(Desc->Radius);
 	}
-
-	return BoundedForce;
 }
 
-FVector2D PointRepulsionRule::ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid)
+FVector2D PointRepulsionRule::ComputeForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid)
 {
 	FVector2D MouseForce;
 	
@@ -185,9 +187,10 @@ FVector2D PointRepulsionRule::ComputeForce(const TArray<ABoid*>& Neighbourhood,
 		{
 			for (int i = 0; i < Neighbourhood.Num(); i++)
 			{
-				if (FVector2D::Distance(Boid->GetPosition(), Neighbourhood[i]->GetPosition()) < 15)
+				FVector2D Offset = Neighbourhood.GetOffset(i);
+				if (Offset.Size() < 15)
 				{
-					DrawDebugLine(World, Boid->GetActorLocation(), Neighbourhood[i]->GetActorLocation(), FColor(255, 0, 0));
+					DrawDebugLine(World, Boid->GetActorLocation(), Boid->GetActorLocation() + FVector(Offset, 0), FColor(255, 0, 0));
 				}
 			}
 		}
@@ -228,8 +231,6 @@ FVector2D PointRepulsionRule::ComputeForce(const TArray<ABoid*>& Neighbourhood,
 				FVector2D Direction = MousePos - Boid->GetPosition();
 				float Distance = Direction.Size();
 			
-				float DesiredDistance = 15.0f;
-
 
 				if (Distance > DesiredDistance || LeftClick)
 				{
@@ -258,4 +259,12 @@ FVector2D PointRepulsionRule::ComputeForce(const TArray<ABoid*>& Neighbourhood,
 		}
 	}
 	return FVector2D();
+}
+
+void PointRepulsionRule::ApplyRuleSet(const TArray<FBoidRuleDesc>& RuleDescs)
+{
+	if (const FBoidRuleDesc* Desc = ApplyRuleDesc(RuleDescs, EBoidRuleType::PointRepulsion))
+	{
+		DesiredDistance = Desc->Radius;
+	}
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidBatchSimulation.h"
+#include "BoidTrajectoryFile.h"
+#include "HAL/FileManager.h"
+#include "Math/RandomStream.h"
+#include "Misc/Paths.h"
+
+// Runs a short batch into a trajectory file, maps it back and checks it against the same flock stepped
+// directly. Fixed point makes the two bit for bit equal however the batch split its steps over the workers.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidBatchTrajectoryTest, "BoidSystem.Batch.Trajectory",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidBatchTrajectoryTest::RunTest(const FString& Parameters)
+{
+	FBoidBatchScenario Scenario;
+	Scenario.NumBoids = 500;
+	Scenario.Seed = 1234;
+	Scenario.SimulatedSeconds = 2.0f;
+	Scenario.RecordInterval = 10;
+	Scenario.Body.Speed = 30.0f;
+	Scenario.Params.UseFixedPoint = true;
+	Scenario.Params.Pipeline.Get<FBoundsKernel>().IsBounded = false;
+
+	const FString Path = FPaths::AutomationTransientDir() / TEXT("BoidBatch.btrj");
+	FBoidBatchResult Result;
+	if (!TestTrue(TEXT("The batch writes its file"), FBoidBatchSimulation::Run(Scenario, Path, Result)))
+	{
+		return false;
+	}
+	AddInfo(FString::Printf(TEXT("%.1f simulated seconds per wall second with %d boids"), Result.GetSimulatedSecondsPerWallSecond(), Scenario.NumBoids));
+
+	FBoidTrajectoryReader Reader;
+	if (!TestTrue(TEXT("The file maps back as a trajectory"), Reader.Open(Path)))
+	{
+		return false;
+	}
+	const FBoidTrajectoryHeader& Header = Reader.GetHeader();
+	TestEqual(TEXT("Steps"), Result.NumSteps, 120);
+	TestEqual(TEXT("Frames in the header"), int32(Header.NumFrames), 13);
+	TestEqual(TEXT("Boids in the header"), int32(Header.NumBoids), Scenario.NumBoids);
+	TestEqual(TEXT("Frame stride"), int32(Header.FrameStride), Scenario.NumBoids * 16);
+	TestEqual(TEXT("File size"), IFileManager::Get().FileSize(*Path), Result.FileBytes);
+
+	// The same flock stepped without the batch, compared at every recorded frame.
+	FRandomStream Random(Scenario.Seed);
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	for (int32 i = 0; i < Scenario.NumBoids; i++)
+	{
+		Positions.Add(FVector2D(Random.FRandRange(0, Scenario.Params.Area.X), Random.FRandRange(0, Scenario.Params.Area.Y)));
+		Velocities.Add(FVector2D(Random.RandRange(-100, 100), Random.RandRange(-100, 100)) * Scenario.Body.Speed);
+	}
+	TArray<FBoidBody> Bodies;
+	Bodies.Init(Scenario.Body, Scenario.NumBoids);
+	FBoidSimulation Simulation;
+	Simulation.Init(Positions, Velocities, Bodies);
+	Simulation.SetParams(Scenario.Params);
+
+	FBoidFlockState State;
+	int32 NumMismatches = 0;
+	for (int32 Frame = 0; Frame < int32(Header.NumFrames); Frame++)
+	{
+		if (Frame > 0)
+		{
+			for (int32 Step = 0; Step < Scenario.RecordInterval; Step++)
+			{
+				Simulation.Step(Scenario.DeltaTime);
+			}
+		}
+
+		Simulation.CopyState(State);
+		const FBoidTrajectorySample* Samples = Reader.GetFrame(Frame);
+		for (int32 i = 0; i < Scenario.NumBoids; i++)
+		{
+			NumMismatches += Samples[i].Position == State.Positions[i] && Samples[i].Velocity == State.Velocities[i] ? 0 : 1;
+		}
+	}
+	TestEqual(TEXT("Every recorded boid matches the direct run"), NumMismatches, 0);
+
+	Reader.Close();
+	IFileManager::Get().Delete(*Path);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,132 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Async/Async.h"
+#include "BoidCommandQueue.h"
+#include "HAL/PlatformProcess.h"
+
+// One thread only. Commands come out in the order they went in, lap after lap of the ring, and a full
+// queue turns the next one away until the consumer frees a slot.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidCommandQueueOrderTest, "BoidSystem.CommandQueue.Order",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidCommandQueueOrderTest::RunTest(const FString& Parameters)
+{
+	FBoidCommandQueue Queue(5);
+	TestEqual(TEXT("The capacity is rounded up to a power of two"), Queue.GetCapacity(), 8);
+
+	FBoidCommand Command;
+	TestFalse(TEXT("A new queue is empty"), Queue.Dequeue(Command));
+
+	bool IsInOrder = true;
+	int32 Next = 0;
+	int32 NumOut = 0;
+	for (int32 Lap = 0; Lap < 5; Lap++)
+	{
+		while (Queue.Enqueue(FBoidCommand::MakeSpawn(FVector2D(Next, 0))))
+		{
+			Next++;
+		}
+		// Take out a different number each lap so the head and tail wrap at different slots.
+		for (int32 i = 0; i < Lap + 3 && Queue.Dequeue(Command); i++)
+		{
+			IsInOrder &= Command.Type == EBoidCommandType::Spawn && Command.Position.X == NumOut;
+			NumOut++;
+		}
+	}
+	while (Queue.Dequeue(Command))
+	{
+		IsInOrder &= Command.Position.X == NumOut;
+		NumOut++;
+	}
+
+	TestTrue(TEXT("Commands come out in order"), IsInOrder);
+	TestEqual(TEXT("Every accepted command comes out"), NumOut, Next);
+	TestTrue(TEXT("The ring wrapped"), Next > 3 * Queue.GetCapacity());
+
+	TestTrue(TEXT("An emptied queue takes commands again"), Queue.Enqueue(FBoidCommand::MakeRuleWeight(EBoidRuleType::Separation, 2.5f)));
+	TestTrue(TEXT("The command comes back out"), Queue.Dequeue(Command) && Command.Type == EBoidCommandType::SetRuleWeight
+		&& Command.Rule == EBoidRuleType::Separation && Command.Value == 2.5f);
+	return true;
+}
+
+// Producer threads push their numbered commands into a small queue while this thread drains it. Each one
+// retries while the queue is full. Every command must come out exactly once, and each producer's commands
+// in the order it pushed them.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidCommandQueueProducersTest, "BoidSystem.CommandQueue.Producers",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidCommandQueueProducersTest::RunTest(const FString& Parameters)
+{
+	const int32 NumProducers = 4;
+	const int32 NumPerProducer = 50000;
+	FBoidCommandQueue Queue(64);
+
+	TArray<TFuture<int32>> Producers;
+	for (int32 Producer = 0; Producer < NumProducers; Producer++)
+	{
+		Producers.Add(Async(EAsyncExecution::Thread, [&Queue, Producer, NumPerProducer]()
+		{
+			int32 NumFull = 0;
+			for (int32 i = 0; i < NumPerProducer; i++)
+			{
+				const FBoidCommand Command = FBoidCommand::MakeSpawn(FVector2D(Producer, i));
+				while (!Queue.Enqueue(Command))
+				{
+					NumFull++;
+					FPlatformProcess::Sleep(0.0f);
+				}
+			}
+			return NumFull;
+		}));
+	}
+
+	// Next number expected from each producer.
+	TArray<int32> Next;
+	Next.Init(0, NumProducers);
+	bool IsInOrder = true;
+	int32 NumOut = 0;
+	FBoidCommand Command;
+	while (NumOut < NumProducers * NumPerProducer)
+	{
+		if (!Queue.Dequeue(Command))
+		{
+			FPlatformProcess::Sleep(0.0f);
+			continue;
+		}
+
+		const int32 Producer = FMath::RoundToInt(Command.Position.X);
+		if (Next.IsValidIndex(Producer))
+		{
+			IsInOrder &= FMath::RoundToInt(Command.Position.Y) == Next[Producer];
+			Next[Producer]++;
+		}
+		else
+		{
+			IsInOrder = false;
+		}
+		NumOut++;
+	}
+
+	int32 NumFull = 0;
+	for (TFuture<int32>& Producer : Producers)
+	{
+		NumFull += Producer.Get();
+	}
+
+	TestTrue(TEXT("Each producer's commands come out once and in order"), IsInOrder);
+	TestEqual(TEXT("Every command comes out"), NumOut, NumProducers * NumPerProducer);
+	TestFalse(TEXT("Nothing is left over"), Queue.Dequeue(Command));
+
+	AddInfo(FString::Printf(TEXT("%d commands from %d threads through %d slots, producers found it full %d times"),
+		NumOut, NumProducers, Queue.GetCapacity(), NumFull));
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
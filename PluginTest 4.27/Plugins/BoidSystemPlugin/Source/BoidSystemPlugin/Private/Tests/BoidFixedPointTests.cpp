@@ -0,0 +1,162 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidConsoleVariables.h"
+#include "BoidPipelinedSimulation.h"
+#include "BoidTestFixture.h"
+#include "Misc/Crc.h"
+
+// Checks the fixed point flock comes out bit for bit the same whatever steps it: every neighbour search
+// backend, the pipelined step split over the workers, and every build configuration. The checksums below
+// were taken from one build, any other build, platform or CPU has to arrive at exactly the same ones.
+// After a deliberate change to the fixed point step, update them with the values the test reports.
+
+static const int32 BoidFixedPointFrames = 120;
+static const float BoidFixedPointDeltaTime = 1.0f / 60.0f;
+
+struct FBoidFixedPointScenario
+{
+	const TCHAR* Name;
+	int32 NumBoids;
+	float AreaSize;
+	bool IsWrapped;
+	// Of the flock after BoidFixedPointFrames.
+	uint32 Checksum;
+};
+
+static const FBoidFixedPointScenario BoidFixedPointScenarios[] = {
+	{ TEXT("Wrapped"), 300, 100.0f, true, 0x6c6d7409 },
+	{ TEXT("Bounded"), 300, 100.0f, false, 0x89789eab },
+	{ TEXT("Crowded"), 2000, 100.0f, true, 0x60f0ccc6 }
+};
+
+static FBoidSimulationParams MakeBoidFixedPointParams(const FBoidFixedPointScenario& Scenario)
+{
+	FBoidSimulationParams Params = MakeBoidTestParams(FVector2D(Scenario.AreaSize, Scenario.AreaSize), Scenario.IsWrapped);
+	Params.UseFixedPoint = true;
+	return Params;
+}
+
+// Fixed point values convert to floats exactly at these sizes, so the floats stand for the fixed state.
+static uint32 GetBoidFlockChecksum(const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities)
+{
+	const uint32 Checksum = FCrc::MemCrc32(Positions.GetData(), Positions.Num() * sizeof(FVector2D));
+	return FCrc::MemCrc32(Velocities.GetData(), Velocities.Num() * sizeof(FVector2D), Checksum);
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidFixedPointMathTest, "BoidSystem.FixedPoint.Math",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidFixedPointMathTest::RunTest(const FString& Parameters)
+{
+	// Largest error of each function against double maths, in fixed point steps.
+	const double Step = 1.0 / FBoidFixedMath::One;
+	double SqrtError = 0;
+	double ExpError = 0;
+	FRandomStream Random(BoidTestSeed);
+
+	for (int32 i = 0; i < 100000; i++)
+	{
+		const int32 Value = Random.RandRange(0, MAX_int32 - 1);
+		const double Exact = sqrt(double(Value) * Step);
+		SqrtError = FMath::Max(SqrtError, FMath::Abs(FBoidFixedMath::Sqrt(Value) * Step - Exact) / Step);
+	}
+
+	// The separation falloff's range, where results still have a few whole bits.
+	for (int32 i = 0; i < 100000; i++)
+	{
+		const int32 Value = Random.RandRange(-12 * FBoidFixedMath::One, 8 * FBoidFixedMath::One);
+		const double Exact = exp(double(Value) * Step);
+		ExpError = FMath::Max(ExpError, FMath::Abs(FBoidFixedMath::Exp(Value) * Step - Exact) / FMath::Max(Step, Exact * 1e-6));
+	}
+
+	AddInfo(FString::Printf(TEXT("Largest error in steps: Sqrt %.2f, Exp %.2f (or a millionth)"), SqrtError, ExpError));
+	TestTrue(TEXT("Sqrt is within a step"), SqrtError <= 1.0);
+	TestTrue(TEXT("Exp is within two steps or a millionth"), ExpError <= 2.0);
+
+	TestEqual(TEXT("Sqrt of 4"), FBoidFixedMath::Sqrt(4 * FBoidFixedMath::One), 2 * FBoidFixedMath::One);
+	TestEqual(TEXT("Raw square root of the largest value"), FBoidFixedMath::SqrtRaw(MAX_uint64), MAX_uint32);
+	TestEqual(TEXT("Raw square root just under a square"), FBoidFixedMath::SqrtRaw((uint64(1) << 62) - 1), (uint32(1) << 31) - 1);
+	TestEqual(TEXT("Exp of 0"), FBoidFixedMath::Exp(0), FBoidFixedMath::One);
+	TestEqual(TEXT("Exp too large to fit saturates"), FBoidFixedMath::Exp(20 * FBoidFixedMath::One), MAX_int32);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidFixedPointChecksumTest, "BoidSystem.FixedPoint.Checksum",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidFixedPointChecksumTest::RunTest(const FString& Parameters)
+{
+	const TPair<const TCHAR*, EBoidNeighbourBackend> Backends[] = {
+		{ TEXT("Grid"), EBoidNeighbourBackend::Grid },
+		{ TEXT("K-d tree"), EBoidNeighbourBackend::KdTree },
+		{ TEXT("Brute force"), EBoidNeighbourBackend::BruteForce }
+	};
+
+	const int32 PreviousBackend = CVarBoidsNeighbourBackend.GetValueOnGameThread();
+	for (const FBoidFixedPointScenario& Scenario : BoidFixedPointScenarios)
+	{
+		const FBoidSimulationParams Params = MakeBoidFixedPointParams(Scenario);
+		FRandomStream Random(BoidTestSeed);
+		TArray<FVector2D> Positions;
+		TArray<FVector2D> Velocities;
+		MakeBoidTestFlock(Random, Scenario.NumBoids, FVector2D::ZeroVector, Params.Area, BoidTestSpeed, Positions, Velocities);
+		TArray<FBoidBody> Bodies;
+		Bodies.SetNum(Scenario.NumBoids);
+		TArray<FBoidHandle> Handles;
+		Handles.SetNum(Scenario.NumBoids);
+
+		TArray<TPair<FString, uint32>> Checksums;
+
+		for (const TPair<const TCHAR*, EBoidNeighbourBackend>& Backend : Backends)
+		{
+			for (const bool AutoTuneGrid : { false, true })
+			{
+				CVarBoidsNeighbourBackend->Set(static_cast<int32>(Backend.Value), ECVF_SetByCode);
+				FBoidSimulationParams PathParams = Params;
+				PathParams.AutoTuneGrid = AutoTuneGrid;
+				FBoidSimulation Simulation;
+				Simulation.Init(Positions, Velocities, Bodies);
+				Simulation.SetParams(PathParams);
+				for (int32 Frame = 0; Frame < BoidFixedPointFrames; Frame++)
+				{
+					Simulation.Step(BoidFixedPointDeltaTime);
+				}
+
+				FBoidFlockState State;
+				Simulation.CopyState(State);
+				Checksums.Add({ FString::Printf(TEXT("%s%s"), Backend.Key, AutoTuneGrid ? TEXT(", tuned") : TEXT("")),
+					GetBoidFlockChecksum(State.Positions, State.Velocities) });
+			}
+		}
+
+		// Spread over the workers in different orders.
+		CVarBoidsNeighbourBackend->Set(static_cast<int32>(EBoidNeighbourBackend::Grid), ECVF_SetByCode);
+		for (const bool BalanceByCost : { true, false })
+		{
+			FBoidPipelinedSimulation Pipelined(Handles, Positions, Velocities, Bodies);
+			for (int32 Frame = 0; Frame < BoidFixedPointFrames; Frame++)
+			{
+				Pipelined.Launch(Params, BoidFixedPointDeltaTime, BalanceByCost);
+				Pipelined.Complete();
+			}
+			Checksums.Add({ BalanceByCost ? TEXT("Pipelined") : TEXT("Pipelined, uniform split"),
+				GetBoidFlockChecksum(Pipelined.GetPositions(), Pipelined.GetVelocities()) });
+		}
+
+		AddInfo(FString::Printf(TEXT("%s: checksum 0x%08x after %d frames"), Scenario.Name, Checksums[0].Value, BoidFixedPointFrames));
+		for (const TPair<FString, uint32>& Checksum : Checksums)
+		{
+			TestEqual(FString::Printf(TEXT("%s, %s matches the recorded checksum"), Scenario.Name, *Checksum.Key), Checksum.Value, Scenario.Checksum);
+		}
+	}
+
+	CVarBoidsNeighbourBackend->Set(PreviousBackend, ECVF_SetByCode);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,142 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidSimulation.h"
+#include "Math/RandomStream.h"
+
+// Boids leave and join a running flock in each state layout. Every slot must still hold the boid its
+// handle names, with its own position and body, and removed handles must be gone. One of the new boids
+// reuses a removed boid's handle id, and one is faster than the rest so the packed velocity range widens.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidFlockChangesApplyTest, "BoidSystem.FlockChanges.Apply",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidFlockChangesApplyTest::RunTest(const FString& Parameters)
+{
+	const int32 NumBoids = 300;
+	const int32 NumAdded = 40;
+	const float AreaSize = 100.0f;
+
+	const TCHAR* LayoutNames[] = { TEXT("Float"), TEXT("Compact"), TEXT("Fixed point") };
+	for (int32 Layout = 0; Layout < 3; Layout++)
+	{
+		FRandomStream Random(1234);
+		FBoidSimulationParams Params;
+		Params.Area = FVector2D(AreaSize, AreaSize);
+		Params.UseCompactState = Layout == 1;
+		Params.UseFixedPoint = Layout == 2;
+
+		// Where each handle id's boid is expected, by id.
+		TMap<int32, FVector2D> Expected;
+		TArray<FBoidHandle> Handles;
+		TArray<FVector2D> Positions;
+		TArray<FVector2D> Velocities;
+		TArray<FBoidBody> Bodies;
+		for (int32 i = 0; i < NumBoids; i++)
+		{
+			const float X = Random.FRandRange(0.0f, AreaSize);
+			const float Y = Random.FRandRange(0.0f, AreaSize);
+			Handles.Add(FBoidHandle{ i });
+			Positions.Add(FVector2D(X, Y));
+			Velocities.Add(FVector2D(10.0f, 0.0f));
+			Bodies.Add(FBoidBody());
+			Expected.Add(i, Positions.Last());
+		}
+
+		FBoidSimulation Simulation;
+		Simulation.Init(Positions, Velocities, Bodies);
+		Simulation.SetParams(Params);
+
+		FBoidFlockChanges Changes;
+		for (int32 i = 0; i < NumBoids; i += 3)
+		{
+			Changes.Removed.Add(FBoidHandle{ i });
+			Expected.Remove(i);
+		}
+		for (int32 i = 0; i < NumAdded; i++)
+		{
+			// The first one takes the id of the first removed boid.
+			const int32 Id = i == 0 ? 0 : NumBoids + i;
+			const float X = Random.FRandRange(0.0f, AreaSize);
+			const float Y = Random.FRandRange(0.0f, AreaSize);
+			FBoidBody Body;
+			Body.Speed = i == NumAdded - 1 ? 2.0f * Body.Speed : Body.Speed;
+			Changes.Add(FBoidHandle{ Id }, FVector2D(X, Y), FVector2D(0.0f, 10.0f), Body);
+			Expected.Add(Id, FVector2D(X, Y));
+		}
+		Simulation.ApplyChanges(Changes, Handles);
+
+		FBoidFlockState State;
+		Simulation.CopyState(State);
+		TestEqual(FString::Printf(TEXT("%s: every boid has a handle"), LayoutNames[Layout]), Handles.Num(), Simulation.GetNum());
+		TestEqual(FString::Printf(TEXT("%s: boids left and joined"), LayoutNames[Layout]), Handles.Num(), Expected.Num());
+
+		// Packing rounds positions to 16 bits over the area.
+		const float Tolerance = AreaSize / 1000.0f;
+		int32 NumMisplaced = 0;
+		TSet<int32> Seen;
+		for (int32 i = 0; i < Handles.Num(); i++)
+		{
+			const FVector2D* Position = Expected.Find(Handles[i].Id);
+			bool IsSeen = false;
+			Seen.Add(Handles[i].Id, &IsSeen);
+			if (!Position || IsSeen || !State.Positions[i].Equals(*Position, Tolerance))
+			{
+				NumMisplaced++;
+			}
+		}
+		TestEqual(FString::Printf(TEXT("%s: each slot holds the boid its handle names"), LayoutNames[Layout]), NumMisplaced, 0);
+
+		// The bodies moved with their boids.
+		for (int32 Step = 0; Step < 10; Step++)
+		{
+			Simulation.Step(1.0f / 60.0f);
+		}
+		Simulation.CopyState(State);
+		float FastestSpeed = 0.0f;
+		for (const FVector2D& Velocity : State.Velocities)
+		{
+			FastestSpeed = FMath::Max(FastestSpeed, Velocity.Size());
+		}
+		TestTrue(FString::Printf(TEXT("%s: only the fast boid goes past the others' speed"), LayoutNames[Layout]),
+			FastestSpeed <= 2.0f * FBoidBody().Speed + 1.0f);
+	}
+
+	return true;
+}
+
+// Batches of changes queued behind one another. A boid removed by a later batch before it was ever
+// simulated just leaves Added, everything else keeps its order.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidFlockChangesAppendTest, "BoidSystem.FlockChanges.Append",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidFlockChangesAppendTest::RunTest(const FString& Parameters)
+{
+	FBoidFlockChanges First;
+	First.Removed.Add(FBoidHandle{ 1 });
+	First.Add(FBoidHandle{ 1 }, FVector2D(1.0f, 0.0f), FVector2D::ZeroVector, FBoidBody());
+	First.Add(FBoidHandle{ 7 }, FVector2D(7.0f, 0.0f), FVector2D::ZeroVector, FBoidBody());
+
+	FBoidFlockChanges Second;
+	Second.Removed.Add(FBoidHandle{ 1 });
+	Second.Removed.Add(FBoidHandle{ 2 });
+	Second.Add(FBoidHandle{ 9 }, FVector2D(9.0f, 0.0f), FVector2D::ZeroVector, FBoidBody());
+
+	First.Append(Second);
+
+	TestEqual(TEXT("The simulated boids leave"), First.Removed.Num(), 2);
+	TestTrue(TEXT("In order"), First.Removed.Num() == 2 && First.Removed[0].Id == 1 && First.Removed[1].Id == 2);
+	TestEqual(TEXT("The boid that joined and left is not added"), First.Added.Num(), 2);
+	TestTrue(TEXT("The rest join in order"), First.Added.Num() == 2 && First.Added[0].Id == 7 && First.Added[1].Id == 9);
+	TestTrue(TEXT("Their positions moved with them"), First.AddedPositions.Num() == 2 && First.AddedPositions[0].X == 7.0f
+		&& First.AddedPositions[1].X == 9.0f);
+	TestEqual(TEXT("One body per added boid"), First.AddedBodies.Num(), First.Added.Num());
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,474 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Boid.h"
+#include "BoidConsoleVariables.h"
+#include "BoidPipelinedSimulation.h"
+#include "BoidReferenceSimulation.h"
+#include "BoidTestFixture.h"
+#include "Engine/Engine.h"
+#include "Interfaces/IPluginManager.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+// Checks the optimised flock paths and the boid actors still move the flock the way the reference does,
+// and the reference still moves it the way it did when the golden trajectories in Resources/GoldenTrajectories
+// were recorded. A missing trajectory fails the tests. After a deliberate change to the rules, record them
+// again with boids.Test.RecordGolden 1 and commit the new files with the change.
+//
+// Flocks are chaotic, any rounding difference grows about tenfold every thirty frames, so paths are
+// mostly compared one step at a time from the reference's state. Free running trajectories are only
+// held to the reference over the first few frames, past that their divergence is just reported.
+//
+// Compact state rounds every value to 16 bits, so it is held to the reference on average instead: two boids
+// rounded onto the same spot lose their separation push, which makes single boids jump.
+
+static TAutoConsoleVariable<int32> CVarBoidsTestRecordGolden(
+	TEXT("boids.Test.RecordGolden"),
+	0,
+	TEXT("1 makes the BoidSystem.Golden tests record the golden trajectories again instead of checking against them."),
+	ECVF_Default);
+
+static const int32 BoidGoldenFrames = 120;
+static const int32 BoidGoldenSampleInterval = 10;
+static const int32 BoidFreeRunFrames = 30;
+static const float BoidPositionTolerance = 1e-3f;
+static const float BoidVelocityTolerance = 1e-2f;
+static const float BoidFreeRunTolerance = 1e-2f;
+static const float BoidCompactVelocityTolerance = 5e-2f;
+
+struct FBoidGoldenScenario
+{
+	const TCHAR* Name;
+	int32 NumBoids;
+	float AreaSize;
+	// Boids start in a square this wide in the middle of the area.
+	float SpawnSize;
+	bool IsWrapped;
+};
+
+static const FBoidGoldenScenario BoidGoldenScenarios[] = {
+	{ TEXT("Wrapped"), 300, 100.0f, 100.0f, true },
+	{ TEXT("Bounded"), 300, 100.0f, 100.0f, false },
+	{ TEXT("Clumped"), 400, 200.0f, 30.0f, true }
+};
+
+// Largest difference between two flock states, across the seam of a wrapped area.
+struct FBoidDivergence
+{
+	float Position = 0;
+	float Velocity = 0;
+	float MeanPosition = 0;
+	float MeanVelocity = 0;
+
+	void Max(const FBoidDivergence& Other)
+	{
+		Position = FMath::Max(Position, Other.Position);
+		Velocity = FMath::Max(Velocity, Other.Velocity);
+		MeanPosition = FMath::Max(MeanPosition, Other.MeanPosition);
+		MeanVelocity = FMath::Max(MeanVelocity, Other.MeanVelocity);
+	}
+};
+
+static FBoidDivergence MeasureBoidDivergence(const FBoidSimulationParams& Params, const TArray<FVector2D>& PositionsA, const TArray<FVector2D>& VelocitiesA,
+	const TArray<FVector2D>& PositionsB, const TArray<FVector2D>& VelocitiesB)
+{
+	FBoidDivergence Divergence;
+
+	for (int32 i = 0; i < PositionsA.Num(); i++)
+	{
+		FVector2D Offset = PositionsB[i] - PositionsA[i];
+		if (Params.IsWrapped)
+		{
+			Offset.X -= Params.Area.X * FMath::RoundToFloat(Offset.X / Params.Area.X);
+			Offset.Y -= Params.Area.Y * FMath::RoundToFloat(Offset.Y / Params.Area.Y);
+		}
+
+		const float VelocityDifference = (VelocitiesB[i] - VelocitiesA[i]).Size();
+		Divergence.Position = FMath::Max(Divergence.Position, Offset.Size());
+		Divergence.Velocity = FMath::Max(Divergence.Velocity, VelocityDifference);
+		Divergence.MeanPosition += Offset.Size();
+		Divergence.MeanVelocity += VelocityDifference;
+	}
+
+	if (PositionsA.Num() > 0)
+	{
+		Divergence.MeanPosition /= PositionsA.Num();
+		Divergence.MeanVelocity /= PositionsA.Num();
+	}
+
+	return Divergence;
+}
+
+static FString GetBoidGoldenPath(const FBoidGoldenScenario& Scenario)
+{
+	const TSharedPtr<IPlugin> Plugin = IPluginManager::Get().FindPlugin(TEXT("BoidSystemPlugin"));
+	return Plugin->GetBaseDir() / TEXT("Resources/GoldenTrajectories") / FString(Scenario.Name) + TEXT(".bin");
+}
+
+// A seeded flock stepped by the reference. This is the synchronous step every path implements, not a replay of
+// the original actor loop, which moved each boid in place before the next one looked at it.
+static void RecordBoidGolden(const FBoidGoldenScenario& Scenario, FBoidGoldenTrajectory& Trajectory)
+{
+	Trajectory = FBoidGoldenTrajectory();
+	Trajectory.Params = MakeBoidTestParams(FVector2D(Scenario.AreaSize, Scenario.AreaSize), Scenario.IsWrapped);
+	Trajectory.Body.Speed = BoidTestSpeed;
+	Trajectory.NumFrames = BoidGoldenFrames;
+	Trajectory.SampleInterval = BoidGoldenSampleInterval;
+
+	FRandomStream Random(BoidTestSeed);
+	const float SpawnStart = (Scenario.AreaSize - Scenario.SpawnSize) * 0.5f;
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	MakeBoidTestFlock(Random, Scenario.NumBoids, FVector2D(SpawnStart, SpawnStart), FVector2D(Scenario.SpawnSize, Scenario.SpawnSize),
+		Trajectory.Body.Speed, Positions, Velocities);
+
+	Trajectory.Record(Positions, Velocities);
+}
+
+// The committed trajectory, or with boids.Test.RecordGolden a fresh recording saved over it.
+static bool LoadBoidGolden(FAutomationTestBase& Test, const FBoidGoldenScenario& Scenario, FBoidGoldenTrajectory& Trajectory)
+{
+	const FString Path = GetBoidGoldenPath(Scenario);
+	TArray<uint8> Bytes;
+
+	if (CVarBoidsTestRecordGolden.GetValueOnGameThread() == 0)
+	{
+		if (!FFileHelper::LoadFileToArray(Bytes, *Path))
+		{
+			Test.AddError(FString::Printf(TEXT("%s is missing, record it with boids.Test.RecordGolden 1"), *Path));
+			return false;
+		}
+
+		FMemoryReader Reader(Bytes);
+		if (Trajectory.Serialize(Reader))
+		{
+			return true;
+		}
+		Test.AddError(FString::Printf(TEXT("%s is not a golden trajectory of this version, record it again"), *Path));
+		return false;
+	}
+
+	RecordBoidGolden(Scenario, Trajectory);
+	FMemoryWriter Writer(Bytes);
+	Trajectory.Serialize(Writer);
+	if (!FFileHelper::SaveArrayToFile(Bytes, *Path))
+	{
+		Test.AddError(FString::Printf(TEXT("Could not write %s"), *Path));
+		return false;
+	}
+
+	Test.AddWarning(FString::Printf(TEXT("Recorded %s, commit it if the change to the flock was intended"), *Path));
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidGoldenReferenceTest, "BoidSystem.Golden.Reference",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidGoldenReferenceTest::RunTest(const FString& Parameters)
+{
+	for (const FBoidGoldenScenario& Scenario : BoidGoldenScenarios)
+	{
+		FBoidGoldenTrajectory Golden;
+		if (!LoadBoidGolden(*this, Scenario, Golden))
+		{
+			continue;
+		}
+
+		// Restart from every sample so only SampleInterval frames of chaos separate it from the next.
+		for (int32 Sample = 0; Sample + 1 < Golden.SamplePositions.Num(); Sample++)
+		{
+			FBoidReferenceSimulation Reference;
+			Reference.Init(Golden.Params, Golden.Body, Golden.SamplePositions[Sample], Golden.SampleVelocities[Sample]);
+			for (int32 Frame = 0; Frame < Golden.SampleInterval; Frame++)
+			{
+				Reference.Step(Golden.DeltaTime);
+			}
+
+			const FBoidDivergence Divergence = MeasureBoidDivergence(Golden.Params, Golden.SamplePositions[Sample + 1], Golden.SampleVelocities[Sample + 1],
+				Reference.GetPositions(), Reference.GetVelocities());
+			const int32 EndFrame = (Sample + 1) * Golden.SampleInterval;
+
+			AddInfo(FString::Printf(TEXT("%s, frame %d: position %.2e, velocity %.2e from golden"), Scenario.Name, EndFrame, Divergence.Position, Divergence.Velocity));
+			TestTrue(FString::Printf(TEXT("%s reference matches golden at frame %d"), Scenario.Name, EndFrame),
+				Divergence.Position <= BoidPositionTolerance && Divergence.Velocity <= BoidVelocityTolerance);
+		}
+	}
+
+	return true;
+}
+
+// One flock step by some path, from the given state.
+struct FBoidTestPath
+{
+	const TCHAR* Name;
+	TFunction<void(const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities, TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities)> Step;
+	// Rounds the state, checked on average.
+	bool IsQuantised = false;
+};
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidGoldenPathsTest, "BoidSystem.Golden.OptimisedPaths",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidGoldenPathsTest::RunTest(const FString& Parameters)
+{
+	const int32 PreviousBackend = CVarBoidsNeighbourBackend.GetValueOnGameThread();
+
+	for (const FBoidGoldenScenario& Scenario : BoidGoldenScenarios)
+	{
+		FBoidGoldenTrajectory Golden;
+		if (!LoadBoidGolden(*this, Scenario, Golden))
+		{
+			continue;
+		}
+
+		const int32 Num = Golden.SamplePositions[0].Num();
+		const float DeltaTime = Golden.DeltaTime;
+		TArray<FBoidBody> Bodies;
+		Bodies.Init(Golden.Body, Num);
+		TArray<FBoidHandle> Handles;
+		Handles.SetNum(Num);
+
+		// The simulation keeps its grid and tuner between steps, so reuse one per path and only reset its state.
+		auto SimulationPath = [&](const TCHAR* Name, FBoidSimulationParams PathParams, EBoidNeighbourBackend Backend)
+		{
+			TSharedRef<FBoidSimulation> Simulation = MakeShared<FBoidSimulation>();
+			return FBoidTestPath{ Name, [Simulation, PathParams, Backend, Bodies, DeltaTime](const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities,
+				TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities)
+			{
+				CVarBoidsNeighbourBackend->Set(static_cast<int32>(Backend), ECVF_SetByCode);
+				Simulation->Init(Positions, Velocities, Bodies);
+				Simulation->SetParams(PathParams);
+				Simulation->Step(DeltaTime);
+
+				FBoidFlockState State;
+				Simulation->CopyState(State);
+				OutPositions = MoveTemp(State.Positions);
+				OutVelocities = MoveTemp(State.Velocities);
+			}, PathParams.UseCompactState };
+		};
+
+		auto PipelinedPath = [&](const TCHAR* Name, bool BalanceByCost)
+		{
+			return FBoidTestPath{ Name, [Params = Golden.Params, Handles, Bodies, DeltaTime, BalanceByCost](const TArray<FVector2D>& Positions,
+				const TArray<FVector2D>& Velocities, TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities)
+			{
+				CVarBoidsNeighbourBackend->Set(static_cast<int32>(EBoidNeighbourBackend::Grid), ECVF_SetByCode);
+				FBoidPipelinedSimulation Pipelined(Handles, Positions, Velocities, Bodies);
+				Pipelined.Launch(Params, DeltaTime, BalanceByCost);
+				Pipelined.Complete();
+				OutPositions = Pipelined.GetPositions();
+				OutVelocities = Pipelined.GetVelocities();
+			} };
+		};
+
+		FBoidSimulationParams FixedGrid = Golden.Params;
+		FixedGrid.AutoTuneGrid = false;
+		FBoidSimulationParams FarField = Golden.Params;
+		FarField.UseFarField = true;
+		FBoidSimulationParams Compact = Golden.Params;
+		Compact.UseCompactState = true;
+
+		TArray<FBoidTestPath> Paths;
+		Paths.Add(SimulationPath(TEXT("Grid"), FixedGrid, EBoidNeighbourBackend::Grid));
+		Paths.Add(SimulationPath(TEXT("Tuned grid"), Golden.Params, EBoidNeighbourBackend::Grid));
+		Paths.Add(SimulationPath(TEXT("K-d tree"), Golden.Params, EBoidNeighbourBackend::KdTree));
+		Paths.Add(SimulationPath(TEXT("Brute force"), Golden.Params, EBoidNeighbourBackend::BruteForce));
+		Paths.Add(SimulationPath(TEXT("Far field"), FarField, EBoidNeighbourBackend::Grid));
+		Paths.Add(SimulationPath(TEXT("Compact"), Compact, EBoidNeighbourBackend::Grid));
+		Paths.Add(PipelinedPath(TEXT("Pipelined"), true));
+		Paths.Add(PipelinedPath(TEXT("Pipelined, uniform split"), false));
+
+		// Compact state is allowed to be off by about one packed step on average.
+		FBoidQuantisation Quantisation;
+		Quantisation.Configure(Golden.Params.Area, Golden.Params.IsWrapped, Golden.Body.Speed);
+		const float CompactPositionTolerance = Quantisation.GetPositionStep().Size();
+
+		for (FBoidTestPath& Path : Paths)
+		{
+			FBoidReferenceSimulation Reference;
+			Reference.Init(Golden.Params, Golden.Body, Golden.SamplePositions[0], Golden.SampleVelocities[0]);
+			TArray<FVector2D> FreePositions = Golden.SamplePositions[0];
+			TArray<FVector2D> FreeVelocities = Golden.SampleVelocities[0];
+			TArray<FVector2D> StepPositions;
+			TArray<FVector2D> StepVelocities;
+			FBoidDivergence StepDivergence;
+			FBoidDivergence FreeDivergence;
+
+			for (int32 Frame = 1; Frame <= Golden.NumFrames; Frame++)
+			{
+				// One step from exactly where the reference is, then the reference's own step.
+				Path.Step(Reference.GetPositions(), Reference.GetVelocities(), StepPositions, StepVelocities);
+				Path.Step(TArray<FVector2D>(FreePositions), TArray<FVector2D>(FreeVelocities), FreePositions, FreeVelocities);
+				Reference.Step(DeltaTime);
+
+				const FBoidDivergence Step = MeasureBoidDivergence(Golden.Params, Reference.GetPositions(), Reference.GetVelocities(), StepPositions, StepVelocities);
+				const FBoidDivergence Free = MeasureBoidDivergence(Golden.Params, Reference.GetPositions(), Reference.GetVelocities(), FreePositions, FreeVelocities);
+				StepDivergence.Max(Step);
+				FreeDivergence.Max(Free);
+
+				if (Path.IsQuantised)
+				{
+					if (Step.MeanPosition > CompactPositionTolerance || Step.MeanVelocity > BoidCompactVelocityTolerance)
+					{
+						AddError(FString::Printf(TEXT("%s, %s, frame %d: one step off the reference by position %.2e, velocity %.2e on average"),
+							Scenario.Name, Path.Name, Frame, Step.MeanPosition, Step.MeanVelocity));
+					}
+				}
+				else
+				{
+					if (Step.Position > BoidPositionTolerance || Step.Velocity > BoidVelocityTolerance)
+					{
+						AddError(FString::Printf(TEXT("%s, %s, frame %d: one step off the reference by position %.2e, velocity %.2e"),
+							Scenario.Name, Path.Name, Frame, Step.Position, Step.Velocity));
+					}
+					if (Frame <= BoidFreeRunFrames && Free.Position > BoidFreeRunTolerance)
+					{
+						AddError(FString::Printf(TEXT("%s, %s, frame %d: free run off the reference by %.2e"), Scenario.Name, Path.Name, Frame, Free.Position));
+					}
+				}
+
+				if (Frame % Golden.SampleInterval == 0)
+				{
+					AddInfo(FString::Printf(TEXT("%s, %s, frames %d-%d: one step position %.2e (mean %.2e), velocity %.2e (mean %.2e), free run position %.2e"),
+						Scenario.Name, Path.Name, Frame - Golden.SampleInterval + 1, Frame, StepDivergence.Position, StepDivergence.MeanPosition,
+						StepDivergence.Velocity, StepDivergence.MeanVelocity, FreeDivergence.Position));
+					StepDivergence = FBoidDivergence();
+					FreeDivergence = FBoidDivergence();
+				}
+			}
+		}
+	}
+
+	CVarBoidsNeighbourBackend->Set(PreviousBackend, ECVF_SetByCode);
+	return true;
+}
+
+// The boid actors ticking themselves, as in the Actors simulation mode, one step at a time from the reference's
+// state. They read their neighbours from the snapshot Settings takes before they tick, so they make the same
+// synchronous step and are held to the same tolerance as the optimised paths.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidGoldenActorPathTest, "BoidSystem.Golden.ActorPath",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidGoldenActorPathTest::RunTest(const FString& Parameters)
+{
+	for (const FBoidGoldenScenario& Scenario : BoidGoldenScenarios)
+	{
+		FBoidGoldenTrajectory Golden;
+		if (!LoadBoidGolden(*this, Scenario, Golden))
+		{
+			continue;
+		}
+
+		UWorld* World = UWorld::CreateWorld(EWorldType::Game, false);
+		FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+		WorldContext.SetCurrentWorld(World);
+		World->InitializeActorsForPlay(FURL());
+		World->BeginPlay();
+
+		// Spawned in order, so slot i of the flock arrays is boid i of the reference as long as nothing reorders them.
+		Settings.Reset();
+		Settings.MaxNeighbours = 0;
+		TArray<ABoid*> Boids;
+		for (int32 i = 0; i < Golden.SamplePositions[0].Num(); i++)
+		{
+			ABoid* Boid = World->SpawnActor<ABoid>();
+			Boid->SetSpeed(Golden.Body.Speed);
+			Boid->SetMaxAcceleration(Golden.Body.MaxAcceleration);
+			Boid->SetIfConstantSpeed(Golden.Body.HasConstantSpeed);
+			Boid->SetRulePipeline(&Golden.Params.Pipeline);
+			// Ticked by hand below.
+			Boid->SetActorTickEnabled(false);
+			Boids.Add(Boid);
+		}
+
+		FBoidReferenceSimulation Reference;
+		Reference.Init(Golden.Params, Golden.Body, Golden.SamplePositions[0], Golden.SampleVelocities[0]);
+		TArray<FVector2D> Positions;
+		TArray<FVector2D> Velocities;
+		FBoidDivergence Divergence;
+
+		for (int32 Frame = 1; Frame <= Golden.NumFrames; Frame++)
+		{
+			for (int32 i = 0; i < Boids.Num(); i++)
+			{
+				Boids[i]->SetPosition(Reference.GetPositions()[i]);
+				Boids[i]->SetVelocity2D(Reference.GetVelocities()[i]);
+			}
+
+			// What the controller does at the start of an Actors mode frame.
+			Settings.RebuildGrid(Golden.Params.Area, Golden.Params.VisualRange, Golden.Params.IsWrapped);
+			Settings.BuildNeighbours(Golden.Params.VisualRange);
+			for (ABoid* Boid : Boids)
+			{
+				Boid->Tick(Golden.DeltaTime);
+			}
+			Reference.Step(Golden.DeltaTime);
+
+			Positions.Reset();
+			Velocities.Reset();
+			for (const ABoid* Boid : Boids)
+			{
+				Positions.Add(Boid->GetPosition());
+				Velocities.Add(Boid->GetVelocity2D());
+			}
+
+			const FBoidDivergence Step = MeasureBoidDivergence(Golden.Params, Reference.GetPositions(), Reference.GetVelocities(), Positions, Velocities);
+			Divergence.Max(Step);
+			if (Step.Position > BoidPositionTolerance || Step.Velocity > BoidVelocityTolerance)
+			{
+				AddError(FString::Printf(TEXT("%s, actors, frame %d: one step off the reference by position %.2e, velocity %.2e"),
+					Scenario.Name, Frame, Step.Position, Step.Velocity));
+			}
+		}
+
+		AddInfo(FString::Printf(TEXT("%s, actors: one step position %.2e (mean %.2e), velocity %.2e (mean %.2e)"),
+			Scenario.Name, Divergence.Position, Divergence.MeanPosition, Divergence.Velocity, Divergence.MeanVelocity));
+
+		for (ABoid* Boid : Boids)
+		{
+			Boid->Destroy();
+		}
+		Settings.Reset();
+		GEngine->DestroyWorldContext(World);
+		World->DestroyWorld(false);
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidCompactStateSizeTest, "BoidSystem.Golden.CompactStateSize",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidCompactStateSizeTest::RunTest(const FString& Parameters)
+{
+	const FBoidGoldenScenario& Scenario = BoidGoldenScenarios[0];
+	FBoidGoldenTrajectory Golden;
+	RecordBoidGolden(Scenario, Golden);
+
+	TArray<FBoidBody> Bodies;
+	Bodies.Init(Golden.Body, Golden.SamplePositions[0].Num());
+	FBoidSimulationParams CompactParams = Golden.Params;
+	CompactParams.UseCompactState = true;
+
+	FBoidSimulation Full;
+	FBoidSimulation Compact;
+	Full.Init(Golden.SamplePositions[0], Golden.SampleVelocities[0], Bodies);
+	Full.SetParams(Golden.Params);
+	Compact.Init(Golden.SamplePositions[0], Golden.SampleVelocities[0], Bodies);
+	Compact.SetParams(CompactParams);
+	Full.Step(Golden.DeltaTime);
+	Compact.Step(Golden.DeltaTime);
+
+	AddInfo(FString::Printf(TEXT("State bytes per boid: %.1f as floats, %.1f compact"), Full.GetStateBytesPerBoid(), Compact.GetStateBytesPerBoid()));
+	TestTrue(TEXT("Compact state is smaller"), Compact.GetStateBytesPerBoid() < Full.GetStateBytesPerBoid());
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
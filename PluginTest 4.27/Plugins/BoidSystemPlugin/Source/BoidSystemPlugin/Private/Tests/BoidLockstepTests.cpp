@@ -0,0 +1,213 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidLockstep.h"
+#include "BoidTestFixture.h"
+#include "Serialization/MemoryReader.h"
+
+// Runs a lockstep session without a network: a host closes turns from random inputs, and two peers step
+// them from the bytes alone, one there from the start and one joining halfway from the saved state.
+// Their checksums have to match the host's after every turn. The real thing can be watched with two players
+// in play in editor and the controller's SimulationMode set to Lockstep.
+
+static const int32 BoidLockstepTestSeed = 4321;
+static const int32 BoidLockstepTestTurns = 120;
+static const int32 BoidLockstepTestPlayers = 2;
+
+static FBoidLockstepParams MakeBoidLockstepTestParams()
+{
+	FBoidLockstepParams Params;
+	Params.Simulation = MakeBoidTestParams(FVector2D(100, 100), true);
+	Params.Body.Speed = BoidTestSpeed;
+	Params.Seed = BoidLockstepTestSeed;
+	return Params;
+}
+
+// Holds or lets go of the buttons now and then and sometimes spawns a boid.
+static FBoidLockstepInput MakeBoidLockstepTestInput(FRandomStream& Random)
+{
+	FBoidLockstepInput Input;
+	const int32 Buttons = Random.RandRange(0, 5);
+	Input.LeftClick = Buttons == 1;
+	Input.RightClick = Buttons == 2;
+	Input.MousePosition = FVector2D(Random.FRandRange(0, 100), Random.FRandRange(0, 100));
+	if (Random.RandRange(0, 9) == 0)
+	{
+		Input.Spawns.Add(FVector2D(Random.FRandRange(0, 100), Random.FRandRange(0, 100)));
+	}
+	return Input;
+}
+
+static bool DecodeBoidLockstepTurn(const TArray<uint8>& Bytes, FBoidLockstepTurn& OutTurn)
+{
+	FMemoryReader Reader(Bytes);
+	return OutTurn.Serialize(Reader);
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidLockstepSyncTest, "BoidSystem.Lockstep.Sync",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidLockstepSyncTest::RunTest(const FString& Parameters)
+{
+	const FBoidLockstepParams Params = MakeBoidLockstepTestParams();
+	FBoidLockstepHost Host;
+	Host.Start(Params, 200);
+	for (int32 i = 0; i < BoidLockstepTestPlayers; i++)
+	{
+		Host.AddPlayer();
+	}
+
+	// Peers that start with the host only need the params, the flock comes from the seed.
+	FBoidLockstepSimulation Peer;
+	Peer.Init(Params, 200);
+	FBoidLockstepSimulation LatePeer;
+	bool HasLatePeer = false;
+
+	FRandomStream Random(BoidLockstepTestSeed);
+	TArray<uint8> Bytes;
+	TArray<uint8> State;
+	FBoidLockstepTurn Turn;
+	int32 NumMismatches = 0;
+
+	for (int32 i = 0; i < BoidLockstepTestTurns; i++)
+	{
+		for (int32 Slot = 0; Slot < BoidLockstepTestPlayers; Slot++)
+		{
+			Host.SetInput(Slot, MakeBoidLockstepTestInput(Random));
+		}
+
+		if (i == BoidLockstepTestTurns / 2)
+		{
+			Host.GetSimulation().Save(State);
+			HasLatePeer = TestTrue(TEXT("The late peer loads the saved flock"), LatePeer.Load(State));
+		}
+
+		Host.CloseTurn(Bytes);
+		if (!TestTrue(FString::Printf(TEXT("Turn %d decodes"), i + 1), DecodeBoidLockstepTurn(Bytes, Turn)))
+		{
+			return false;
+		}
+
+		Peer.Step(Turn);
+		NumMismatches += Host.CheckChecksum(Turn.Turn, Peer.GetChecksum()) ? 0 : 1;
+		if (HasLatePeer)
+		{
+			LatePeer.Step(Turn);
+			NumMismatches += Host.CheckChecksum(Turn.Turn, LatePeer.GetChecksum()) ? 0 : 1;
+		}
+	}
+
+	TestEqual(TEXT("Every peer's checksum matches the host's"), NumMismatches, 0);
+	TestEqual(TEXT("Spawns reach every peer"), Peer.GetNum(), Host.GetSimulation().GetNum());
+	TestTrue(TEXT("The players spawned boids"), Host.GetSimulation().GetNum() > 200);
+	TestEqual(TEXT("The late peer has the same flock"), LatePeer.GetChecksum(), Host.GetSimulation().GetChecksum());
+
+	// A peer whose flock is off by the smallest step is caught on the next turn. The last float saved is a velocity.
+	Peer.Save(State);
+	State[State.Num() - sizeof(float)] ^= 1;
+	FBoidLockstepSimulation BrokenPeer;
+	TestTrue(TEXT("The broken peer loads"), BrokenPeer.Load(State));
+	Host.CloseTurn(Bytes);
+	DecodeBoidLockstepTurn(Bytes, Turn);
+	BrokenPeer.Step(Turn);
+	TestFalse(TEXT("A desync is detected"), Host.CheckChecksum(Turn.Turn, BrokenPeer.GetChecksum()));
+
+	return true;
+}
+
+// More spawns in one turn than a turn carries, as a busy host can queue for itself. Every turn still has to
+// decode on a peer, the spawns over the limit going out in the turns after, until the peer has them all.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidLockstepSpawnLimitTest, "BoidSystem.Lockstep.SpawnLimit",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidLockstepSpawnLimitTest::RunTest(const FString& Parameters)
+{
+	const FBoidLockstepParams Params = MakeBoidLockstepTestParams();
+	const int32 NumSpawns = 10000;
+	FBoidLockstepHost Host;
+	Host.Start(Params, 200);
+	const int32 Slot = Host.AddPlayer();
+	FBoidLockstepSimulation Peer;
+	Peer.Init(Params, 200);
+
+	FRandomStream Random(BoidLockstepTestSeed);
+	FBoidLockstepInput Input;
+	for (int32 i = 0; i < NumSpawns; i++)
+	{
+		const float X = Random.FRandRange(0, 100);
+		const float Y = Random.FRandRange(0, 100);
+		Input.Spawns.Add(FVector2D(X, Y));
+	}
+	Host.SetInput(Slot, Input);
+
+	TArray<uint8> Bytes;
+	FBoidLockstepTurn Turn;
+	int32 NumTurns = 0;
+	int32 MostPerTurn = 0;
+	while (Peer.GetNum() < 200 + NumSpawns && NumTurns < 10)
+	{
+		Host.CloseTurn(Bytes);
+		NumTurns++;
+		if (!TestTrue(FString::Printf(TEXT("Turn %d decodes"), NumTurns), DecodeBoidLockstepTurn(Bytes, Turn)))
+		{
+			return false;
+		}
+		for (const TPair<int32, FBoidLockstepInput>& TurnInput : Turn.Inputs)
+		{
+			MostPerTurn = FMath::Max(MostPerTurn, TurnInput.Value.Spawns.Num());
+		}
+		Peer.Step(Turn);
+	}
+
+	AddInfo(FString::Printf(TEXT("%d spawns went out over %d turns, at most %d in one"), NumSpawns, NumTurns, MostPerTurn));
+	TestTrue(TEXT("The spawns are spread over several turns"), NumTurns > 1 && MostPerTurn < NumSpawns);
+	TestEqual(TEXT("The peer spawns every boid"), Peer.GetNum(), 200 + NumSpawns);
+	TestEqual(TEXT("The peer's flock matches the host's"), Peer.GetChecksum(), Host.GetSimulation().GetChecksum());
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidLockstepTrafficTest, "BoidSystem.Lockstep.Traffic",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidLockstepTrafficTest::RunTest(const FString& Parameters)
+{
+	// The same inputs with a small and a large flock cost the same bytes.
+	int64 TotalBytes[2] = { 0, 0 };
+	const int32 NumBoids[2] = { 50, 1000 };
+
+	for (int32 Run = 0; Run < 2; Run++)
+	{
+		FBoidLockstepHost Host;
+		Host.Start(MakeBoidLockstepTestParams(), NumBoids[Run]);
+		for (int32 i = 0; i < BoidLockstepTestPlayers; i++)
+		{
+			Host.AddPlayer();
+		}
+
+		FRandomStream Random(BoidLockstepTestSeed);
+		TArray<uint8> Bytes;
+		for (int32 i = 0; i < BoidLockstepTestTurns; i++)
+		{
+			for (int32 Slot = 0; Slot < BoidLockstepTestPlayers; Slot++)
+			{
+				Host.SetInput(Slot, MakeBoidLockstepTestInput(Random));
+			}
+			Host.CloseTurn(Bytes);
+			TotalBytes[Run] += Bytes.Num();
+		}
+	}
+
+	const float TurnRate = 1.0f / MakeBoidLockstepTestParams().TurnDeltaTime;
+	AddInfo(FString::Printf(TEXT("Bytes a second to each peer for %d players: %.1f with %d boids, %.1f with %d boids"), BoidLockstepTestPlayers,
+		TotalBytes[0] * TurnRate / BoidLockstepTestTurns, NumBoids[0], TotalBytes[1] * TurnRate / BoidLockstepTestTurns, NumBoids[1]));
+	TestEqual(TEXT("Traffic does not depend on the flock size"), TotalBytes[1], TotalBytes[0]);
+
+	return true;
+}
+
+#endif
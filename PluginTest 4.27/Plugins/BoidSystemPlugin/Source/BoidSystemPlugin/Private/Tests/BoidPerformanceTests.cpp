@@ -0,0 +1,242 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidConsoleVariables.h"
+#include "BoidController.h"
+#include "BoidSimulation.h"
+#include "BoidTestFixture.h"
+#include "Engine/Engine.h"
+#include "EngineUtils.h"
+#include "HAL/MemoryBase.h"
+
+// Frame time and allocation checks for the flock. They need no GPU, run them headless with
+//   UE4Editor-Cmd <Project>.uproject -nullrhi -unattended -nopause -ExecCmds="Automation RunTests BoidSystem.Performance; Quit"
+// The budgets suit a recent build machine, boids.Test.BudgetScale stretches them for slower agents.
+
+static TAutoConsoleVariable<float> CVarBoidsTestBudgetScale(
+	TEXT("boids.Test.BudgetScale"),
+	1.0f,
+	TEXT("Multiplier on the frame time budgets of the BoidSystem.Performance automation tests."),
+	ECVF_Default);
+
+static const int32 BoidTestWarmUpFrames = 10;
+static const int32 BoidTestFrames = 120;
+static const float BoidTestDeltaTime = 1.0f / 60.0f;
+// Boids per 100 x 100 units, the controller's default flock, so every size sees the same neighbour count.
+static const float BoidTestDensity = 1000.0f;
+// Allocations per world frame the engine may make around the flock, whatever its size.
+static const double BoidTestWorldAllocationsPerFrame = 128.0;
+
+// A flock size and the mean frame time it has to stay under.
+struct FBoidTestCase
+{
+	int32 NumBoids;
+	double BudgetMs;
+};
+
+struct FBoidFrameTimes
+{
+	double MeanMs = 0;
+	double Percentile95Ms = 0;
+	double AllocationsPerFrame = 0;
+	// False if the allocator does not count its calls, AllocationsPerFrame is meaningless then.
+	bool AreAllocationsCounted = false;
+};
+
+// Allocations made by any thread since startup, in builds where the allocator counts them.
+static uint64 GetBoidTestAllocations()
+{
+	return uint64(FMalloc::TotalMallocCalls) + uint64(FMalloc::TotalReallocCalls);
+}
+
+// Not every allocator or build configuration keeps the counters up to date, see if one allocation moves them.
+static bool AreBoidTestAllocationsCounted()
+{
+	const uint64 StartAllocations = GetBoidTestAllocations();
+	void* Probe = FMemory::Malloc(64);
+	FMemory::Free(Probe);
+	return GetBoidTestAllocations() != StartAllocations;
+}
+
+static void WarnIfBoidTestAllocationsUncounted(FAutomationTestBase& Test)
+{
+	if (!AreBoidTestAllocationsCounted())
+	{
+		Test.AddWarning(TEXT("The allocator does not count its calls in this build, allocations per frame are not checked."));
+	}
+}
+
+// Run Step for the warm up frames, then time it over the measured ones.
+template <typename StepType>
+static FBoidFrameTimes MeasureBoidFrames(StepType&& Step)
+{
+	for (int32 Frame = 0; Frame < BoidTestWarmUpFrames; Frame++)
+	{
+		Step();
+	}
+
+	TArray<double> FrameMs;
+	FrameMs.Reserve(BoidTestFrames);
+	const uint64 StartAllocations = GetBoidTestAllocations();
+
+	for (int32 Frame = 0; Frame < BoidTestFrames; Frame++)
+	{
+		const double StartTime = FPlatformTime::Seconds();
+		Step();
+		FrameMs.Add((FPlatformTime::Seconds() - StartTime) * 1000.0);
+	}
+
+	FBoidFrameTimes Times;
+	Times.AllocationsPerFrame = double(GetBoidTestAllocations() - StartAllocations) / BoidTestFrames;
+	Times.AreAllocationsCounted = AreBoidTestAllocationsCounted();
+	for (const double Ms : FrameMs)
+	{
+		Times.MeanMs += Ms;
+	}
+	Times.MeanMs /= BoidTestFrames;
+	FrameMs.Sort();
+	Times.Percentile95Ms = FrameMs[BoidTestFrames * 95 / 100];
+	return Times;
+}
+
+static FVector2D GetBoidTestArea(int32 NumBoids)
+{
+	const float Side = 100.0f * FMath::Sqrt(NumBoids / BoidTestDensity);
+	return FVector2D(Side, Side);
+}
+
+// Mean under the budget, and no more than the odd frame far over it.
+static void CheckBoidFrameTimes(FAutomationTestBase& Test, const FString& What, const FBoidFrameTimes& Times, double BudgetMs, double MaxAllocationsPerFrame)
+{
+	BudgetMs *= FMath::Max(CVarBoidsTestBudgetScale.GetValueOnGameThread(), 0.0f);
+
+	Test.AddInfo(FString::Printf(TEXT("%s: mean %.3f ms, 95th percentile %.3f ms (budget %.3f ms), %.1f allocations per frame"),
+		*What, Times.MeanMs, Times.Percentile95Ms, BudgetMs, Times.AllocationsPerFrame));
+
+	Test.TestTrue(FString::Printf(TEXT("%s mean frame time within %.3f ms"), *What, BudgetMs), Times.MeanMs <= BudgetMs);
+	Test.TestTrue(FString::Printf(TEXT("%s 95th percentile frame time within %.3f ms"), *What, BudgetMs * 2.0), Times.Percentile95Ms <= BudgetMs * 2.0);
+	if (Times.AreAllocationsCounted)
+	{
+		Test.TestTrue(FString::Printf(TEXT("%s allocations per frame at most %.0f"), *What, MaxAllocationsPerFrame), Times.AllocationsPerFrame <= MaxAllocationsPerFrame);
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidSimulationStepPerfTest, "BoidSystem.Performance.SimulationStep",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+bool FBoidSimulationStepPerfTest::RunTest(const FString& Parameters)
+{
+	// One thread, no actors: the cost of the flock step itself.
+	const FBoidTestCase Cases[] = { { 1000, 1.0 }, { 10000, 10.0 }, { 50000, 50.0 } };
+	WarnIfBoidTestAllocationsUncounted(*this);
+
+	for (const FBoidTestCase& Case : Cases)
+	{
+		FRandomStream Random(BoidTestSeed);
+		const FVector2D Area = GetBoidTestArea(Case.NumBoids);
+
+		TArray<FVector2D> Positions;
+		TArray<FVector2D> Velocities;
+		MakeBoidTestFlock(Random, Case.NumBoids, FVector2D::ZeroVector, Area, BoidTestSpeed, Positions, Velocities);
+		TArray<FBoidBody> Bodies;
+		Bodies.SetNum(Case.NumBoids);
+
+		// Float first, then the fixed point step with the same flock, which may take up to twice as long.
+		double FloatMeanMs = 0;
+		for (const bool UseFixedPoint : { false, true })
+		{
+			FBoidSimulationParams Params = MakeBoidTestParams(Area, true);
+			Params.UseFixedPoint = UseFixedPoint;
+
+			FBoidSimulation Simulation;
+			Simulation.Init(Positions, Velocities, Bodies);
+			Simulation.SetParams(Params);
+
+			// Every array and the frame arena are reused once warm, so a step allocates next to nothing whatever the flock size.
+			const FBoidFrameTimes Times = MeasureBoidFrames([&Simulation]()
+			{
+				Simulation.Step(BoidTestDeltaTime);
+			});
+
+			if (!UseFixedPoint)
+			{
+				CheckBoidFrameTimes(*this, FString::Printf(TEXT("Simulation step, %d boids"), Case.NumBoids), Times, Case.BudgetMs, 4.0);
+				FloatMeanMs = Times.MeanMs;
+				continue;
+			}
+
+			CheckBoidFrameTimes(*this, FString::Printf(TEXT("Fixed point simulation step, %d boids"), Case.NumBoids), Times, Case.BudgetMs * 2.0, 4.0);
+			AddInfo(FString::Printf(TEXT("Fixed point costs %.2fx the float step with %d boids"), Times.MeanMs / FMath::Max(FloatMeanMs, 1e-6), Case.NumBoids));
+		}
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidControllerFramePerfTest, "BoidSystem.Performance.ControllerFrame",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+bool FBoidControllerFramePerfTest::RunTest(const FString& Parameters)
+{
+	// Whole world ticks with the boid actors, through the controller as in a game.
+	const TPair<EBoidSimulationMode, const TCHAR*> Modes[] = {
+		{ EBoidSimulationMode::Actors, TEXT("actors") },
+		{ EBoidSimulationMode::Pipelined, TEXT("pipelined") }
+	};
+	const FBoidTestCase Cases[] = { { 500, 8.0 }, { 2000, 25.0 }, { 5000, 60.0 } };
+
+	// Whatever the editor session had set, put back at the end.
+	const int32 PreviousCount = CVarBoidsCount.GetValueOnGameThread();
+	const int32 PreviousMode = CVarBoidsSimulationMode.GetValueOnGameThread();
+	const int32 PreviousDebugDraw = CVarBoidsDebugDraw.GetValueOnGameThread();
+	CVarBoidsDebugDraw->Set(0, ECVF_SetByCode);
+	WarnIfBoidTestAllocationsUncounted(*this);
+
+	for (const TPair<EBoidSimulationMode, const TCHAR*>& Mode : Modes)
+	{
+		for (const FBoidTestCase& Case : Cases)
+		{
+			UWorld* World = UWorld::CreateWorld(EWorldType::Game, false);
+			FWorldContext& WorldContext = GEngine->CreateNewWorldContext(EWorldType::Game);
+			WorldContext.SetCurrentWorld(World);
+			World->InitializeActorsForPlay(FURL());
+			World->BeginPlay();
+
+			// The controller spawns the flock itself from the random stream, so seed it first.
+			FMath::RandInit(BoidTestSeed);
+			FMath::SRandInit(BoidTestSeed);
+			CVarBoidsCount->Set(Case.NumBoids, ECVF_SetByCode);
+			CVarBoidsSimulationMode->Set(static_cast<int32>(Mode.Key), ECVF_SetByCode);
+			ABoidController* Controller = World->SpawnActor<ABoidController>();
+
+			const FBoidFrameTimes Times = MeasureBoidFrames([World]()
+			{
+				World->Tick(LEVELTICK_All, BoidTestDeltaTime);
+			});
+
+			// The engine allocates a little every frame, the flock must add nothing that grows with it.
+			CheckBoidFrameTimes(*this, FString::Printf(TEXT("World frame, %d boids, %s"), Case.NumBoids, Mode.Value),
+				Times, Case.BudgetMs, BoidTestWorldAllocationsPerFrame);
+
+			// Destroying the controller ends play for it, which empties the flock for the next case.
+			for (TActorIterator<ABoid> It(World); It; ++It)
+			{
+				It->Destroy();
+			}
+			Controller->Destroy();
+			GEngine->DestroyWorldContext(World);
+			World->DestroyWorld(false);
+		}
+	}
+
+	CVarBoidsCount->Set(PreviousCount, ECVF_SetByCode);
+	CVarBoidsSimulationMode->Set(PreviousMode, ECVF_SetByCode);
+	CVarBoidsDebugDraw->Set(PreviousDebugDraw, ECVF_SetByCode);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
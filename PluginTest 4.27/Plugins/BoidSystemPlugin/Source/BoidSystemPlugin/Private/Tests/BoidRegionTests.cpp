@@ -0,0 +1,139 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidRegionWorld.h"
+#include "HAL/FileManager.h"
+#include "Math/RandomStream.h"
+#include "Misc/Paths.h"
+
+// A world of the given size in regions, ten boids per region spread over it.
+static void InitRegionWorld(FBoidRegionWorld& World, int32 NumRegions, int32 Seed)
+{
+	FBoidRegionWorldParams Params;
+	Params.NumRegions = FIntPoint(NumRegions, NumRegions);
+	Params.Body.Speed = 30.0f;
+	Params.Simulation.Pipeline.Get<FBoundsKernel>().IsBounded = false;
+	Params.CacheDirectory = FPaths::AutomationTransientDir() / TEXT("BoidRegions");
+	World.Init(Params);
+
+	FRandomStream Random(Seed);
+	const float WorldSize = NumRegions * Params.RegionSize;
+	for (int32 i = 0; i < NumRegions * NumRegions * 10; i++)
+	{
+		World.AddBoid(FVector2D(Random.FRandRange(0, WorldSize), Random.FRandRange(0, WorldSize)),
+			FVector2D(Random.FRandRange(-1, 1), Random.FRandRange(-1, 1)) * Params.Body.Speed);
+	}
+}
+
+// Moves a focus point across a world, checking no boid is lost going over borders, to sleep and back, and
+// that the work per frame follows the awake area rather than the size of the world.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidRegionStreamingTest, "BoidSystem.Regions.Streaming",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidRegionStreamingTest::RunTest(const FString& Parameters)
+{
+	int32 SteppedBoids[2] = {};
+	const int32 WorldSizes[2] = { 12, 36 };
+
+	for (int32 Size = 0; Size < 2; Size++)
+	{
+		FBoidRegionWorld World;
+		InitRegionWorld(World, WorldSizes[Size], 1234);
+		const int32 NumBoids = World.GetNumBoids();
+
+		int32 NumHandOffs = 0;
+		int32 MaxAwakeRegions = 0;
+		int64 MaxCacheBytes = 0;
+		bool IsConserved = true;
+		for (int32 Frame = 0; Frame < 240; Frame++)
+		{
+			// Crosses a few hundred units, waking regions ahead of it and putting those behind to sleep.
+			TArray<FVector2D> Focus = { FVector2D(150.0f + Frame * 2.5f, 150.0f) };
+			World.UpdateRegions(Focus);
+			World.Step(1.0f / 60.0f);
+
+			NumHandOffs += World.GetNumHandOffs();
+			SteppedBoids[Size] += World.GetNumSteppedBoids();
+			MaxAwakeRegions = FMath::Max(MaxAwakeRegions, World.GetNumAwakeRegions());
+			MaxCacheBytes = FMath::Max(MaxCacheBytes, World.GetCacheBytes());
+			IsConserved &= World.GetNumBoids() == NumBoids;
+		}
+
+		TestTrue(TEXT("No boid is lost or made"), IsConserved);
+		TestTrue(TEXT("Boids are handed over borders"), NumHandOffs > 0);
+		TestTrue(TEXT("Regions left behind are cached"), MaxCacheBytes > 0);
+		TestTrue(TEXT("Only regions near the focus are awake"), MaxAwakeRegions < 64);
+		AddInfo(FString::Printf(TEXT("%dx%d regions: %d awake at most, %d boids stepped, %lld cache bytes at most"),
+			WorldSizes[Size], WorldSizes[Size], MaxAwakeRegions, SteppedBoids[Size], MaxCacheBytes));
+	}
+
+	// Nine times the world, about the same work.
+	TestTrue(TEXT("Work follows the awake area"), SteppedBoids[1] < SteppedBoids[0] * 1.25f);
+	return true;
+}
+
+// Puts a region to sleep and wakes it again without stepping, so the boids must come back from the cache
+// within the packing's rounding. A boid added while it sleeps goes into the cache after the others.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidRegionCacheTest, "BoidSystem.Regions.Cache",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidRegionCacheTest::RunTest(const FString& Parameters)
+{
+	FBoidRegionWorld World;
+	InitRegionWorld(World, 16, 99);
+
+	const FIntPoint Key(1, 1);
+	const TArray<FVector2D> Near = { FVector2D(150, 150) };
+	const TArray<FVector2D> Far = { FVector2D(950, 950) };
+
+	World.UpdateRegions(Near);
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	if (!TestTrue(TEXT("The region is awake with boids"), World.GetRegionBoids(Key, Positions, Velocities)))
+	{
+		return false;
+	}
+
+	World.UpdateRegions(Far);
+	TestTrue(TEXT("The region sleeps"), World.GetRegionTier(Key) == EBoidRegionTier::Dormant);
+	TestTrue(TEXT("Its flock is in the cache"), World.GetCacheBytes() > 0);
+
+	const int64 SleepingBytes = World.GetCacheBytes();
+	const FVector2D ArrivalPosition(150, 150);
+	const FVector2D ArrivalVelocity(10, -5);
+	World.AddBoid(ArrivalPosition, ArrivalVelocity);
+	World.UpdateRegions(Far);
+	TestTrue(TEXT("A boid added to a dormant region is cached"), World.GetCacheBytes() > SleepingBytes);
+	Positions.Add(ArrivalPosition);
+	Velocities.Add(ArrivalVelocity);
+
+	World.UpdateRegions(Near);
+	TArray<FVector2D> LoadedPositions;
+	TArray<FVector2D> LoadedVelocities;
+	World.GetRegionBoids(Key, LoadedPositions, LoadedVelocities);
+	if (!TestEqual(TEXT("Boids back from the cache"), LoadedPositions.Num(), Positions.Num()))
+	{
+		return false;
+	}
+
+	// A step is 100 / 65536 for positions and 60 / 32767 for velocities, boids on the far edge may move by a whole one.
+	float PositionError = 0;
+	float VelocityError = 0;
+	for (int32 i = 0; i < Positions.Num(); i++)
+	{
+		PositionError = FMath::Max(PositionError, FMath::Max(FMath::Abs(Positions[i].X - LoadedPositions[i].X), FMath::Abs(Positions[i].Y - LoadedPositions[i].Y)));
+		VelocityError = FMath::Max(VelocityError, FMath::Max(FMath::Abs(Velocities[i].X - LoadedVelocities[i].X), FMath::Abs(Velocities[i].Y - LoadedVelocities[i].Y)));
+	}
+	TestTrue(TEXT("Positions within the packing's rounding"), PositionError <= 0.002f);
+	TestTrue(TEXT("Velocities within the packing's rounding"), VelocityError <= 0.002f);
+	TestTrue(TEXT("The cache file is gone once read"), IFileManager::Get().FileSize(*(FPaths::AutomationTransientDir() / TEXT("BoidRegions/Region_1_1.bin"))) < 0);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,308 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidReferenceSimulation.h"
+#include "BoidReplication.h"
+#include "BoidTestFixture.h"
+
+// Runs the flock replication codec end to end without a network: a reference flock is fed through a
+// snapshot sender and its bytes straight into a receiver, losing every fifth snapshot and acknowledging
+// a snapshot late, the way an unreliable connection would. The real thing can be watched with
+// Play As Listen Server and two players, and the log has the bandwidth per connection.
+
+static const int32 BoidReplicationBoids = 300;
+static const float BoidReplicationArea = 100.0f;
+static const float BoidReplicationDeltaTime = 1.0f / 60.0f;
+static const int32 BoidReplicationFrames = 180;
+// Frames between snapshots, 20 a second.
+static const int32 BoidReplicationSendInterval = 3;
+static const int32 BoidReplicationDelayFrames = 6;
+
+// Every frame of a seeded reference flock.
+static void RecordBoidReplicationFlock(TArray<TArray<FVector2D>>& OutPositions, TArray<TArray<FVector2D>>& OutVelocities)
+{
+	const FBoidSimulationParams Params = MakeBoidTestParams(FVector2D(BoidReplicationArea, BoidReplicationArea), true);
+	FBoidBody Body;
+	Body.Speed = BoidTestSpeed;
+
+	FRandomStream Random(BoidTestSeed);
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	MakeBoidTestFlock(Random, BoidReplicationBoids, FVector2D::ZeroVector, FVector2D(BoidReplicationArea, BoidReplicationArea), Body.Speed,
+		Positions, Velocities);
+
+	FBoidReferenceSimulation Simulation;
+	Simulation.Init(Params, Body, Positions, Velocities);
+	OutPositions.Reset();
+	OutVelocities.Reset();
+	for (int32 Frame = 0; Frame <= BoidReplicationFrames; Frame++)
+	{
+		OutPositions.Add(Simulation.GetPositions());
+		OutVelocities.Add(Simulation.GetVelocities());
+		Simulation.Step(BoidReplicationDeltaTime);
+	}
+}
+
+static float GetBoidReplicationError(FVector2D A, FVector2D B)
+{
+	FVector2D Offset = B - A;
+	Offset.X -= BoidReplicationArea * FMath::RoundToFloat(Offset.X / BoidReplicationArea);
+	Offset.Y -= BoidReplicationArea * FMath::RoundToFloat(Offset.Y / BoidReplicationArea);
+	return Offset.Size();
+}
+
+// Bytes per boid per second of a run where the client acknowledges or never does.
+static float SendBoidReplicationFlock(const TArray<TArray<FVector2D>>& Positions, const TArray<TArray<FVector2D>>& Velocities, bool Acknowledge)
+{
+	FBoidSnapshotSender Sender;
+	Sender.Settings.Area = FVector2D(BoidReplicationArea, BoidReplicationArea);
+	FBoidSnapshotReceiver Receiver;
+	Receiver.Settings = Sender.Settings;
+
+	TArray<int32> Ids;
+	for (int32 i = 0; i < BoidReplicationBoids; i++)
+	{
+		Ids.Add(i);
+	}
+
+	TArray<uint8> Bytes;
+	int64 TotalBytes = 0;
+	for (int32 Frame = 0; Frame <= BoidReplicationFrames; Frame += BoidReplicationSendInterval)
+	{
+		Sender.BuildSnapshot(Ids, Positions[Frame], Velocities[Frame], Frame * BoidReplicationDeltaTime, Bytes);
+		TotalBytes += Bytes.Num();
+
+		uint32 Sequence = 0;
+		if (Acknowledge && Receiver.Receive(Bytes, Sequence))
+		{
+			Sender.Acknowledge(Sequence);
+		}
+	}
+
+	return TotalBytes / (BoidReplicationFrames * BoidReplicationDeltaTime) / BoidReplicationBoids;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidReplicationLoopbackTest, "BoidSystem.Replication.Loopback",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidReplicationLoopbackTest::RunTest(const FString& Parameters)
+{
+	TArray<TArray<FVector2D>> Positions;
+	TArray<TArray<FVector2D>> Velocities;
+	RecordBoidReplicationFlock(Positions, Velocities);
+
+	FBoidSnapshotSender Sender;
+	Sender.Settings.Area = FVector2D(BoidReplicationArea, BoidReplicationArea);
+	FBoidSnapshotReceiver Receiver;
+	Receiver.Settings = Sender.Settings;
+	const float Precision = Sender.Settings.Precision;
+
+	TArray<int32> Ids;
+	for (int32 i = 0; i < BoidReplicationBoids; i++)
+	{
+		Ids.Add(i);
+	}
+
+	TArray<uint8> Bytes;
+	TArray<FBoidReplicatedState> States;
+	uint32 PendingAck = 0;
+	int32 NumSnapshots = 0;
+	int32 NumReceived = 0;
+	float MaxSnapshotError = 0;
+	float MaxHeadingError = 0;
+	float MeanInterpolationError = 0;
+	int32 NumInterpolated = 0;
+
+	for (int32 Frame = 0; Frame <= BoidReplicationFrames; Frame++)
+	{
+		const float Time = Frame * BoidReplicationDeltaTime;
+
+		if (Frame % BoidReplicationSendInterval == 0)
+		{
+			// The acknowledgement of the last snapshot arrives now, a snapshot late.
+			if (PendingAck != 0)
+			{
+				Sender.Acknowledge(PendingAck);
+				PendingAck = 0;
+			}
+
+			Sender.BuildSnapshot(Ids, Positions[Frame], Velocities[Frame], Time, Bytes);
+			if (++NumSnapshots % 5 != 0)
+			{
+				uint32 Sequence = 0;
+				if (!TestTrue(FString::Printf(TEXT("Snapshot %d decodes"), NumSnapshots), Receiver.Receive(Bytes, Sequence)))
+				{
+					return false;
+				}
+				PendingAck = Sequence;
+				NumReceived++;
+
+				// The newest snapshot is shown as it was sent, off by the rounding alone.
+				Receiver.Sample(Time, States);
+				TestEqual(TEXT("Every boid is in the snapshot"), States.Num(), BoidReplicationBoids);
+				for (const FBoidReplicatedState& State : States)
+				{
+					MaxSnapshotError = FMath::Max(MaxSnapshotError, GetBoidReplicationError(Positions[Frame][State.Id], State.Position));
+					const FVector2D Heading = Velocities[Frame][State.Id].GetSafeNormal();
+					MaxHeadingError = FMath::Max(MaxHeadingError, FMath::Acos(FMath::Clamp(FVector2D::DotProduct(Heading, State.Heading), -1.0f, 1.0f)));
+				}
+			}
+		}
+
+		// Between snapshots the client shows the flock a little in the past.
+		const int32 ShownFrame = Frame - BoidReplicationDelayFrames;
+		if (ShownFrame >= BoidReplicationSendInterval * 2)
+		{
+			Receiver.Sample(ShownFrame * BoidReplicationDeltaTime, States);
+			for (const FBoidReplicatedState& State : States)
+			{
+				MeanInterpolationError += GetBoidReplicationError(Positions[ShownFrame][State.Id], State.Position);
+				NumInterpolated++;
+			}
+		}
+	}
+	MeanInterpolationError /= FMath::Max(NumInterpolated, 1);
+
+	// How far a boid moves between two snapshots, which interpolation should be well inside.
+	const float SnapshotDistance = BoidTestSpeed * BoidReplicationSendInterval * BoidReplicationDeltaTime;
+
+	AddInfo(FString::Printf(TEXT("%d of %d snapshots received, position error %.3f at snapshots, %.3f mean interpolated, heading error %.1f degrees"),
+		NumReceived, NumSnapshots, MaxSnapshotError, MeanInterpolationError, FMath::RadiansToDegrees(MaxHeadingError)));
+	TestTrue(TEXT("Snapshot positions are within rounding"), MaxSnapshotError <= Precision * 0.5f * UE_SQRT_2 + KINDA_SMALL_NUMBER);
+	TestTrue(TEXT("Snapshot headings are within rounding"), MaxHeadingError <= PI / 256.0f + 1e-3f);
+	TestTrue(TEXT("Interpolated positions follow the flock"), MeanInterpolationError < SnapshotDistance * 0.1f);
+
+	const float FullBytes = SendBoidReplicationFlock(Positions, Velocities, false);
+	const float DeltaBytes = SendBoidReplicationFlock(Positions, Velocities, true);
+	AddInfo(FString::Printf(TEXT("Bytes per boid per second at 20 snapshots a second: %.1f whole, %.1f delta compressed"), FullBytes, DeltaBytes));
+	TestTrue(TEXT("Delta compression saves bandwidth"), DeltaBytes < FullBytes * 0.6f);
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidReplicationRelevancyTest, "BoidSystem.Replication.Relevancy",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidReplicationRelevancyTest::RunTest(const FString& Parameters)
+{
+	TArray<TArray<FVector2D>> Positions;
+	TArray<TArray<FVector2D>> Velocities;
+	RecordBoidReplicationFlock(Positions, Velocities);
+
+	FBoidSnapshotSender Sender;
+	Sender.Settings.Area = FVector2D(BoidReplicationArea, BoidReplicationArea);
+	Sender.Settings.RelevancyRadius = 20.0f;
+	Sender.SetViewPosition(FVector2D(5, 5));
+	FBoidSnapshotReceiver Receiver;
+	Receiver.Settings = Sender.Settings;
+
+	TArray<int32> Ids;
+	for (int32 i = 0; i < BoidReplicationBoids; i++)
+	{
+		Ids.Add(i);
+	}
+
+	TArray<uint8> Bytes;
+	TArray<FBoidReplicatedState> States;
+	uint32 Sequence = 0;
+
+	Sender.BuildSnapshot(Ids, Positions[0], Velocities[0], 0, Bytes);
+	TestTrue(TEXT("Culled snapshot decodes"), Receiver.Receive(Bytes, Sequence));
+	Receiver.Sample(0, States);
+	TestTrue(TEXT("Some boids are relevant"), States.Num() > 0 && States.Num() < BoidReplicationBoids);
+	for (const FBoidReplicatedState& State : States)
+	{
+		// Across the seam from the view counts as close.
+		TestTrue(TEXT("Only boids near the view are sent"), GetBoidReplicationError(FVector2D(5, 5), State.Position) <= 20.0f + Sender.Settings.Precision);
+	}
+
+	Sender.Settings.MaxBoids = 10;
+	Sender.Acknowledge(Sequence);
+	Sender.BuildSnapshot(Ids, Positions[1], Velocities[1], BoidReplicationDeltaTime, Bytes);
+	TestTrue(TEXT("Capped snapshot decodes"), Receiver.Receive(Bytes, Sequence));
+	Receiver.Sample(BoidReplicationDeltaTime, States);
+	TestEqual(TEXT("Snapshots hold at most MaxBoids"), States.Num(), 10);
+
+	return true;
+}
+
+// The whole flock does not fit in the byte budget at first. Snapshots must stay inside it, keep the boids
+// nearest the view, and take in the rest as the client acknowledges them and they cost a delta instead.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidReplicationByteBudgetTest, "BoidSystem.Replication.ByteBudget",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidReplicationByteBudgetTest::RunTest(const FString& Parameters)
+{
+	TArray<TArray<FVector2D>> Positions;
+	TArray<TArray<FVector2D>> Velocities;
+	RecordBoidReplicationFlock(Positions, Velocities);
+
+	const FVector2D ViewPosition(50, 50);
+	FBoidSnapshotSender Sender;
+	Sender.Settings.Area = FVector2D(BoidReplicationArea, BoidReplicationArea);
+	Sender.Settings.MaxBytes = 600;
+	Sender.SetViewPosition(ViewPosition);
+	FBoidSnapshotReceiver Receiver;
+	Receiver.Settings = Sender.Settings;
+
+	TArray<int32> Ids;
+	for (int32 i = 0; i < BoidReplicationBoids; i++)
+	{
+		Ids.Add(i);
+	}
+
+	TArray<uint8> Bytes;
+	TArray<FBoidReplicatedState> States;
+	int32 LargestSnapshot = 0;
+	int32 FirstNumSent = 0;
+	bool IsNearestFirst = true;
+	for (int32 Frame = 0; Frame <= BoidReplicationFrames; Frame += BoidReplicationSendInterval)
+	{
+		Sender.BuildSnapshot(Ids, Positions[Frame], Velocities[Frame], Frame * BoidReplicationDeltaTime, Bytes);
+		LargestSnapshot = FMath::Max(LargestSnapshot, Bytes.Num());
+
+		uint32 Sequence = 0;
+		if (!TestTrue(TEXT("Trimmed snapshots decode"), Receiver.Receive(Bytes, Sequence)))
+		{
+			return false;
+		}
+		Sender.Acknowledge(Sequence);
+
+		// Every boid left out is at least as far from the view as every boid sent.
+		Receiver.Sample(Frame * BoidReplicationDeltaTime, States);
+		float FarthestSent = 0;
+		for (const FBoidReplicatedState& State : States)
+		{
+			FarthestSent = FMath::Max(FarthestSent, GetBoidReplicationError(ViewPosition, Positions[Frame][State.Id]));
+		}
+		int32 NumCloserLeftOut = 0;
+		for (int32 i = 0, Sent = 0; i < BoidReplicationBoids; i++)
+		{
+			if (Sent < States.Num() && States[Sent].Id == i)
+			{
+				Sent++;
+			}
+			else if (GetBoidReplicationError(ViewPosition, Positions[Frame][i]) < FarthestSent)
+			{
+				NumCloserLeftOut++;
+			}
+		}
+		IsNearestFirst &= NumCloserLeftOut == 0;
+		FirstNumSent = Frame == 0 ? States.Num() : FirstNumSent;
+	}
+
+	AddInfo(FString::Printf(TEXT("First snapshot holds %d boids, the last %d, largest %d bytes"), FirstNumSent, States.Num(), LargestSnapshot));
+	TestTrue(TEXT("Snapshots stay inside the byte budget"), LargestSnapshot <= Sender.Settings.MaxBytes);
+	TestTrue(TEXT("The first snapshot is trimmed"), FirstNumSent > 0 && FirstNumSent < BoidReplicationBoids);
+	TestTrue(TEXT("The boids nearest the view are sent"), IsNearestFirst);
+	TestTrue(TEXT("Deltas let more boids in"), States.Num() > FirstNumSent);
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,296 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidBatchSimulation.h"
+#include "BoidShard.h"
+#include "BoidShardProcess.h"
+#include "SocketSubsystem.h"
+#include "Sockets.h"
+
+// Shards stepped side by side in one process, passing their exchange messages round by hand as the
+// coordinator's workers do over sockets.
+
+static void StepShards(FBoidShard* Shards, int32 NumShards, float DeltaTime, bool& OutValid)
+{
+	TArray<TArray<uint8>> ToLeft;
+	TArray<TArray<uint8>> ToRight;
+	ToLeft.SetNum(NumShards);
+	ToRight.SetNum(NumShards);
+
+	for (int32 i = 0; i < NumShards; i++)
+	{
+		Shards[i].WriteExchange(ToLeft[i], ToRight[i]);
+	}
+	for (int32 i = 0; i < NumShards; i++)
+	{
+		OutValid &= Shards[i].ReadExchange(ToRight[(i + NumShards - 1) % NumShards], ToLeft[(i + 1) % NumShards]);
+		Shards[i].Step(DeltaTime);
+	}
+}
+
+static FBoidBatchScenario MakeShardScenario()
+{
+	FBoidBatchScenario Scenario;
+	Scenario.NumBoids = 600;
+	Scenario.Seed = 77;
+	Scenario.Body.Speed = 30.0f;
+	Scenario.Params.Pipeline.Get<FBoundsKernel>().IsBounded = false;
+	return Scenario;
+}
+
+// A few steps split over one to four shards against the whole flock in one wrapped simulation. The ghosts
+// give every boid the neighbours it would have had, so only the float rounding of the offsets differs. That
+// can still tip a neighbour right on the visual range in or out, so a few boids may drift apart.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidShardMatchTest, "BoidSystem.Shards.MatchWholeFlock",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidShardMatchTest::RunTest(const FString& Parameters)
+{
+	const FBoidBatchScenario Scenario = MakeShardScenario();
+	const int32 NumSteps = 10;
+
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	FBoidBatchSimulation::SpawnFlock(Scenario, Positions, Velocities);
+	TArray<FBoidBody> Bodies;
+	Bodies.Init(Scenario.Body, Scenario.NumBoids);
+
+	FBoidSimulation Simulation;
+	Simulation.Init(Positions, Velocities, Bodies);
+	Simulation.SetParams(Scenario.Params);
+	for (int32 Step = 0; Step < NumSteps; Step++)
+	{
+		Simulation.Step(Scenario.DeltaTime);
+	}
+	FBoidFlockState Expected;
+	Simulation.CopyState(Expected);
+
+	for (int32 NumShards = 1; NumShards <= 4; NumShards++)
+	{
+		FBoidShard Shards[4];
+		for (int32 i = 0; i < NumShards; i++)
+		{
+			Shards[i].Init(Scenario.Params, Scenario.Body, i, NumShards);
+			Shards[i].AddBoids(Positions, Velocities, 0);
+		}
+
+		bool IsValid = true;
+		for (int32 Step = 0; Step < NumSteps; Step++)
+		{
+			StepShards(Shards, NumShards, Scenario.DeltaTime, IsValid);
+		}
+		TestTrue(TEXT("Every exchange message reads back"), IsValid);
+
+		// Shortest way round the wrap, a boid on the seam may be on either side of it.
+		int32 NumBoids = 0;
+		int32 NumMatching = 0;
+		for (int32 ShardIndex = 0; ShardIndex < NumShards; ShardIndex++)
+		{
+			const FBoidShard& Shard = Shards[ShardIndex];
+			NumBoids += Shard.GetNum();
+			for (int32 i = 0; i < Shard.GetNum(); i++)
+			{
+				FVector2D Error = Shard.GetPositions()[i] - Expected.Positions[Shard.GetIds()[i]];
+				Error.X -= Scenario.Params.Area.X * FMath::RoundToFloat(Error.X / Scenario.Params.Area.X);
+				Error.Y -= Scenario.Params.Area.Y * FMath::RoundToFloat(Error.Y / Scenario.Params.Area.Y);
+				NumMatching += Error.Size() < 0.001f ? 1 : 0;
+			}
+		}
+
+		TestEqual(FString::Printf(TEXT("Boids over %d shards"), NumShards), NumBoids, Scenario.NumBoids);
+		TestTrue(FString::Printf(TEXT("%d shards match the whole flock, %d of %d boids"), NumShards, NumMatching, NumBoids), NumMatching >= NumBoids * 0.98f);
+	}
+	return true;
+}
+
+// A longer run over four shards: every boid is owned by exactly one of them however often it crosses.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidShardOwnershipTest, "BoidSystem.Shards.Ownership",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidShardOwnershipTest::RunTest(const FString& Parameters)
+{
+	const FBoidBatchScenario Scenario = MakeShardScenario();
+	const int32 NumShards = 4;
+
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	FBoidBatchSimulation::SpawnFlock(Scenario, Positions, Velocities);
+
+	FBoidShard Shards[NumShards];
+	for (int32 i = 0; i < NumShards; i++)
+	{
+		Shards[i].Init(Scenario.Params, Scenario.Body, i, NumShards);
+		Shards[i].AddBoids(Positions, Velocities, 0);
+	}
+
+	bool IsValid = true;
+	bool IsOwnedOnce = true;
+	int32 MaxGhosts = 0;
+	TArray<int32> Owners;
+	for (int32 Step = 0; Step < 300; Step++)
+	{
+		StepShards(Shards, NumShards, Scenario.DeltaTime, IsValid);
+
+		Owners.Init(0, Scenario.NumBoids);
+		for (const FBoidShard& Shard : Shards)
+		{
+			MaxGhosts = FMath::Max(MaxGhosts, Shard.GetNumGhosts());
+			for (uint32 Id : Shard.GetIds())
+			{
+				Owners[Id]++;
+			}
+		}
+		for (int32 Count : Owners)
+		{
+			IsOwnedOnce &= Count == 1;
+		}
+	}
+
+	TestTrue(TEXT("Every exchange message reads back"), IsValid);
+	TestTrue(TEXT("Every boid has exactly one owner"), IsOwnedOnce);
+	AddInfo(FString::Printf(TEXT("Up to %d ghosts per shard of %d boids over %d shards"), MaxGhosts, Scenario.NumBoids, NumShards));
+	return true;
+}
+
+// Both ends of a link over loopback in this process. A message many times the socket buffers goes out over
+// several pumps and is read in pieces, while the small ones sent ahead of it arrive in one read and are split
+// apart again. Every message must come out whole and in order, the empty one too.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidShardLinkFramingTest, "BoidSystem.Shards.LinkFraming",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidShardLinkFramingTest::RunTest(const FString& Parameters)
+{
+	const int32 Port = 47810;
+	FSocket* Listener = FBoidShardLink::Listen(Port, 1);
+	if (!TestNotNull(TEXT("Listening on loopback"), Listener))
+	{
+		return false;
+	}
+	FBoidShardLink Client;
+	FBoidShardLink Server;
+	const bool IsConnected = Client.Connect(Port, 5.0) && Server.Accept(Listener, 5.0);
+	FBoidShardLink::CloseSocket(Listener);
+	if (!TestTrue(TEXT("The link connects"), IsConnected))
+	{
+		return false;
+	}
+
+	TArray<TArray<uint8>> Messages;
+	Messages.AddDefaulted();
+	for (int32 i = 1; i <= 5; i++)
+	{
+		TArray<uint8>& Message = Messages.AddDefaulted_GetRef();
+		for (int32 j = 0; j < i * 3; j++)
+		{
+			Message.Add(uint8(i * 31 + j));
+		}
+	}
+	TArray<uint8>& Large = Messages.AddDefaulted_GetRef();
+	Large.SetNumUninitialized(32 * 1024 * 1024);
+	for (int32 j = 0; j < Large.Num(); j++)
+	{
+		Large[j] = uint8(j * 7 + j / 251);
+	}
+	for (const TArray<uint8>& Message : Messages)
+	{
+		Client.Send(Message);
+	}
+
+	bool IsLinked = Client.Pump();
+	TestFalse(TEXT("The large message does not go out in one send"), Client.IsSent());
+
+	int32 NumReceived = 0;
+	int32 NumPumps = 0;
+	int32 MostPerPump = 0;
+	bool IsWhole = true;
+	TArray<uint8> Received;
+	const double EndTime = FPlatformTime::Seconds() + 30.0;
+	while (IsLinked && NumReceived < Messages.Num() && FPlatformTime::Seconds() < EndTime)
+	{
+		IsLinked = Server.Pump() && Client.Pump();
+		NumPumps++;
+
+		int32 NumThisPump = 0;
+		while (Server.Receive(Received))
+		{
+			IsWhole &= Messages.IsValidIndex(NumReceived) && Received == Messages[NumReceived];
+			NumReceived++;
+			NumThisPump++;
+		}
+		MostPerPump = FMath::Max(MostPerPump, NumThisPump);
+		Server.Wait(0.01);
+	}
+
+	TestTrue(TEXT("The link stays up"), IsLinked);
+	TestEqual(TEXT("Every message arrives"), NumReceived, Messages.Num());
+	TestTrue(TEXT("Each one whole and in order"), IsWhole);
+	TestTrue(TEXT("Messages that came in one read are split apart"), MostPerPump > 1);
+	TestTrue(TEXT("The large message took several pumps"), NumPumps > 1);
+	TestTrue(TEXT("Nothing is left to send"), Client.IsSent());
+	TestFalse(TEXT("Nothing more is received"), Server.Receive(Received));
+	return true;
+}
+
+// A raw socket in place of a worker, writing a whole message and then a header claiming close to 4GB. The
+// message before it still comes out, the header closes the link instead of waiting for the rest.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidShardLinkOversizedTest, "BoidSystem.Shards.LinkOversized",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidShardLinkOversizedTest::RunTest(const FString& Parameters)
+{
+	const int32 Port = 47811;
+	FSocket* Listener = FBoidShardLink::Listen(Port, 1);
+	if (!TestNotNull(TEXT("Listening on loopback"), Listener))
+	{
+		return false;
+	}
+	ISocketSubsystem* SocketSubsystem = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+	TSharedRef<FInternetAddr> Address = SocketSubsystem->CreateInternetAddr();
+	Address->SetLoopbackAddress();
+	Address->SetPort(Port);
+	FSocket* Raw = SocketSubsystem->CreateSocket(NAME_Stream, TEXT("Boid shard test"), false);
+	FBoidShardLink Server;
+	const bool IsConnected = Raw && Raw->Connect(*Address) && Server.Accept(Listener, 5.0);
+	FBoidShardLink::CloseSocket(Listener);
+	if (!TestTrue(TEXT("The link connects"), IsConnected))
+	{
+		FBoidShardLink::CloseSocket(Raw);
+		return false;
+	}
+
+	const uint32 Header[] = { 4, 0x12345678, 0xFFFFFFFC };
+	int32 BytesSent = 0;
+	Raw->Send(reinterpret_cast<const uint8*>(Header), sizeof(Header), BytesSent);
+	TestEqual(TEXT("Sent in one go"), BytesSent, int32(sizeof(Header)));
+
+	AddExpectedError(TEXT("longer than"), EAutomationExpectedErrorFlags::Contains, 1);
+	int32 NumReceived = 0;
+	bool IsWhole = true;
+	TArray<uint8> Received;
+	const double EndTime = FPlatformTime::Seconds() + 10.0;
+	while (Server.Pump() && FPlatformTime::Seconds() < EndTime)
+	{
+		while (Server.Receive(Received))
+		{
+			IsWhole &= Received.Num() == 4 && FMemory::Memcmp(Received.GetData(), &Header[1], 4) == 0;
+			NumReceived++;
+		}
+		Server.Wait(0.01);
+	}
+
+	TestEqual(TEXT("The message ahead of the header arrives"), NumReceived, 1);
+	TestTrue(TEXT("Whole"), IsWhole);
+	TestFalse(TEXT("The oversized header closes the link"), Server.IsConnected());
+	FBoidShardLink::CloseSocket(Raw);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
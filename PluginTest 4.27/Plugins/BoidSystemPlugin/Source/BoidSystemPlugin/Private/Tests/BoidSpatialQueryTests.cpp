@@ -0,0 +1,198 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidSpatialQuery.h"
+#include "Math/RandomStream.h"
+
+// A flock half spread out and half in a few tight clumps, so crowded cells get split. Bounded, some boids
+// are outside the area and end up in the border cells.
+static void BuildQueryGrid(FBoidSpatialGrid& Grid, bool IsWrapped, int32 Seed)
+{
+	const FVector2D Area(400, 300);
+	FRandomStream Random(Seed);
+	TArray<FVector2D> Positions;
+	for (int32 i = 0; i < 1500; i++)
+	{
+		const float Margin = IsWrapped ? 0.0f : 20.0f;
+		Positions.Add(FVector2D(Random.FRandRange(-Margin, Area.X + Margin), Random.FRandRange(-Margin, Area.Y + Margin)));
+	}
+	for (int32 i = 0; i < 1500; i++)
+	{
+		const FVector2D Centre((i % 4 + 0.5f) * Area.X / 4, (i % 3 + 0.5f) * Area.Y / 3);
+		Positions.Add(Grid.WrapPosition(Centre + FVector2D(Random.FRandRange(-8, 8), Random.FRandRange(-8, 8))));
+	}
+
+	Grid.Configure(Area, 10.0f, IsWrapped);
+	Grid.SetMaxBoidsPerCell(8);
+	Grid.Build(Positions);
+}
+
+// Distances of every boid the query should find, nearest first, looking at the whole flock.
+static void BruteForceQuery(const FBoidSpatialGrid& Grid, const FBoidQuery& Query, TArray<float>& OutDistances)
+{
+	OutDistances.Reset();
+	const FVector2D Position = Grid.WrapPosition(Query.Position);
+	const float Length = Query.Extent.Size();
+	const FVector2D Direction = Query.Extent / Length;
+
+	for (int32 i = 0; i < Grid.GetNum(); i++)
+	{
+		const FVector2D Offset = Grid.GetOffset(Position, Grid.GetPosition(i));
+		switch (Query.Type)
+		{
+		case EBoidQueryType::Radius:
+		case EBoidQueryType::Nearest:
+			if (Offset.Size() <= Query.Radius)
+			{
+				OutDistances.Add(Offset.Size());
+			}
+			break;
+		case EBoidQueryType::Box:
+			if (FMath::Abs(Offset.X) <= Query.Extent.X && FMath::Abs(Offset.Y) <= Query.Extent.Y)
+			{
+				OutDistances.Add(Offset.Size());
+			}
+			break;
+		case EBoidQueryType::Ray:
+		{
+			const float Along = FVector2D::DotProduct(Offset, Direction);
+			const FVector2D Closest = Direction * FMath::Clamp(Along, 0.0f, Length);
+			if (FVector2D::Distance(Offset, Closest) <= Query.Radius)
+			{
+				const float Across = FMath::Sqrt(FMath::Max(Offset.SizeSquared() - Along * Along, 0.0f));
+				OutDistances.Add(FMath::Max(Along - FMath::Sqrt(FMath::Max(FMath::Square(Query.Radius) - FMath::Square(Across), 0.0f)), 0.0f));
+			}
+			break;
+		}
+		}
+	}
+	OutDistances.Sort();
+}
+
+static FBoidQuery MakeRandomQuery(FRandomStream& Random, EBoidQueryType Type)
+{
+	// Some start outside the area, to check they are wrapped or find the border cells.
+	const FVector2D Position(Random.FRandRange(-30, 430), Random.FRandRange(-30, 330));
+	switch (Type)
+	{
+	case EBoidQueryType::Box:
+		return FBoidQuery::MakeBox(Position, FVector2D(Random.FRandRange(0, 40), Random.FRandRange(0, 40)));
+	case EBoidQueryType::Ray:
+		return FBoidQuery::MakeRay(Position, Position + FVector2D(Random.FRandRange(-100, 100), Random.FRandRange(-100, 100)), Random.FRandRange(0, 4));
+	case EBoidQueryType::Nearest:
+		return FBoidQuery::MakeNearest(Position, Random.FRandRange(10, 200));
+	default:
+		return FBoidQuery::MakeRadius(Position, Random.FRandRange(0, 40));
+	}
+}
+
+// Every kind of query against a look at the whole flock, wrapped and bounded. Radius and Box must find
+// exactly the same boids, Ray and Nearest the same nearest ones.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidSpatialQueryBruteForceTest, "BoidSystem.SpatialQuery.MatchBruteForce",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidSpatialQueryBruteForceTest::RunTest(const FString& Parameters)
+{
+	const TCHAR* TypeNames[] = { TEXT("Radius"), TEXT("Box"), TEXT("Ray"), TEXT("Nearest") };
+	FBoidQueryHit Hits[4096];
+	TArray<float> Expected;
+	TArray<float> Found;
+
+	for (const bool IsWrapped : { true, false })
+	{
+		FBoidSpatialGrid Grid;
+		BuildQueryGrid(Grid, IsWrapped, 31);
+		FRandomStream Random(7);
+
+		for (int32 Type = 0; Type < 4; Type++)
+		{
+			int32 NumMismatched = 0;
+			int32 NumFound = 0;
+			for (int32 Query = 0; Query < 300; Query++)
+			{
+				const FBoidQuery BoidQuery = MakeRandomQuery(Random, EBoidQueryType(Type));
+				BruteForceQuery(Grid, BoidQuery, Expected);
+
+				// Ray and Nearest only keep the few nearest.
+				const bool KeepsNearest = BoidQuery.Type == EBoidQueryType::Ray || BoidQuery.Type == EBoidQueryType::Nearest;
+				const int32 Capacity = KeepsNearest ? 8 : UE_ARRAY_COUNT(Hits);
+				const int32 NumHits = FBoidSpatialQuery::Run(Grid, BoidQuery, MakeArrayView(Hits, Capacity));
+				if (KeepsNearest)
+				{
+					Expected.SetNum(FMath::Min(Expected.Num(), Capacity));
+				}
+
+				Found.Reset();
+				for (int32 i = 0; i < FMath::Min(NumHits, Capacity); i++)
+				{
+					Found.Add(Hits[i].Distance);
+				}
+				Found.Sort();
+
+				bool IsMatch = NumHits == Expected.Num();
+				for (int32 i = 0; IsMatch && i < Found.Num(); i++)
+				{
+					IsMatch = FMath::IsNearlyEqual(Found[i], Expected[i], 1e-3f);
+				}
+				NumMismatched += IsMatch ? 0 : 1;
+				NumFound += NumHits;
+			}
+
+			TestEqual(FString::Printf(TEXT("%s queries, %s, that differ from the whole flock"), TypeNames[Type], IsWrapped ? TEXT("wrapped") : TEXT("bounded")), NumMismatched, 0);
+			TestTrue(FString::Printf(TEXT("%s queries find boids"), TypeNames[Type]), NumFound > 0);
+		}
+	}
+	return true;
+}
+
+// A mixed batch gives every query what it would get alone, in its own slice, and a query with more
+// matches than room says how many there were.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidSpatialQueryBatchTest, "BoidSystem.SpatialQuery.Batch",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidSpatialQueryBatchTest::RunTest(const FString& Parameters)
+{
+	FBoidSpatialGrid Grid;
+	BuildQueryGrid(Grid, true, 5);
+	FRandomStream Random(11);
+
+	const int32 HitsPerQuery = 16;
+	TArray<FBoidQuery> Queries;
+	for (int32 i = 0; i < 200; i++)
+	{
+		Queries.Add(MakeRandomQuery(Random, EBoidQueryType(i % 4)));
+	}
+	TArray<FBoidQueryHit> Hits;
+	Hits.SetNum(Queries.Num() * HitsPerQuery);
+	TArray<int32> NumHits;
+	NumHits.SetNum(Queries.Num());
+
+	FBoidSpatialQuery::RunBatch(Grid, Queries, Hits, NumHits);
+
+	bool IsSame = true;
+	FBoidQueryHit Single[HitsPerQuery];
+	for (int32 i = 0; i < Queries.Num(); i++)
+	{
+		const int32 NumSingle = FBoidSpatialQuery::Run(Grid, Queries[i], MakeArrayView(Single, HitsPerQuery));
+		IsSame &= NumSingle == NumHits[i];
+		for (int32 Hit = 0; Hit < FMath::Min(NumSingle, HitsPerQuery); Hit++)
+		{
+			IsSame &= Single[Hit].Index == Hits[i * HitsPerQuery + Hit].Index;
+		}
+	}
+	TestTrue(TEXT("Batched queries match single ones"), IsSame);
+
+	// Right on a clump, far more boids than the buffer holds.
+	FBoidQueryHit Few[4];
+	const int32 NumMatched = FBoidSpatialQuery::Radius(Grid, FVector2D(50, 50), 10.0f, MakeArrayView(Few, 4));
+	TestTrue(TEXT("A full buffer still counts every match"), NumMatched > 4);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidSimulation.h"
+#include "Math/RandomStream.h"
+
+// The seeded flock the simulation tests share. The golden trajectories and fixed point checksums were
+// recorded with it, change any of it and record them again.
+
+static const int32 BoidTestSeed = 1234;
+static const float BoidTestVisualRange = 10.0f;
+static const float BoidTestSpeed = 30.0f;
+
+// The rules the tests steer by. A wrapped area needs no bounds, a bounded one turns boids back at its edges.
+inline FBoidSimulationParams MakeBoidTestParams(FVector2D Area, bool IsWrapped)
+{
+	FBoidSimulationParams Params;
+	Params.Area = Area;
+	Params.VisualRange = BoidTestVisualRange;
+	Params.IsWrapped = IsWrapped;
+	Params.Pipeline.Get<FCohesionKernel>().Weight = 0.15f;
+	Params.Pipeline.Get<FSeparationKernel>().Weight = 3.0f;
+	Params.Pipeline.Get<FAlignmentKernel>().Weight = 2.0f;
+	FBoundsKernel& Bounds = Params.Pipeline.Get<FBoundsKernel>();
+	Bounds.Weight = 3.5f;
+	Bounds.Width = Area.X;
+	Bounds.Height = Area.Y;
+	Bounds.IsBounded = !IsWrapped;
+	return Params;
+}
+
+// Boids scattered over a rectangle, each heading its own way at Speed. One draw per statement, the order
+// of arguments is up to the compiler and every build has to draw the same flock.
+inline void MakeBoidTestFlock(FRandomStream& Random, int32 NumBoids, FVector2D SpawnStart, FVector2D SpawnSize, float Speed,
+	TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities)
+{
+	OutPositions.Reset(NumBoids);
+	OutVelocities.Reset(NumBoids);
+	for (int32 i = 0; i < NumBoids; i++)
+	{
+		const float X = SpawnStart.X + Random.FRandRange(0, SpawnSize.X);
+		const float Y = SpawnStart.Y + Random.FRandRange(0, SpawnSize.Y);
+		const float VelocityX = Random.FRandRange(-1, 1);
+		const float VelocityY = Random.FRandRange(-1, 1);
+		OutPositions.Add(FVector2D(X, Y));
+		OutVelocities.Add(FVector2D(VelocityX, VelocityY) * Speed);
+	}
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
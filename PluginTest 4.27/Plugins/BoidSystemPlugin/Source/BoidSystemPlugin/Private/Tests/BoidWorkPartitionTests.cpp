@@ -0,0 +1,114 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidPipelinedSimulation.h"
+#include "BoidTestFixture.h"
+
+// The skew the work partition is there for: a flock held on the mouse, most of it piled into a few cells.
+// The point kernel pulls the flock onto the middle of the area, then the pipelined step carries on with the
+// pull still on. Split by cost or into equal slices, every boid has to be stepped exactly as the plain
+// simulation steps it, and every item run once. Once with floats and once in fixed point.
+
+static const int32 BoidPartitionNumBoids = 2000;
+static const float BoidPartitionAreaSize = 200.0f;
+static const int32 BoidPartitionGatherFrames = 300;
+static const int32 BoidPartitionFrames = 30;
+static const float BoidPartitionDeltaTime = 1.0f / 30.0f;
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidWorkPartitionAttractorTest, "BoidSystem.Simulation.WorkPartition.Attractor",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidWorkPartitionAttractorTest::RunTest(const FString& Parameters)
+{
+	const FVector2D Area(BoidPartitionAreaSize, BoidPartitionAreaSize);
+	FBoidSimulationParams Params = MakeBoidTestParams(Area, true);
+	// Held right button, as the controller sets it.
+	FPointKernel& Point = Params.Pipeline.Get<FPointKernel>();
+	Point.Weight = 0.5f;
+	Point.Point = Area / 2;
+	Point.IsPulling = true;
+
+	FRandomStream Random(BoidTestSeed);
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	MakeBoidTestFlock(Random, BoidPartitionNumBoids, FVector2D::ZeroVector, Area, BoidTestSpeed, Positions, Velocities);
+	TArray<FBoidBody> Bodies;
+	Bodies.SetNum(BoidPartitionNumBoids);
+	for (FBoidBody& Body : Bodies)
+	{
+		Body.Speed = BoidTestSpeed;
+	}
+	TArray<FBoidHandle> Handles;
+	Handles.SetNum(BoidPartitionNumBoids);
+
+	FBoidSimulation Gather;
+	Gather.Init(Positions, Velocities, Bodies);
+	Gather.SetParams(Params);
+	for (int32 Frame = 0; Frame < BoidPartitionGatherFrames; Frame++)
+	{
+		Gather.Step(BoidPartitionDeltaTime);
+	}
+
+	// The pile has to be there, or the rest says nothing about clumped flocks.
+	int32 NumPiled = 0;
+	for (const FVector2D& Position : Gather.GetPositions())
+	{
+		NumPiled += FVector2D::Distance(Position, Point.Point) < Point.Distance * 2 ? 1 : 0;
+	}
+	AddInfo(FString::Printf(TEXT("%d of %d boids piled on the attractor"), NumPiled, BoidPartitionNumBoids));
+	TestTrue(TEXT("The attractor piles up most of the flock"), NumPiled > BoidPartitionNumBoids / 2);
+
+	for (const bool UseFixedPoint : { false, true })
+	{
+		FBoidSimulationParams StepParams = Params;
+		StepParams.UseFixedPoint = UseFixedPoint;
+
+		FBoidSimulation Simulation;
+		Simulation.Init(Gather.GetPositions(), Gather.GetVelocities(), Bodies);
+		Simulation.SetParams(StepParams);
+		for (int32 Frame = 0; Frame < BoidPartitionFrames; Frame++)
+		{
+			Simulation.Step(BoidPartitionDeltaTime);
+		}
+		FBoidFlockState Expected;
+		Simulation.CopyState(Expected);
+
+		for (const bool BalanceByCost : { true, false })
+		{
+			const FString Name = FString::Printf(TEXT("%s, %s"), UseFixedPoint ? TEXT("Fixed point") : TEXT("Floats"),
+				BalanceByCost ? TEXT("split by cost") : TEXT("equal slices"));
+			FBoidPipelinedSimulation Pipelined(Handles, Gather.GetPositions(), Gather.GetVelocities(), Bodies);
+			float Imbalance = 0;
+			for (int32 Frame = 0; Frame < BoidPartitionFrames; Frame++)
+			{
+				Pipelined.Launch(StepParams, BoidPartitionDeltaTime, BalanceByCost);
+				Pipelined.Complete();
+
+				FBoidWorkPartition& Partition = Pipelined.GetPartition();
+				int32 NumItemsRun = 0;
+				for (int32 Worker = 0; Worker < Partition.GetNumWorkers(); Worker++)
+				{
+					NumItemsRun += Partition.GetWorkerStats(Worker).Items;
+				}
+				if (NumItemsRun != Partition.GetNumItems())
+				{
+					AddError(FString::Printf(TEXT("%s, frame %d ran %d of %d items"), *Name, Frame, NumItemsRun, Partition.GetNumItems()));
+				}
+				Imbalance = FMath::Max(Imbalance, Partition.GetImbalance());
+				Partition.ResetStats();
+			}
+
+			AddInfo(FString::Printf(TEXT("%s: worst imbalance %.2f"), *Name, Imbalance));
+			TestTrue(FString::Printf(TEXT("%s steps the piled flock like the plain simulation"), *Name),
+				Pipelined.GetPositions() == Expected.Positions && Pipelined.GetVelocities() == Expected.Velocities);
+		}
+	}
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
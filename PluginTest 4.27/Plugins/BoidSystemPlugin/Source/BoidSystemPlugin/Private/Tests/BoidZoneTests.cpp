@@ -0,0 +1,139 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "BoidZones.h"
+#include "Math/RandomStream.h"
+
+// Whether a boid is inside a zone, looking at the boid alone.
+static bool IsInZone(const FBoidSpatialGrid& Grid, const FBoidZoneShape& Shape, FVector2D Position)
+{
+	const FVector2D Offset = Grid.GetOffset(Grid.WrapPosition(Shape.Centre), Position);
+	return Shape.Type == EBoidZoneShape::Circle ? Offset.SizeSquared() <= FMath::Square(Shape.Extent.X)
+		: FMath::Abs(Offset.X) <= Shape.Extent.X && FMath::Abs(Offset.Y) <= Shape.Extent.Y;
+}
+
+// Boids drift through a dozen zones, some of them moving, over a wrapped area. The flock arrays are shuffled
+// every frame, so ids and indices part ways. Every event must match what checking each boid against each
+// zone frame by frame gives, and the members after every update too.
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FBoidZoneEventsTest, "BoidSystem.Zones.Events",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FBoidZoneEventsTest::RunTest(const FString& Parameters)
+{
+	const FVector2D Area(300, 300);
+	const int32 NumBoids = 2000;
+	FRandomStream Random(3);
+
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	TArray<int32> Ids;
+	for (int32 i = 0; i < NumBoids; i++)
+	{
+		Positions.Add(FVector2D(Random.FRandRange(0, Area.X), Random.FRandRange(0, Area.Y)));
+		Velocities.Add(FVector2D(Random.FRandRange(-60, 60), Random.FRandRange(-60, 60)));
+		Ids.Add(i);
+	}
+
+	FBoidSpatialGrid Grid;
+	Grid.Configure(Area, 10.0f, true);
+	Grid.SetMaxBoidsPerCell(16);
+
+	FBoidZoneTracker Tracker;
+	TArray<FBoidZoneShape> Shapes;
+	for (int32 i = 0; i < 12; i++)
+	{
+		const FVector2D Centre(Random.FRandRange(0, Area.X), Random.FRandRange(0, Area.Y));
+		Shapes.Add(i % 2 == 0 ? FBoidZoneShape::MakeCircle(Centre, Random.FRandRange(5, 40))
+			: FBoidZoneShape::MakeBox(Centre, FVector2D(Random.FRandRange(5, 40), Random.FRandRange(5, 40))));
+		TestEqual(TEXT("Zones are numbered in order"), Tracker.AddZone(Shapes.Last()), i);
+	}
+
+	// Inside[Zone * NumBoids + Id] as of the last frame.
+	TArray<bool> Inside;
+	Inside.Init(false, Shapes.Num() * NumBoids);
+	bool IsMatch = true;
+	int32 NumEntered = 0;
+	int32 NumExited = 0;
+
+	for (int32 Frame = 0; Frame < 120; Frame++)
+	{
+		for (int32 i = 0; i < NumBoids; i++)
+		{
+			Positions[i] = Grid.WrapPosition(Positions[i] + Velocities[i] / 60.0f);
+		}
+		for (int32 i = NumBoids - 1; i > 0; i--)
+		{
+			const int32 Other = Random.RandRange(0, i);
+			Swap(Positions[i], Positions[Other]);
+			Swap(Velocities[i], Velocities[Other]);
+			Swap(Ids[i], Ids[Other]);
+		}
+		Shapes[1].Centre.X += 1.0f;
+		Tracker.SetZoneShape(1, Shapes[1]);
+
+		Grid.Build(Positions);
+		Tracker.Update(Grid, [&Ids](int32 Index) { return Ids[Index]; });
+
+		// Every expected change must be among the events, and there must be no others.
+		int32 NumChanges = 0;
+		TArray<bool> IsEntered;
+		TArray<bool> IsExited;
+		IsEntered.Init(false, Inside.Num());
+		IsExited.Init(false, Inside.Num());
+		for (const FBoidZoneEvent& Event : Tracker.GetEntered())
+		{
+			IsEntered[Event.Zone * NumBoids + Event.BoidId] = true;
+		}
+		for (const FBoidZoneEvent& Event : Tracker.GetExited())
+		{
+			IsExited[Event.Zone * NumBoids + Event.BoidId] = true;
+		}
+
+		for (int32 Zone = 0; Zone < Shapes.Num(); Zone++)
+		{
+			int32 NumInside = 0;
+			for (int32 i = 0; i < NumBoids; i++)
+			{
+				const int32 Slot = Zone * NumBoids + Ids[i];
+				const bool IsInside = IsInZone(Grid, Shapes[Zone], Positions[i]);
+				if (IsInside != Inside[Slot])
+				{
+					IsMatch &= IsInside ? IsEntered[Slot] : IsExited[Slot];
+					NumChanges++;
+				}
+				Inside[Slot] = IsInside;
+				NumInside += IsInside ? 1 : 0;
+			}
+			IsMatch &= Tracker.GetMembers(Zone).Num() == NumInside;
+		}
+		IsMatch &= NumChanges == Tracker.GetEntered().Num() + Tracker.GetExited().Num();
+		NumEntered += Tracker.GetEntered().Num();
+		NumExited += Tracker.GetExited().Num();
+	}
+
+	TestTrue(TEXT("Events match checking every boid against every zone"), IsMatch);
+	TestTrue(TEXT("Boids come and go"), NumEntered > 0 && NumExited > 0);
+
+	// A removed zone sends all its boids out on the next update, then its id is free again.
+	const int32 NumMembers = Tracker.GetMembers(0).Num();
+	Tracker.RemoveZone(0);
+	TestFalse(TEXT("A removed zone is gone at once"), Tracker.IsValidZone(0));
+	Tracker.Update(Grid, [&Ids](int32 Index) { return Ids[Index]; });
+	int32 NumZoneExits = 0;
+	for (const FBoidZoneEvent& Event : Tracker.GetExited())
+	{
+		NumZoneExits += Event.Zone == 0 ? 1 : 0;
+	}
+	TestEqual(TEXT("Every boid of a removed zone exits"), NumZoneExits, NumMembers);
+	TestEqual(TEXT("The id of a removed zone is reused"), Tracker.AddZone(Shapes[0]), 0);
+
+	AddInfo(FString::Printf(TEXT("%d enters and %d exits over 120 frames of %d boids and %d zones"), NumEntered, NumExited, NumBoids, Shapes.Num()));
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -3,6 +3,9 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "BoidPipeline.h"
+#include "BoidSettings.h"
+#include "BoidSimulation.h"
 #include "FBoidRules.h"
 
 #include "Boid.generated.h"
@@ -16,49 +19,57 @@ public:
 	// Sets default values for this pawn's properties
 	ABoid();
 	virtual void BeginDestroy() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 	void ResetAcceleration();
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 	
-	void ComputeNeighbourhood();
-	
 public:	
+	// Look up this frame's neighbours, and copy them into ListOfBoidsInVision if the flock tracks actors.
+	FBoidNeighbourhood ComputeNeighbourhood();
+
 	// Called every frame
 	virtual void Tick(float DeltaTime) override;
 
 	// Getters
 	float GetVisualRange() const			{ return VisualRange; }
 	FVector2D GetVelocity2D() const			{ return Velocity; }
-	FVector2D GetPosition() const			{ return FVector2D(this->GetActorLocation().X, this->GetActorLocation().Y); }
+	FVector2D GetPosition() const			{ return Position; }
 	FRotator GetRotation() const			{ return this->GetActorRotation(); }
 	float GetSpeed() const					{ return Speed; }
 	FVector2D GetAcceleration() const		{ return Acceleration; }
 	float GetMaxAcceleration() const		{ return MaxAcceleration; }
 	bool GetIfConstantSpeed() const			{ return HasConstantSpeed; }
+	FBoidHandle GetHandle() const			{ return Handle; }
+	FBoidBody GetBody() const				{ return FBoidBody{ Speed, MaxAcceleration, HasConstantSpeed }; }
+	int32 GetFramesPerTick() const			{ return FramesPerTick; }
 	
 	// Setters
 	void SetVisualRange(float _VisualRange) 			{ VisualRange = _VisualRange; }
 	void SetVelocity2D(FVector2D _Velocity)				{ Velocity = _Velocity; }
-	void SetPosition(FVector2D _Position)				{ this->SetActorLocation(FVector(_Position.X, _Position.Y, 1)); }
+	void SetPosition(FVector2D _Position)				{ Position = _Position; this->SetActorLocation(FVector(_Position.X, _Position.Y, 1)); }
 	void SetRotation(FRotator _Rotator)					{ this->SetActorRotation(_Rotator); }
 	void SetSpeed(float _Speed)							{ Speed = _Speed; }
 	void SetAcceleration(FVector2D _Acceleration)		{ Acceleration = _Acceleration; }
 	void SetMaxAcceleration(float _MaxAcceleration)		{ MaxAcceleration = _MaxAcceleration; }
 	void SetIfConstantSpeed(bool _HasConstantSpeed)		{ HasConstantSpeed = _HasConstantSpeed; }
-	void SetBoidRules(TArray<TUniquePtr<FBoidRules>> const& NewRules)
-	{
-		Rules.Empty();
-	
-		for (auto& Rule : NewRules)
-		{
-			Rules.Add(Rule->Clone());
-		}
-	}
+	// Frames each tick stands for while the boid ticks less often for LOD, its steering is scaled up to match.
+	void SetFramesPerTick(int32 _FramesPerTick)			{ FramesPerTick = FMath::Max(_FramesPerTick, 1); }
+	// Rules are shared with the controller rather than cloned, so changes to them reach every boid. Boids outlive
+	// the controller, which sets both of these back to null before its rules go away.
+	void SetBoidRules(const TArray<TUniquePtr<FBoidRules>>* NewRules)	{ Rules = NewRules; }
+	// Built-in rules run through this first, owned by the controller. Null to only use Rules.
+	void SetRulePipeline(const FDefaultBoidPipeline* _Pipeline)	{ Pipeline = _Pipeline; }
 	void ApplyForce(FVector2D Force);
 	void BoidRotation();
 
+	FBoidHandle Handle;
+	// Set before BeginPlay for boids driven by UBoidFlockReplicationComponent. They never join Settings or tick.
+	bool IsReplica = false;
+
+	// Simulation position, the actor location only mirrors it.
 	FVector2D Position;
 	float VisualRange;
 	FVector2D Velocity;
@@ -67,10 +78,14 @@ public:
 	
 	FVector2D Acceleration;
 	float MaxAcceleration;
+	int32 FramesPerTick = 1;
 
 	
+	// Copy of this boid's row of the flock neighbour lists for inspecting in the editor. Empty unless
+	// Settings.TrackNeighbourActors is on, as every entry is one more reference for the garbage collector to walk.
 	UPROPERTY(VisibleAnywhere)
 	TArray<ABoid*> ListOfBoidsInVision;
 
-	TArray<TUniquePtr<FBoidRules>> Rules;
+	const TArray<TUniquePtr<FBoidRules>>* Rules = nullptr;
+	const FDefaultBoidPipeline* Pipeline = nullptr;
 };
\ No newline at end of file
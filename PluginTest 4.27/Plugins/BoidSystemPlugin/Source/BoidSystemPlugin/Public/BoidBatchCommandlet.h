@@ -0,0 +1,29 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+
+#include "BoidBatchSimulation.h"
+#include "BoidBatchCommandlet.generated.h"
+
+/**
+ * Runs FBoidBatchSimulation from the command line, for tuning the rule weights offline:
+ *   UE4Editor-Cmd <Project>.uproject -run=BoidBatch -Output=Saved/Boids/Run.btrj -Boids=1000 -Seconds=600
+ * The other switches are -Seed= -DeltaTime= -RecordInterval= -Area= -VisualRange= -Speed= -Cohesion=
+ * -Separation= -Alignment= -Bounds= -Bounded -FixedPoint. Anything left out is the controller's default flock.
+ */
+UCLASS()
+class BOIDSYSTEMPLUGIN_API UBoidBatchCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UBoidBatchCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+
+	// The flock and run from the switches above, false if they make no sense.
+	static bool ParseScenario(const FString& Params, FBoidBatchScenario& OutScenario);
+};
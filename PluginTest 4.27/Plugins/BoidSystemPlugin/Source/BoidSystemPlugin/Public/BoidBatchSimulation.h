@@ -0,0 +1,47 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidSimulation.h"
+
+// An offline run: the flock, how long to simulate it for and how often to record it.
+struct FBoidBatchScenario
+{
+	FBoidSimulationParams Params;
+	FBoidBody Body;
+	int32 NumBoids = 1000;
+	// The flock starts spread over the area as the controller spawns it, from this seed.
+	int32 Seed = 0;
+	float DeltaTime = 1.0f / 60.0f;
+	float SimulatedSeconds = 60.0f;
+	// Steps between recorded frames, 1 records every step. The starting state is always recorded.
+	int32 RecordInterval = 1;
+};
+
+struct FBoidBatchResult
+{
+	int32 NumSteps = 0;
+	int32 NumFrames = 0;
+	int64 FileBytes = 0;
+	double SimulatedSeconds = 0;
+	double WallSeconds = 0;
+
+	double GetSimulatedSecondsPerWallSecond() const		{ return WallSeconds > 0 ? SimulatedSeconds / WallSeconds : 0; }
+};
+
+/**
+ * Steps a scenario as fast as the machine allows, with no world, actors or frame rate, and writes it to
+ * a trajectory file, see FBoidTrajectoryWriter. Each step runs on the task graph workers as in the
+ * pipelined mode, and the previous step is written to the file while it runs.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidBatchSimulation
+{
+public:
+	// False if the file could not be written, OutResult then covers the frames that were.
+	static bool Run(const FBoidBatchScenario& Scenario, const FString& Path, FBoidBatchResult& OutResult);
+
+	// The scenario's starting flock, spread over the area as the controller spawns it.
+	static void SpawnFlock(const FBoidBatchScenario& Scenario, TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities);
+};
@@ -0,0 +1,124 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Atomic.h"
+#include "UObject/WeakObjectPtrTemplates.h"
+
+#include "BoidRuleSet.h"
+
+class ABoid;
+
+/**
+ * Bounded lock-free queue any number of threads push into and one thread pops from. Every slot carries a
+ * sequence number telling which lap of the ring it is free or full for. A producer claims a slot with one
+ * compare and swap on the tail and publishes it by bumping the sequence, the consumer never writes the tail.
+ * Nothing is allocated after construction, and a full queue turns items away instead of waiting.
+ */
+template <typename T>
+class TBoidMpscQueue
+{
+public:
+	// Rounded up to a power of two.
+	explicit TBoidMpscQueue(int32 MinCapacity = 4096)
+	{
+		const int32 Capacity = static_cast<int32>(FMath::RoundUpToPowerOfTwo(FMath::Max(MinCapacity, 2)));
+		Slots.SetNum(Capacity);
+		for (int32 i = 0; i < Capacity; i++)
+		{
+			Slots[i].Sequence.Store(i);
+		}
+		Mask = Capacity - 1;
+	}
+
+	TBoidMpscQueue(const TBoidMpscQueue&) = delete;
+	TBoidMpscQueue& operator=(const TBoidMpscQueue&) = delete;
+
+	// Any thread. False if the queue is full, the item is dropped then.
+	bool Enqueue(const T& Item)
+	{
+		uint32 Position = Tail.Load(EMemoryOrder::Relaxed);
+		for (;;)
+		{
+			FSlot& Slot = Slots[Position & Mask];
+			const int32 Lap = static_cast<int32>(Slot.Sequence.Load() - Position);
+			if (Lap == 0)
+			{
+				// Free on this lap. A failed exchange means another producer took it, and loads the new tail.
+				if (Tail.CompareExchange(Position, Position + 1))
+				{
+					Slot.Item = Item;
+					Slot.Sequence.Store(Position + 1);
+					return true;
+				}
+			}
+			else if (Lap < 0)
+			{
+				// Still full from the last lap, the consumer is a whole ring behind.
+				return false;
+			}
+			else
+			{
+				Position = Tail.Load(EMemoryOrder::Relaxed);
+			}
+		}
+	}
+
+	// Consumer thread only. False if nothing has been published yet, a slot still being written counts as empty.
+	bool Dequeue(T& OutItem)
+	{
+		FSlot& Slot = Slots[Head & Mask];
+		if (static_cast<int32>(Slot.Sequence.Load() - (Head + 1)) < 0)
+		{
+			return false;
+		}
+
+		OutItem = MoveTemp(Slot.Item);
+		// Free for the producers' next lap.
+		Slot.Sequence.Store(Head + Mask + 1);
+		Head++;
+		return true;
+	}
+
+	// Getters
+	int32 GetCapacity() const							{ return Mask + 1; }
+
+private:
+	struct FSlot
+	{
+		TAtomic<uint32> Sequence { 0 };
+		T Item;
+	};
+
+	TArray<FSlot> Slots;
+	uint32 Mask = 0;
+	// Every producer hits the tail, keep it off the consumer's cache line.
+	alignas(PLATFORM_CACHE_LINE_SIZE) TAtomic<uint32> Tail { 0 };
+	alignas(PLATFORM_CACHE_LINE_SIZE) uint32 Head = 0;
+};
+
+enum class EBoidCommandType : uint8
+{
+	Spawn,
+	Despawn,
+	SetRuleWeight
+};
+
+// A change to the flock from any thread, applied by the controller at the start of its next frame.
+struct FBoidCommand
+{
+	EBoidCommandType Type = EBoidCommandType::Spawn;
+	FVector2D Position = FVector2D::ZeroVector;
+	// The boid to despawn. Handle ids are handed out again, so a boid gone before the command is applied
+	// must not be mistaken for the one that took its id.
+	TWeakObjectPtr<ABoid> Boid;
+	EBoidRuleType Rule = EBoidRuleType::Cohesion;
+	float Value = 0.0f;
+
+	static FBoidCommand MakeSpawn(FVector2D Position)					{ FBoidCommand Command; Command.Type = EBoidCommandType::Spawn; Command.Position = Position; return Command; }
+	static FBoidCommand MakeDespawn(const TWeakObjectPtr<ABoid>& Boid)	{ FBoidCommand Command; Command.Type = EBoidCommandType::Despawn; Command.Boid = Boid; return Command; }
+	static FBoidCommand MakeRuleWeight(EBoidRuleType Rule, float Weight)	{ FBoidCommand Command; Command.Type = EBoidCommandType::SetRuleWeight; Command.Rule = Rule; Command.Value = Weight; return Command; }
+};
+
+using FBoidCommandQueue = TBoidMpscQueue<FBoidCommand>;
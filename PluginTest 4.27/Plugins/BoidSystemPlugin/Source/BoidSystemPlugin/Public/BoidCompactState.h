@@ -0,0 +1,120 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidNeighbours.h"
+
+// Two 16 bit fixed point values, half the bytes of an FVector2D.
+struct FBoidPackedVector
+{
+	uint16 X;
+	uint16 Y;
+};
+
+/**
+ * Maps flock positions and velocities to 16 bit fixed point. Positions are relative to the flock bounds:
+ * just the area when it wraps. When bounded the area gets a margin as wide as itself on every side, as
+ * boids do get past the walls, and the grid is shifted half a step so no packed position lies on a wall.
+ * Velocities are signed, relative to twice the fastest body's speed so unclamped starting velocities fit.
+ *
+ * When wrapped one position step is exactly Area / 65536, so the difference of two packed positions read
+ * as int16 already is the shortest offset across the seam.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidQuantisation
+{
+public:
+	void Configure(FVector2D Area, bool _IsWrapped, float MaxSpeed);
+
+	FORCEINLINE FBoidPackedVector PackPosition(FVector2D Position) const;
+	FORCEINLINE FVector2D UnpackPosition(FBoidPackedVector Packed) const;
+	FORCEINLINE FBoidPackedVector PackVelocity(FVector2D Velocity) const;
+	FORCEINLINE FVector2D UnpackVelocity(FBoidPackedVector Packed) const;
+	// Shortest vector from one packed position to another, without unpacking either.
+	FORCEINLINE FVector2D GetOffset(FBoidPackedVector From, FBoidPackedVector To) const;
+
+	bool operator==(const FBoidQuantisation& Other) const;
+	bool operator!=(const FBoidQuantisation& Other) const	{ return !(*this == Other); }
+
+	// Getters
+	// Distance between two neighbouring packed values, packing is off by at most half of it per axis.
+	FVector2D GetPositionStep() const			{ return PositionStep; }
+	float GetVelocityStep() const				{ return VelocityStep; }
+
+private:
+	FVector2D Origin = FVector2D::ZeroVector;
+	FVector2D PositionStep = FVector2D(1, 1);
+	FVector2D InvPositionStep = FVector2D(1, 1);
+	float VelocityStep = 1;
+	float InvVelocityStep = 1;
+	bool IsWrapped = true;
+};
+
+FORCEINLINE FBoidPackedVector FBoidQuantisation::PackPosition(FVector2D Position) const
+{
+	const int32 X = FMath::RoundToInt((Position.X - Origin.X) * InvPositionStep.X);
+	const int32 Y = FMath::RoundToInt((Position.Y - Origin.Y) * InvPositionStep.Y);
+
+	// Wrapped, the far edge is the near edge again. Bounded, boids past the margin are held on it.
+	if (IsWrapped)
+	{
+		return { static_cast<uint16>(X & 0xFFFF), static_cast<uint16>(Y & 0xFFFF) };
+	}
+	return { static_cast<uint16>(FMath::Clamp(X, 0, 0xFFFF)), static_cast<uint16>(FMath::Clamp(Y, 0, 0xFFFF)) };
+}
+
+FORCEINLINE FVector2D FBoidQuantisation::UnpackPosition(FBoidPackedVector Packed) const
+{
+	return FVector2D(Origin.X + Packed.X * PositionStep.X, Origin.Y + Packed.Y * PositionStep.Y);
+}
+
+FORCEINLINE FBoidPackedVector FBoidQuantisation::PackVelocity(FVector2D Velocity) const
+{
+	const int32 X = FMath::Clamp(FMath::RoundToInt(Velocity.X * InvVelocityStep), -MAX_int16, static_cast<int32>(MAX_int16));
+	const int32 Y = FMath::Clamp(FMath::RoundToInt(Velocity.Y * InvVelocityStep), -MAX_int16, static_cast<int32>(MAX_int16));
+	return { static_cast<uint16>(static_cast<int16>(X)), static_cast<uint16>(static_cast<int16>(Y)) };
+}
+
+FORCEINLINE FVector2D FBoidQuantisation::UnpackVelocity(FBoidPackedVector Packed) const
+{
+	return FVector2D(static_cast<int16>(Packed.X) * VelocityStep, static_cast<int16>(Packed.Y) * VelocityStep);
+}
+
+FORCEINLINE FVector2D FBoidQuantisation::GetOffset(FBoidPackedVector From, FBoidPackedVector To) const
+{
+	if (IsWrapped)
+	{
+		return FVector2D(static_cast<int16>(static_cast<uint16>(To.X - From.X)) * PositionStep.X,
+			static_cast<int16>(static_cast<uint16>(To.Y - From.Y)) * PositionStep.Y);
+	}
+	return FVector2D((static_cast<int32>(To.X) - From.X) * PositionStep.X, (static_cast<int32>(To.Y) - From.Y) * PositionStep.Y);
+}
+
+/**
+ * FBoidNeighbourhood over packed state: the kernels get the same offsets and velocities,
+ * unpacked from four bytes each as they are read.
+ */
+class FBoidCompactNeighbourhood
+{
+public:
+	FBoidCompactNeighbourhood(const FBoidNeighbourLists& _Lists, const FBoidQuantisation& _Quantisation, const TArray<FBoidPackedVector>& _Positions,
+		const TArray<FBoidPackedVector>& _Velocities, int32 _Self) :
+		Lists(_Lists), Quantisation(_Quantisation), Positions(_Positions.GetData()), Velocities(_Velocities.GetData()),
+		SelfPosition(Positions[_Self]), Start(_Lists.GetRowStart(_Self)), NumNeighbours(_Lists.GetRowEnd(_Self) - Start)
+	{}
+
+	int32 Num() const							{ return NumNeighbours; }
+	int32 GetIndex(int32 i) const				{ return Lists.GetIndex(Start + i); }
+	FVector2D GetOffset(int32 i) const			{ return Quantisation.GetOffset(SelfPosition, Positions[GetIndex(i)]); }
+	FVector2D GetVelocity(int32 i) const		{ return Quantisation.UnpackVelocity(Velocities[GetIndex(i)]); }
+
+private:
+	const FBoidNeighbourLists& Lists;
+	const FBoidQuantisation& Quantisation;
+	const FBoidPackedVector* Positions;
+	const FBoidPackedVector* Velocities;
+	FBoidPackedVector SelfPosition;
+	int32 Start;
+	int32 NumNeighbours;
+};
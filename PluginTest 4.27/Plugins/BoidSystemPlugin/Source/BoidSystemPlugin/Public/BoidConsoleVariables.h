@@ -0,0 +1,21 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/IConsoleManager.h"
+
+// boids.* console variables, for sweeping flock configurations in packaged builds. The controller
+// reads them every tick, so a change applies from the next frame. Left at their defaults they
+// leave the controller's own settings alone.
+
+extern BOIDSYSTEMPLUGIN_API TAutoConsoleVariable<int32> CVarBoidsCount;
+extern BOIDSYSTEMPLUGIN_API TAutoConsoleVariable<int32> CVarBoidsThreads;
+extern BOIDSYSTEMPLUGIN_API TAutoConsoleVariable<int32> CVarBoidsChunkSize;
+extern BOIDSYSTEMPLUGIN_API TAutoConsoleVariable<int32> CVarBoidsLODTiers;
+extern BOIDSYSTEMPLUGIN_API TAutoConsoleVariable<float> CVarBoidsLODDistance;
+extern BOIDSYSTEMPLUGIN_API TAutoConsoleVariable<int32> CVarBoidsNeighbourCap;
+extern BOIDSYSTEMPLUGIN_API TAutoConsoleVariable<float> CVarBoidsUpdateBudgetMs;
+extern BOIDSYSTEMPLUGIN_API TAutoConsoleVariable<int32> CVarBoidsDebugDraw;
+extern BOIDSYSTEMPLUGIN_API TAutoConsoleVariable<int32> CVarBoidsNeighbourBackend;
+extern BOIDSYSTEMPLUGIN_API TAutoConsoleVariable<int32> CVarBoidsSimulationMode;
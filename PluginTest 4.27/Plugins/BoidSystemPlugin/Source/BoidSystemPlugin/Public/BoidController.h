@@ -6,12 +6,49 @@
 #include "GameFramework/PlayerController.h"
 
 #include "Boid.h"
+#include "BoidCommandQueue.h"
+#include "BoidFlockReplicationComponent.h"
+#include "BoidLockstep.h"
+#include "BoidPipeline.h"
+#include "BoidPipelinedSimulation.h"
+#include "BoidRuleSet.h"
+#include "BoidSimulationThread.h"
+#include "BoidSpatialQuery.h"
+#include "BoidZones.h"
 #include "FBoidRules.h"
 
 #include "BoidController.generated.h"
 
 using BoidPtr = TUniquePtr<ABoid>;
 
+UENUM(BlueprintType)
+enum class EBoidSimulationMode : uint8
+{
+	// Every boid actor steps itself in its Tick.
+	Actors,
+	// The controller steps the flock on the task graph, overlapping the next step with the actor sync.
+	Pipelined,
+	// The flock steps on its own thread at AsyncStepRate, the game thread only shows the newest step.
+	Async,
+	// Every player steps the same flock from the same inputs, only the inputs go over the network.
+	// For small flocks. Picked when play begins, switching to it later keeps the flock in its running mode.
+	Lockstep
+};
+
+// A boid going into or out of a zone. Boid is null if it was destroyed since.
+USTRUCT(BlueprintType)
+struct FBoidZoneOverlap
+{
+	GENERATED_BODY()
+
+	UPROPERTY(BlueprintReadOnly, Category = "Boids|Zones")
+	int32 Zone = INDEX_NONE;
+	UPROPERTY(BlueprintReadOnly, Category = "Boids|Zones")
+	ABoid* Boid = nullptr;
+};
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FBoidZoneEventsSignature, const TArray<FBoidZoneOverlap>&, Entered, const TArray<FBoidZoneOverlap>&, Exited);
+
 /**
  * 
  */
@@ -25,6 +62,64 @@ public:
 	virtual void BeginDestroy() override;
 	
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	
+	// Time a full garbage collection at 1k, 10k and 50k boids with and without per-boid neighbour references. Actors mode only.
+	UFUNCTION(Exec)
+	void BenchmarkBoidGC();
+
+	// Log how far the far field rule forces are from the exact ones for the flock as it is now, at a few tolerances.
+	UFUNCTION(Exec)
+	void ReportFarFieldAccuracy();
+
+	// Time the brute force, grid and k-d tree neighbour searches on the flock as it is, spread evenly and in a few tight clumps.
+	UFUNCTION(Exec)
+	void BenchmarkNeighbourSearch();
+
+	// Grid over the flock for FBoidSpatialQuery, hit indices are slots in Settings.ListOfBoids. Outside the Actors
+	// mode nothing else keeps it current, so the first query of a frame builds it from where the boid actors are.
+	const FBoidSpatialGrid& GetQueryGrid();
+
+	// Boids within Radius of Centre, up to MaxBoids of them. Returns how many there were in all.
+	UFUNCTION(BlueprintCallable, Category = "Boids|Query")
+	int32 FindBoidsInRadius(FVector2D Centre, float Radius, TArray<ABoid*>& OutBoids, int32 MaxBoids = 64);
+	// Boids in the box of HalfExtent around Centre, up to MaxBoids of them. Returns how many there were in all.
+	UFUNCTION(BlueprintCallable, Category = "Boids|Query")
+	int32 FindBoidsInBox(FVector2D Centre, FVector2D HalfExtent, TArray<ABoid*>& OutBoids, int32 MaxBoids = 64);
+	// The MaxBoids nearest boids within Radius of the segment, nearest first, with how far along it each is hit.
+	UFUNCTION(BlueprintCallable, Category = "Boids|Query")
+	int32 TraceBoids(FVector2D Start, FVector2D End, float Radius, TArray<ABoid*>& OutBoids, TArray<float>& OutDistances, int32 MaxBoids = 16);
+	// The Count nearest boids no further than MaxDistance, nearest first.
+	UFUNCTION(BlueprintCallable, Category = "Boids|Query")
+	int32 FindNearestBoids(FVector2D Centre, float MaxDistance, int32 Count, TArray<ABoid*>& OutBoids, TArray<float>& OutDistances);
+	// FindBoidsInRadius for every centre at once. Centre i's boids are OutBoids from i * MaxBoidsPerCentre on,
+	// OutNumFound[i] of them, empty slots are null.
+	UFUNCTION(BlueprintCallable, Category = "Boids|Query")
+	void FindBoidsInRadiusBatch(const TArray<FVector2D>& Centres, float Radius, int32 MaxBoidsPerCentre, TArray<ABoid*>& OutBoids,
+		TArray<int32>& OutNumFound);
+
+	// Trigger zones over the flock, see FBoidZoneTracker. Returns the zone's id for the events.
+	UFUNCTION(BlueprintCallable, Category = "Boids|Zones")
+	int32 AddCircleZone(FVector2D Centre, float Radius);
+	UFUNCTION(BlueprintCallable, Category = "Boids|Zones")
+	int32 AddBoxZone(FVector2D Centre, FVector2D HalfExtent);
+	// Its boids exit on the next update.
+	UFUNCTION(BlueprintCallable, Category = "Boids|Zones")
+	void RemoveZone(int32 Zone);
+	UFUNCTION(BlueprintCallable, Category = "Boids|Zones")
+	void MoveZone(int32 Zone, FVector2D Centre);
+
+	// Every boid that went into or out of a zone this frame, in two arrays, once per frame if anything changed.
+	UPROPERTY(BlueprintAssignable, Category = "Boids|Zones")
+	FBoidZoneEventsSignature OnZoneEvents;
+
+	// For C++, events carry handle ids: Settings.GetBoid(FBoidHandle{ Event.BoidId }).
+	const FBoidZoneTracker& GetZones() const			{ return Zones; }
+
+	// Any thread, without locks. Spawns, despawns and rule weight changes are applied at the start of the
+	// controller's next tick, before the flock moves. False if the queue is full and the command was dropped.
+	// A lockstep flock only takes spawns, the rest are dropped with a warning.
+	bool EnqueueCommand(const FBoidCommand& Command)	{ return Commands.Enqueue(Command); }
 	
 protected:
 	virtual void SetupInputComponent() override;
@@ -49,21 +144,36 @@ protected:
 	
 	// Boids
 	TArray<BoidPtr> Boids;
+	// The only container keeping the boid actors referenced, the flock itself works on indices.
+	UPROPERTY(Transient)
 	TArray<ABoid*> CachedBoids;
 	
-	// Rules
+	// Rules, shared by every boid.
 	TArray<TUniquePtr<FBoidRules>> BoidRules;
-	float* DefaultWeights;
+	FDefaultBoidPipeline RulePipeline;
+	// The controller's weights as rules, for when there is no RuleSet.
+	TArray<FBoidRuleDesc> ControllerRules;
+	PointRepulsionRule* MouseRule = nullptr;
+	BoundedAreaRule* WallRule = nullptr;
+	bool RulesUsePipeline = false;
 	
 	void InitializeRules();
+	void GatherRuleDescs();
+	void UpdateRules();
 	void ApplyBoidRules();
 	void ApplyOneBoidRules(ABoid* Boid);
+	// Point every boid away from the rules, before they are destroyed with the controller.
+	void DetachBoidRules();
+	// The RuleSet's rules in place, or the controller's.
+	const TArray<FBoidRuleDesc>& GetActiveRules() const		{ return RuleSet ? RuleSet->Rules : ControllerRules; }
+	ABoid* SpawnFlockBoid(FVector Location);
 	void RandomizeBoidVelocity(ABoid* Boid);
 	void LeftMouse();
 	void RightMouse();
 	
+	// 1 is what the flock always ran with, the SeparationRule constructor used to drop the weight it was given.
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Weights")
-		float SeparationWeight = 3.0f;
+		float SeparationWeight = 1.0f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Weights")
 		float CohesionWeight = 0.15f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Weights")
@@ -72,6 +182,12 @@ protected:
 		float PointWeight = 0.7f;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Weights")
 		float WallWeight = 3.5f;
+	// Used instead of the weights above when set. Edits to it apply while playing.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Weights")
+		UBoidRuleSet* RuleSet = nullptr;
+	// Run cohesion, separation, alignment and walls as one inlined kernel instead of virtual rules.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Weights")
+		bool UseRulePipeline = true;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "AreaInfo")
 		FVector2D WallArea = { 100, 100 };
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "AreaInfo")
@@ -80,6 +196,132 @@ protected:
 		bool DebugLines = true;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "BoidInput")
 		bool EnableMouse = true;
+	// Frames between sorting the flock arrays along a Z-order curve, 0 keeps spawn order.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Performance")
+		int32 ReorderInterval = 30;
+	// Seconds between flock timing lines in the log, 0 turns them off.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Performance")
+		float StatsLogInterval = 5.0f;
+	// Fill every boid's ListOfBoidsInVision for debugging. Costs N x neighbours object references per garbage collection.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Performance")
+		bool TrackNeighbourActors = false;
+
+	int32 FramesSinceReorder = 0;
+	float StatsTime = 0.0f;
+	int32 StatsFrames = 0;
+	uint64 StatsGridCycles = 0;
+	uint64 StatsNeighbourCycles = 0;
+	uint64 StatsBoidUpdates = 0;
+
+	void LogFlockStats(float DeltaSeconds, uint64 GridCycles, uint64 NeighbourCycles);
+
+	// Outside of Actors mode the boids stop ticking and just show the flock step. Only the built-in
+	// rules run there, the mouse rule and debug lines need the game thread.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Performance")
+		EBoidSimulationMode SimulationMode = EBoidSimulationMode::Actors;
+	// Steps per second of the async simulation.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Performance")
+		float AsyncStepRate = 60.0f;
+	// Split the pipelined rules stage by grid cells weighted by neighbour count, with work stealing,
+	// instead of equal slices of boids.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Performance")
+		bool BalanceWorkByCost = true;
+	// Pick the grid cell size from the measured density and split crowded cells, instead of VisualRange wide cells.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Performance")
+		bool AutoTuneGrid = true;
+	// Cohesion and alignment take whole grid cells inside the visual range as sums, for cheap large ranges.
+	// Only in the Pipelined and Async modes.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Performance")
+		bool UseFarField = false;
+	// Cell diagonals a cell may reach past the visual range and still be summed whole. 0 is exact.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Performance", meta = (ClampMin = "0"))
+		float FarFieldTolerance = 0.0f;
+	// Keep the flock as 16 bit fixed point positions and velocities, for very large flocks where memory bandwidth
+	// limits the step. Only in the Pipelined and Async modes, and not with far field.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Performance")
+		bool UseCompactState = false;
+	// Step the flock in fixed point, so it moves bit for bit the same with every compiler and CPU, for replays and baselines
+	// that compare across machines. Costs more than float. Only in the Pipelined and Async modes, overrides the two above.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Performance")
+		bool UseFixedPoint = false;
+
+	// Sends the flock to this controller's client when it is a remote player of a listen server.
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"), Category = "Replication")
+		UBoidFlockReplicationComponent* FlockReplication = nullptr;
+	// Only the listen server or standalone player's controller simulates the flock, remote players get it replicated.
+	bool OwnsFlock() const;
+
+	// Runs the flock in the Lockstep simulation mode.
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"), Category = "Replication")
+		class UBoidLockstepComponent* Lockstep = nullptr;
+	// Turns per second in the Lockstep mode, one flock step each.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Replication", meta = (ClampMin = "1"))
+		float LockstepTurnRate = 30.0f;
+	FBoidLockstepParams MakeLockstepParams() const;
+
+	TUniquePtr<FBoidSimulationThread> SimulationThread;
+	TUniquePtr<FBoidPipelinedSimulation> PipelinedSimulation;
+	// Mode the running simulation was started with, and the flock revision it has caught up with.
+	EBoidSimulationMode ActiveMode = EBoidSimulationMode::Actors;
+	bool HasWarnedNoLockstep = false;
+	uint32 SimulationRevision = 0;
+	// Reused for the boids handed to the running simulation each frame.
+	FBoidFlockChanges FlockChanges;
+	TArray<FBoidHandle> AddedBoids;
+	// Handle ids of boids the async simulation is removing, by the batch of changes that removes them. Older states
+	// still hold the destroyed boid under the id, which may belong to a new boid by now.
+	TMap<int32, uint32> RemovedIds;
+
+	// SimulationMode unless boids.SimulationMode overrides it.
+	EBoidSimulationMode GetSimulationMode() const;
+	FBoidSimulationParams MakeSimulationParams() const;
+	void StartFlockSimulation(EBoidSimulationMode Mode);
+	void StopFlockSimulation();
+	// Mode is never Lockstep, that runs in the Lockstep component.
+	void TickFlockSimulation(float DeltaSeconds, EBoidSimulationMode Mode);
+	// Gather the boids spawned and destroyed since the last call into FlockChanges.
+	void GatherFlockChanges();
+	void LogWorkerStats(float DeltaSeconds);
+	void SyncBoidActors(const TArray<FBoidHandle>& Handles, const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities);
+
+	// boids.* console variables that act on the controller rather than being passed on.
+	void ApplyFlockCount();
+	// boids.Count as last applied, the flock is only resized when it changes.
+	int32 AppliedFlockCount = -1;
+	void ApplyBoidLOD();
+	// Distance tier of a position from the camera, 0 for the nearest tier.
+	int32 GetLODTier(FVector2D Position, FVector2D ViewPosition, int32 NumTiers, float TierDistance) const;
+	FVector2D GetViewPosition() const;
+
+	// LOD tier count the boids' tick intervals were last set for.
+	int32 AppliedLODTiers = 1;
+	// Slot the next actor sync starts from, for when the last one ran out of budget.
+	int32 SyncCursor = 0;
+	uint32 SyncFrame = 0;
+
+	// Frame Settings.Grid was last rebuilt on, and reused buffers for the Blueprint queries.
+	uint64 QueryGridFrame = MAX_uint64;
+	TArray<FBoidQueryHit> QueryHits;
+	TArray<FBoidQuery> BatchQueries;
+	// Copy the first hits into the Blueprint outputs, OutDistances may be null.
+	void CopyQueryHits(int32 NumHits, TArray<ABoid*>& OutBoids, TArray<float>* OutDistances) const;
+
+	FBoidZoneTracker Zones;
+	TArray<FBoidZoneOverlap> ZoneEntered;
+	TArray<FBoidZoneOverlap> ZoneExited;
+	// The lockstep flock's boids are not in Settings, they get a grid of their own.
+	FBoidSpatialGrid LockstepZoneGrid;
+	// One pass over every zone once the flock has moved, then the events go out.
+	void UpdateZones();
+	// Same over the lockstep flock, once its replicas show the newest turn. Boid ids are slots in its state,
+	// which only ever grows.
+	void UpdateLockstepZones(const FBoidLockstepSimulation& Shown);
+	void UpdateZones(const FBoidSpatialGrid& Grid, TFunctionRef<int32(int32)> GetBoidId, TFunctionRef<ABoid*(int32)> GetBoid);
+	bool HasZoneWork() const;
+
+	FBoidCommandQueue Commands;
+	// Drains the queue on the game thread, where the flock may be changed.
+	void ApplyCommands();
 
 	bool LeftClick;
 	bool RightClick;
@@ -0,0 +1,97 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Two 16.16 fixed point values.
+struct FBoidFixedVector
+{
+	int32 X = 0;
+	int32 Y = 0;
+
+	FBoidFixedVector() = default;
+	FBoidFixedVector(int32 _X, int32 _Y) : X(_X), Y(_Y) {}
+
+	FORCEINLINE FBoidFixedVector operator+(FBoidFixedVector Other) const	{ return FBoidFixedVector(X + Other.X, Y + Other.Y); }
+	FORCEINLINE FBoidFixedVector operator-(FBoidFixedVector Other) const	{ return FBoidFixedVector(X - Other.X, Y - Other.Y); }
+	FORCEINLINE bool operator==(FBoidFixedVector Other) const				{ return X == Other.X && Y == Other.Y; }
+	FORCEINLINE bool operator!=(FBoidFixedVector Other) const				{ return !(*this == Other); }
+};
+
+/**
+ * 16.16 fixed point arithmetic for the fixed point flock step. Everything is integer maths with the rounding
+ * spelled out, so results are bit for bit the same whatever the compiler, optimisation level, instruction set
+ * or CPU, unlike float maths where contraction into FMA, SIMD widths and library Exp or Atan2 all differ.
+ * Values hold up to 32767 either way with a step of 1 / 65536. Results that would not fit saturate.
+ *
+ * Conversions from float are exact for the same float, so a flock started from the same floats steps the same
+ * everywhere. The converted values are not the floats, so the trajectories are close to the float step's but not it.
+ */
+struct BOIDSYSTEMPLUGIN_API FBoidFixedMath
+{
+	static constexpr int32 FractionBits = 16;
+	static constexpr int32 One = 1 << FractionBits;
+
+	static FORCEINLINE int32 FromFloat(float Value)
+	{
+		// Largest floats either side that still fit in an int32.
+		return FMath::RoundToInt(FMath::Clamp(Value * One, -2147483520.0f, 2147483520.0f));
+	}
+
+	static FORCEINLINE float ToFloat(int32 Value)
+	{
+		return Value * (1.0f / One);
+	}
+
+	static FORCEINLINE FBoidFixedVector FromVector(FVector2D Value)	{ return FBoidFixedVector(FromFloat(Value.X), FromFloat(Value.Y)); }
+	static FORCEINLINE FVector2D ToVector(FBoidFixedVector Value)		{ return FVector2D(ToFloat(Value.X), ToFloat(Value.Y)); }
+
+	static FORCEINLINE int32 Saturate(int64 Value)
+	{
+		return static_cast<int32>(FMath::Clamp<int64>(Value, MIN_int32, MAX_int32));
+	}
+
+	// Rounded to nearest, halves up.
+	static FORCEINLINE int32 Mul(int32 A, int32 B)
+	{
+		return Saturate((static_cast<int64>(A) * B + One / 2) >> FractionBits);
+	}
+
+	// Rounded towards zero. B must not be 0.
+	static FORCEINLINE int32 Div(int32 A, int32 B)
+	{
+		return Saturate((static_cast<int64>(A) * One) / B);
+	}
+
+	static FORCEINLINE FBoidFixedVector Mul(FBoidFixedVector V, int32 Scale)	{ return FBoidFixedVector(Mul(V.X, Scale), Mul(V.Y, Scale)); }
+
+	// Squared length with 32 fraction bits, exact.
+	static FORCEINLINE uint64 SizeSquared(FBoidFixedVector V)
+	{
+		return static_cast<uint64>(static_cast<int64>(V.X) * V.X) + static_cast<uint64>(static_cast<int64>(V.Y) * V.Y);
+	}
+
+	static FORCEINLINE int32 Size(FBoidFixedVector V)
+	{
+		return Saturate(SqrtRaw(SizeSquared(V)));
+	}
+
+	// Unit length, or zero for a zero vector.
+	static FORCEINLINE FBoidFixedVector GetNormal(FBoidFixedVector V)
+	{
+		const int32 Length = Size(V);
+		if (Length == 0)
+		{
+			return FBoidFixedVector();
+		}
+		return FBoidFixedVector(Div(V.X, Length), Div(V.Y, Length));
+	}
+
+	// Largest integer whose square is at most Value.
+	static uint32 SqrtRaw(uint64 Value);
+	// Square root, 0 for negative values.
+	static int32 Sqrt(int32 Value);
+	// e^Value, within a step or two of the exact value.
+	static int32 Exp(int32 Value);
+};
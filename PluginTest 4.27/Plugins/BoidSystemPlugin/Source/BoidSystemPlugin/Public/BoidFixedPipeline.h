@@ -0,0 +1,64 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidFixedMath.h"
+#include "BoidNeighbours.h"
+#include "BoidPipeline.h"
+
+/**
+ * The built-in kernels and the integration of FBoidSimulation in 16.16 fixed point, see FBoidFixedMath.
+ * Integer sums come out the same in any order, so neither the neighbour search backend nor how the boids
+ * are split over threads changes a bit of the result. The neighbour lists only have to hold every boid in
+ * range: they are built a little wide in float and each neighbour is tested again here.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidFixedPipeline
+{
+public:
+	// Converts the float pipeline's parameters.
+	void Configure(const FDefaultBoidPipeline& Pipeline, FVector2D Area, float VisualRange, bool _IsWrapped);
+
+	// Summed weighted force on boid Self, from the neighbours in its row of Lists.
+	FBoidFixedVector Evaluate(const FBoidNeighbourLists& Lists, const TArray<FBoidFixedVector>& Positions, const TArray<FBoidFixedVector>& Velocities,
+		int32 Self) const;
+
+	// Clamp the acceleration and speed and move one boid, as IntegrateBoid does.
+	void Integrate(FBoidFixedVector& Position, FBoidFixedVector& Velocity, FBoidFixedVector Acceleration, int32 Speed, int32 MaxAcceleration,
+		bool HasConstantSpeed, int32 DeltaTime) const;
+
+	// Shortest vector going from one position to another.
+	FBoidFixedVector GetOffset(FBoidFixedVector From, FBoidFixedVector To) const;
+	FBoidFixedVector WrapPosition(FBoidFixedVector Position) const;
+
+	// Getters
+	// Range to build the neighbour lists with, wide enough that float rounding can't leave out a boid in range.
+	float GetSearchRange() const			{ return SearchRange; }
+
+private:
+	FBoidFixedVector FinishBounds(FBoidFixedVector Position) const;
+	FBoidFixedVector FinishPoint(FBoidFixedVector Position) const;
+
+	int32 CohesionWeight = 0;
+	int32 SeparationWeight = 0;
+	uint64 DesiredDistanceSquared = 0;
+	int32 Falloff = 0;
+	int32 AlignmentWeight = 0;
+	int32 BoundsWeight = 0;
+	int32 Width = 0;
+	int32 Height = 0;
+	int32 BoundsDistance = 0;
+	bool IsBounded = false;
+	// 30 times the point kernel's weight, as FBoidLockstepSimulation::AddFixedMouseForces scales it.
+	int32 PointScale = 0;
+	FBoidFixedVector Point;
+	int32 PointDistance = 0;
+	bool IsPushing = false;
+	bool IsPulling = false;
+
+	FBoidFixedVector Area;
+	bool IsWrapped = true;
+	uint64 RangeSquared = 0;
+	float SearchRange = 0;
+};
@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/ActorComponent.h"
+
+#include "BoidReplication.h"
+
+#include "BoidFlockReplicationComponent.generated.h"
+
+class ABoid;
+
+/**
+ * Sends the flock from the server to one client as compressed snapshots, on the player controller of
+ * that client's connection. On the server it quantises and culls the flock around the client's view and
+ * delta encodes it against the last snapshot the client acknowledged. On the client it spawns replica
+ * boids and moves them between snapshots, InterpolationDelay behind the newest.
+ *
+ * Try it with Play As Listen Server and two players: the second window only shows the replicated flock.
+ */
+UCLASS(ClassGroup = (Boids), meta = (BlueprintSpawnableComponent))
+class BOIDSYSTEMPLUGIN_API UBoidFlockReplicationComponent : public UActorComponent
+{
+	GENERATED_BODY()
+
+public:
+	UBoidFlockReplicationComponent();
+
+	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	// Area the flock moves in, set by the controller.
+	void SetFlockArea(FVector2D Area, bool IsWrapped);
+
+	// Bytes sent to this client per second for each boid in the flock, over the last stats interval.
+	float GetBytesPerBoidPerSecond() const		{ return BytesPerBoidPerSecond; }
+
+protected:
+	UFUNCTION(Client, Unreliable)
+		void ClientReceiveSnapshot(const TArray<uint8>& Data);
+	// Tells the server which snapshot can be the next baseline, and where the client is looking from.
+	UFUNCTION(Server, Unreliable)
+		void ServerAcknowledgeSnapshot(uint32 Sequence, FVector2D ViewPosition);
+
+	// Snapshots per second sent to the client.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Replication", meta = (ClampMin = "1"))
+		float SendRate = 20.0f;
+	// World units per position step.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Replication", meta = (ClampMin = "0.001"))
+		float Precision = 0.05f;
+	// Only boids this close to the client's view are sent, 0 sends the whole flock.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Replication", meta = (ClampMin = "0"))
+		float RelevancyRadius = 0.0f;
+	// Most boids per snapshot, nearest first. 0 sends every relevant boid.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Replication", meta = (ClampMin = "0"))
+		int32 MaxBoidsPerSnapshot = 512;
+	// Most bytes per snapshot, the farthest boids wait for a later one. Snapshots go unreliably, and one that
+	// spills over a packet is split into partial bunches that are all lost if any one is. 0 has no limit.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Replication", meta = (ClampMin = "0"))
+		int32 MaxSnapshotBytes = 900;
+	// How far behind the newest snapshot the client shows the flock. A couple of send intervals rides out a lost snapshot.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Replication", meta = (ClampMin = "0"))
+		float InterpolationDelay = 0.1f;
+	// Seconds between bandwidth lines in the log, 0 turns them off.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Replication")
+		float StatsLogInterval = 5.0f;
+
+private:
+	bool IsSending() const;
+	bool IsReceiving() const;
+	void SendSnapshot(float DeltaTime);
+	void ShowFlock(float DeltaTime);
+	void LogBandwidth(int32 SentBytes);
+	FBoidReplicationSettings MakeSettings() const;
+
+	FBoidSnapshotSender Sender;
+	FBoidSnapshotReceiver Receiver;
+	FVector2D FlockArea = { 100, 100 };
+	bool FlockIsWrapped = true;
+
+	float SendAccumulator = 0.0f;
+	// Server time the client is showing, trails the newest snapshot by InterpolationDelay.
+	float RenderTime = 0.0f;
+	bool HasRenderTime = false;
+
+	// Replica boid of each replicated id, client only.
+	UPROPERTY(Transient)
+		TMap<int32, ABoid*> Replicas;
+	TArray<FBoidReplicatedState> States;
+
+	// Gathered flock, reused every send.
+	TArray<int32> Ids;
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	TArray<uint8> Bytes;
+
+	float StatsTime = 0.0f;
+	int64 StatsBytes = 0;
+	int64 StatsFlockBoids = 0;
+	int32 StatsSnapshots = 0;
+	float BytesPerBoidPerSecond = 0.0f;
+};
@@ -0,0 +1,43 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Linear allocator for data that only lives for one flock frame. Everything is released at once by
+ * Reset, and if a frame ran out of room the block is grown there so the next frame fits in one piece.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidFrameArena
+{
+public:
+	FBoidFrameArena() = default;
+	FBoidFrameArena(const FBoidFrameArena&) = delete;
+	FBoidFrameArena& operator=(const FBoidFrameArena&) = delete;
+	~FBoidFrameArena();
+
+	// Drop everything allocated since the last reset.
+	void Reset();
+
+	// Uninitialised room for Count elements, valid until the next Reset.
+	template <typename T>
+	T* Alloc(int32 Count)
+	{
+		return static_cast<T*>(AllocBytes(sizeof(T) * FMath::Max(Count, 0), alignof(T)));
+	}
+
+	// Getters
+	int64 GetUsed() const			{ return Used + OverflowBytes; }
+	int64 GetCapacity() const		{ return Capacity; }
+
+private:
+	void* AllocBytes(int64 Size, int64 Alignment);
+
+	uint8* Block = nullptr;
+	int64 Capacity = 0;
+	int64 Used = 0;
+
+	// Allocations that did not fit in the block this frame.
+	TArray<void*> Overflow;
+	int64 OverflowBytes = 0;
+};
@@ -0,0 +1,37 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidSpatialGrid.h"
+
+/**
+ * Picks the grid layout for the next frame from how the flock filled the grid this frame.
+ * The cell size is the fraction of the visual range with the lowest predicted query cost, cells
+ * visited against boids tested, at the density the average boid sees. Cells far above the flock's
+ * mean occupancy get split, which takes care of clumps the single cell size can't suit.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidGridTuner
+{
+public:
+	// Look at the grid as last built and settle the layout for its next build.
+	void Tune(const FBoidSpatialGrid& LastGrid, float Range);
+
+	// Getters
+	float GetCellSize() const				{ return CellSize; }
+	int32 GetMaxBoidsPerCell() const		{ return MaxBoidsPerCell; }
+	int32 GetDivisor() const				{ return Divisor; }
+	float GetEffectiveDensity() const		{ return EffectiveDensity; }
+
+private:
+	float PredictCost(float Range, int32 RangeDivisor) const;
+
+	// Cell size is the range over this.
+	int32 Divisor = 1;
+	float CellSize = 0;
+	int32 MaxBoidsPerCell = 0;
+	// Boids per unit area around the average boid, rather than over the whole area.
+	float EffectiveDensity = 0;
+	float LastRange = 0;
+};
@@ -0,0 +1,125 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidSimulation.h"
+
+// One player's input over one turn.
+struct FBoidLockstepInput
+{
+	// Only sent while a button is held, it does nothing otherwise.
+	FVector2D MousePosition = FVector2D::ZeroVector;
+	// Held buttons, as the mouse rule reads them: left pushes boids away, right pulls them to a ring around the mouse.
+	bool LeftClick = false;
+	bool RightClick = false;
+	// Boids the player spawned during the turn.
+	TArray<FVector2D> Spawns;
+
+	// Nothing the simulation would notice.
+	bool IsIdle() const							{ return !LeftClick && !RightClick && Spawns.Num() == 0; }
+
+	void Serialize(FArchive& Ar);
+};
+
+// Everything that happens in one turn: the input of every player that did anything, by player slot.
+struct FBoidLockstepTurn
+{
+	uint32 Turn = 0;
+	TArray<TPair<int32, FBoidLockstepInput>> Inputs;
+
+	// False if the data is broken.
+	bool Serialize(FArchive& Ar);
+};
+
+// What every peer has to agree on besides the inputs. Sent to peers as they join.
+struct FBoidLockstepParams
+{
+	FBoidSimulationParams Simulation;
+	FBoidBody Body;
+	// One step per turn.
+	float TurnDeltaTime = 1.0f / 30.0f;
+	// Mouse force, the mouse rule's weight and distance.
+	float PointWeight = 0.07f;
+	float PointDistance = 15.0f;
+	int32 Seed = 0;
+};
+
+/**
+ * The flock as every lockstep peer steps it. A turn is one fixed step on one thread, without the grid tuner,
+ * far field or compact state, so peers that start from the same state and get the same turns stay bit for bit
+ * the same. That holds for peers running the same build on the same kind of CPU, or any build with the
+ * simulation's UseFixedPoint. The checksum of the state after every turn shows when they don't.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidLockstepSimulation
+{
+public:
+	// A flock seeded from Params.Seed, so peers starting together agree on it without sending it.
+	void Init(const FBoidLockstepParams& _Params, int32 NumBoids);
+
+	// Params and state, for a peer joining a running session.
+	void Save(TArray<uint8>& OutBytes) const;
+	bool Load(const TArray<uint8>& Bytes);
+
+	// Step one turn, which has to be GetNextTurn().
+	void Step(const FBoidLockstepTurn& Turn);
+
+	// Of the state after the last turn, the same on every peer in sync.
+	uint32 GetChecksum() const;
+
+	// Getters
+	uint32 GetNextTurn() const						{ return NextTurn; }
+	const FBoidFlockState& GetState() const			{ return State; }
+	const FBoidLockstepParams& GetParams() const	{ return Params; }
+	int32 GetNum() const							{ return State.Positions.Num(); }
+
+private:
+	void Restart(const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities);
+	void AddMouseForces(const FBoidLockstepInput& Input);
+	void AddFixedMouseForces(const FBoidLockstepInput& Input);
+
+	FBoidLockstepParams Params;
+	FBoidSimulation Simulation;
+	// Copied out after every turn, the mouse forces and checksums read it.
+	FBoidFlockState State;
+	uint32 NextTurn = 1;
+	TArray<FBoidBody> Bodies;
+	// Boids count up from 0 in the order they joined, nothing ever leaves.
+	TArray<FBoidHandle> Handles;
+	// Reused for the boids each turn spawns.
+	FBoidFlockChanges Changes;
+};
+
+/**
+ * The server's side of a session. Collects the players' inputs, closes them into a turn at the turn rate,
+ * steps its own simulation with it and checks the checksums the peers send back against its own.
+ * Buttons and mouse are held from the last input a player sent, spawns go into the next turn only.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidLockstepHost
+{
+public:
+	void Start(const FBoidLockstepParams& Params, int32 NumBoids);
+
+	// Slot the player's inputs go in.
+	int32 AddPlayer();
+	void RemovePlayer(int32 Slot);
+	void SetInput(int32 Slot, const FBoidLockstepInput& Input);
+
+	// Step the next turn and encode it for the peers.
+	void CloseTurn(TArray<uint8>& OutBytes);
+
+	// False when a peer's state after Turn is not the host's. Turns too old to remember pass.
+	bool CheckChecksum(uint32 Turn, uint32 Checksum) const;
+
+	// Getters
+	const FBoidLockstepSimulation& GetSimulation() const	{ return Simulation; }
+
+private:
+	FBoidLockstepSimulation Simulation;
+	TArray<FBoidLockstepInput> Inputs;
+	TArray<bool> IsSlotUsed;
+	// Checksum after each recent turn, by turn modulo their number.
+	TArray<TPair<uint32, uint32>> Checksums;
+	FBoidLockstepTurn Turn;
+};
@@ -0,0 +1,99 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/ActorComponent.h"
+
+#include "BoidLockstep.h"
+
+#include "BoidLockstepComponent.generated.h"
+
+class ABoid;
+class UBoidLockstepSubsystem;
+
+DECLARE_MULTICAST_DELEGATE_OneParam(FBoidLockstepFlockShownSignature, const FBoidLockstepSimulation&);
+
+/**
+ * One player's end of a lockstep session, on their player controller. Every peer steps the same flock
+ * from the same turns, so only the players' mouse buttons, mouse position and spawns go over the network,
+ * however big the flock. On the server it joins the world's UBoidLockstepSubsystem and sends a joining
+ * client the flock once, then every turn. On the client it steps its copy of the flock with the turns and
+ * reports a checksum after each, which the server compares with its own.
+ *
+ * Try it with two players and either net mode in play in editor. Desyncs show up as errors in the log.
+ */
+UCLASS(ClassGroup = (Boids), meta = (BlueprintSpawnableComponent))
+class BOIDSYSTEMPLUGIN_API UBoidLockstepComponent : public UActorComponent
+{
+	GENERATED_BODY()
+
+public:
+	UBoidLockstepComponent();
+
+	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	// Server only: join the world's session, starting it with this flock if nobody has yet.
+	void JoinSession(const FBoidLockstepParams& Params, int32 NumBoids);
+
+	// The local player's input, passed on once a turn.
+	void SetLocalInput(FVector2D MousePosition, bool LeftClick, bool RightClick);
+	void AddLocalSpawn(FVector2D Position);
+
+	// Called by the session for every turn it closes.
+	void SendTurn(const TArray<uint8>& Bytes);
+
+	// On the server once joined, on the client once the flock arrived.
+	bool IsInSession() const					{ return Slot != INDEX_NONE || HasSimulation; }
+	// Replica i shows boid i of the flock, null if something destroyed it.
+	const TArray<ABoid*>& GetReplicas() const	{ return Replicas; }
+
+	// Every frame the replicas have been moved to the newest turn, on each peer that shows the flock.
+	FBoidLockstepFlockShownSignature OnFlockShown;
+
+protected:
+	UFUNCTION(Client, Reliable)
+		void ClientStartLockstep(const TArray<uint8>& State);
+	UFUNCTION(Client, Reliable)
+		void ClientReceiveTurn(const TArray<uint8>& Turn);
+	UFUNCTION(Server, Reliable)
+		void ServerSendInput(const TArray<uint8>& Input);
+	UFUNCTION(Server, Unreliable)
+		void ServerReportChecksum(uint32 Turn, uint32 Checksum);
+
+	// Most turns a client steps in one frame while catching up.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Lockstep", meta = (ClampMin = "1"))
+		int32 MaxTurnsPerFrame = 4;
+	// Most boids a client may spawn a second, a second's worth can come at once. Every spawn costs every peer a boid for good.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Lockstep", meta = (ClampMin = "0"))
+		float MaxSpawnsPerSecond = 20.0f;
+
+private:
+	UBoidLockstepSubsystem* GetSession() const;
+	// The server's side of a remote player's controller.
+	bool IsRemotePeer() const;
+	void StepTurns();
+	void SendLocalInput(float DeltaTime);
+	void ShowFlock(const FBoidLockstepSimulation& Shown);
+
+	// Server: this player's slot in the session.
+	int32 Slot = INDEX_NONE;
+	bool HasSentState = false;
+	// Spawns the remote player may still send.
+	float SpawnAllowance = 0.0f;
+
+	// Client: its copy of the flock and the turns it has yet to step.
+	FBoidLockstepSimulation Simulation;
+	bool HasSimulation = false;
+	TArray<FBoidLockstepTurn> PendingTurns;
+
+	FBoidLockstepInput LocalInput;
+	bool IsInputDirty = false;
+	float InputAccumulator = 0.0f;
+	TArray<uint8> Bytes;
+
+	// Shows the flock, one replica boid per simulated boid.
+	UPROPERTY(Transient)
+		TArray<ABoid*> Replicas;
+};
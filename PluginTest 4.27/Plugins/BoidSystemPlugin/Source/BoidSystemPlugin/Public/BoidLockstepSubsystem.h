@@ -0,0 +1,59 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+
+#include "BoidLockstep.h"
+
+#include "BoidLockstepSubsystem.generated.h"
+
+class UBoidLockstepComponent;
+
+/**
+ * The server's lockstep session, one per world so a listen server and a dedicated one work the same.
+ * Every player's UBoidLockstepComponent on the server joins it, their inputs go into the turns it
+ * closes and the turns go out to every remote player.
+ */
+UCLASS()
+class BOIDSYSTEMPLUGIN_API UBoidLockstepSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	// The first call starts the session with its flock, later ones are ignored.
+	void StartSession(const FBoidLockstepParams& Params, int32 NumBoids);
+
+	// Slot of the peer's inputs, also used in the logs.
+	int32 AddPeer(UBoidLockstepComponent* Peer);
+	void RemovePeer(int32 Slot);
+	void SetInput(int32 Slot, const FBoidLockstepInput& Input);
+	void ReportChecksum(int32 Slot, uint32 Turn, uint32 Checksum);
+
+	// Close the turns due by now and send them. Only the first call each frame does anything, so every peer can call it.
+	void Update(float DeltaTime);
+
+	// Getters
+	bool IsRunning() const									{ return Running; }
+	const FBoidLockstepSimulation& GetSimulation() const	{ return Host.GetSimulation(); }
+	int32 GetNumDesyncs() const								{ return NumDesyncs; }
+
+private:
+	void LogTraffic(float DeltaTime, int32 NumBoids);
+
+	FBoidLockstepHost Host;
+	bool Running = false;
+	TArray<TWeakObjectPtr<UBoidLockstepComponent>> Peers;
+	// Peers already reported as out of sync, by slot, so the log says it once.
+	TArray<bool> HasDesynced;
+	int32 NumDesyncs = 0;
+
+	uint64 LastUpdateFrame = 0;
+	float TurnAccumulator = 0.0f;
+	TArray<uint8> TurnBytes;
+
+	float StatsTime = 0.0f;
+	int64 StatsBytes = 0;
+	int32 StatsTurns = 0;
+};
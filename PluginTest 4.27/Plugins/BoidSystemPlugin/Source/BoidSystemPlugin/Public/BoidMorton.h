@@ -0,0 +1,38 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Interleave the low 16 bits of X and Y into a Z-order code, X takes the even bits.
+FORCEINLINE uint32 EncodeMorton2D(uint32 X, uint32 Y)
+{
+	auto Spread = [](uint32 Value)
+	{
+		Value &= 0x0000FFFF;
+		Value = (Value | (Value << 8)) & 0x00FF00FF;
+		Value = (Value | (Value << 4)) & 0x0F0F0F0F;
+		Value = (Value | (Value << 2)) & 0x33333333;
+		Value = (Value | (Value << 1)) & 0x55555555;
+		return Value;
+	};
+
+	return Spread(X) | (Spread(Y) << 1);
+}
+
+/**
+ * LSD radix sort over 32-bit keys, one byte per pass, skipping the high bytes no key uses.
+ * Keeps its buffers between sorts so reordering the flock does not allocate once warmed up.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidRadixSorter
+{
+public:
+	// Indices into Keys in ascending key order, equal keys keep their original order.
+	const TArray<int32>& Sort(const TArray<uint32>& Keys);
+
+private:
+	TArray<uint32> SortedKeys;
+	TArray<uint32> ScratchKeys;
+	TArray<int32> Order;
+	TArray<int32> ScratchOrder;
+};
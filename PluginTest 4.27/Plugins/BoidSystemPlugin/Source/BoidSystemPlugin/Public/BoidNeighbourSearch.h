@@ -0,0 +1,131 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidSpatialGrid.h"
+
+// Which structure answers the neighbour queries, boids.NeighbourBackend takes these as numbers.
+enum class EBoidNeighbourBackend : uint8
+{
+	Auto,
+	BruteForce,
+	Grid,
+	KdTree,
+	Count
+};
+
+/**
+ * A way of finding the boids within range of a position. Every backend is built from the
+ * flock's grid once it has been built for the frame, which gives it the positions, the area and
+ * whether it wraps, and answers with the same boids the grid would.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidNeighbourSearch
+{
+public:
+	virtual ~FBoidNeighbourSearch() {}
+
+	virtual const TCHAR* GetName() const = 0;
+
+	// Get ready to query the positions the grid was last built from.
+	virtual void Build(const FBoidSpatialGrid& Grid) = 0;
+
+	// Append the index of every position within Range of Position, other than Self.
+	virtual void GatherNeighbours(FVector2D Position, int32 Self, float Range, TArray<int32>& OutIndices) const = 0;
+
+	// The grid itself, for callers that can query it directly, null for the other backends.
+	virtual const FBoidSpatialGrid* GetGrid() const { return nullptr; }
+};
+
+// Tests every boid, nothing to build. Cheapest for small flocks.
+class BOIDSYSTEMPLUGIN_API FBoidBruteForceSearch : public FBoidNeighbourSearch
+{
+public:
+	virtual const TCHAR* GetName() const override { return TEXT("Brute force"); }
+	virtual void Build(const FBoidSpatialGrid& _Grid) override { Grid = &_Grid; }
+	virtual void GatherNeighbours(FVector2D Position, int32 Self, float Range, TArray<int32>& OutIndices) const override;
+
+private:
+	const FBoidSpatialGrid* Grid = nullptr;
+};
+
+// The uniform grid the flock builds every frame anyway.
+class BOIDSYSTEMPLUGIN_API FBoidGridSearch : public FBoidNeighbourSearch
+{
+public:
+	virtual const TCHAR* GetName() const override { return TEXT("Grid"); }
+	virtual void Build(const FBoidSpatialGrid& _Grid) override { Grid = &_Grid; }
+	virtual void GatherNeighbours(FVector2D Position, int32 Self, float Range, TArray<int32>& OutIndices) const override;
+	virtual const FBoidSpatialGrid* GetGrid() const override { return Grid; }
+
+private:
+	const FBoidSpatialGrid* Grid = nullptr;
+};
+
+/**
+ * Balanced 2D k-d tree rebuilt from scratch each frame. Nodes are implicit: a range of the
+ * point array splits at its middle element along its wider axis, so the tree is just the
+ * reordered points and one axis per split. Follows the flock's density wherever it goes,
+ * which suits clumps in large empty areas the grid has to cover cell by cell.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidKdTree : public FBoidNeighbourSearch
+{
+public:
+	virtual const TCHAR* GetName() const override { return TEXT("K-d tree"); }
+	virtual void Build(const FBoidSpatialGrid& Grid) override;
+	virtual void GatherNeighbours(FVector2D Position, int32 Self, float Range, TArray<int32>& OutIndices) const override;
+
+private:
+	void BuildRange(int32 Start, int32 End);
+	// Reorder Start up to End so Nth holds the element that belongs there sorted on Axis.
+	void Select(int32 Start, int32 End, int32 Nth, int32 Axis);
+	void Query(int32 Start, int32 End, FVector2D Position, float Range, float RangeSquared, int32 Self, TArray<int32>& OutIndices) const;
+
+	// Points in tree order and the boid each one came from.
+	TArray<FVector2D> Points;
+	TArray<int32> Order;
+	// Axis of the split at each middle element, unused for leaf points.
+	TArray<uint8> SplitAxis;
+	FVector2D Area;
+	bool IsWrapped = false;
+};
+
+// Time taken by one backend to build and fill the neighbour lists for a flock.
+struct FBoidNeighbourTiming
+{
+	double Seconds = 0;
+	int32 NumNeighbours = 0;
+};
+
+/**
+ * Owns one of each backend and hands out the one to use each frame: whatever
+ * boids.NeighbourBackend asks for, or on auto the one with the lowest predicted cost for how
+ * the flock is spread over the grid.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidNeighbourBackends
+{
+public:
+	// The backend for this frame, built over the grid and ready to query. Required overrides boids.NeighbourBackend.
+	FBoidNeighbourSearch& Select(const FBoidSpatialGrid& Grid, float Range, EBoidNeighbourBackend Required = EBoidNeighbourBackend::Auto);
+
+	FBoidNeighbourSearch& Get(EBoidNeighbourBackend Backend);
+
+	// Cheapest backend by predicted cost per boid, staying with Current unless another is clearly cheaper.
+	static EBoidNeighbourBackend Choose(const FBoidSpatialGrid& Grid, float Range, EBoidNeighbourBackend Current);
+
+	// Build the grid and each backend over Positions and fill neighbour lists with it, best of Repeats runs.
+	static void Benchmark(const TArray<FVector2D>& Positions, FVector2D Area, float Range, bool IsWrapped, int32 Repeats,
+		FBoidNeighbourTiming OutTimings[(int32)EBoidNeighbourBackend::Count]);
+
+	// Getters
+	EBoidNeighbourBackend GetCurrent() const	{ return Current; }
+
+private:
+	FBoidBruteForceSearch BruteForce;
+	FBoidGridSearch GridSearch;
+	FBoidKdTree KdTree;
+	EBoidNeighbourBackend Current = EBoidNeighbourBackend::Grid;
+};
+
+BOIDSYSTEMPLUGIN_API const TCHAR* GetBoidNeighbourBackendName(EBoidNeighbourBackend Backend);
@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidFrameArena.h"
+#include "BoidSpatialGrid.h"
+
+class ABoid;
+class FBoidNeighbourSearch;
+
+/**
+ * Every boid's neighbours for one frame in compressed sparse row form: boid i's neighbours are
+ * Indices[RowStart[i]] up to Indices[RowStart[i + 1]]. Indices are 16 bit while the flock fits,
+ * 32 bit otherwise. Both arrays live in the frame arena, so the whole flock costs two allocations.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidNeighbourLists
+{
+public:
+	// Find every boid within Range of each position, excluding itself.
+	void Build(const FBoidSpatialGrid& Grid, const TArray<FVector2D>& Positions, float Range, FBoidFrameArena& Arena);
+	// Same through any search backend built over Grid, which also measures the distances for MaxNeighbours.
+	void Build(const FBoidNeighbourSearch& Search, const FBoidSpatialGrid& Grid, const TArray<FVector2D>& Positions, float Range,
+		FBoidFrameArena& Arena);
+
+	// Keep at most this many neighbours per boid from the next Build, the nearest. 0 keeps all.
+	void SetMaxNeighbours(int32 Max)		{ MaxNeighbours = Max; }
+
+	// Getters
+	int32 GetNumBoids() const				{ return NumBoids; }
+	int32 GetNumNeighbours() const			{ return RowStart ? RowStart[NumBoids] : 0; }
+	int32 GetRowStart(int32 Boid) const		{ return RowStart[Boid]; }
+	int32 GetRowEnd(int32 Boid) const		{ return RowStart[Boid + 1]; }
+	int32 GetIndex(int32 Entry) const		{ return Indices16 ? Indices16[Entry] : Indices32[Entry]; }
+	bool IsWide() const						{ return Indices32 != nullptr; }
+	int64 GetAllocatedBytes() const;
+
+private:
+	// Query(Boid, Emit) calls Emit(Index, DistanceSquared) for each of the boid's neighbours. The distance is only
+	// read with MaxNeighbours set.
+	template <typename QueryType>
+	void BuildWith(int32 _NumBoids, FBoidFrameArena& Arena, const QueryType& Query);
+	template <typename IndexType, typename QueryType>
+	int32 Fill(const QueryType& Query, IndexType* Indices, int32 IndexCapacity);
+
+	int32 NumBoids = 0;
+	int32 Capacity = 0;
+	int32* RowStart = nullptr;
+	uint16* Indices16 = nullptr;
+	int32* Indices32 = nullptr;
+	// Last frame's total, used to size this frame's index array in one go.
+	int32 ExpectedNeighbours = 0;
+	int32 MaxNeighbours = 0;
+	TArray<int32> GatherScratch;
+	// Nearest neighbours of the row being filled under MaxNeighbours, sorted by distance.
+	TArray<int32> NearestIndices;
+	TArray<float> NearestDistances;
+};
+
+/**
+ * What a rule sees of one boid's neighbours. Just a view over the flock arrays and the CSR row,
+ * it holds no references to actors and costs nothing to create.
+ */
+class FBoidNeighbourhood
+{
+public:
+	FBoidNeighbourhood() = default;
+	FBoidNeighbourhood(const FBoidNeighbourLists& _Lists, const FBoidSpatialGrid& _Grid, const TArray<FVector2D>& _Positions,
+		const TArray<FVector2D>& _Velocities, const TArray<ABoid*>& _Boids, int32 _Self) :
+		Lists(&_Lists), Grid(&_Grid), Positions(_Positions.GetData()), Velocities(_Velocities.GetData()), Boids(_Boids.GetData()),
+		Self(_Self), Start(_Lists.GetRowStart(_Self)), NumNeighbours(_Lists.GetRowEnd(_Self) - Start)
+	{}
+
+	int32 Num() const							{ return NumNeighbours; }
+	// Slot in the flock arrays of the i'th neighbour.
+	int32 GetIndex(int32 i) const				{ return Lists->GetIndex(Start + i); }
+	// Shortest vector to the i'th neighbour, across the seam when the area wraps.
+	FVector2D GetOffset(int32 i) const			{ return Grid->GetOffset(Positions[Self], Positions[GetIndex(i)]); }
+	FVector2D GetVelocity(int32 i) const		{ return Velocities[GetIndex(i)]; }
+	ABoid* GetBoid(int32 i) const				{ return Boids[GetIndex(i)]; }
+
+private:
+	const FBoidNeighbourLists* Lists = nullptr;
+	const FBoidSpatialGrid* Grid = nullptr;
+	const FVector2D* Positions = nullptr;
+	const FVector2D* Velocities = nullptr;
+	ABoid* const* Boids = nullptr;
+	int32 Self = INDEX_NONE;
+	int32 Start = 0;
+	int32 NumNeighbours = 0;
+};
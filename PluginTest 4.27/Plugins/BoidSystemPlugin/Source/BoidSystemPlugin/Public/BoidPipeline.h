@@ -0,0 +1,363 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidSpatialGrid.h"
+
+/**
+ * Compile-time version of the built-in FBoidRules. Every kernel sees each neighbour once inside a
+ * single loop, so the whole rule set inlines into one function with no virtual calls.
+ * Rules that are only known at runtime still go through the virtual FBoidRules list.
+ *
+ * A kernel is a plain struct with a Weight and:
+ *	void Begin(const FBoidKernelSelf& Self);
+ *	void Accumulate(const FBoidKernelSelf& Self, FVector2D Offset, float DistanceSquared, FVector2D Velocity);
+ *	void AccumulateAggregate(const FBoidKernelSelf& Self, FVector2D OffsetSum, FVector2D VelocitySum, int32 Count);
+ *	FVector2D Finish(const FBoidKernelSelf& Self, int32 NumNeighbours) const; // Unweighted force.
+ *	float GetNearRange() const; // Neighbours closer than this must go through Accumulate one by one.
+ *
+ * AccumulateAggregate gets a whole group of far neighbours at once, for kernels that only need sums.
+ */
+
+// The boid being updated.
+struct FBoidKernelSelf
+{
+	FVector2D Position;
+	FVector2D Velocity;
+};
+
+// Median position of neighbours, same as CohesionRule.
+struct FCohesionKernel
+{
+	float Weight = 1;
+
+	FVector2D OffsetSum;
+
+	FORCEINLINE void Begin(const FBoidKernelSelf& Self)
+	{
+		OffsetSum = FVector2D::ZeroVector;
+	}
+
+	FORCEINLINE void Accumulate(const FBoidKernelSelf& Self, FVector2D Offset, float DistanceSquared, FVector2D Velocity)
+	{
+		OffsetSum += Offset;
+	}
+
+	FORCEINLINE void AccumulateAggregate(const FBoidKernelSelf& Self, FVector2D _OffsetSum, FVector2D VelocitySum, int32 Count)
+	{
+		OffsetSum += _OffsetSum;
+	}
+
+	FORCEINLINE float GetNearRange() const	{ return 0; }
+
+	FORCEINLINE FVector2D Finish(const FBoidKernelSelf& Self, int32 NumNeighbours) const
+	{
+		if (NumNeighbours == 0)
+		{
+			return FVector2D::ZeroVector;
+		}
+
+		FVector2D CohesionForce = OffsetSum / static_cast<float>(NumNeighbours);
+		CohesionForce.Normalize();
+		return CohesionForce;
+	}
+};
+
+// Keep distance from boids, same as SeparationRule.
+struct FSeparationKernel
+{
+	float Weight = 1;
+	float DesiredDistance = 10;
+	float Falloff = 1;
+
+	FVector2D ForceSum;
+	int32 CountCloseNeighbours;
+
+	FORCEINLINE void Begin(const FBoidKernelSelf& Self)
+	{
+		ForceSum = FVector2D::ZeroVector;
+		CountCloseNeighbours = 0;
+	}
+
+	FORCEINLINE void Accumulate(const FBoidKernelSelf& Self, FVector2D Offset, float DistanceSquared, FVector2D Velocity)
+	{
+		if (DistanceSquared < DesiredDistance * DesiredDistance && DistanceSquared > 0)
+		{
+			const float Distance = FMath::Sqrt(DistanceSquared);
+			ForceSum -= Offset * (FMath::Exp(-Distance * Falloff) / Distance);
+			CountCloseNeighbours++;
+		}
+	}
+
+	// Aggregates only ever come from beyond the near range, so out of reach.
+	FORCEINLINE void AccumulateAggregate(const FBoidKernelSelf& Self, FVector2D OffsetSum, FVector2D VelocitySum, int32 Count) {}
+
+	FORCEINLINE float GetNearRange() const	{ return DesiredDistance; }
+
+	FORCEINLINE FVector2D Finish(const FBoidKernelSelf& Self, int32 NumNeighbours) const
+	{
+		FVector2D SeparationForce = ForceSum;
+		if (CountCloseNeighbours > 0)
+		{
+			SeparationForce /= static_cast<float>(CountCloseNeighbours);
+		}
+
+		SeparationForce.Normalize();
+		return SeparationForce;
+	}
+};
+
+// Median direction of neighbours, same as AlignmentRule.
+struct FAlignmentKernel
+{
+	float Weight = 1;
+
+	FVector2D VelocitySum;
+
+	FORCEINLINE void Begin(const FBoidKernelSelf& Self)
+	{
+		VelocitySum = FVector2D::ZeroVector;
+	}
+
+	FORCEINLINE void Accumulate(const FBoidKernelSelf& Self, FVector2D Offset, float DistanceSquared, FVector2D Velocity)
+	{
+		VelocitySum += Velocity;
+	}
+
+	FORCEINLINE void AccumulateAggregate(const FBoidKernelSelf& Self, FVector2D OffsetSum, FVector2D _VelocitySum, int32 Count)
+	{
+		VelocitySum += _VelocitySum;
+	}
+
+	FORCEINLINE float GetNearRange() const	{ return 0; }
+
+	FORCEINLINE FVector2D Finish(const FBoidKernelSelf& Self, int32 NumNeighbours) const
+	{
+		FVector2D AverageVelocity = FVector2D::ZeroVector;
+		if (NumNeighbours > 0)
+		{
+			AverageVelocity = VelocitySum / static_cast<float>(NumNeighbours);
+		}
+
+		AverageVelocity.Normalize();
+		return AverageVelocity;
+	}
+};
+
+// Steer away from the walls, same as BoundedAreaRule. Does nothing per neighbour.
+struct FBoundsKernel
+{
+	float Weight = 1;
+	float Width = 100;
+	float Height = 100;
+	int32 DesiredDistance = 10;
+	bool IsBounded = true;
+
+	FORCEINLINE void Begin(const FBoidKernelSelf& Self) {}
+	FORCEINLINE void Accumulate(const FBoidKernelSelf& Self, FVector2D Offset, float DistanceSquared, FVector2D Velocity) {}
+	FORCEINLINE void AccumulateAggregate(const FBoidKernelSelf& Self, FVector2D OffsetSum, FVector2D VelocitySum, int32 Count) {}
+	FORCEINLINE float GetNearRange() const	{ return 0; }
+
+	FORCEINLINE FVector2D Finish(const FBoidKernelSelf& Self, int32 NumNeighbours) const
+	{
+		FVector2D BoundedForce = FVector2D::ZeroVector;
+
+		// A wrapped area is handled on the position, nothing to push against.
+		if (!IsBounded)
+		{
+			return BoundedForce;
+		}
+
+		const float Epsilon = 0.00001f;
+		const FVector2D Position = Self.Position;
+
+		if (Position.X < DesiredDistance)
+		{
+			BoundedForce.X += DesiredDistance / Position.X;
+		}
+		else if (Position.X > Width - DesiredDistance)
+		{
+			int32 Distance = Position.X - Width;
+			BoundedForce.X += DesiredDistance / (Distance + Epsilon);
+		}
+
+		if (Position.Y < DesiredDistance)
+		{
+			BoundedForce.Y += DesiredDistance / Position.Y;
+		}
+		else if (Position.Y > Height - DesiredDistance)
+		{
+			int32 Distance = Position.Y - Height;
+			BoundedForce.Y += DesiredDistance / (Distance + Epsilon);
+		}
+
+		return BoundedForce;
+	}
+};
+
+// The mouse, same as PointRepulsionRule: pushes boids away from Point, or pulls them to Distance from it. Off
+// unless one of the two is set, the controller sets them from the mouse buttons. Does nothing per neighbour.
+struct FPointKernel
+{
+	float Weight = 1;
+	FVector2D Point = FVector2D::ZeroVector;
+	float Distance = 15;
+	bool IsPushing = false;
+	bool IsPulling = false;
+
+	FORCEINLINE void Begin(const FBoidKernelSelf& Self) {}
+	FORCEINLINE void Accumulate(const FBoidKernelSelf& Self, FVector2D Offset, float DistanceSquared, FVector2D Velocity) {}
+	FORCEINLINE void AccumulateAggregate(const FBoidKernelSelf& Self, FVector2D OffsetSum, FVector2D VelocitySum, int32 Count) {}
+	FORCEINLINE float GetNearRange() const	{ return 0; }
+
+	FORCEINLINE FVector2D Finish(const FBoidKernelSelf& Self, int32 NumNeighbours) const
+	{
+		FVector2D PointForce = FVector2D::ZeroVector;
+		if (!IsPushing && !IsPulling)
+		{
+			return PointForce;
+		}
+
+		FVector2D Direction = Point - Self.Position;
+		const float PointDistance = Direction.Size();
+		if (PointDistance > Distance || IsPushing)
+		{
+			Direction.Normalize();
+			PointForce = Direction * 30;
+		}
+		else if (PointDistance < Distance)
+		{
+			Direction.Normalize();
+			PointForce = -Direction * 30;
+		}
+
+		return IsPushing ? -PointForce : PointForce;
+	}
+};
+
+template <typename KernelType>
+struct TBoidKernelTag {};
+
+template <typename... KernelTypes>
+class TBoidPipeline;
+
+// End of the chain.
+template <>
+class TBoidPipeline<>
+{
+protected:
+	FORCEINLINE void BeginAll(const FBoidKernelSelf& Self) {}
+	FORCEINLINE void AccumulateAll(const FBoidKernelSelf& Self, FVector2D Offset, float DistanceSquared, FVector2D Velocity) {}
+	FORCEINLINE void AccumulateAggregateAll(const FBoidKernelSelf& Self, FVector2D OffsetSum, FVector2D VelocitySum, int32 Count) {}
+	FORCEINLINE FVector2D FinishAll(const FBoidKernelSelf& Self, int32 NumNeighbours, FVector2D Sum) const { return Sum; }
+	FORCEINLINE float GetNearRangeAll() const { return 0; }
+	void GetKernel() = delete;
+};
+
+template <typename KernelType, typename... OtherKernelTypes>
+class TBoidPipeline<KernelType, OtherKernelTypes...> : private TBoidPipeline<OtherKernelTypes...>
+{
+	using Super = TBoidPipeline<OtherKernelTypes...>;
+	template <typename...> friend class TBoidPipeline;
+
+public:
+	// Access a kernel's parameters by type, e.g. Pipeline.Get<FCohesionKernel>().Weight.
+	template <typename T>
+	FORCEINLINE T& Get()					{ return GetKernel(TBoidKernelTag<T>()); }
+	template <typename T>
+	FORCEINLINE const T& Get() const		{ return GetKernel(TBoidKernelTag<T>()); }
+
+	/**
+	 * Summed weighted force of every kernel. Neighbourhood needs Num(), GetOffset(i) and GetVelocity(i),
+	 * like FBoidNeighbourhood. Runs on a stack copy so the shared parameters stay read-only while the
+	 * accumulators sit in registers.
+	 */
+	template <typename NeighbourhoodType>
+	FVector2D Evaluate(const FBoidKernelSelf& Self, const NeighbourhoodType& Neighbourhood) const
+	{
+		TBoidPipeline Local(*this);
+		Local.BeginAll(Self);
+
+		const int32 NumNeighbours = Neighbourhood.Num();
+		for (int32 i = 0; i < NumNeighbours; i++)
+		{
+			const FVector2D Offset = Neighbourhood.GetOffset(i);
+			Local.AccumulateAll(Self, Offset, Offset.SizeSquared(), Neighbourhood.GetVelocity(i));
+		}
+
+		return Local.FinishAll(Self, NumNeighbours, FVector2D::ZeroVector);
+	}
+
+	/**
+	 * Same as Evaluate but straight from the grid, with whole cells inside Range summed up instead of visited
+	 * boid by boid. Exact apart from rounding at Tolerance 0, see FBoidSpatialGrid::ForEachInRangeAggregated.
+	 * The grid needs BuildAggregates, and SelfIndex is left out.
+	 */
+	FVector2D EvaluateFarField(const FBoidKernelSelf& Self, int32 SelfIndex, const FBoidSpatialGrid& Grid, const TArray<FVector2D>& Velocities,
+		float Range, float Tolerance) const
+	{
+		TBoidPipeline Local(*this);
+		Local.BeginAll(Self);
+		int32 NumNeighbours = 0;
+
+		Grid.ForEachInRangeAggregated(Self.Position, Range, GetNearRangeAll(), Tolerance,
+			[&](int32 Index, FVector2D Offset)
+			{
+				if (Index != SelfIndex)
+				{
+					Local.AccumulateAll(Self, Offset, Offset.SizeSquared(), Velocities[Index]);
+					NumNeighbours++;
+				}
+			},
+			[&](int32 Count, FVector2D OffsetSum, FVector2D VelocitySum)
+			{
+				Local.AccumulateAggregateAll(Self, OffsetSum, VelocitySum, Count);
+				NumNeighbours += Count;
+			});
+
+		return Local.FinishAll(Self, NumNeighbours, FVector2D::ZeroVector);
+	}
+
+protected:
+	using Super::GetKernel;
+	FORCEINLINE KernelType& GetKernel(TBoidKernelTag<KernelType>)				{ return Kernel; }
+	FORCEINLINE const KernelType& GetKernel(TBoidKernelTag<KernelType>) const	{ return Kernel; }
+
+	FORCEINLINE void BeginAll(const FBoidKernelSelf& Self)
+	{
+		Kernel.Begin(Self);
+		Super::BeginAll(Self);
+	}
+
+	FORCEINLINE void AccumulateAll(const FBoidKernelSelf& Self, FVector2D Offset, float DistanceSquared, FVector2D Velocity)
+	{
+		Kernel.Accumulate(Self, Offset, DistanceSquared, Velocity);
+		Super::AccumulateAll(Self, Offset, DistanceSquared, Velocity);
+	}
+
+	FORCEINLINE void AccumulateAggregateAll(const FBoidKernelSelf& Self, FVector2D OffsetSum, FVector2D VelocitySum, int32 Count)
+	{
+		Kernel.AccumulateAggregate(Self, OffsetSum, VelocitySum, Count);
+		Super::AccumulateAggregateAll(Self, OffsetSum, VelocitySum, Count);
+	}
+
+	// Added left to right like the rules applied one by one, so the sum rounds the same way.
+	FORCEINLINE FVector2D FinishAll(const FBoidKernelSelf& Self, int32 NumNeighbours, FVector2D Sum) const
+	{
+		return Super::FinishAll(Self, NumNeighbours, Sum + Kernel.Weight * Kernel.Finish(Self, NumNeighbours));
+	}
+
+	FORCEINLINE float GetNearRangeAll() const
+	{
+		return FMath::Max(Kernel.GetNearRange(), Super::GetNearRangeAll());
+	}
+
+private:
+	KernelType Kernel;
+};
+
+// The built-in rules, in the same order the controller used to add them. The point kernel is last and adds
+// nothing while it is off, so flocks without a mouse step exactly as before it.
+using FDefaultBoidPipeline = TBoidPipeline<FCohesionKernel, FSeparationKernel, FAlignmentKernel, FBoundsKernel, FPointKernel>;
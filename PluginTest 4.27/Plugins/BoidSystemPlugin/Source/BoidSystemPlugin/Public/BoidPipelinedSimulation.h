@@ -0,0 +1,55 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/TaskGraphInterfaces.h"
+
+#include "BoidSettings.h"
+#include "BoidSimulation.h"
+#include "BoidWorkPartition.h"
+
+/**
+ * Runs the flock step stages as a chain of task graph tasks: neighbours, then rules split over the
+ * workers, then integration. The game thread launches step N+1 straight after collecting step N, then
+ * syncs the actors from step N while the tasks run. The game thread only waits if the step has not
+ * finished by the next frame. Each stage shows up as its own event in Insights.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidPipelinedSimulation
+{
+public:
+	FBoidPipelinedSimulation(const TArray<FBoidHandle>& _Handles, const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities,
+		const TArray<FBoidBody>& Bodies);
+	~FBoidPipelinedSimulation();
+
+	// Start the next step from the current state. Call Complete before launching again. With BalanceByCost
+	// the rules are split by grid cells weighted by neighbour count, otherwise into equal index slices.
+	void Launch(const FBoidSimulationParams& Params, float DeltaTime, bool BalanceByCost = true);
+
+	// Wait for the launched step, if any, and make its result the current state.
+	void Complete();
+
+	// Boids that left and joined the flock since it started. Between Complete and Launch.
+	void ApplyChanges(const FBoidFlockChanges& Changes);
+
+	// Current state, safe to read while a step is running. Compact and fixed point state is read from an unpacked copy.
+	const TArray<FVector2D>& GetPositions() const		{ return HasFloatState() ? Simulation.GetPositions() : Unpacked.Positions; }
+	const TArray<FVector2D>& GetVelocities() const		{ return HasFloatState() ? Simulation.GetVelocities() : Unpacked.Velocities; }
+	// Boid of each slot in the state.
+	const TArray<FBoidHandle>& GetHandles() const		{ return Handles; }
+	// How the rules stage was split, and how busy each worker was. Only touch it between Complete and Launch.
+	FBoidWorkPartition& GetPartition()					{ return Partition; }
+
+private:
+	// Bring the unpacked copy up to the current compact state.
+	void UpdateUnpacked();
+	bool HasFloatState() const							{ return !Simulation.IsCompactState() && !Simulation.IsFixedPointState(); }
+
+	FBoidSimulation Simulation;
+	FBoidFlockState Unpacked;
+	TArray<FBoidHandle> Handles;
+	FBoidWorkPartition Partition;
+
+	// Last stage of the launched step, null when nothing is in flight.
+	FGraphEventRef StepDone;
+};
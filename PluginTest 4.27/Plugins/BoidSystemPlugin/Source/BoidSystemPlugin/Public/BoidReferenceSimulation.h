@@ -0,0 +1,62 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidSimulation.h"
+
+/**
+ * The flock step written out as plainly as possible: every boid tests every other, and the rules and
+ * integration follow FBoidRules and ABoid::Tick. Every boid sees the state from the start of the step,
+ * where the original actors moved one at a time in place and jumped across the edges rather than
+ * wrapping, so this is the synchronous step the paths implement, not a replay of the original flock.
+ * Deliberately slow and shares no code with the simulation, so optimisations can be checked against it.
+ * Only the built-in rules, with their parameters read from the params' pipeline.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidReferenceSimulation
+{
+public:
+	void Init(const FBoidSimulationParams& _Params, const FBoidBody& _Body, const TArray<FVector2D>& _Positions, const TArray<FVector2D>& _Velocities);
+
+	// Every boid sees the state from the start of the step.
+	void Step(float DeltaTime);
+
+	// Getters
+	const TArray<FVector2D>& GetPositions() const		{ return Positions; }
+	const TArray<FVector2D>& GetVelocities() const		{ return Velocities; }
+
+private:
+	FVector2D GetOffset(FVector2D From, FVector2D To) const;
+	FVector2D ComputeAcceleration(int32 Index) const;
+
+	FBoidSimulationParams Params;
+	FBoidBody Body;
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	TArray<FVector2D> Accelerations;
+	mutable TArray<int32> NeighbourScratch;
+};
+
+/**
+ * A recorded run of the reference simulation: the scenario, its starting state and the state every
+ * SampleInterval frames after. Saved next to the tests so changes to the rules show up as a diff
+ * against what the flock used to do, not just against the reference as it is now.
+ */
+struct BOIDSYSTEMPLUGIN_API FBoidGoldenTrajectory
+{
+	FBoidSimulationParams Params;
+	FBoidBody Body;
+	float DeltaTime = 1.0f / 60.0f;
+	int32 NumFrames = 0;
+	int32 SampleInterval = 1;
+	// Samples[0] is the starting state, sample i is the state after i * SampleInterval frames.
+	TArray<TArray<FVector2D>> SamplePositions;
+	TArray<TArray<FVector2D>> SampleVelocities;
+
+	// Run the reference from the given state and keep the samples.
+	void Record(const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities);
+
+	// False if the data is not a trajectory of this version.
+	bool Serialize(FArchive& Ar);
+};
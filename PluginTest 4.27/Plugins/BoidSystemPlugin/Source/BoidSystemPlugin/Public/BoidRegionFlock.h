@@ -0,0 +1,81 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+
+#include "BoidRegionWorld.h"
+
+#include "BoidRegionFlock.generated.h"
+
+class UInstancedStaticMeshComponent;
+
+/**
+ * Runs a FBoidRegionWorld in a level. The regions around every player's camera are awake, the rest of the
+ * world sleeps in the cache. The awake boids are drawn as instances of one mesh, there are no boid actors.
+ * Steps on the server or in standalone only, clients see nothing of it.
+ */
+UCLASS()
+class BOIDSYSTEMPLUGIN_API ABoidRegionFlock : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	ABoidRegionFlock();
+
+	virtual void Tick(float DeltaTime) override;
+
+	// Getters
+	const FBoidRegionWorld& GetRegionWorld() const		{ return RegionWorld; }
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+private:
+	// Camera locations of every player, where the regions stay awake.
+	void GatherFocusPoints();
+	// One instance per awake boid, facing the way it flies.
+	void DrawAwakeBoids();
+
+	UPROPERTY(VisibleAnywhere, Category = "Boids")
+	UInstancedStaticMeshComponent* BoidInstances = nullptr;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Spawning", meta = (ClampMin = "0"))
+		int32 NumBoids = 10000;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Spawning")
+		int32 Seed = 1234;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Spawning", meta = (ClampMin = "0"))
+		float Speed = 30.0f;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Weights")
+		float SeparationWeight = 3.0f;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Weights")
+		float CohesionWeight = 0.15f;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Weights")
+		float AlignmentWeight = 2.0f;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Weights", meta = (ClampMin = "0"))
+		float VisualRange = 10.0f;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Regions", meta = (ClampMin = "1"))
+		FIntPoint NumRegions = FIntPoint(16, 16);
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Regions", meta = (ClampMin = "1"))
+		float RegionSize = 100.0f;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Regions", meta = (ClampMin = "0"))
+		float ActiveRadius = 150.0f;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Regions", meta = (ClampMin = "0"))
+		float SlowRadius = 300.0f;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Regions", meta = (ClampMin = "1"))
+		int32 SlowInterval = 4;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "Regions", meta = (ClampMin = "0"))
+		float SleepMargin = 50.0f;
+	// Scale of each boid's mesh.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"), Category = "BoidDebug", meta = (ClampMin = "0"))
+		float BoidScale = 0.01f;
+
+	FBoidRegionWorld RegionWorld;
+	bool IsRunning = false;
+	TArray<FVector2D> FocusPoints;
+	TArray<FVector2D> AwakePositions;
+	TArray<FVector2D> AwakeVelocities;
+	TArray<FTransform> InstanceTransforms;
+};
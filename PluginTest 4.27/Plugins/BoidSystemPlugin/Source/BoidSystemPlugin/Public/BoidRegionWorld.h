@@ -0,0 +1,164 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidSimulation.h"
+
+// How often an awake region steps, by distance from the nearest focus point.
+enum class EBoidRegionTier : uint8
+{
+	Dormant,
+	Slow,
+	Active,
+};
+
+struct FBoidRegionWorldParams
+{
+	// Rules and search settings for every region. Area, IsWrapped and the bounds kernel are set per region.
+	FBoidSimulationParams Simulation;
+	FBoidBody Body;
+	// Regions across the world on each axis. The world wraps at its edges.
+	FIntPoint NumRegions = FIntPoint(16, 16);
+	float RegionSize = 100;
+	// Regions closer than this to a focus point step every frame.
+	float ActiveRadius = 150;
+	// Out to this they step every SlowInterval frames, one longer step each time. Past it they sleep.
+	float SlowRadius = 300;
+	int32 SlowInterval = 4;
+	// How much further than SlowRadius an awake region has to be before it sleeps, so regions on the edge don't flicker.
+	float SleepMargin = 50;
+	// Dormant regions' flocks are saved here, one file per region.
+	FString CacheDirectory;
+};
+
+/**
+ * A flock spread over a world much larger than one simulation's area. The world is cut into square
+ * regions and only those near a focus point, the camera or the players, are awake. Each awake region
+ * steps its own FBoidSimulation over its boids plus a halo of ghosts, the boids of the neighbouring awake
+ * regions within visual range of the border, so flocks carry on across borders. Regions step in parallel.
+ *
+ * Boids that cross a border are handed to the region they end up in after every step. If that region is
+ * asleep they are added to its cache. A region going to sleep saves its flock packed to 16 bits per value,
+ * see FBoidQuantisation, to a cache file and frees its memory; waking up loads it back. A region whose
+ * cache can't be written stays awake rather than lose its boids. Positions are kept relative to their
+ * region, so precision does not depend on where in the world a region is.
+ *
+ * Memory and time per frame follow the boids in awake regions. A dormant region only costs a map entry.
+ * ABoidRegionFlock runs one in a level, around the players' cameras.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidRegionWorld
+{
+public:
+	~FBoidRegionWorld();
+
+	// Starts an empty world. Cache files from before are removed as their regions are.
+	void Init(const FBoidRegionWorldParams& _Params);
+	// Forget every boid and delete the cache files.
+	void Reset();
+
+	// Add a boid at a world position, to its region whether awake or not. Boids added to a dormant region are
+	// packed into its cache by the next UpdateRegions or Step.
+	void AddBoid(FVector2D Position, FVector2D Velocity);
+
+	// Wake the regions near the focus points, world positions, and put those far from all of them to sleep.
+	void UpdateRegions(const TArray<FVector2D>& FocusPoints);
+	// Step the awake regions that are due and hand boids over borders.
+	void Step(float DeltaTime);
+
+	// World positions and velocities of every boid in an awake region, for drawing.
+	void GetAwakeBoids(TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities) const;
+	// False if the region is asleep or empty.
+	bool GetRegionBoids(FIntPoint Key, TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities) const;
+	EBoidRegionTier GetRegionTier(FIntPoint Key) const;
+	// Region a world position lies in.
+	FIntPoint GetRegionKey(FVector2D Position) const;
+
+	// Getters
+	int32 GetNumAwakeRegions() const					{ return AwakeKeys.Num(); }
+	int32 GetNumAwakeBoids() const;
+	int32 GetNumDormantBoids() const;
+	int32 GetNumBoids() const							{ return GetNumAwakeBoids() + GetNumDormantBoids(); }
+	// Boids stepped by the last Step, ghosts not counted.
+	int32 GetNumSteppedBoids() const					{ return NumSteppedBoids; }
+	// Boids moved to another region by the last Step.
+	int32 GetNumHandOffs() const						{ return NumHandOffs; }
+	// Of the cache files written so far that still exist.
+	int64 GetCacheBytes() const							{ return CacheBytes; }
+	// Heap bytes held by the awake regions' boids and simulations, not counting the grids and neighbour lists.
+	int64 GetAwakeBytes() const;
+
+private:
+	struct FRegion
+	{
+		EBoidRegionTier Tier = EBoidRegionTier::Dormant;
+		// Awake: the flock. Dormant: boids that arrived since the last UpdateRegions or Step, or that could not be
+		// cached. Relative to the region's corner.
+		TArray<FVector2D> Positions;
+		TArray<FVector2D> Velocities;
+		// Boids in the cache file while dormant.
+		int32 NumCached = 0;
+		int64 CachedBytes = 0;
+		float PendingTime = 0;
+		// Only while awake.
+		TUniquePtr<FBoidSimulation> Simulation;
+		// Inputs of this step: own boids first, then ghosts.
+		TArray<FVector2D> StepPositions;
+		TArray<FVector2D> StepVelocities;
+		TArray<FBoidBody> StepBodies;
+		FBoidFlockState StepState;
+	};
+
+	// A boid leaving a region, relative to the region it goes to.
+	struct FBoidHandOff
+	{
+		FIntPoint Key;
+		FVector2D Position;
+		FVector2D Velocity;
+	};
+
+	FIntPoint WrapKey(FIntPoint Key) const;
+	// Shortest distance from a world position to a region, across the world's wrap.
+	float GetDistanceToRegion(FVector2D Position, FIntPoint Key) const;
+	FString GetCachePath(FIntPoint Key) const;
+
+	void Wake(FIntPoint Key, FRegion& Region, EBoidRegionTier Tier);
+	// False if the flock could not be cached, the region stays awake then.
+	bool Sleep(FIntPoint Key, FRegion& Region);
+	// Append the region's Positions and Velocities to its cache file and let go of them. False if the file
+	// could not be written, they are kept then.
+	bool SaveCache(FIntPoint Key, FRegion& Region);
+	bool LoadCache(FIntPoint Key, FRegion& Region);
+	// Pack the boids that arrived in dormant regions into their caches.
+	void CacheArrivals();
+
+	// Own boids and ghosts from the awake neighbours into the region's step inputs, offset by the halo.
+	void GatherStepInputs(FIntPoint Key, FRegion& Region) const;
+	void StepRegion(FRegion& Region, float DeltaTime) const;
+	// Take the region's own boids back from its step, collecting those that left.
+	void FinishRegionStep(FIntPoint Key, FRegion& Region, TArray<FBoidHandOff>& OutHandOffs) const;
+
+	FBoidRegionWorldParams Params;
+	// Regions awake or holding boids, the rest of the world has no entry.
+	TMap<FIntPoint, FRegion> Regions;
+	TArray<FIntPoint> AwakeKeys;
+	// Dormant regions holding boids that are not in their cache yet.
+	TSet<FIntPoint> ArrivalKeys;
+	FBoidQuantisation CacheQuantisation;
+	FBoidSimulationParams RegionParams;
+	// Width of the ghost band around each region, its visual range.
+	float Halo = 0;
+	uint32 FrameIndex = 0;
+
+	int32 NumSteppedBoids = 0;
+	int32 NumHandOffs = 0;
+	int64 CacheBytes = 0;
+
+	// Reused every frame.
+	TMap<FIntPoint, EBoidRegionTier> WantedTiers;
+	TArray<FIntPoint> SteppingKeys;
+	TArray<FRegion*> SteppingRegions;
+	TArray<FBoidHandOff> HandOffs;
+	TArray<uint8> CacheScratch;
+};
@@ -0,0 +1,130 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// One boid as sent over the network: position in steps of the precision, heading in 256ths of a turn.
+struct FBoidReplicatedBoid
+{
+	int32 Id;
+	FIntPoint Position;
+	uint8 Heading;
+};
+
+// The relevant part of the flock at one moment, as one connection sees it.
+struct BOIDSYSTEMPLUGIN_API FBoidReplicationSnapshot
+{
+	// Counts up from 1, 0 means no snapshot.
+	uint32 Sequence = 0;
+	// Server time it was taken at.
+	float Time = 0;
+	// Sorted by Id.
+	TArray<FBoidReplicatedBoid> Boids;
+
+	// Null if the boid is not in this snapshot.
+	const FBoidReplicatedBoid* Find(int32 Id) const;
+};
+
+struct FBoidReplicationSettings
+{
+	// World units per position step.
+	float Precision = 0.05f;
+	// Only boids this close to the viewer are sent, 0 sends the whole flock.
+	float RelevancyRadius = 0;
+	// Most boids per snapshot, the nearest ones win. 0 sends every relevant boid.
+	int32 MaxBoids = 0;
+	// Most bytes per encoded snapshot, the farthest boids are left out until it fits. 0 has no limit.
+	int32 MaxBytes = 0;
+	// Area the flock moves in, so interpolation can take the short way across a wrapped seam.
+	FVector2D Area = { 100, 100 };
+	bool IsWrapped = true;
+};
+
+// A replicated boid unpacked, as the client shows it.
+struct FBoidReplicatedState
+{
+	int32 Id;
+	FVector2D Position;
+	// Unit vector.
+	FVector2D Heading;
+};
+
+/**
+ * Snapshots are written as a delta against a baseline both sides have, usually the newest one the
+ * client acknowledged. Boids are sorted by id, so ids are sent as gaps, or not at all when the snapshot
+ * has the same boids as the baseline. Boids also in the baseline send how far they moved and turned,
+ * others their whole state. Every number is variable length, so the few steps a boid moves between
+ * snapshots take a byte or two.
+ */
+BOIDSYSTEMPLUGIN_API void EncodeBoidSnapshot(const FBoidReplicationSnapshot& Snapshot, const FBoidReplicationSnapshot* Baseline, TArray<uint8>& OutBytes);
+
+// False if the data is broken or encoded against a baseline FindBaseline(Sequence) does not have.
+BOIDSYSTEMPLUGIN_API bool DecodeBoidSnapshot(const TArray<uint8>& Bytes, TFunctionRef<const FBoidReplicationSnapshot*(uint32)> FindBaseline,
+	FBoidReplicationSnapshot& OutSnapshot);
+
+/**
+ * Server side of one connection: quantises and culls the flock into snapshots and remembers the recent
+ * ones, so the next can be encoded against whichever the client acknowledged last. Until the client
+ * acknowledges one, snapshots go out whole.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidSnapshotSender
+{
+public:
+	// Encode the next snapshot of the flock, Ids are the boids' stable ids. Never more than Settings.MaxBytes.
+	void BuildSnapshot(const TArray<int32>& Ids, const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities, float Time,
+		TArray<uint8>& OutBytes);
+
+	// The client has this snapshot, it can be a baseline from now on.
+	void Acknowledge(uint32 Sequence);
+
+	void SetViewPosition(FVector2D _ViewPosition)	{ ViewPosition = _ViewPosition; }
+
+	// Getters
+	uint32 GetAcknowledged() const					{ return Acknowledged; }
+	int32 GetNumSent() const						{ return LastNumBoids; }
+
+	FBoidReplicationSettings Settings;
+
+private:
+	const FBoidReplicationSnapshot* FindSent(uint32 Sequence) const;
+
+	// Recent snapshots, oldest first.
+	TArray<FBoidReplicationSnapshot> Sent;
+	uint32 NextSequence = 1;
+	uint32 Acknowledged = 0;
+	FVector2D ViewPosition = FVector2D::ZeroVector;
+	int32 LastNumBoids = 0;
+	TArray<int32> Relevant;
+	TArray<float> DistancesSquared;
+};
+
+/**
+ * Client side of the connection: decodes snapshots and shows the flock a little in the past, interpolated
+ * between the two snapshots around that time, so it moves smoothly whatever the send rate and jitter.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidSnapshotReceiver
+{
+public:
+	// Decode a snapshot. False if it could not be, or is older than the newest one, so not worth acknowledging.
+	bool Receive(const TArray<uint8>& Bytes, uint32& OutSequence);
+
+	// Every boid's state at a server time, boids that left the last snapshot are gone.
+	void Sample(float Time, TArray<FBoidReplicatedState>& OutStates) const;
+
+	// Server time of the newest snapshot, 0 before the first.
+	float GetLatestTime() const;
+
+	FBoidReplicationSettings Settings;
+
+private:
+	FVector2D Unpack(FIntPoint Position) const;
+	static FVector2D UnpackHeading(uint8 Heading);
+
+	// Recent snapshots, oldest first.
+	TArray<FBoidReplicationSnapshot> Received;
+};
+
+// Steps of a position, and 256ths of a turn of a velocity.
+BOIDSYSTEMPLUGIN_API FIntPoint QuantiseBoidPosition(FVector2D Position, float Precision);
+BOIDSYSTEMPLUGIN_API uint8 QuantiseBoidHeading(FVector2D Velocity);
@@ -0,0 +1,62 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+
+#include "BoidRuleSet.generated.h"
+
+UENUM(BlueprintType)
+enum class EBoidRuleType : uint8
+{
+	Cohesion,
+	Separation,
+	Alignment,
+	Bounds,
+	PointRepulsion
+};
+
+// One rule of a rule set. Rules missing from the set are turned off.
+USTRUCT(BlueprintType)
+struct BOIDSYSTEMPLUGIN_API FBoidRuleDesc
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Rule")
+		EBoidRuleType Type = EBoidRuleType::Cohesion;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Rule")
+		float Weight = 1.0f;
+	// Separation distance, distance kept from the walls or distance held from the mouse. Unused by cohesion and alignment.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Rule")
+		float Radius = 10.0f;
+	// How fast separation fades with distance, the force scales by Exp(-Distance * Falloff).
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Rule")
+		float Falloff = 1.0f;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Rule")
+		bool IsEnabled = true;
+};
+
+/**
+ * Data driven rule set a flock can reference instead of the weights on the controller.
+ * The controller reads it into the rules it shares with every boid each frame, so edits
+ * made while playing show up straight away without rebuilding anything per boid.
+ */
+UCLASS(BlueprintType)
+class BOIDSYSTEMPLUGIN_API UBoidRuleSet : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Rules")
+		TArray<FBoidRuleDesc> Rules;
+
+	// Null if the set has no rule of that type.
+	const FBoidRuleDesc* FindRule(EBoidRuleType Type) const;
+
+	UFUNCTION(BlueprintCallable, Category = "Rules")
+		void SetRuleWeight(EBoidRuleType Type, float Weight);
+};
+
+// Null if RuleDescs has no rule of that type.
+BOIDSYSTEMPLUGIN_API const FBoidRuleDesc* FindBoidRuleDesc(const TArray<FBoidRuleDesc>& RuleDescs, EBoidRuleType Type);
@@ -1,14 +1,104 @@
 ﻿#pragma once
 
+#include "BoidFrameArena.h"
+#include "BoidGridTuner.h"
+#include "BoidMorton.h"
+#include "BoidNeighbourSearch.h"
+#include "BoidNeighbours.h"
+#include "BoidSpatialGrid.h"
 
 class ABoid;
 
+// Stable reference to a boid, stays valid when the flock arrays get reordered.
+struct FBoidHandle
+{
+	int32 Id = INDEX_NONE;
+
+	bool IsValid() const								{ return Id != INDEX_NONE; }
+	bool operator==(const FBoidHandle& Other) const		{ return Id == Other.Id; }
+	bool operator!=(const FBoidHandle& Other) const		{ return Id != Other.Id; }
+	friend uint32 GetTypeHash(const FBoidHandle& Handle)	{ return GetTypeHash(Handle.Id); }
+};
+
 class BOIDSYSTEMPLUGIN_API BoidSettings
 {
 public:
 	BoidSettings();
 	~BoidSettings();
+
+	// Add a boid at the end of the flock arrays.
+	FBoidHandle AddBoid(ABoid* Boid);
+	// Its slot is cleared straight away and compacted out on the next RebuildGrid, so indices stay valid this frame.
+	void RemoveBoid(FBoidHandle Handle);
+	// Forget every boid and handle.
+	void Reset();
+
+	// Current slot of a boid in ListOfBoids, Positions and Velocities. INDEX_NONE if the handle is stale.
+	int32 GetIndex(FBoidHandle Handle) const;
+	FBoidHandle GetHandle(int32 Index) const			{ return FBoidHandle{ IndexToHandle[Index] }; }
+	ABoid* GetBoid(FBoidHandle Handle) const;
+	// Bumped whenever a boid joins or leaves the flock.
+	uint32 GetRevision() const							{ return Revision; }
+
+	// Log boids joining and leaving from now on, for a simulation running on its own copy of the flock. Clears the log.
+	void SetTrackChanges(bool Track);
+	// Boids that joined and left since the last call, a boid that did both in between is in neither. Apply the removed
+	// ones first: once a slot is compacted its handle id is handed out again, so an id can be in both for two boids.
+	void TakeChanges(TArray<FBoidHandle>& OutAdded, TArray<FBoidHandle>& OutRemoved);
+
+	/**
+	 * Snapshot every boid into the flock arrays and the grid, called once per frame before the boids tick.
+	 * With Reorder set the arrays are first sorted along a Z-order curve over the grid cells, so boids
+	 * close in space are close in memory. Handles are remapped, indices from earlier frames are not.
+	 */
+	void RebuildGrid(FVector2D Area, float VisualRange, bool IsWrapped, bool Reorder = false);
+
+	// Fill the neighbour lists for every boid with the backend boids.NeighbourBackend picks, after RebuildGrid.
+	void BuildNeighbours(float VisualRange);
+
+	// Neighbours of the boid in a slot, empty for boids added since the lists were built.
+	FBoidNeighbourhood GetNeighbourhood(int32 Index) const;
 	
 	TArray<ABoid*> ListOfBoids;
 	bool DebugOn = true;
-};
\ No newline at end of file
+	// Copy each boid's neighbours into its ListOfBoidsInVision. Off, the simulation keeps no object references per neighbour.
+	bool TrackNeighbourActors = false;
+	// Let the grid tuner pick the cell size and split crowded cells, otherwise cells are VisualRange wide.
+	bool AutoTuneGrid = true;
+	// Most neighbours kept per boid, 0 keeps all.
+	int32 MaxNeighbours = 0;
+
+	// Start of frame state, same order as ListOfBoids. Grid indices are indices into these.
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	FBoidSpatialGrid Grid;
+	FBoidGridTuner GridTuner;
+	FBoidNeighbourLists Neighbours;
+	FBoidNeighbourBackends NeighbourBackends;
+	// Reset every frame, backs the neighbour lists.
+	FBoidFrameArena FrameArena;
+
+private:
+	void CompactRemovedBoids();
+	void ReorderByMorton();
+
+	TArray<int32> IndexToHandle;
+	TArray<int32> HandleToIndex;
+	TArray<int32> FreeHandles;
+	int32 NumRemoved = 0;
+	uint32 Revision = 0;
+
+	bool TrackChanges = false;
+	TArray<FBoidHandle> AddedSinceTaken;
+	TArray<FBoidHandle> RemovedSinceTaken;
+	// Slot in AddedSinceTaken by handle id, INDEX_NONE if not in it.
+	TArray<int32> AddedSlots;
+
+	FBoidRadixSorter Sorter;
+	TArray<uint32> MortonKeys;
+	TArray<ABoid*> ScratchBoids;
+	TArray<int32> ScratchHandles;
+};
+
+// Shared by every boid, defined in Boid.cpp.
+extern BOIDSYSTEMPLUGIN_API BoidSettings Settings;
\ No newline at end of file
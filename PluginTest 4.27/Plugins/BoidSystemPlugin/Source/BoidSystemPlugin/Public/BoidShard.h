@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidSimulation.h"
+
+/**
+ * One strip of a flock split over several processes, see FBoidShardCoordinator. A wrapped area is cut into
+ * NumShards strips along X, and each shard owns the boids in its strip. Before every step a shard sends each
+ * neighbour the boids that crossed into its strip and, as ghosts, its own boids within visual range of their
+ * shared edge. It then steps its boids with the ghosts around them and throws the ghosts away.
+ *
+ * Each shard's FBoidSimulation runs unwrapped over the strip plus a ghost band on every side; boids near the
+ * top and bottom are ghosted to the other edge by the shard itself, so the flock still wraps both ways.
+ * Strips must be at least the visual range wide, and no boid may cross a whole strip in one step.
+ *
+ * Nothing here knows about sockets: exchange messages are byte arrays, so shards can also be stepped side by
+ * side in one process.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidShard
+{
+public:
+	// The flock params must be wrapped, the bounds kernel is switched off.
+	void Init(const FBoidSimulationParams& _Params, const FBoidBody& _Body, int32 _Index, int32 _NumShards);
+
+	// Boids are owned by the strip their X falls in, the rest are left out. Ids must be unique over all shards.
+	void AddBoids(const TArray<FVector2D>& _Positions, const TArray<FVector2D>& _Velocities, uint32 FirstId);
+
+	// Hands on the boids that left the strip in the last step, with ghosts for the shards on either side.
+	void WriteExchange(TArray<uint8>& OutToLeft, TArray<uint8>& OutToRight);
+	// The neighbours' messages for this step. False if either is not a valid exchange message for it.
+	bool ReadExchange(const TArray<uint8>& FromLeft, const TArray<uint8>& FromRight);
+	// Only after ReadExchange.
+	void Step(float DeltaTime);
+
+	// Ids, positions and velocities of the owned boids, for the coordinator to merge. Between a step and the
+	// next exchange that includes those that just left the strip.
+	void WriteBoids(TArray<uint8>& OutMessage) const;
+	static bool ReadBoids(const TArray<uint8>& Message, uint64& OutStepIndex, TArray<uint32>& OutIds,
+		TArray<FVector2D>& OutPositions, TArray<FVector2D>& OutVelocities);
+
+	// Strips along X for a flock, fewer than asked for if they would be narrower than its visual range.
+	static int32 GetMaxShards(const FBoidSimulationParams& Params);
+
+	// Getters
+	int32 GetIndex() const								{ return Index; }
+	int32 GetNum() const								{ return Ids.Num(); }
+	// Ghosts in the last step, from both sides and from the wrap along Y.
+	int32 GetNumGhosts() const							{ return NumGhosts; }
+	uint64 GetStepIndex() const							{ return StepIndex; }
+	float GetMinX() const								{ return MinX; }
+	float GetMaxX() const								{ return MaxX; }
+	const TArray<uint32>& GetIds() const				{ return Ids; }
+	const TArray<FVector2D>& GetPositions() const		{ return Positions; }
+	const TArray<FVector2D>& GetVelocities() const		{ return Velocities; }
+
+private:
+	// X offset from an edge, shortest way round the wrap.
+	float GetEdgeOffset(float X, float Edge) const;
+	void WriteSide(TArray<uint8>& OutMessage, int32 Side);
+	bool ReadSide(const TArray<uint8>& Message, int32 Side);
+	// A boid into the step inputs in strip local coordinates. Side is where it lies: 0 left, 1 right, 2 in the strip.
+	void AddStepBoid(FVector2D Position, FVector2D Velocity, int32 Side);
+	// Copies of the step inputs near the top and bottom over the wrap along Y.
+	void AddWrapGhosts();
+
+	FBoidSimulationParams Params;
+	FBoidSimulationParams LocalParams;
+	FBoidBody Body;
+	int32 Index = 0;
+	int32 NumShards = 1;
+	float MinX = 0;
+	float MaxX = 0;
+	float Halo = 0;
+	uint64 StepIndex = 0;
+	int32 NumGhosts = 0;
+
+	// Owned boids, in world positions.
+	TArray<uint32> Ids;
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+
+	// Boids handed on at the last exchange, by side: 0 left, 1 right. Kept here as ghosts for the next step.
+	TArray<uint32> LeavingIds[2];
+	TArray<FVector2D> LeavingPositions[2];
+	TArray<FVector2D> LeavingVelocities[2];
+
+	// Ghosts from the neighbours for the next step, by the side they came from.
+	TArray<FVector2D> GhostPositions[2];
+	TArray<FVector2D> GhostVelocities[2];
+	// Reused for the messages going out.
+	TArray<FVector2D> SendPositions;
+	TArray<FVector2D> SendVelocities;
+
+	// Step inputs in strip local coordinates: owned boids first, then ghosts.
+	FBoidSimulation Simulation;
+	TArray<FVector2D> StepPositions;
+	TArray<FVector2D> StepVelocities;
+	TArray<FBoidBody> StepBodies;
+	FBoidFlockState StepState;
+};
@@ -0,0 +1,26 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+
+#include "BoidShardCommandlet.generated.h"
+
+/**
+ * Runs a batch scenario split over several worker processes, see FBoidShardCoordinator:
+ *   UE4Editor-Cmd <Project>.uproject -run=BoidShard -Shards=4 -Boids=100000 -Area=3000 -Seconds=60
+ * Takes BoidBatch's switches except -Bounded, the flock must wrap, plus -Shards= and -Port=, 7820 unless
+ * given. -Sweep runs it over 1, 2, 4... up to -Shards processes and logs the speedup and scaling
+ * efficiency of each against one process. Workers are started with -Worker -Index= by the coordinator.
+ */
+UCLASS()
+class BOIDSYSTEMPLUGIN_API UBoidShardCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UBoidShardCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidBatchSimulation.h"
+
+class FSocket;
+
+/**
+ * A TCP connection carrying whole messages, each sent with its length in front. Sockets are non-blocking:
+ * Pump moves whatever the socket takes or has, so both ends of a link can send before either receives
+ * without filling each other's buffers into a deadlock.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidShardLink
+{
+public:
+	~FBoidShardLink();
+
+	// Listen on a loopback port. Null if it could not be bound.
+	static FSocket* Listen(int32 Port, int32 MaxPending);
+	static void CloseSocket(FSocket* Socket);
+
+	// Retries until the port is listening or the time runs out.
+	bool Connect(int32 Port, double TimeoutSeconds);
+	bool Accept(FSocket* Listener, double TimeoutSeconds);
+	void Close();
+
+	// Queue a message, it goes out as Pump gets to it.
+	void Send(const TArray<uint8>& Message);
+	// Send and receive what can be without waiting. False once the connection is lost.
+	bool Pump();
+	// The oldest whole message received, false if there is none yet. A length over the limit closes the link.
+	bool Receive(TArray<uint8>& OutMessage);
+	// Block until there is more to read, room to send what is queued, or the time runs out.
+	void Wait(double TimeoutSeconds);
+
+	// Getters
+	bool IsConnected() const							{ return Socket != nullptr; }
+	bool IsSent() const									{ return Outgoing.Num() == 0; }
+
+private:
+	void SetupSocket();
+
+	FSocket* Socket = nullptr;
+	TArray<uint8> Outgoing;
+	int32 SendOffset = 0;
+	TArray<uint8> Incoming;
+};
+
+// Timings of one worker over a whole run.
+struct FBoidShardWorkerReport
+{
+	int32 Index = 0;
+	// Boids owned at the end.
+	int32 NumBoids = 0;
+	int32 MaxGhosts = 0;
+	double StepSeconds = 0;
+	// Spent waiting on the neighbours' messages, with sending the coordinator its frames.
+	double ExchangeSeconds = 0;
+};
+
+struct FBoidShardResult
+{
+	int32 NumShards = 0;
+	int32 NumSteps = 0;
+	int32 NumFrames = 0;
+	int64 FileBytes = 0;
+	double SimulatedSeconds = 0;
+	double WallSeconds = 0;
+	TArray<FBoidShardWorkerReport> Workers;
+
+	double GetSimulatedSecondsPerWallSecond() const		{ return WallSeconds > 0 ? SimulatedSeconds / WallSeconds : 0; }
+};
+
+/**
+ * Runs a batch scenario split over NumShards worker processes, see FBoidShard, and merges what they record
+ * into one trajectory file as FBoidBatchSimulation would write it. Workers are started as copies of this
+ * executable with the commandlet's switches, all on this machine: the coordinator listens on Port and
+ * worker i on Port + 1 + i, each talking to the next over loopback TCP.
+ *
+ * Each worker spawns the whole seeded flock and keeps its strip, so only the scenario's switches are passed.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidShardCoordinator
+{
+public:
+	// False if a worker could not be started, lost or the file could not be written.
+	static bool Run(const FBoidBatchScenario& Scenario, int32 NumShards, int32 Port, const FString& WorkerSwitches,
+		const FString& Path, FBoidShardResult& OutResult);
+};
+
+// One worker process: steps its strip, swaps messages with its neighbours and sends its boids to the coordinator.
+class BOIDSYSTEMPLUGIN_API FBoidShardWorker
+{
+public:
+	static bool Run(const FBoidBatchScenario& Scenario, int32 Index, int32 NumShards, int32 Port);
+};
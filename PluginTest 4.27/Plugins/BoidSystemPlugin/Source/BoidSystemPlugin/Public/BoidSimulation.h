@@ -0,0 +1,234 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidCompactState.h"
+#include "BoidFixedPipeline.h"
+#include "BoidFrameArena.h"
+#include "BoidGridTuner.h"
+#include "BoidNeighbourSearch.h"
+#include "BoidNeighbours.h"
+#include "BoidPipeline.h"
+#include "BoidSettings.h"
+#include "BoidSpatialGrid.h"
+
+// Per boid movement limits, set when the boid is spawned.
+struct FBoidBody
+{
+	float Speed = 300;
+	float MaxAcceleration = 100;
+	bool HasConstantSpeed = false;
+};
+
+// Whatever the flock step needs besides the boids.
+struct FBoidSimulationParams
+{
+	FDefaultBoidPipeline Pipeline;
+	FVector2D Area = { 100, 100 };
+	float VisualRange = 10;
+	bool IsWrapped = true;
+	// Let the grid tuner pick the cell size and split crowded cells, otherwise cells are VisualRange wide.
+	bool AutoTuneGrid = true;
+	// Sum whole grid cells inside the visual range instead of visiting their boids, no neighbour lists are built.
+	bool UseFarField = false;
+	// How far past the visual range, in cell diagonals, a cell may reach and still be summed whole.
+	float FarFieldTolerance = 0;
+	// Cells across the visual range in far field mode. Finer cells leave fewer boids in the cells on the edge.
+	int32 FarFieldCellsPerRange = 4;
+	// Most neighbours kept per boid, 0 keeps all.
+	int32 MaxNeighbours = 0;
+	// Backends list neighbours in different orders, which changes the rounding of the sums. Auto leaves it to boids.NeighbourBackend.
+	EBoidNeighbourBackend NeighbourBackend = EBoidNeighbourBackend::Auto;
+	// Workers the rules stage is split over when pipelined, 0 uses every task graph worker.
+	int32 NumThreads = 0;
+	// Boids per work item when pipelined, 0 makes a few items per worker.
+	int32 BoidsPerItem = 0;
+	// Keep positions and velocities as 16 bit fixed point between steps, see FBoidQuantisation. Not with far field.
+	bool UseCompactState = false;
+	// Step in 16.16 fixed point, see FBoidFixedPipeline: bit for bit the same on every compiler, CPU, backend and thread
+	// count, at some cost. Replaces far field and compact state, and MaxNeighbours is not used.
+	bool UseFixedPoint = false;
+};
+
+// Finished flock step, in the order the simulation was started with.
+struct FBoidFlockState
+{
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	uint64 StepIndex = 0;
+	// Wall time the step took.
+	double StepSeconds = 0;
+	// Boid of each slot. CopyState leaves it alone, whoever keeps the handles fills it in.
+	TArray<FBoidHandle> Handles;
+	// Batches of flock changes applied before this step, see FBoidSimulationThread::PushChanges.
+	uint32 NumChanges = 0;
+};
+
+// Boids that left and joined the flock since a simulation of it started, applied between its steps. Removals go first.
+struct FBoidFlockChanges
+{
+	TArray<FBoidHandle> Removed;
+	TArray<FBoidHandle> Added;
+	// Same order as Added.
+	TArray<FVector2D> AddedPositions;
+	TArray<FVector2D> AddedVelocities;
+	TArray<FBoidBody> AddedBodies;
+
+	void Add(FBoidHandle Handle, FVector2D Position, FVector2D Velocity, const FBoidBody& Body);
+	// Queue Other's changes after these. A boid Other removes that these still add is dropped from Added instead.
+	void Append(const FBoidFlockChanges& Other);
+	void Reset();
+	bool IsEmpty() const								{ return Removed.Num() == 0 && Added.Num() == 0; }
+};
+
+// Far field against exact rule forces over one flock snapshot.
+struct FBoidFarFieldAccuracy
+{
+	double MeanError = 0;
+	double MaxError = 0;
+	// Mean length of the exact force, to read the errors against.
+	double MeanForce = 0;
+	double ExactSeconds = 0;
+	double FarFieldSeconds = 0;
+};
+
+// Clamp the acceleration and speed and move one boid, same for the actors and the flock step.
+FORCEINLINE void IntegrateBoid(FVector2D& Position, FVector2D& Velocity, FVector2D Acceleration, const FBoidBody& Body,
+	float DeltaTime, const FBoidSpatialGrid& Grid)
+{
+	if (Acceleration.Size() > Body.MaxAcceleration)
+	{
+		Acceleration.Normalize();
+		Acceleration *= Body.MaxAcceleration;
+	}
+
+	Velocity += Acceleration;
+
+	if (Body.HasConstantSpeed || Velocity.Size() > Body.Speed)
+	{
+		Velocity.Normalize();
+		Velocity *= Body.Speed;
+	}
+
+	// Wrapping is done on the simulation position.
+	Position = Grid.WrapPosition(Position + Velocity * DeltaTime);
+}
+
+/**
+ * The whole flock stepped as arrays, without touching any actor, so it can run off the game thread.
+ * Only the built-in rules run here, through the pipeline. Every boid sees the state from the start
+ * of the step, the new state is written to separate arrays and swapped in at the end.
+ *
+ * A step is four stages that must run in order: BuildNeighbours, EvaluateRules, Integrate, FinishStep.
+ * The middle two work on independent index ranges, so they can be split over threads. Until FinishStep
+ * the stages only read the current state, which can be read from other threads meanwhile.
+ *
+ * With UseCompactState the state is kept packed to 16 bits per value and unpacked as the kernels read
+ * it, halving the bytes every neighbour read pulls in. Only the grid keeps float positions.
+ *
+ * With UseFixedPoint the state, forces and integration are all 16.16 fixed point, and the grid and neighbour
+ * lists, still float, only narrow down the candidates. GetStateChecksum then comes out the same on every build.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidSimulation
+{
+public:
+	// Start over with this flock, keeping the params. The last flock's buffers are reused, so a simulation can be
+	// handed a new flock every step.
+	void Init(const TArray<FVector2D>& _Positions, const TArray<FVector2D>& _Velocities, const TArray<FBoidBody>& _Bodies);
+	// Also packs or unpacks the state when UseCompactState changes, so call it between steps.
+	void SetParams(const FBoidSimulationParams& _Params);
+
+	// All four stages in a row on the calling thread.
+	void Step(float DeltaTime);
+
+	// Grid and neighbour lists from the current positions.
+	void BuildNeighbours();
+	// Summed rule force of boids [Start, End).
+	void EvaluateRules(int32 Start, int32 End);
+	// Summed rule force of the listed boids.
+	void EvaluateRules(const int32* Boids, int32 Count);
+	// Add to a boid's summed rule force, for forces from outside the pipeline. Between EvaluateRules and Integrate.
+	void AddForce(int32 Index, FVector2D Force);
+	// New positions and velocities of boids [Start, End), into the next state.
+	void Integrate(float DeltaTime, int32 Start, int32 End);
+	// Make the next state current.
+	void FinishStep();
+
+	// Between steps. Remove and append boids, in whatever layout the state is held. Handles holds the boid of
+	// each slot and is kept in step with the state.
+	void ApplyChanges(const FBoidFlockChanges& Changes, TArray<FBoidHandle>& Handles);
+
+	// Copy positions and velocities out, reusing the state's arrays. Unpacks compact state.
+	void CopyState(FBoidFlockState& State) const;
+
+	// Bytes per boid held by the state, next state, forces and bodies, not counting the grid and neighbour lists.
+	float GetStateBytesPerBoid() const;
+	// Of the state as it is held, floats, packed or fixed point.
+	uint32 GetStateChecksum() const;
+
+	// Rule forces of a snapshot through the neighbour lists and through far field with Params' tolerance.
+	static FBoidFarFieldAccuracy MeasureFarFieldAccuracy(const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities,
+		const FBoidSimulationParams& Params);
+
+	// Getters
+	int32 GetNum() const								{ return IsCompact ? PackedPositions.Num() : IsFixed ? FixedPositions.Num() : Positions.Num(); }
+	uint64 GetStepIndex() const							{ return StepIndex; }
+	bool IsCompactState() const							{ return IsCompact; }
+	bool IsFixedPointState() const						{ return IsFixed; }
+	// Empty while the state is compact or fixed point, CopyState converts it.
+	const TArray<FVector2D>& GetPositions() const		{ return Positions; }
+	const TArray<FVector2D>& GetVelocities() const		{ return Velocities; }
+	const FBoidSpatialGrid& GetGrid() const				{ return Grid; }
+	const FBoidNeighbourLists& GetNeighbours() const	{ return Neighbours; }
+
+private:
+	void EvaluateRule(int32 Index);
+	// Move the state between the float and packed arrays to match the params.
+	void UpdateStorage();
+	void PackState();
+	void UnpackState();
+	void FixState();
+	void UnfixState();
+	void AddBoid(FVector2D Position, FVector2D Velocity, const FBoidBody& Body);
+	// The last boid moves into the freed slot.
+	void RemoveBoidAtSwap(int32 Index);
+
+	FBoidSimulationParams Params;
+
+	TArray<FVector2D> Positions;
+	TArray<FVector2D> Velocities;
+	TArray<FBoidBody> Bodies;
+	TArray<FVector2D> Accelerations;
+	TArray<FVector2D> NextPositions;
+	TArray<FVector2D> NextVelocities;
+	uint64 StepIndex = 0;
+	// Fastest body, the packed velocities' range depends on it.
+	float MaxSpeed = 0;
+
+	// Used instead of the float state while IsCompact, the float arrays are emptied.
+	bool IsCompact = false;
+	FBoidQuantisation Quantisation;
+	TArray<FBoidPackedVector> PackedPositions;
+	TArray<FBoidPackedVector> PackedVelocities;
+	TArray<FBoidPackedVector> NextPackedPositions;
+	TArray<FBoidPackedVector> NextPackedVelocities;
+
+	// Used instead of the float state while IsFixed, the float arrays are emptied.
+	bool IsFixed = false;
+	FBoidFixedPipeline FixedPipeline;
+	TArray<FBoidFixedVector> FixedPositions;
+	TArray<FBoidFixedVector> FixedVelocities;
+	TArray<FBoidFixedVector> FixedAccelerations;
+	TArray<FBoidFixedVector> NextFixedPositions;
+	TArray<FBoidFixedVector> NextFixedVelocities;
+
+	FBoidSpatialGrid Grid;
+	FBoidGridTuner GridTuner;
+	FBoidNeighbourLists Neighbours;
+	FBoidNeighbourBackends NeighbourBackends;
+	FBoidFrameArena FrameArena;
+	// No actors here, neighbourhoods get an empty list.
+	TArray<class ABoid*> NoBoids;
+};
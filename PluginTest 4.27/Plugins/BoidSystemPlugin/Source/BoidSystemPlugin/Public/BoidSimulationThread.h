@@ -0,0 +1,64 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+
+#include "BoidSettings.h"
+#include "BoidSimulation.h"
+#include "BoidTripleBuffer.h"
+
+class FRunnableThread;
+
+/**
+ * Steps a flock on its own thread at a fixed rate, independent of the frame rate.
+ * Finished states go to the game thread through a triple buffer and parameters come back the same
+ * way, so neither thread ever blocks the other. Boids joining and leaving are handed over under a
+ * short lock and applied before the next step, each state carries the handles of its slots.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidSimulationThread : public FRunnable
+{
+public:
+	FBoidSimulationThread(const TArray<FBoidHandle>& _Handles, const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities,
+		const TArray<FBoidBody>& Bodies, const FBoidSimulationParams& Params, float StepRate);
+	virtual ~FBoidSimulationThread() override;
+
+	void Start();
+
+	// Game thread. Parameters the next step should use.
+	void PushParams(const FBoidSimulationParams& Params);
+
+	// Game thread. Boids that left and joined the flock, applied before the next step. Returns the number of
+	// batches pushed so far, states with a NumChanges that high include these.
+	uint32 PushChanges(const FBoidFlockChanges& Changes);
+
+	// Game thread. Newest finished state, null if no step finished since the last call.
+	const FBoidFlockState* FetchState();
+
+	// FRunnable
+	virtual uint32 Run() override;
+	virtual void Stop() override						{ StopRequested = true; }
+
+private:
+	FBoidSimulation Simulation;
+	TArray<FBoidHandle> Handles;
+	float StepInterval;
+
+	TBoidTripleBuffer<FBoidFlockState> States;
+	TBoidTripleBuffer<FBoidSimulationParams> PendingParams;
+
+	// Pushed and not yet taken by the simulation thread, and the batch it is applying.
+	FCriticalSection ChangesLock;
+	FBoidFlockChanges PendingChanges;
+	FBoidFlockChanges ApplyingChanges;
+	// Batches pushed, and pushed as of PendingChanges, under the lock. Applied, on the simulation thread.
+	uint32 NumChangesPushed = 0;
+	uint32 NumChangesPending = 0;
+	uint32 NumChangesApplied = 0;
+
+	FThreadSafeBool StopRequested;
+	FRunnableThread* Thread = nullptr;
+};
@@ -0,0 +1,373 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Uniform grid over the flock area, rebuilt once per frame from the boid positions.
+ * When wrapped the area is a torus: cells on opposite edges are neighbours and offsets
+ * between boids use the shortest path across the seam (minimum image).
+ * Cells holding more than MaxBoidsPerCell boids are split again into a finer grid of their own,
+ * so queries into a dense clump skip the parts of it out of range.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidSpatialGrid
+{
+public:
+	FBoidSpatialGrid();
+
+	// Set the area covered by the grid, the smallest cell size and whether the area wraps.
+	void Configure(FVector2D _Area, float _MinCellSize, bool _IsWrapped);
+
+	// Split cells holding more than this many boids on the next Build, 0 never splits.
+	void SetMaxBoidsPerCell(int32 _MaxBoidsPerCell)	{ MaxBoidsPerCell = _MaxBoidsPerCell; }
+
+	// Sort the positions into cells. Indices handed out by queries are indices into this array.
+	void Build(const TArray<FVector2D>& Positions);
+	// Same from the positions GetPosition(Index) gives, for flocks not stored as FVector2D.
+	template <typename GetPositionType>
+	void Build(int32 Num, GetPositionType&& GetPosition);
+
+	// Bring a position back inside the area when wrapped, untouched otherwise.
+	FVector2D WrapPosition(FVector2D Position) const;
+
+	// Shortest vector going from one position to another.
+	FVector2D GetOffset(FVector2D From, FVector2D To) const;
+
+	// Calls Func(Index, Offset) for every built position within Range of Position.
+	template <typename FuncType>
+	void ForEachInRange(FVector2D Position, float Range, FuncType&& Func) const;
+
+	// Calls Func(Index, Offset) for every built position in the box of HalfExtent around Centre.
+	template <typename FuncType>
+	void ForEachInBox(FVector2D Centre, FVector2D HalfExtent, FuncType&& Func) const;
+
+	// Sum up every cell's boids for ForEachInRangeAggregated, after Build.
+	void BuildAggregates(const TArray<FVector2D>& Velocities);
+
+	/**
+	 * Like ForEachInRange, but whole cells inside Range go to FarFunc(Count, OffsetSum, VelocitySum) as one
+	 * aggregate. NearFunc(Index, Offset) still sees every boid within NearRange and those in cells crossing
+	 * the edge of Range. With Tolerance, in cell diagonals, cells reaching that far past Range count as inside
+	 * and cells starting that far before its end as outside.
+	 */
+	template <typename NearFuncType, typename FarFuncType>
+	void ForEachInRangeAggregated(FVector2D Position, float Range, float NearRange, float Tolerance, NearFuncType&& NearFunc,
+		FarFuncType&& FarFunc) const;
+
+	// Column and row of the cell holding a position.
+	FIntPoint GetCell(FVector2D Position) const	{ return FIntPoint(CellCoord(Position.X, 0), CellCoord(Position.Y, 1)); }
+
+	// Getters
+	FVector2D GetArea() const				{ return Area; }
+	bool GetIsWrapped() const				{ return IsWrapped; }
+	int32 GetNum() const					{ return Positions.Num(); }
+	FVector2D GetPosition(int32 Index) const	{ return Positions[Index]; }
+	const TArray<FVector2D>& GetPositions() const	{ return Positions; }
+	int32 GetNumCells() const				{ return NumCells.X * NumCells.Y; }
+	// Columns and rows, cells are numbered Y * X count + X.
+	FIntPoint GetCellCounts() const			{ return NumCells; }
+	FVector2D GetCellSize() const			{ return CellSize; }
+	int32 GetNumSubdivided() const			{ return Splits.Num(); }
+	// A cell's indices are GetCellEntries()[GetCellStart(Cell)] up to GetCellStart(Cell + 1), cells in row order.
+	// Split cells keep their indices together, only ordered by sub-cell.
+	int32 GetCellStart(int32 Cell) const		{ return CellStart[Cell]; }
+	const TArray<int32>& GetCellEntries() const	{ return CellEntries; }
+
+private:
+	int32 CellCoord(float Value, int32 Axis) const;
+	// First and last cell to visit on each axis, may be outside the grid when wrapped.
+	void GetCellRange(FVector2D Position, FVector2D Range, int32 MinCell[2], int32 MaxCell[2]) const;
+	int32 WrapCell(int32 X, int32 Y) const;
+	FVector2D GetCellCentre(int32 Cell) const;
+	// Counting sort of Positions into cells, then splitting crowded cells.
+	void SortIntoCells();
+	void Subdivide();
+
+	template <typename FuncType>
+	void ForEachInSplitCell(int32 Cell, FVector2D Position, float RangeSquared, FuncType& Func) const;
+
+	struct FCellSplit
+	{
+		// Where the cell's sub-cell starts begin in SubCellStart.
+		int32 SubStart;
+		int32 Divisions;
+	};
+
+	FVector2D Area;
+	FVector2D HalfArea;
+	FVector2D CellSize;
+	FVector2D InvCellSize;
+	FIntPoint NumCells;
+	bool IsWrapped;
+
+	// Copy of the positions the grid was built from.
+	TArray<FVector2D> Positions;
+	// Boid indices sorted by cell, CellStart[Cell] is where that cell's run begins.
+	TArray<int32> CellStart;
+	TArray<int32> CellEntries;
+	TArray<int32> BoidCell;
+
+	int32 MaxBoidsPerCell = 0;
+	// Per cell, index into Splits or INDEX_NONE. Empty while no cell is split.
+	TArray<int32> CellSplit;
+	TArray<FCellSplit> Splits;
+	// Like CellStart for the sub-cells of every split cell, Divisions squared plus one entries each.
+	TArray<int32> SubCellStart;
+	TArray<int32> ScratchSubCell;
+	TArray<int32> ScratchEntries;
+	// Per cell, positions summed relative to the cell centre, and velocities.
+	TArray<FVector2D> CellPositionSums;
+	TArray<FVector2D> CellVelocitySums;
+};
+
+template <typename GetPositionType>
+void FBoidSpatialGrid::Build(int32 Num, GetPositionType&& GetPosition)
+{
+	Positions.SetNumUninitialized(Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		Positions[i] = GetPosition(i);
+	}
+
+	SortIntoCells();
+}
+
+FORCEINLINE int32 FBoidSpatialGrid::CellCoord(float Value, int32 Axis) const
+{
+	// Positions outside a bounded area pile up in the border cells.
+	return FMath::Clamp(FMath::FloorToInt(Value * InvCellSize[Axis]), 0, NumCells[Axis] - 1);
+}
+
+FORCEINLINE FVector2D FBoidSpatialGrid::GetOffset(FVector2D From, FVector2D To) const
+{
+	FVector2D Offset = To - From;
+
+	if (IsWrapped)
+	{
+		// Both positions are inside the area, so one correction per axis is enough.
+		if (Offset.X > HalfArea.X)			{ Offset.X -= Area.X; }
+		else if (Offset.X < -HalfArea.X)	{ Offset.X += Area.X; }
+
+		if (Offset.Y > HalfArea.Y)			{ Offset.Y -= Area.Y; }
+		else if (Offset.Y < -HalfArea.Y)	{ Offset.Y += Area.Y; }
+	}
+
+	return Offset;
+}
+
+FORCEINLINE void FBoidSpatialGrid::GetCellRange(FVector2D Position, FVector2D Range, int32 MinCell[2], int32 MaxCell[2]) const
+{
+	for (int32 Axis = 0; Axis < 2; Axis++)
+	{
+		if (IsWrapped)
+		{
+			// Cells are visited modulo the grid size, never more than once each.
+			const int32 Centre = CellCoord(Position[Axis], Axis);
+			const int32 Reach = FMath::CeilToInt(Range[Axis] * InvCellSize[Axis]);
+			if (Reach * 2 + 1 >= NumCells[Axis])
+			{
+				MinCell[Axis] = 0;
+				MaxCell[Axis] = NumCells[Axis] - 1;
+			}
+			else
+			{
+				MinCell[Axis] = Centre - Reach;
+				MaxCell[Axis] = Centre + Reach;
+			}
+		}
+		else
+		{
+			MinCell[Axis] = CellCoord(Position[Axis] - Range[Axis], Axis);
+			MaxCell[Axis] = CellCoord(Position[Axis] + Range[Axis], Axis);
+		}
+	}
+}
+
+FORCEINLINE int32 FBoidSpatialGrid::WrapCell(int32 X, int32 Y) const
+{
+	return ((Y % NumCells.Y) + NumCells.Y) % NumCells.Y * NumCells.X + ((X % NumCells.X) + NumCells.X) % NumCells.X;
+}
+
+FORCEINLINE FVector2D FBoidSpatialGrid::GetCellCentre(int32 Cell) const
+{
+	return FVector2D((Cell % NumCells.X + 0.5f) * CellSize.X, (Cell / NumCells.X + 0.5f) * CellSize.Y);
+}
+
+template <typename FuncType>
+void FBoidSpatialGrid::ForEachInSplitCell(int32 Cell, FVector2D Position, float RangeSquared, FuncType& Func) const
+{
+	const FCellSplit& Split = Splits[CellSplit[Cell]];
+	const FVector2D SubSize = CellSize / static_cast<float>(Split.Divisions);
+
+	// The cell's box seen from Position. Sub-cells can only be skipped by box if every boid in it shares the centre's image.
+	const FVector2D CellMin = GetOffset(Position, GetCellCentre(Cell)) - CellSize * 0.5f;
+	const bool CanSkip = !IsWrapped || (FMath::Max(FMath::Abs(CellMin.X), FMath::Abs(CellMin.X + CellSize.X)) <= HalfArea.X
+		&& FMath::Max(FMath::Abs(CellMin.Y), FMath::Abs(CellMin.Y + CellSize.Y)) <= HalfArea.Y);
+
+	for (int32 SubY = 0; SubY < Split.Divisions; SubY++)
+	{
+		for (int32 SubX = 0; SubX < Split.Divisions; SubX++)
+		{
+			const int32 SubCell = Split.SubStart + SubY * Split.Divisions + SubX;
+
+			if (CanSkip)
+			{
+				const FVector2D Min = CellMin + FVector2D(SubX * SubSize.X, SubY * SubSize.Y);
+				const FVector2D Near(FMath::Max(FMath::Max(Min.X, -Min.X - SubSize.X), 0.0f), FMath::Max(FMath::Max(Min.Y, -Min.Y - SubSize.Y), 0.0f));
+				if (Near.SizeSquared() > RangeSquared)
+				{
+					continue;
+				}
+			}
+
+			for (int32 Entry = SubCellStart[SubCell]; Entry < SubCellStart[SubCell + 1]; Entry++)
+			{
+				const int32 Index = CellEntries[Entry];
+				const FVector2D Offset = GetOffset(Position, Positions[Index]);
+
+				if (Offset.SizeSquared() <= RangeSquared)
+				{
+					Func(Index, Offset);
+				}
+			}
+		}
+	}
+}
+
+template <typename FuncType>
+void FBoidSpatialGrid::ForEachInRange(FVector2D Position, float Range, FuncType&& Func) const
+{
+	if (Positions.Num() == 0)
+	{
+		return;
+	}
+
+	const float RangeSquared = Range * Range;
+	int32 MinCell[2];
+	int32 MaxCell[2];
+	GetCellRange(Position, FVector2D(Range, Range), MinCell, MaxCell);
+
+	for (int32 Y = MinCell[1]; Y <= MaxCell[1]; Y++)
+	{
+		for (int32 X = MinCell[0]; X <= MaxCell[0]; X++)
+		{
+			const int32 Cell = WrapCell(X, Y);
+
+			if (CellSplit.Num() > 0 && CellSplit[Cell] != INDEX_NONE)
+			{
+				ForEachInSplitCell(Cell, Position, RangeSquared, Func);
+				continue;
+			}
+
+			for (int32 Entry = CellStart[Cell]; Entry < CellStart[Cell + 1]; Entry++)
+			{
+				const int32 Index = CellEntries[Entry];
+				const FVector2D Offset = GetOffset(Position, Positions[Index]);
+
+				if (Offset.SizeSquared() <= RangeSquared)
+				{
+					Func(Index, Offset);
+				}
+			}
+		}
+	}
+}
+
+template <typename FuncType>
+void FBoidSpatialGrid::ForEachInBox(FVector2D Centre, FVector2D HalfExtent, FuncType&& Func) const
+{
+	if (Positions.Num() == 0)
+	{
+		return;
+	}
+
+	int32 MinCell[2];
+	int32 MaxCell[2];
+	GetCellRange(Centre, HalfExtent, MinCell, MaxCell);
+
+	// Split cells keep their entries together, a box gains little from their sub-cells.
+	for (int32 Y = MinCell[1]; Y <= MaxCell[1]; Y++)
+	{
+		for (int32 X = MinCell[0]; X <= MaxCell[0]; X++)
+		{
+			const int32 Cell = WrapCell(X, Y);
+
+			for (int32 Entry = CellStart[Cell]; Entry < CellStart[Cell + 1]; Entry++)
+			{
+				const int32 Index = CellEntries[Entry];
+				const FVector2D Offset = GetOffset(Centre, Positions[Index]);
+
+				if (FMath::Abs(Offset.X) <= HalfExtent.X && FMath::Abs(Offset.Y) <= HalfExtent.Y)
+				{
+					Func(Index, Offset);
+				}
+			}
+		}
+	}
+}
+
+template <typename NearFuncType, typename FarFuncType>
+void FBoidSpatialGrid::ForEachInRangeAggregated(FVector2D Position, float Range, float NearRange, float Tolerance, NearFuncType&& NearFunc,
+	FarFuncType&& FarFunc) const
+{
+	if (Positions.Num() == 0)
+	{
+		return;
+	}
+
+	const FVector2D HalfCell = CellSize * 0.5f;
+	const float RangeSquared = Range * Range;
+	const float NearRangeSquared = NearRange * NearRange;
+	// Past the tolerance, cells almost inside count whole and cells almost outside are dropped, so the two roughly cancel.
+	const float Slack = Tolerance * CellSize.Size();
+	const float InsideRangeSquared = FMath::Square(Range + Slack);
+	const float OutsideRangeSquared = FMath::Square(FMath::Max(Range - Slack, 0.0f));
+	int32 MinCell[2];
+	int32 MaxCell[2];
+	GetCellRange(Position, FVector2D(Range, Range), MinCell, MaxCell);
+
+	for (int32 Y = MinCell[1]; Y <= MaxCell[1]; Y++)
+	{
+		for (int32 X = MinCell[0]; X <= MaxCell[0]; X++)
+		{
+			const int32 Cell = WrapCell(X, Y);
+			const int32 Count = CellStart[Cell + 1] - CellStart[Cell];
+			if (Count == 0)
+			{
+				continue;
+			}
+
+			// Box of the cell seen from Position, through the nearest image of its centre.
+			const FVector2D CentreOffset = GetOffset(Position, GetCellCentre(Cell));
+			const FVector2D Far(FMath::Abs(CentreOffset.X) + HalfCell.X, FMath::Abs(CentreOffset.Y) + HalfCell.Y);
+			const FVector2D Near(FMath::Max(Far.X - CellSize.X, 0.0f), FMath::Max(Far.Y - CellSize.Y, 0.0f));
+
+			if (Near.SizeSquared() > RangeSquared || (Near.SizeSquared() > FMath::Max(OutsideRangeSquared, NearRangeSquared) && Slack > 0))
+			{
+				continue;
+			}
+
+			// Wrapped, every boid of the cell shares the centre's image only if the whole box is within half the area.
+			// Bounded, the border cells also hold whatever left the area, so their box is not a bound.
+			const bool BoxHoldsCell = IsWrapped ? (Far.X <= HalfArea.X && Far.Y <= HalfArea.Y)
+				: (X > 0 && Y > 0 && X < NumCells.X - 1 && Y < NumCells.Y - 1);
+			if (BoxHoldsCell && Near.SizeSquared() > NearRangeSquared && Far.SizeSquared() <= InsideRangeSquared)
+			{
+				FarFunc(Count, CellPositionSums[Cell] + CentreOffset * static_cast<float>(Count), CellVelocitySums[Cell]);
+				continue;
+			}
+
+			for (int32 Entry = CellStart[Cell]; Entry < CellStart[Cell + 1]; Entry++)
+			{
+				const int32 Index = CellEntries[Entry];
+				const FVector2D Offset = GetOffset(Position, Positions[Index]);
+
+				if (Offset.SizeSquared() <= RangeSquared)
+				{
+					NearFunc(Index, Offset);
+				}
+			}
+		}
+	}
+}
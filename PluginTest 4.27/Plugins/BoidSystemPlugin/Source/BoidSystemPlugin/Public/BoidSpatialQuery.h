@@ -0,0 +1,68 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidSpatialGrid.h"
+
+// One boid found by a query. Index is into the positions the grid was built from.
+struct FBoidQueryHit
+{
+	int32 Index = INDEX_NONE;
+	// From the query's centre, or along the ray to where it first touches the boid.
+	float Distance = 0;
+};
+
+enum class EBoidQueryType : uint8
+{
+	Radius,
+	Box,
+	Ray,
+	Nearest
+};
+
+// A query for FBoidSpatialQuery::RunBatch.
+struct FBoidQuery
+{
+	EBoidQueryType Type = EBoidQueryType::Radius;
+	// Centre, or where the ray starts.
+	FVector2D Position = FVector2D::ZeroVector;
+	// Half the box's size, or the ray's direction times its length.
+	FVector2D Extent = FVector2D::ZeroVector;
+	// Radius, how thick the ray is, or how far Nearest looks.
+	float Radius = 0;
+
+	static FBoidQuery MakeRadius(FVector2D Centre, float Radius)						{ return FBoidQuery{ EBoidQueryType::Radius, Centre, FVector2D::ZeroVector, Radius }; }
+	static FBoidQuery MakeBox(FVector2D Centre, FVector2D HalfExtent)					{ return FBoidQuery{ EBoidQueryType::Box, Centre, HalfExtent, 0 }; }
+	static FBoidQuery MakeRay(FVector2D Start, FVector2D End, float Radius)				{ return FBoidQuery{ EBoidQueryType::Ray, Start, End - Start, Radius }; }
+	static FBoidQuery MakeNearest(FVector2D Centre, float MaxDistance)					{ return FBoidQuery{ EBoidQueryType::Nearest, Centre, FVector2D::ZeroVector, MaxDistance }; }
+};
+
+/**
+ * Gameplay queries against a built FBoidSpatialGrid, costing the cells they touch rather than the whole flock.
+ * Hits go into a buffer the caller owns and nothing is allocated, so weapons and AI can query every frame.
+ *
+ * Radius and Box return how many boids matched, which may be more than the buffer holds: the rest are dropped,
+ * in no particular order. Ray and Nearest keep the nearest boids that fit, nearest first, and return how many.
+ * Positions are wrapped into the grid's area first when it wraps, and distances are across the seam.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidSpatialQuery
+{
+public:
+	static int32 Radius(const FBoidSpatialGrid& Grid, FVector2D Centre, float Radius, TArrayView<FBoidQueryHit> OutHits);
+	static int32 Box(const FBoidSpatialGrid& Grid, FVector2D Centre, FVector2D HalfExtent, TArrayView<FBoidQueryHit> OutHits);
+	// Boids within Radius of the segment from Start to End. On a wrapped grid the ray is cut short of half the area.
+	static int32 Ray(const FBoidSpatialGrid& Grid, FVector2D Start, FVector2D End, float Radius, TArrayView<FBoidQueryHit> OutHits);
+	// Up to OutHits.Num() boids nearest to Centre, none further than MaxDistance.
+	static int32 Nearest(const FBoidSpatialGrid& Grid, FVector2D Centre, float MaxDistance, TArrayView<FBoidQueryHit> OutHits);
+
+	static int32 Run(const FBoidSpatialGrid& Grid, const FBoidQuery& Query, TArrayView<FBoidQueryHit> OutHits);
+
+	/**
+	 * Every query into its own equal slice of OutHits, query i from i * (OutHits.Num() / Queries.Num()),
+	 * and what it returned into OutNumHits[i]. Large batches are split over the task graph.
+	 */
+	static void RunBatch(const FBoidSpatialGrid& Grid, TArrayView<const FBoidQuery> Queries, TArrayView<FBoidQueryHit> OutHits,
+		TArrayView<int32> OutNumHits);
+};
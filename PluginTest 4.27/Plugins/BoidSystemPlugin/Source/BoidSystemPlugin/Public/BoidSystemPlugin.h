@@ -5,6 +5,9 @@
 #include "CoreMinimal.h"
 #include "Modules/ModuleManager.h"
 
+DECLARE_LOG_CATEGORY_EXTERN(LogBoids, Log, All);
+DECLARE_STATS_GROUP(TEXT("Boids"), STATGROUP_Boids, STATCAT_Advanced);
+
 class FBoidSystemPluginModule : public IModuleInterface
 {
 public:
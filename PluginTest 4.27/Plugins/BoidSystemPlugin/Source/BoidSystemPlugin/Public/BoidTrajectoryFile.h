@@ -0,0 +1,109 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+/**
+ * Layout of a trajectory file: this header, then NumFrames frames of FrameStride bytes each. A frame is
+ * NumBoids FBoidTrajectorySamples in slot order. Everything is little endian 32 bit, so analysis tools can
+ * map the file and index it as an array with no parsing, e.g. numpy's
+ *   np.memmap(Path, dtype="<f4", offset=HeaderSize).reshape(NumFrames, NumBoids, 4)
+ */
+struct FBoidTrajectoryHeader
+{
+	static constexpr uint32 MagicValue = 0x4a525442;	// "BTRJ"
+	static constexpr uint32 CurrentVersion = 1;
+
+	enum EFlags : uint32
+	{
+		Wrapped = 1 << 0,
+		FixedPoint = 1 << 1,
+	};
+
+	uint32 Magic = MagicValue;
+	uint32 Version = CurrentVersion;
+	uint32 HeaderSize = sizeof(FBoidTrajectoryHeader);
+	uint32 NumBoids = 0;
+	uint32 NumFrames = 0;
+	uint32 FrameStride = 0;
+	// Simulated seconds between frames, and of each step in between.
+	float FrameInterval = 0;
+	float StepDeltaTime = 0;
+	float AreaX = 0;
+	float AreaY = 0;
+	uint32 Flags = 0;
+	int32 Seed = 0;
+	uint32 Reserved[4] = {};
+};
+
+static_assert(sizeof(FBoidTrajectoryHeader) == 64, "Trajectory readers rely on the header layout");
+
+struct FBoidTrajectorySample
+{
+	FVector2D Position;
+	FVector2D Velocity;
+};
+
+static_assert(sizeof(FBoidTrajectorySample) == 16, "Trajectory readers rely on the sample layout");
+
+/**
+ * Writes a trajectory file through a writable memory mapping, so frames go straight from the flock
+ * state into the page cache. The file is sized for every frame up front and cut down to the frames
+ * actually written on Close. Platforms without a writable mapping fill a buffer and save it on Close.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidTrajectoryWriter
+{
+public:
+	~FBoidTrajectoryWriter();
+
+	// Room for Header.NumFrames frames of Header.NumBoids boids, FrameStride is filled in.
+	bool Open(const FString& Path, const FBoidTrajectoryHeader& Header);
+	// Frame to write, Frame must be under the header's NumFrames.
+	FBoidTrajectorySample* GetFrame(int32 Frame);
+	void WriteFrame(int32 Frame, const TArray<FVector2D>& Positions, const TArray<FVector2D>& Velocities);
+	// Record how many frames were written and release the file. False if saving it failed.
+	bool Close(int32 NumFramesWritten);
+
+	// Getters
+	bool IsOpen() const								{ return Data != nullptr; }
+	int64 GetFileSize() const						{ return FileSize; }
+
+private:
+	FString FilePath;
+	FBoidTrajectoryHeader Header;
+	uint8* Data = nullptr;
+	int64 FileSize = 0;
+
+#if PLATFORM_WINDOWS
+	void* FileHandle = nullptr;
+	void* MappingHandle = nullptr;
+#elif PLATFORM_UNIX || PLATFORM_MAC
+	int32 FileDescriptor = -1;
+#endif
+	// Without a mapping the file is built here.
+	TArray<uint8> Buffer;
+};
+
+// Maps a trajectory file read only, for checking or analysing runs in the engine.
+class BOIDSYSTEMPLUGIN_API FBoidTrajectoryReader
+{
+public:
+	~FBoidTrajectoryReader();
+
+	// False if the file is missing, truncated or not a trajectory of this version.
+	bool Open(const FString& Path);
+	void Close();
+
+	// Getters
+	const FBoidTrajectoryHeader& GetHeader() const	{ return *reinterpret_cast<const FBoidTrajectoryHeader*>(Data); }
+	const FBoidTrajectorySample* GetFrame(int32 Frame) const;
+
+private:
+	IMappedFileHandle* Handle = nullptr;
+	IMappedFileRegion* Region = nullptr;
+	const uint8* Data = nullptr;
+};
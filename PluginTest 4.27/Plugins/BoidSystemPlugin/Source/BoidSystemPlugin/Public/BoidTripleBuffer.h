@@ -0,0 +1,50 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Atomic.h"
+
+/**
+ * Lock-free hand-off of the newest value between one writer thread and one reader thread.
+ * The writer fills its slot and publishes it, the reader picks up whatever was published last.
+ * Neither side ever waits, and states published between two fetches are simply skipped.
+ */
+template <typename T>
+class TBoidTripleBuffer
+{
+public:
+	// Writer side. Slot to fill before calling Publish.
+	T& GetWriteBuffer()					{ return Buffers[WriteIndex]; }
+
+	// Writer side. Hand the filled slot over and take back whichever slot the reader is not using.
+	void Publish()
+	{
+		WriteIndex = Shared.Exchange(WriteIndex | FreshFlag) & IndexMask;
+	}
+
+	// Reader side. Swap in the newest published slot, false if nothing was published since the last fetch.
+	bool Fetch()
+	{
+		if ((Shared.Load() & FreshFlag) == 0)
+		{
+			return false;
+		}
+
+		ReadIndex = Shared.Exchange(ReadIndex) & IndexMask;
+		return true;
+	}
+
+	// Reader side. Slot picked up by the last successful Fetch.
+	const T& GetReadBuffer() const		{ return Buffers[ReadIndex]; }
+
+private:
+	static constexpr int32 IndexMask = 3;
+	static constexpr int32 FreshFlag = 4;
+
+	T Buffers[3];
+	int32 WriteIndex = 0;
+	int32 ReadIndex = 2;
+	// Index of the slot in between, plus FreshFlag while it holds something the reader has not fetched.
+	TAtomic<int32> Shared { 1 };
+};
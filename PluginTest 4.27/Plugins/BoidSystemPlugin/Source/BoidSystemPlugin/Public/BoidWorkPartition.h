@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Atomic.h"
+
+#include "BoidNeighbours.h"
+#include "BoidSpatialGrid.h"
+
+// Load one worker carried since the last ResetStats.
+struct FBoidWorkerStats
+{
+	uint64 BusyCycles = 0;
+	int32 Items = 0;
+	int32 Steals = 0;
+};
+
+/**
+ * Splits a flock step over worker threads so clumped flocks don't leave most threads idle.
+ * Work items are runs of grid cells of roughly equal cost, a boid costing one plus its neighbour
+ * count, and a cell too expensive on its own is split further. Every worker starts with a run of
+ * items of about equal total cost and steals from the back of other workers' runs once done.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidWorkPartition
+{
+public:
+	// Items from the grid's cells weighted by the neighbour lists built from it. Valid until the grid is rebuilt.
+	// BoidsPerItem sizes items at the cost of that many average boids, 0 makes a few items per worker.
+	void Build(const FBoidSpatialGrid& Grid, const FBoidNeighbourLists& Neighbours, int32 NumWorkers, int32 BoidsPerItem = 0);
+
+	// Equal slices of boid indices with no stealing, the plain ParallelFor split, for comparison.
+	// With BoidsPerItem the slices are that long, dealt out in runs.
+	void BuildUniform(int32 NumBoids, int32 NumWorkers, int32 BoidsPerItem = 0);
+
+	// Run Func(Boids, Count) over every item, on as many threads as there are workers.
+	void Execute(TFunctionRef<void(const int32* Boids, int32 Count)> Func);
+
+	// Stats
+	int32 GetNumWorkers() const								{ return Queues.Num(); }
+	int32 GetNumItems() const								{ return Items.Num(); }
+	const FBoidWorkerStats& GetWorkerStats(int32 Worker) const	{ return Queues[Worker].Stats; }
+	// Busiest worker over the average, 1 is a perfect balance.
+	float GetImbalance() const;
+	void ResetStats();
+
+private:
+	struct FItem
+	{
+		int32 EntryStart;
+		int32 EntryEnd;
+	};
+
+	// Items still to run are [Head, Tail), both packed in one word so the owner and thieves agree on it.
+	struct FQueue
+	{
+		TAtomic<uint64> Range { 0 };
+		FBoidWorkerStats Stats;
+	};
+
+	static uint64 PackRange(uint32 Head, uint32 Tail)		{ return (uint64(Head) << 32) | Tail; }
+	bool PopFront(FQueue& Queue, int32& Item);
+	bool PopBack(FQueue& Queue, int32& Item);
+	void SetNumWorkers(int32 NumWorkers);
+	void DealItems(const TArray<int64>& ItemCosts);
+
+	const int32* Entries = nullptr;
+	TArray<int32> IdentityEntries;
+	TArray<FItem> Items;
+	TArray<FQueue> Queues;
+	bool AllowStealing = true;
+};
@@ -0,0 +1,90 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "BoidSpatialGrid.h"
+
+enum class EBoidZoneShape : uint8
+{
+	Circle,
+	Box
+};
+
+struct FBoidZoneShape
+{
+	EBoidZoneShape Type = EBoidZoneShape::Circle;
+	FVector2D Centre = FVector2D::ZeroVector;
+	// Radius in X for a circle, half the size for a box.
+	FVector2D Extent = FVector2D::ZeroVector;
+
+	static FBoidZoneShape MakeCircle(FVector2D Centre, float Radius)			{ return FBoidZoneShape{ EBoidZoneShape::Circle, Centre, FVector2D(Radius, Radius) }; }
+	static FBoidZoneShape MakeBox(FVector2D Centre, FVector2D HalfExtent)		{ return FBoidZoneShape{ EBoidZoneShape::Box, Centre, HalfExtent }; }
+};
+
+// A boid that went into or out of a zone since the last update.
+struct FBoidZoneEvent
+{
+	int32 Zone = INDEX_NONE;
+	// Whatever stable id the update was given for the boid, not its index.
+	int32 BoidId = INDEX_NONE;
+};
+
+/**
+ * Trigger zones for the whole flock, in place of overlap events on every boid's collision. Zones are
+ * circles and boxes, and once per frame Update finds every zone's boids with one grid query each and
+ * compares them with the last update's. What changed comes out as two arrays of events for the frame.
+ *
+ * Members are kept sorted by boid id, so the comparison is a single merge and survives the flock arrays
+ * being reordered. Zones are independent, so many are updated in parallel.
+ */
+class BOIDSYSTEMPLUGIN_API FBoidZoneTracker
+{
+public:
+	// Returns the zone's id, ids of removed zones are handed out again.
+	int32 AddZone(const FBoidZoneShape& Shape);
+	// Its boids get exit events on the next update.
+	void RemoveZone(int32 Zone);
+	void SetZoneShape(int32 Zone, const FBoidZoneShape& Shape);
+	// Forget every zone without any events.
+	void Reset();
+
+	// GetBoidId(Index) gives the stable id of the boid at a grid index. Replaces the last update's events.
+	void Update(const FBoidSpatialGrid& Grid, TFunctionRef<int32(int32)> GetBoidId);
+
+	// Boids inside the zone as of the last update, sorted by id. Empty for a zone that doesn't exist.
+	TArrayView<const int32> GetMembers(int32 Zone) const;
+	bool IsValidZone(int32 Zone) const;
+	FBoidZoneShape GetShape(int32 Zone) const			{ return IsValidZone(Zone) ? Zones[Zone].Shape : FBoidZoneShape(); }
+
+	// Getters
+	bool HasZones() const								{ return NumZones > 0 || NumRemoved > 0; }
+	int32 GetNumZones() const							{ return NumZones; }
+	const TArray<FBoidZoneEvent>& GetEntered() const	{ return Entered; }
+	const TArray<FBoidZoneEvent>& GetExited() const		{ return Exited; }
+
+private:
+	struct FZone
+	{
+		FBoidZoneShape Shape;
+		bool IsUsed = false;
+		// Still holds its members until the update that sends their exits.
+		bool IsRemoved = false;
+		TArray<int32> Members;
+		// This update's members before they replace the last, and what changed.
+		TArray<int32> Found;
+		TArray<int32> ZoneEntered;
+		TArray<int32> ZoneExited;
+	};
+
+	void UpdateZone(FZone& Zone, const FBoidSpatialGrid& Grid, TFunctionRef<int32(int32)> GetBoidId);
+
+	TArray<FZone> Zones;
+	TArray<int32> FreeZones;
+	int32 NumZones = 0;
+	int32 NumRemoved = 0;
+
+	TArray<FBoidZoneEvent> Entered;
+	TArray<FBoidZoneEvent> Exited;
+};
@@ -6,6 +6,9 @@
 
 #include "CoreMinimal.h"
 
+#include "BoidNeighbours.h"
+#include "BoidRuleSet.h"
+
 class ABoid;
 
 /**
@@ -16,10 +19,13 @@ class BOIDSYSTEMPLUGIN_API FBoidRules
 public:
 	FBoidRules(const FBoidRules& SRules); // All rules for boids
 	
-	FVector2D ComputeWeightedForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid);
+	FVector2D ComputeWeightedForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid);
 
 	virtual TUniquePtr<FBoidRules> Clone() = 0;
 
+	// Pick up weights and radii from a rule set, in place. Custom rules can ignore it.
+	virtual void ApplyRuleSet(const TArray<FBoidRuleDesc>& RuleDescs) {}
+
 protected:
 	FColor DebugColor;
 
@@ -36,8 +42,12 @@ protected:
 		IsEnabled(_IsEnabled),
 		Force2D(FVector())
 	{}
-	virtual FVector2D ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid) = 0;
+	// Use the neighbourhood offsets rather than positions so wrapping works.
+	virtual FVector2D ComputeForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid) = 0;
 	virtual float GetBaseWeightMultiplier() { return 1; }
+
+	// Copy weight and enabled state from the rule's entry, turns the rule off if there is none.
+	const FBoidRuleDesc* ApplyRuleDesc(const TArray<FBoidRuleDesc>& RuleDescs, EBoidRuleType Type);
 };
 
 class BOIDSYSTEMPLUGIN_API CohesionRule : public FBoidRules
@@ -45,8 +55,9 @@ class BOIDSYSTEMPLUGIN_API CohesionRule : public FBoidRules
 public:
 	CohesionRule(float Weight = 1, bool IsEnabled = true) : FBoidRules(FColor::Cyan, Weight, IsEnabled) {} // Median position of neighbours.
 
-	FVector2D ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid) override;
+	FVector2D ComputeForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid) override;
 	virtual float GetBaseWeightMultiplier() override { return 1; }
+	virtual void ApplyRuleSet(const TArray<FBoidRuleDesc>& RuleDescs) override { ApplyRuleDesc(RuleDescs, EBoidRuleType::Cohesion); }
 
 	TUniquePtr<FBoidRules> Clone() override
 	{
@@ -59,8 +70,9 @@ class BOIDSYSTEMPLUGIN_API SeparationRule : public FBoidRules
 public:
 	SeparationRule(float DesiredSeparation = 20, float Weight = 1, bool IsEnabled = true) : FBoidRules(FColor::Red, Weight, IsEnabled) {} // Keep distance from boids.
 
-	FVector2D ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid) override;
+	FVector2D ComputeForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid) override;
 	virtual float GetBaseWeightMultiplier() override { return 1; }
+	virtual void ApplyRuleSet(const TArray<FBoidRuleDesc>& RuleDescs) override;
 
 	TUniquePtr<FBoidRules> Clone() override
 	{
@@ -69,6 +81,7 @@ public:
 
 private:	
 	float DesiredMinimalDistance = 10;
+	float Falloff = 1;
 };
 
 class BOIDSYSTEMPLUGIN_API AlignmentRule : public FBoidRules
@@ -76,8 +89,9 @@ class BOIDSYSTEMPLUGIN_API AlignmentRule : public FBoidRules
 public:
 	AlignmentRule(float Weight = 1, bool IsEnabled = true) : FBoidRules(FColor::Yellow, Weight, IsEnabled) {} // Median direction of neighbours.
 
-	FVector2D ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid) override;
+	FVector2D ComputeForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid) override;
 	virtual float GetBaseWeightMultiplier() override { return 1; }
+	virtual void ApplyRuleSet(const TArray<FBoidRuleDesc>& RuleDescs) override { ApplyRuleDesc(RuleDescs, EBoidRuleType::Alignment); }
 
 	TUniquePtr<FBoidRules> Clone() override
 	{
@@ -100,14 +114,17 @@ public:
 		IsBounded = SRules.IsBounded;
 	}
 
-	FVector2D ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid) override;
+	FVector2D ComputeForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid) override;
 	virtual float GetBaseWeightMultiplier() override { return 1; }
+	virtual void ApplyRuleSet(const TArray<FBoidRuleDesc>& RuleDescs) override;
 
 	TUniquePtr<FBoidRules> Clone() override
 	{
 		return MakeUnique<BoundedAreaRule>(*this);
 	}
 
+	void SetArea(int _Width, int _Height, bool _IsBounded)		{ Width = _Width; Height = _Height; IsBounded = _IsBounded; }
+
 private:
 	int Height;
 	int DesiredDistance;
@@ -133,15 +150,25 @@ public:
 		EnablePress = SRules.EnablePress;
 		LeftClick = SRules.LeftClick;
 		RightClick = SRules.RightClick;
+		DesiredDistance = SRules.DesiredDistance;
 	}
-	FVector2D ComputeForce(const TArray<ABoid*>& Neighbourhood, ABoid* Boid) override;
+	FVector2D ComputeForce(const FBoidNeighbourhood& Neighbourhood, ABoid* Boid) override;
 	virtual float GetBaseWeightMultiplier() override { return 0.1f; }
+	virtual void ApplyRuleSet(const TArray<FBoidRuleDesc>& RuleDescs) override;
 
 	TUniquePtr<FBoidRules> Clone() override
 	{
 		return MakeUnique<PointRepulsionRule>(*this);
 	}	
 
+	void SetInput(bool _DebugLines, bool _EnablePress, bool _LeftClick, bool _RightClick)
+	{
+		DebugLines = _DebugLines;
+		EnablePress = _EnablePress;
+		LeftClick = _LeftClick;
+		RightClick = _RightClick;
+	}
+
 private:
 	bool IsRepulsive; // Will attract instead if false
 	UObject* WorldContextObject;
@@ -151,4 +178,5 @@ private:
 	bool EnablePress;
 	bool LeftClick;
 	bool RightClick;
+	float DesiredDistance = 15.0f;
 };
\ No newline at end of file